@@ -161,6 +161,15 @@ typedef TRay<Point2, Vector2> Ray2;
 struct RayPacket4;
 struct RayInterval4;
 struct Intersection4;
+template <int N> struct TRayPacket;
+template <int N> struct TRayInterval;
+template <int N> struct TPacketIntersection;
+typedef TRayPacket<8>          RayPacket8;
+typedef TRayPacket<16>         RayPacket16;
+typedef TRayInterval<8>        RayInterval8;
+typedef TRayInterval<16>       RayInterval16;
+typedef TPacketIntersection<8> Intersection8;
+typedef TPacketIntersection<16> Intersection16;
 class WaitFlag;
 class Wavelet2D;
 class Wavelet3D;
@@ -40,6 +40,9 @@ public:
 	/// Lock the mutex
 	void lock();
 
+	/// Try to lock the mutex without blocking (returns \c true on success)
+	bool tryLock();
+
 	/// Unlock the mutex
 	void unlock();
 
@@ -208,6 +211,12 @@ public:
 		is_locked = true;
 	}
 
+	bool tryLock() {
+		SAssert(!ownsLock() && m != NULL);
+		is_locked = m->tryLock();
+		return is_locked;
+	}
+
 	void unlock() {
 		SAssert(ownsLock() && m != NULL);
 		m->unlock();
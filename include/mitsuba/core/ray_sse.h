@@ -34,12 +34,20 @@ MTS_NAMESPACE_BEGIN
 struct RayPacket4 {
 	QuadVector o, d;
 	QuadVector dRcp;
+	SSEVector time;
 	uint8_t signs[4][4];
 
 	inline RayPacket4() {
 	}
 
+	/**
+	 * \brief Load four rays into the packet
+	 *
+	 * \return \c true if the direction signs of all rays agree,
+	 * i.e. when the packet can be traced coherently
+	 */
 	inline bool load(const Ray *rays) {
+		bool coherent = true;
 		for (int i=0; i<4; i++) {
 			for (int axis=0; axis<3; axis++) {
 				o[axis].f[i] = rays[i].o[axis];
@@ -47,10 +55,11 @@ struct RayPacket4 {
 				dRcp[axis].f[i] = rays[i].dRcp[axis];
 				signs[axis][i] = rays[i].d[axis] < 0 ? 1 : 0;
 				if (signs[axis][i] != signs[axis][0])
-					return false;
+					coherent = false;
 			}
+			time.f[i] = rays[i].time;
 		}
-		return true;
+		return coherent;
 	}
 };
 
@@ -87,6 +96,91 @@ struct Intersection4 {
 	}
 };
 
+/**
+ * \brief Wide SIMD ray packet for coherent ray tracing
+ *
+ * The 8- and 16-wide packets are traced using AVX2 and AVX-512 kernels,
+ * which are selected at runtime (see \ref ShapeKDTree::getMaxPacketSize()).
+ * Since these instruction sets are not available in all translation
+ * units, the lanes are stored as plain arrays that are aligned to a
+ * cache line.
+ */
+template <int N> struct TRayPacket {
+	enum {
+		/// Number of rays in the packet
+		Size = N
+	};
+
+	MM_ALIGN64 float o[3][N];
+	MM_ALIGN64 float d[3][N];
+	MM_ALIGN64 float dRcp[3][N];
+	MM_ALIGN64 float time[N];
+	uint8_t signs[3];
+
+	inline TRayPacket() {
+	}
+
+	/**
+	 * \brief Load \c N rays into the packet
+	 *
+	 * \return \c true if the direction signs of all rays agree,
+	 * i.e. when the packet can be traced coherently
+	 */
+	inline bool load(const Ray *rays) {
+		bool coherent = true;
+		for (int axis=0; axis<3; axis++)
+			signs[axis] = rays[0].d[axis] < 0 ? 1 : 0;
+		for (int i=0; i<N; i++) {
+			for (int axis=0; axis<3; axis++) {
+				o[axis][i] = rays[i].o[axis];
+				d[axis][i] = rays[i].d[axis];
+				dRcp[axis][i] = rays[i].dRcp[axis];
+				if ((rays[i].d[axis] < 0 ? 1 : 0) != signs[axis])
+					coherent = false;
+			}
+			time[i] = rays[i].time;
+		}
+		return coherent;
+	}
+};
+
+/// Search intervals of the rays in a \ref TRayPacket
+template <int N> struct TRayInterval {
+	MM_ALIGN64 float mint[N];
+	MM_ALIGN64 float maxt[N];
+
+	inline TRayInterval() {
+		for (int i=0; i<N; i++) {
+			mint[i] = Epsilon;
+			maxt[i] = std::numeric_limits<float>::infinity();
+		}
+	}
+
+	inline TRayInterval(const Ray *rays) {
+		for (int i=0; i<N; i++) {
+			mint[i] = rays[i].mint;
+			maxt[i] = rays[i].maxt;
+		}
+	}
+};
+
+/// Intersection information of the rays in a \ref TRayPacket
+template <int N> struct TPacketIntersection {
+	MM_ALIGN64 float t[N];
+	MM_ALIGN64 float u[N];
+	MM_ALIGN64 float v[N];
+	MM_ALIGN64 uint32_t primIndex[N];
+	MM_ALIGN64 uint32_t shapeIndex[N];
+
+	inline TPacketIntersection() {
+		for (int i=0; i<N; i++) {
+			t[i] = std::numeric_limits<float>::infinity();
+			u[i] = v[i] = 0.0f;
+			primIndex[i] = shapeIndex[i] = 0xFFFFFFFFU;
+		}
+	}
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_CORE_RAY_SSE_H_ */
@@ -0,0 +1,161 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_CORE_RESREGISTRY_H_)
+#define __MITSUBA_CORE_RESREGISTRY_H_
+
+#include <mitsuba/core/lock.h>
+#include <boost/function.hpp>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Process-wide registry of immutable resources that are
+ * shared between scenes
+ *
+ * When several scenes are loaded by the same process (e.g. when
+ * rendering multiple views via <tt>mitsuba -j N</tt>), plugins can use
+ * this class to avoid holding several copies of identical geometry
+ * or texture data. Resources are identified by a string key that must
+ * capture the resolved source file (see \ref getFileKey()) as well as
+ * all parameters that influence the loaded data.
+ *
+ * The first request for a key invokes the supplied loader, while
+ * concurrent requests for the same key wait until it has finished.
+ * Resources that are only referenced by the registry are kept around
+ * for the next scene, up to a limit (see \ref setRetainedCount()).
+ * Beyond that, the least recently requested ones are released
+ * whenever a new resource is loaded. \ref collect() releases all of
+ * them right away.
+ *
+ * \remark Shared resources must not be modified after they have been
+ * registered.
+ *
+ * \ingroup libcore
+ */
+class MTS_EXPORT_CORE ResourceRegistry : public Object {
+public:
+	/// Function that loads a resource when it is not registered yet
+	typedef boost::function<ref<Object> ()> Loader;
+
+	/// Return the global registry instance
+	inline static ResourceRegistry *getInstance() { return m_instance; }
+
+	/**
+	 * \brief Return the resource with the given key, loading it
+	 * if necessary
+	 *
+	 * Exceptions thrown by the loader are passed on to the caller,
+	 * and nothing is registered in that case. The same applies when
+	 * the loader returns \c NULL.
+	 */
+	ref<Object> get(const std::string &key, const Loader &loader);
+
+	/**
+	 * \brief Release all resources that are not referenced outside
+	 * of the registry anymore
+	 *
+	 * \return The number of released resources
+	 */
+	size_t collect();
+
+	/**
+	 * \brief Set how many resources that are not referenced outside of
+	 * the registry are kept for later requests (16 by default)
+	 *
+	 * Loaders typically return a container that only the registry holds
+	 * once its contents have been copied into a scene, hence this is
+	 * what allows consecutive scenes to share data.
+	 */
+	void setRetainedCount(size_t count);
+
+	/// Return the number of unreferenced resources that are kept
+	inline size_t getRetainedCount() const { return m_retainedCount; }
+
+	/// Release all resources
+	void clear();
+
+	/// Return the number of registered resources
+	size_t getResourceCount() const;
+
+	/**
+	 * \brief Return a key prefix that uniquely identifies the
+	 * current version of the given file
+	 *
+	 * The key consists of the absolute path along with the
+	 * modification time of the file.
+	 */
+	static std::string getFileKey(const fs::path &path);
+
+	/**
+	 * \brief Return a key that exactly represents the given transformation
+	 *
+	 * The matrix entries are stored in hexadecimal floating point
+	 * notation, hence transformations that differ in the last bit
+	 * produce different keys.
+	 */
+	static std::string getTransformKey(const Transform &trafo);
+
+	/// Create the global registry instance
+	static void staticInitialization();
+
+	/**
+	 * \brief Release all registered resources and the registry
+	 *
+	 * This must be called before plugins are unloaded, since the
+	 * resources may be instances of classes defined in plugins.
+	 */
+	static void staticShutdown();
+
+	/// Return a string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Create a registry instance
+	ResourceRegistry();
+
+	/// Virtual destructor
+	virtual ~ResourceRegistry() { }
+
+	/**
+	 * \brief Move unreferenced resources to \c released, except for the
+	 * \c retain most recently used ones (assumes that the lock is held)
+	 */
+	void collectLocked(std::vector<ref<Object> > &released, size_t retain);
+private:
+	struct Entry {
+		ref<Object> resource;
+		uint64_t lastUse;
+		bool loading;
+
+		inline Entry() : lastUse(0), loading(true) { }
+	};
+
+	static ref<ResourceRegistry> m_instance;
+	std::map<std::string, Entry> m_entries;
+	uint64_t m_useCounter;
+	size_t m_retainedCount;
+	mutable ref<Mutex> m_mutex;
+	ref<ConditionVariable> m_cond;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_CORE_RESREGISTRY_H_ */
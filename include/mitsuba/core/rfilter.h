@@ -21,6 +21,9 @@
 #define __MITSUBA_CORE_RFILTER_H_
 
 #include <mitsuba/core/cobject.h>
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+#include <mitsuba/core/sse.h>
+#endif
 
 MTS_NAMESPACE_BEGIN
 
@@ -76,6 +79,38 @@ public:
 	inline Float evalDiscretized(Float x) const { return m_values[
 		std::min((int) std::abs(x * m_scaleFactor), MTS_FILTER_RESOLUTION)]; }
 
+	/**
+	 * \brief Perform \c count lookups into the discretized version at
+	 * the positions <tt>(start + i) - offset</tt>, where <tt>i=0, 1, ..</tt>
+	 *
+	 * The results are identical to calling \ref evalDiscretized() for
+	 * each position, but four positions are processed at a time when
+	 * SSE is available.
+	 */
+	inline void evalDiscretizedRange(int start, Float offset, int count, Float *result) const {
+		int i = 0;
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+		const __m128 scale = _mm_set1_ps(m_scaleFactor),
+		             maxIndex = _mm_set1_ps((float) MTS_FILTER_RESOLUTION),
+		             absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF)),
+		             offset4 = _mm_set1_ps(offset);
+		__m128i pos = _mm_add_epi32(_mm_set1_epi32(start), _mm_set_epi32(3, 2, 1, 0));
+		MM_ALIGN16 int indices[4];
+
+		for (; i<count; i += 4) {
+			__m128 x = _mm_sub_ps(_mm_cvtepi32_ps(pos), offset4);
+			/* Clamping before the conversion is equivalent, since the argument is positive */
+			__m128 index = _mm_min_ps(_mm_and_ps(_mm_mul_ps(x, scale), absMask), maxIndex);
+			_mm_store_si128((__m128i *) indices, _mm_cvttps_epi32(index));
+			for (int j=0, n=std::min(4, count-i); j<n; ++j)
+				result[i+j] = m_values[indices[j]];
+			pos = _mm_add_epi32(pos, _mm_set1_epi32(4));
+		}
+#endif
+		for (; i<count; ++i)
+			result[i] = evalDiscretized((start + i) - offset);
+	}
+
 	/// Serialize the filter to a binary data stream
 	void serialize(Stream *stream, InstanceManager *manager) const;
 
@@ -85,6 +85,19 @@ public:
 	/// Serialize a work result to a binary data stream
 	virtual void save(Stream *stream) const = 0;
 
+	/**
+	 * \brief Serialize a work result using a more compact, but
+	 * potentially lossy representation (e.g. half precision)
+	 *
+	 * This is used when transmitting results over the network, if
+	 * requested by the \ref RemoteWorker. The default implementation
+	 * simply calls \ref save().
+	 */
+	virtual void saveCompact(Stream *stream) const { save(stream); }
+
+	/// Fill the work result with content written by \ref saveCompact()
+	virtual void loadCompact(Stream *stream) { load(stream); }
+
 	/// Return a string representation
 	virtual std::string toString() const = 0;
 
@@ -223,7 +236,9 @@ public:
 	 * be required once more work is available. In some cases, it
 	 * is useful to distribute 'nearby' pieces of work to the same
 	 * processor -- the \c worker parameter can be used to
-	 * implement this.
+	 * implement this. Note that local workers generate several
+	 * work units at once (see \ref Scheduler::setWorkBatchSize()),
+	 * which may end up being processed by another worker.
 	 * This function should run as quickly as possible, since it
 	 * will be executed while the scheduler mutex is held. A
 	 * thrown exception will lead to the termination of the
@@ -444,6 +459,22 @@ public:
 	/// Retrieve one of the workers by index
 	Worker *getWorker(int index);
 
+	/**
+	 * \brief Set the number of work units that local workers generate
+	 * at once (default: 4)
+	 *
+	 * Local workers generate several work units whenever they acquire
+	 * the main scheduler lock and keep the surplus in a private queue,
+	 * which avoids contention on machines with many cores. Idle workers
+	 * steal work units from the queues of the other workers. A value of
+	 * one disables this mechanism. This must not be called while
+	 * the scheduler is running.
+	 */
+	void setWorkBatchSize(int batchSize);
+
+	/// Return the number of work units that local workers generate at once
+	inline int getWorkBatchSize() const { return m_workBatchSize; }
+
 	/// Start all workers and begin execution of any scheduled processes
 	void start();
 
@@ -553,6 +584,16 @@ public:
 		}
 	};
 
+	/// Work unit that was generated in advance by a local worker
+	struct QueuedWork {
+		int id;
+		ref<WorkUnit> workUnit;
+
+		inline QueuedWork() : id(-1) { }
+		inline QueuedWork(int id, WorkUnit *workUnit)
+			: id(id), workUnit(workUnit) { }
+	};
+
 	/// A list of status codes returned by acquireWork()
 	enum EStatus {
 		/// Sucessfully acquired a work unit
@@ -591,22 +632,8 @@ protected:
 	/// Release the main scheduler lock -- internally used by the remote worker
 	inline void releaseLock() { m_mutex->unlock(); }
 
-	inline void releaseWork(Item &item) {
-		ProcessRecord *rec = item.rec;
-		try {
-			item.proc->processResult(item.workResult, item.stop);
-		} catch (const std::exception &ex) {
-			Log(EWarn, "Caught an exception - canceling process %i: %s",
-				item.id, ex.what());
-			cancel(item.proc, true);
-			return;
-		}
-		LockGuard lock(m_mutex);
-		--rec->inflight;
-		rec->cond->signal();
-		if (rec->inflight == 0 && !rec->morework && !item.stop)
-			signalProcessTermination(item.proc, item.rec);
-	}
+	/// Return a processed work unit to its parallel process
+	void releaseWork(Item &item);
 
 	/**
 	 * Cancel the execution of a parallelizable process. Upon
@@ -645,6 +672,21 @@ protected:
 
 	/// Announces the termination of a process
 	void signalProcessTermination(ParallelProcess *proc, ProcessRecord *rec);
+
+	/**
+	 * Take a work unit from the queue of the worker that owns \c item,
+	 * or steal one from another local worker. Doesn't need the main lock.
+	 */
+	bool acquireQueuedWork(Item &item);
+
+	/**
+	 * Remove all queued work units of a process and return their
+	 * number (assumes that the main lock is held)
+	 */
+	int discardQueuedWork(int id);
+
+	/// Lock the main scheduler mutex and keep track of contention
+	void lockScheduler(UniqueLock &lock);
 private:
 	/// Global scheduler instance
 	static ref<Scheduler> m_scheduler;
@@ -662,7 +704,19 @@ private:
 	std::map<int, ResourceRecord *> m_resources;
 	/// List of all active workers
 	std::vector<Worker *> m_workers;
+	/**
+	 * Workers started by \ref start(), indexed by their worker index.
+	 * Unlike \ref m_workers, this doesn't change while the scheduler is
+	 * running, hence it can be accessed without the main lock.
+	 */
+	ref_vector<Worker> m_startedWorkers;
 	int m_resourceCounter, m_processCounter;
+	/// Number of work units generated per acquisition of the main lock
+	int m_workBatchSize;
+	/// Total number of work units in the queues of the workers
+	volatile int32_t m_queuedWork;
+	/// Number of batches of queued work units so far (protected by the main lock)
+	uint32_t m_queuedBatches;
 	bool m_running;
 };
 
@@ -745,6 +799,9 @@ protected:
 protected:
 	Scheduler *m_scheduler;
 	Scheduler::Item m_schedItem;
+	/// Work units generated in advance (only used by local workers)
+	std::deque<Scheduler::QueuedWork> m_workQueue;
+	ref<Mutex> m_workQueueMutex;
 	size_t m_coreCount;
 	bool m_isRemote;
 };
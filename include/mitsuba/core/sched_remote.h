@@ -35,30 +35,84 @@
    continue sending batches of work units */
 #define MTS_CONTINUE_FACTOR 2
 
+/** Maximum amount of resource data (in bytes) that a processing node
+   keeps around, so that it does not have to be transmitted again */
+#define MTS_CHUNK_CACHE_SIZE (256*1024*1024)
+
 MTS_NAMESPACE_BEGIN
 
 class RemoteWorkerReader;
 class StreamBackend;
+class ChunkCache;
 
 /**
  * \brief Acquires work from the scheduler and forwards
  * it to a processing node reachable through a \ref Stream.
  *
+ * Resources are split into content-defined chunks, which the processing
+ * node caches (up to \ref MTS_CHUNK_CACHE_SIZE bytes, also across
+ * connections). The worker keeps track of the cached chunks and only
+ * transmits the checksums of chunks that the other side already holds, e.g.
+ * when the same meshes are sent again as part of a new scene.
+ *
+ * The transport of work results can optionally be compressed and/or use
+ * a compact representation (see \ref ETransportFlags), which reduces the
+ * required bandwidth at the cost of some computation.
+ *
  * \ingroup libcore
  * \ingroup libpython
  */
 class MTS_EXPORT_CORE RemoteWorker : public Worker {
 	friend class RemoteWorkerReader;
 public:
+	/// Options that affect the transmission of work results
+	enum ETransportFlags {
+		/// Compress work results using \c zlib
+		ECompressResults = 0x01,
+
+		/**
+		 * Transmit work results using their compact and potentially
+		 * lossy representation (\ref WorkResult::saveCompact())
+		 */
+		ECompactResults = 0x02,
+
+		/// All flags that are known to this version
+		EAllTransportFlags = ECompressResults | ECompactResults
+	};
+
 	/**
 	 * \brief Construct a new remote worker with the given name and
 	 * communication stream
+	 *
+	 * \param transportFlags
+	 *    Combination of \ref ETransportFlags values. The server may
+	 *    only accept a subset of them (see \ref getTransportFlags())
+	 */
+	RemoteWorker(const std::string &name, Stream *stream, int transportFlags = 0);
+
+	/**
+	 * \brief Parse a comma-separated list of transport options
+	 *
+	 * Supported are \c zlib (\ref ECompressResults) and \c half
+	 * (\ref ECompactResults). Throws an exception for unknown options.
 	 */
-	RemoteWorker(const std::string &name, Stream *stream);
+	static int parseTransportFlags(const std::string &options);
 
 	/// Return the name of the node on the other side
 	inline const std::string &getNodeName() const { return m_nodeName; }
 
+	/// Return the transport flags that were accepted by the server
+	inline int getTransportFlags() const { return m_transportFlags; }
+
+	/**
+	 * \brief Serialize a work result as it is transmitted over a
+	 * connection with the given transport flags
+	 */
+	static void saveWorkResult(Stream *stream, const WorkResult *result, int transportFlags);
+
+	/// Fill a work result with content written by \ref saveWorkResult()
+	static void loadWorkResult(Stream *stream, WorkResult *result, int transportFlags);
+
 	MTS_DECLARE_CLASS()
 protected:
 	/// Virtual destructor
@@ -91,6 +145,10 @@ protected:
 	std::set<std::string> m_plugins;
 	std::string m_nodeName;
 	size_t m_inFlight;
+	int m_transportFlags;
+
+	/* Mirror of the chunk cache at the remote node */
+	ChunkCache *m_chunkCache;
 };
 
 /**
@@ -216,6 +274,16 @@ public:
 	StreamBackend(const std::string &name, Scheduler *scheduler,
 		const std::string &nodeName, Stream *stream, bool detach);
 
+	/**
+	 * \brief Create the chunk cache that is shared by all stream backends
+	 *
+	 * Called by \ref Scheduler::staticInitialization()
+	 */
+	static void staticInitialization();
+
+	/// Release the shared chunk cache (called by \ref Scheduler::staticShutdown())
+	static void staticShutdown();
+
 	MTS_DECLARE_CLASS()
 protected:
 	enum EMessage {
@@ -249,6 +317,8 @@ private:
 	std::map<int, RemoteProcess *> m_processes;
 	std::map<int, int> m_resources;
 	ref<Mutex> m_sendMutex;
+	ChunkCache *m_chunkCache;
+	int m_transportFlags;
 	bool m_detach;
 };
 
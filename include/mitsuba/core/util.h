@@ -120,6 +120,24 @@ extern MTS_EXPORT_CORE size_t getTotalSystemMemory();
 /// Return the fully qualified domain name of this machine
 extern MTS_EXPORT_CORE std::string getFQDN();
 
+/**
+ * \brief Return the number of single precision values that fit into the
+ * widest SIMD register supported by both the processor and the OS
+ *
+ * \return 16 when AVX-512F is available, 8 for AVX2 and FMA, and 4 otherwise
+ */
+extern MTS_EXPORT_CORE int getSIMDWidth();
+
+/**
+ * \brief Compute a 64-bit FNV-1a hash of a memory region
+ *
+ * Larger inputs can be hashed incrementally by passing the result of
+ * the previous call as the \c hash parameter. The result is suitable
+ * for identifying cached data, but it is not a cryptographic hash.
+ */
+extern MTS_EXPORT_CORE uint64_t hashBytes(const void *data, size_t size,
+	uint64_t hash = 0xcbf29ce484222325ULL);
+
 /**
  * \brief Enable floating point exceptions (to catch NaNs, overflows,
  * arithmetic with infinity).
@@ -0,0 +1,191 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_ACCEL_H_)
+#define __MITSUBA_RENDER_ACCEL_H_
+
+#include <mitsuba/render/skdtree.h>
+#include <mitsuba/core/properties.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Abstract interface to the acceleration data structures, which
+ * are used to intersect rays against the shapes of a \ref Scene
+ *
+ * A scene selects its acceleration data structure using the \c accel
+ * parameter, which can be set to \c kdtree (\ref ShapeKDTree, the
+ * default) or \c bvh (\ref ShapeBVH).
+ *
+ * Serializing an instance only transmits its construction parameters --
+ * the shapes have to be added and the data structure must be built
+ * again after unserialization.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER Accelerator : public SerializableObject {
+public:
+	// =============================================================
+	//! @{ \name Initialization and construction
+	// =============================================================
+
+	/**
+	 * \brief Create the acceleration data structure that is requested
+	 * by the parameters of a scene
+	 */
+	static ref<Accelerator> create(const Properties &props);
+
+	/// Add a shape (must be called before \ref build())
+	virtual void addShape(const Shape *shape) = 0;
+
+	/// Build the data structure (needs to be called before tracing any rays)
+	virtual void build() = 0;
+
+	/// Has the data structure already been built?
+	virtual bool isBuilt() const = 0;
+
+	/// Return the list of stored shapes
+	virtual const std::vector<const Shape *> &getShapes() const = 0;
+
+	/// Return an axis-aligned bounding box containing all primitives
+	virtual const AABB &getAABB() const = 0;
+
+	/**
+	 * \brief Create an empty acceleration data structure with the same
+	 * construction parameters
+	 */
+	virtual ref<Accelerator> createEmpty() const = 0;
+
+	//! @}
+	// =============================================================
+
+	// =============================================================
+	//! @{ \name Ray tracing routines
+	// =============================================================
+
+	/**
+	 * \brief Intersect a ray against all stored primitives and
+	 * return detailed intersection information
+	 *
+	 * \sa ShapeKDTree::rayIntersect()
+	 */
+	virtual bool rayIntersect(const Ray &ray, Intersection &its) const = 0;
+
+	/**
+	 * \brief Intersect a ray against all stored primitives and
+	 * return the traveled distance and intersected shape
+	 *
+	 * \sa ShapeKDTree::rayIntersect()
+	 */
+	virtual bool rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
+		Normal &n, Point2 &uv) const = 0;
+
+	/**
+	 * \brief Test a ray for occlusion with respect to all
+	 * stored primitives
+	 *
+	 * \sa ShapeKDTree::rayIntersect()
+	 */
+	virtual bool rayIntersect(const Ray &ray) const = 0;
+
+	//! @}
+	// =============================================================
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Create a new acceleration data structure
+	inline Accelerator() { }
+
+	/// Unserialize the construction parameters from a binary data stream
+	inline Accelerator(Stream *stream, InstanceManager *manager)
+		: SerializableObject(stream, manager) { }
+
+	/// Virtual destructor
+	virtual ~Accelerator() { }
+};
+
+/**
+ * \brief Exposes the SAH kd-tree (\ref ShapeKDTree) through the
+ * \ref Accelerator interface
+ *
+ * The kd-tree construction is controlled by the following
+ * scene parameters: \c kdIntersectionCost, \c kdTraversalCost,
+ * \c kdEmptySpaceBonus, \c kdStopPrims, \c kdMaxDepth, \c kdClip,
+ * \c kdExactPrimitiveThreshold, \c kdParallelBuild, \c kdRetract
+ * and \c kdMaxBadRefines. Setting \c kdCache to a directory enables
+ * the on-disk kd-tree cache (see \ref ShapeKDTree::setCacheDirectory()).
+ * The cache directory is a local path and is therefore not serialized.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER KDTreeAccelerator : public Accelerator {
+public:
+	/// Create an empty kd-tree with the default construction parameters
+	KDTreeAccelerator();
+
+	/// Create an empty kd-tree using the construction parameters of a scene
+	KDTreeAccelerator(const Properties &props);
+
+	/// Unserialize the construction parameters from a binary data stream
+	KDTreeAccelerator(Stream *stream, InstanceManager *manager);
+
+	/// Serialize the construction parameters to a binary data stream
+	void serialize(Stream *stream, InstanceManager *manager) const;
+
+	/// Return the underlying kd-tree
+	inline ShapeKDTree *getKDTree() { return m_kdtree; }
+
+	/// Return the underlying kd-tree
+	inline const ShapeKDTree *getKDTree() const { return m_kdtree.get(); }
+
+	/* Accelerator implementation */
+	void addShape(const Shape *shape) { m_kdtree->addShape(shape); }
+	void build() { m_kdtree->build(); }
+	bool isBuilt() const { return m_kdtree->isBuilt(); }
+	const std::vector<const Shape *> &getShapes() const { return m_kdtree->getShapes(); }
+	const AABB &getAABB() const { return m_kdtree->getAABB(); }
+	ref<Accelerator> createEmpty() const;
+
+	bool rayIntersect(const Ray &ray, Intersection &its) const {
+		return m_kdtree->rayIntersect(ray, its);
+	}
+
+	bool rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
+			Normal &n, Point2 &uv) const {
+		return m_kdtree->rayIntersect(ray, t, shape, n, uv);
+	}
+
+	bool rayIntersect(const Ray &ray) const {
+		return m_kdtree->rayIntersect(ray);
+	}
+
+	/// Return a string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~KDTreeAccelerator() { }
+private:
+	ref<ShapeKDTree> m_kdtree;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_ACCEL_H_ */
@@ -0,0 +1,179 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_BVH_H_)
+#define __MITSUBA_RENDER_BVH_H_
+
+#include <mitsuba/render/accel.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Wide bounding volume hierarchy for fast ray-shape intersections
+ *
+ * Each node of the hierarchy stores the bounding boxes of up to four or
+ * eight children in a structure-of-arrays layout, which allows testing a
+ * ray against all of them at once using SSE instructions. The hierarchy
+ * is constructed top-down using a binned surface area heuristic, which is
+ * considerably faster than the 'perfect split' kd-tree construction of
+ * \ref ShapeKDTree. This makes it a good choice for small and medium-sized
+ * scenes, where the kd-tree construction time would dominate the cost of
+ * rendering. On the other hand, the kd-tree tends to trace rays faster.
+ *
+ * Subtrees are constructed in parallel using OpenMP. Like the kd-tree,
+ * this class intersects triangles using the precomputed
+ * \ref TriAccel representation.
+ *
+ * The hierarchy is selected by setting the \c accel parameter of a
+ * scene to \c bvh. The following scene parameters control its
+ * construction:
+ * <ul>
+ *   <li>\c bvhWidth: Number of children per node (4 or 8, default: 4)</li>
+ *   <li>\c bvhMaxLeafSize: Maximum number of primitives
+ *       per leaf (default: 4)</li>
+ *   <li>\c bvhBinCount: Number of bins of the surface
+ *       area heuristic (default: 16)</li>
+ *   <li>\c bvhParallelBuild: Construct subtrees in parallel?
+ *       (default: \c true)</li>
+ * </ul>
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER ShapeBVH : public Accelerator {
+public:
+	// =============================================================
+	//! @{ \name Initialization and construction
+	// =============================================================
+
+	/// Create an empty BVH with the default construction parameters
+	ShapeBVH();
+
+	/// Create an empty BVH using the construction parameters of a scene
+	ShapeBVH(const Properties &props);
+
+	/// Unserialize the construction parameters from a binary data stream
+	ShapeBVH(Stream *stream, InstanceManager *manager);
+
+	/// Serialize the construction parameters to a binary data stream
+	void serialize(Stream *stream, InstanceManager *manager) const;
+
+	/// Set the number of children per node (4 or 8)
+	void setWidth(int width);
+
+	/// Return the number of children per node
+	inline int getWidth() const { return m_width; }
+
+	/// Set the maximum number of primitives per leaf
+	inline void setMaxLeafSize(int size) { m_maxLeafSize = size; }
+
+	/// Return the maximum number of primitives per leaf
+	inline int getMaxLeafSize() const { return m_maxLeafSize; }
+
+	/// Set the number of bins used to evaluate the surface area heuristic
+	inline void setBinCount(int count) { m_binCount = count; }
+
+	/// Return the number of bins used to evaluate the surface area heuristic
+	inline int getBinCount() const { return m_binCount; }
+
+	/// Specify whether subtrees should be constructed in parallel
+	inline void setParallelBuild(bool parallel) { m_parallelBuild = parallel; }
+
+	/// Return whether subtrees are constructed in parallel
+	inline bool getParallelBuild() const { return m_parallelBuild; }
+
+	/// Return the number of nodes of the hierarchy
+	inline size_t getNodeCount() const { return m_nodeCount; }
+
+	/// Return the total number of low-level primitives
+	inline size_t getPrimitiveCount() const { return m_primitiveCount; }
+
+	/* Accelerator implementation */
+	void addShape(const Shape *shape);
+	void build();
+	inline bool isBuilt() const { return m_built; }
+	inline const std::vector<const Shape *> &getShapes() const { return m_shapes; }
+	inline const AABB &getAABB() const { return m_aabb; }
+	ref<Accelerator> createEmpty() const;
+
+	//! @}
+	// =============================================================
+
+	// =============================================================
+	//! @{ \name Ray tracing routines
+	// =============================================================
+
+	bool rayIntersect(const Ray &ray, Intersection &its) const;
+
+	bool rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
+		Normal &n, Point2 &uv) const;
+
+	bool rayIntersect(const Ray &ray) const;
+
+	//! @}
+	// =============================================================
+
+	/// Return a string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Temporarily holds some intersection information (as in \ref ShapeKDTree)
+	struct IntersectionCache {
+		uint32_t shapeIndex;
+		uint32_t primIndex;
+		Float u, v;
+	};
+
+	/// Construct the hierarchy with nodes of width \c N
+	template <int N> void buildInternal();
+
+	/**
+	 * \brief Find the closest intersection (or, when \c ShadowRay is
+	 * \c true, any intersection) within the interval <tt>[mint, maxt]</tt>
+	 */
+	template <int N, bool ShadowRay> bool rayIntersectInternal(const Ray &ray,
+		Float mint, Float maxt, Float &t, void *temp) const;
+
+	/// Dispatch a ray query to the implementation for the node width
+	template <bool ShadowRay> bool rayIntersectDispatch(const Ray &ray,
+		Float &t, void *temp) const;
+
+	/// Fill a detailed intersection record using the cached hit information
+	void fillIntersectionRecord(const Ray &ray, const void *temp,
+		Intersection &its) const;
+
+	/// Virtual destructor
+	virtual ~ShapeBVH();
+private:
+	std::vector<const Shape *> m_shapes;
+	AABB m_aabb;
+	TriAccel *m_triAccel;
+	void *m_nodes;
+	size_t m_nodeCount;
+	size_t m_primitiveCount;
+	int m_width;
+	int m_maxLeafSize;
+	int m_binCount;
+	bool m_parallelBuild;
+	bool m_built;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_BVH_H_ */
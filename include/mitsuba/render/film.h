@@ -25,6 +25,77 @@
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * \brief Describes an auxiliary per-pixel output (AOV) that is recorded
+ * next to the reconstructed image
+ *
+ * AOVs store information about the first surface seen through a pixel
+ * (e.g. its depth or surface normal). They are kept in additional channels
+ * of the image blocks after the spectrum, alpha and weight channels, bypass
+ * the reconstruction filter, and are written exactly once per pixel by the
+ * block that contains it.
+ *
+ * \sa Film::getAOVs()
+ * \ingroup librender
+ */
+struct MTS_EXPORT_RENDER AOV {
+	/// Supported kinds of AOVs
+	enum EType {
+		/// Depth along the optical axis of the sensor (1 channel)
+		EDepth = 0,
+		/// Distance from the sensor to the surface (1 channel)
+		EDistance,
+		/// Position in world space (3 channels)
+		EPosition,
+		/// Geometric surface normal in world space (3 channels)
+		EGeometricNormal,
+		/// Shading surface normal in world space (3 channels)
+		EShadingNormal,
+		/// UV coordinates (2 channels)
+		EUV,
+		/// Diffuse reflectance of the BSDF as linear RGB (3 channels)
+		EAlbedo,
+		/// 1 if a surface was hit, and 0 otherwise (1 channel)
+		EMask,
+		/// Object ID of the surface covering most of the pixel (1 channel, see \ref Shape::getObjectID())
+		EObjectID,
+		/// Part ID of the surface covering most of the pixel (1 channel, see \ref Shape::getPartID())
+		EPartID,
+		/// Fraction of the pixel covered by the surface reported by \c EObjectID and \c EPartID (1 channel)
+		ECoverage,
+		ETypeCount
+	};
+
+	/// Kind of the AOV
+	EType type;
+
+	/// Index of the first channel of this AOV within an image block
+	int offset;
+
+	/// Return the number of channels needed by an AOV type
+	static int getChannelCount(EType type);
+
+	/// Return the name of an AOV type (e.g. \c "depth")
+	static std::string getName(EType type);
+
+	/**
+	 * \brief Is this an integer ID or the coverage AOV?
+	 *
+	 * These are determined from all samples of a pixel, using the
+	 * object/part ID pair that is hit by most of them. They are never
+	 * interpolated, and background pixels have the IDs 0.
+	 */
+	static inline bool isCoverageBased(EType type) {
+		return type == EObjectID || type == EPartID || type == ECoverage;
+	}
+
+	/**
+	 * \brief Look up an AOV type by name
+	 * \return \c false if there is no such type
+	 */
+	static bool fromString(const std::string &name, EType &type);
+};
+
 /** \brief Abstract film base class - used to store samples
  * generated by \ref Integrator implementations.
  *
@@ -51,6 +122,25 @@ public:
 	/// Merge an image block into the film
 	virtual void put(const ImageBlock *block) = 0;
 
+	/**
+	 * \brief Can \ref put() be called by several threads at the same time?
+	 *
+	 * When this is the case, render processes merge finished image blocks
+	 * without serializing on a common lock. The default implementation
+	 * returns \c false.
+	 */
+	virtual bool supportsConcurrentPut() const { return false; }
+
+	/**
+	 * \brief Return the auxiliary per-pixel outputs recorded by this film
+	 *
+	 * Integrators that support AOVs must then produce image blocks
+	 * using the \ref Bitmap::EMultiChannel pixel format, whose channels
+	 * are laid out as described in \ref AOV. The default implementation
+	 * returns an empty list.
+	 */
+	virtual std::vector<AOV> getAOVs() const;
+
 	/// Overwrite the film with the given bitmap and optionally multiply it by a scalar
 	virtual void setBitmap(const Bitmap *bitmap, Float multiplier = 1.0f) = 0;
 
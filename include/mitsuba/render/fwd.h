@@ -22,6 +22,7 @@
 
 MTS_NAMESPACE_BEGIN
 
+class Accelerator;
 class BlockedImageProcess;
 class BlockedRenderProcess;
 class BlockListener;
@@ -39,6 +40,7 @@ class Instanced;
 class Integrator;
 struct Intersection;
 class IrradianceCache;
+class KDTreeAccelerator;
 template <typename AABBType> class KDTreeBase;
 template <typename AABBType, typename TreeConstructionHeuristic, typename Derived> class GenericKDTree;
 template <typename Derived> class SAHKDTree3D;
@@ -68,6 +70,7 @@ class RenderListener;
 class RenderQueue;
 class SamplingIntegrator;
 class Sampler;
+class ShapeBVH;
 class Sensor;
 class Scene;
 class SceneHandler;
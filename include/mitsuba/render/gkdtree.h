@@ -22,6 +22,7 @@
 
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/lock.h>
+#include <mitsuba/core/statistics.h>
 #include <boost/static_assert.hpp>
 #include <stack>
 
@@ -29,6 +30,10 @@
 #include <malloc.h>
 #endif
 
+#if defined(MTS_OPENMP)
+#include <omp.h>
+#endif
+
 /// Activate lots of extra checks
 //#define MTS_KD_DEBUG 1
 
@@ -43,6 +48,12 @@
 #define MTS_KD_BLOCKSIZE_KD  (512*1024/sizeof(KDNode))
 #define MTS_KD_BLOCKSIZE_IDX (512*1024/sizeof(uint32_t))
 
+/**
+ * \brief Minimum number of primitives per work unit, when the scene
+ * bounds, min-max binning and partitioning steps run in parallel
+ */
+#define MTS_KD_PARALLEL_CHUNK 16384
+
 /**
  * \brief To avoid numerical issues, the size of the scene
  * bounding box is increased by this amount
@@ -59,6 +70,16 @@
 
 MTS_NAMESPACE_BEGIN
 
+/* Time spent in the different phases of the kd-tree construction */
+namespace stats {
+	extern MTS_EXPORT_RENDER StatsCounter kdBoundsTime;
+	extern MTS_EXPORT_RENDER StatsCounter kdBinningTime;
+	extern MTS_EXPORT_RENDER StatsCounter kdPartitionTime;
+	extern MTS_EXPORT_RENDER StatsCounter kdEventListTime;
+	extern MTS_EXPORT_RENDER StatsCounter kdSubtreeTime;
+	extern MTS_EXPORT_RENDER StatsCounter kdLayoutTime;
+};
+
 
 /**
  * \brief Special "ordered" memory allocator
@@ -996,11 +1017,28 @@ protected:
 		ref<Timer> timer = new Timer();
 		AABBType &aabb = m_aabb;
 		aabb.reset();
-		for (IndexType i=0; i<primCount; ++i) {
-			aabb.expandBy(cast()->getAABB(i));
-			indices[i] = i;
+
+		/* Compute the bounds of separate chunks of the primitive list
+		   (in parallel, if enabled) and merge them afterwards */
+		const int chunkCount = getChunkCount(primCount);
+		std::vector<AABBType> chunkAABBs(chunkCount);
+
+		#if defined(MTS_OPENMP)
+			#pragma omp parallel for schedule(static) if (chunkCount > 1)
+		#endif
+		for (int chunk=0; chunk<chunkCount; ++chunk) {
+			IndexType start = getChunkStart(primCount, chunk, chunkCount),
+			          end   = getChunkStart(primCount, chunk+1, chunkCount);
+			AABBType &chunkAABB = chunkAABBs[chunk];
+			for (IndexType i=start; i<end; ++i) {
+				chunkAABB.expandBy(cast()->getAABB(i));
+				indices[i] = i;
+			}
 		}
 
+		for (int chunk=0; chunk<chunkCount; ++chunk)
+			aabb.expandBy(chunkAABBs[chunk]);
+
 		#if defined(DOUBLE_PRECISION)
 			for (int i=0; i<3; ++i) {
 				aabb.min[i] = math::castflt_down(aabb.min[i]);
@@ -1008,8 +1046,9 @@ protected:
 			}
 		#endif
 
+		ctx.boundsTime = timer->getMicroseconds();
 		KDLog(m_logLevel, "Computed scene bounds in %i ms",
-				timer->getMilliseconds());
+				(int) (ctx.boundsTime / 1000));
 		KDLog(m_logLevel, "");
 
 		KDLog(m_logLevel, "kd-tree configuration:");
@@ -1091,6 +1130,23 @@ protected:
 			ctx.accumulateStatisticsFrom(subCtx);
 		}
 		KDLog(m_logLevel, "   Total: %s", memString(totalUsage).c_str());
+		KDLog(m_logLevel, "");
+
+		/* Subtree timings are summed over all threads, hence they can
+		   exceed the total build time */
+		KDLog(m_logLevel, "Construction phases:");
+		KDLog(m_logLevel, "   Scene bounds           : %i ms", (int) (ctx.boundsTime / 1000));
+		KDLog(m_logLevel, "   Min-max binning        : %i ms", (int) (ctx.binningTime / 1000));
+		KDLog(m_logLevel, "   Partitioning           : %i ms", (int) (ctx.partitionTime / 1000));
+		KDLog(m_logLevel, "   Event list creation    : %i ms (all threads)",
+				(int) (ctx.eventListTime / 1000));
+		KDLog(m_logLevel, "   O(n log n) subtrees    : %i ms (all threads)",
+				(int) (ctx.subtreeTime / 1000));
+		stats::kdBoundsTime += ctx.boundsTime / 1000;
+		stats::kdBinningTime += ctx.binningTime / 1000;
+		stats::kdPartitionTime += ctx.partitionTime / 1000;
+		stats::kdEventListTime += ctx.eventListTime / 1000;
+		stats::kdSubtreeTime += ctx.subtreeTime / 1000;
 
 		KDLog(m_logLevel, "");
 		timer->reset();
@@ -1183,7 +1239,9 @@ protected:
 		KDAssert(nodePtr == ctx.innerNodeCount + ctx.leafNodeCount);
 		KDAssert(indexPtr == m_indexCount);
 
-		KDLog(m_logLevel, "Finished -- took %i ms.", timer->getMilliseconds());
+		unsigned int layoutTime = timer->getMilliseconds();
+		stats::kdLayoutTime += layoutTime;
+		KDLog(m_logLevel, "Finished -- took %i ms.", layoutTime);
 
 		/* Free some more memory */
 		ctx.nodes.clear();
@@ -1390,6 +1448,13 @@ protected:
 		SizeType retractedSplits;
 		SizeType pruned;
 
+		/* Time spent in the construction phases (in microseconds) */
+		uint64_t boundsTime;
+		uint64_t binningTime;
+		uint64_t partitionTime;
+		uint64_t eventListTime;
+		uint64_t subtreeTime;
+
 		BuildContext(SizeType primCount, SizeType binCount)
 				: minMaxBins(binCount) {
 			classStorage.setPrimitiveCount(primCount);
@@ -1399,6 +1464,8 @@ protected:
 			primIndexCount = 0;
 			retractedSplits = 0;
 			pruned = 0;
+			boundsTime = binningTime = partitionTime = 0;
+			eventListTime = subtreeTime = 0;
 		}
 
 		size_t size() {
@@ -1431,6 +1498,10 @@ protected:
 			primIndexCount += ctx.primIndexCount;
 			retractedSplits += ctx.retractedSplits;
 			pruned += ctx.pruned;
+			binningTime += ctx.binningTime;
+			partitionTime += ctx.partitionTime;
+			eventListTime += ctx.eventListTime;
+			subtreeTime += ctx.subtreeTime;
 		}
 	};
 
@@ -1449,7 +1520,7 @@ protected:
 		int depth;
 		KDNode *node;
 		AABBType nodeAABB;
-		EdgeEvent *eventStart, *eventEnd;
+		IndexType *indices;
 		SizeType primCount;
 		int badRefines;
 
@@ -1494,22 +1565,31 @@ protected:
 				int depth = m_interface.depth;
 				KDNode *node = m_interface.node;
 				AABBType nodeAABB = m_interface.nodeAABB;
-				size_t eventCount = m_interface.eventEnd - m_interface.eventStart;
 				SizeType primCount = m_interface.primCount;
 				int badRefines = m_interface.badRefines;
-				EdgeEvent *eventStart = leftAlloc.allocate<EdgeEvent>(eventCount),
-						  *eventEnd = eventStart + eventCount;
-				memcpy(eventStart, m_interface.eventStart,
-						eventCount * sizeof(EdgeEvent));
+				IndexType *indices = leftAlloc.allocate<IndexType>(primCount);
+				memcpy(indices, m_interface.indices,
+						primCount * sizeof(IndexType));
 				m_interface.threadMap[node] = m_id;
 				m_interface.node = NULL;
 				m_interface.condJobTaken->signal();
 				lock.unlock();
 
-				std::sort(eventStart, eventEnd, EdgeEventOrdering());
-				m_parent->buildTree(m_context, depth, node,
-					nodeAABB, eventStart, eventEnd, primCount, true, badRefines);
-				leftAlloc.release(eventStart);
+				/* Create the event list here rather than on the main thread,
+				   which can then proceed with the next job right away */
+				ref<Timer> timer = new Timer();
+				EventList events = m_parent->createEventList(leftAlloc,
+						nodeAABB, indices, primCount);
+				std::sort(events.start, events.end, EdgeEventOrdering());
+				m_context.eventListTime += timer->getMicroseconds();
+
+				timer->reset();
+				m_parent->buildTree(m_context, depth, node, nodeAABB,
+					events.start, events.end, events.primCount, true, badRefines);
+				m_context.subtreeTime += timer->getMicroseconds();
+
+				leftAlloc.release(events.start);
+				leftAlloc.release(indices);
 			}
 		}
 
@@ -1534,6 +1614,27 @@ protected:
 		return static_cast<const Derived *>(this);
 	}
 
+	/**
+	 * \brief Return the number of chunks, into which a list of
+	 * \c primCount primitives should be split for parallel processing
+	 *
+	 * This is 1 (i.e. serial processing) unless the build runs in
+	 * parallel and OpenMP is available.
+	 */
+	inline int getChunkCount(SizeType primCount) const {
+		#if defined(MTS_OPENMP)
+			if (m_parallelBuild)
+				return (int) std::max((SizeType) 1, std::min((SizeType)
+					mts_omp_get_max_threads() * 4, primCount / MTS_KD_PARALLEL_CHUNK));
+		#endif
+		return 1;
+	}
+
+	/// Return the first primitive of a chunk (see \ref getChunkCount())
+	static inline IndexType getChunkStart(SizeType primCount, int chunk, int chunkCount) {
+		return (IndexType) (((uint64_t) primCount * chunk) / chunkCount);
+	}
+
 	struct EventList {
 		EdgeEvent *start, *end;
 		SizeType primCount;
@@ -1729,18 +1830,15 @@ protected:
 	inline Float transitionToNLogN(BuildContext &ctx, unsigned int depth, KDNode *node,
 			const AABBType &nodeAABB, IndexType *indices,
 			SizeType primCount, bool isLeftChild, SizeType badRefines) {
-		OrderedChunkAllocator &alloc = isLeftChild
-				? ctx.leftAlloc : ctx.rightAlloc;
-		EventList events = createEventList(alloc, nodeAABB, indices, primCount);
 		Float cost;
 		if (m_parallelBuild) {
+			/* The worker thread creates the event list itself */
 			LockGuard lock(m_interface.mutex);
 			m_interface.depth = depth;
 			m_interface.node = node;
 			m_interface.nodeAABB = nodeAABB;
-			m_interface.eventStart = events.start;
-			m_interface.eventEnd = events.end;
-			m_interface.primCount = events.primCount;
+			m_interface.indices = indices;
+			m_interface.primCount = primCount;
 			m_interface.badRefines = badRefines;
 			m_interface.cond->signal();
 
@@ -1751,12 +1849,19 @@ protected:
 			// Never tear down this subtree (return a cost of -infinity)
 			cost = -std::numeric_limits<Float>::infinity();
 		} else {
+			OrderedChunkAllocator &alloc = isLeftChild
+					? ctx.leftAlloc : ctx.rightAlloc;
+			ref<Timer> timer = new Timer();
+			EventList events = createEventList(alloc, nodeAABB, indices, primCount);
 			std::sort(events.start, events.end, EdgeEventOrdering());
+			ctx.eventListTime += timer->getMicroseconds();
 
+			timer->reset();
 			cost = buildTree(ctx, depth, node, nodeAABB, events.start,
 				events.end, events.primCount, isLeftChild, badRefines);
+			ctx.subtreeTime += timer->getMicroseconds();
+			alloc.release(events.start);
 		}
-		alloc.release(events.start);
 		return cost;
 	}
 
@@ -1808,14 +1913,17 @@ protected:
 	    /*                              Binning                                 */
 	    /* ==================================================================== */
 
+		const int chunkCount = getChunkCount(primCount);
+		ref<Timer> timer = new Timer();
 		ctx.minMaxBins.setAABB(tightAABB);
-		ctx.minMaxBins.bin(cast(), indices, primCount);
+		ctx.minMaxBins.bin(cast(), indices, primCount, chunkCount);
 
 		/* ==================================================================== */
 	    /*                        Split candidate search                        */
     	/* ==================================================================== */
 		SplitCandidate bestSplit = ctx.minMaxBins.minimizeCost(m_traversalCost,
 				m_queryCost);
+		ctx.binningTime += timer->getMicroseconds();
 
 		if (bestSplit.cost == std::numeric_limits<Float>::infinity()) {
 			/* This is bad: we have either run out of floating point precision to
@@ -1846,9 +1954,11 @@ protected:
 	    /*                            Partitioning                              */
 	    /* ==================================================================== */
 
+		timer->reset();
 		typename MinMaxBins::Partition partition =
 			ctx.minMaxBins.partition(ctx, cast(), indices, bestSplit,
-			isLeftChild, m_traversalCost, m_queryCost);
+			isLeftChild, m_traversalCost, m_queryCost, chunkCount);
+		ctx.partitionTime += timer->getMicroseconds();
 
 		/* ==================================================================== */
 	    /*                              Recursion                               */
@@ -2429,7 +2539,7 @@ protected:
 		}
 
 		/// Compute the bin location for a given position and axis
-		inline IndexType computeIndex(float pos, int axis) {
+		inline IndexType computeIndex(float pos, int axis) const {
 			return (IndexType) std::min((float) (m_binCount-1), std::max(0.0f, (pos - m_min[axis]) * m_invBinSize[axis]));
 		}
 
@@ -2440,18 +2550,40 @@ protected:
 		 *     a given list of primitives
 		 * \param indices Primitive indirection list
 		 * \param primCount Specifies the length of \a indices
+		 * \param chunkCount When larger than one, separate chunks of the
+		 *     primitive list are binned in parallel and the resulting
+		 *     histograms are added up afterwards
 		 */
 		void bin(const Derived *derived, IndexType *indices,
-				SizeType primCount) {
+				SizeType primCount, int chunkCount = 1) {
+			const SizeType entryCount = PointType::dim * m_binCount;
 			m_primCount = primCount;
-			memset(m_minBins, 0, sizeof(SizeType) * PointType::dim * m_binCount);
-			memset(m_maxBins, 0, sizeof(SizeType) * PointType::dim * m_binCount);
+			memset(m_minBins, 0, sizeof(SizeType) * entryCount);
+			memset(m_maxBins, 0, sizeof(SizeType) * entryCount);
 
-			for (SizeType i=0; i<m_primCount; ++i) {
-				const AABBType aabb = derived->getAABB(indices[i]);
-				for (int axis=0; axis<PointType::dim; ++axis) {
-					m_minBins[axis * m_binCount + computeIndex(math::castflt_down(aabb.min[axis]), axis)]++;
-					m_maxBins[axis * m_binCount + computeIndex(math::castflt_up  (aabb.max[axis]), axis)]++;
+			if (chunkCount <= 1) {
+				binRange(derived, indices, 0, primCount, m_minBins, m_maxBins);
+				return;
+			}
+
+			std::vector<SizeType> minBins(entryCount * chunkCount, 0),
+			                      maxBins(entryCount * chunkCount, 0);
+
+			#if defined(MTS_OPENMP)
+				#pragma omp parallel for schedule(static)
+			#endif
+			for (int chunk=0; chunk<chunkCount; ++chunk)
+				binRange(derived, indices,
+					getChunkStart(primCount, chunk, chunkCount),
+					getChunkStart(primCount, chunk+1, chunkCount),
+					&minBins[chunk * entryCount], &maxBins[chunk * entryCount]);
+
+			for (int chunk=0; chunk<chunkCount; ++chunk) {
+				const SizeType *chunkMinBins = &minBins[chunk * entryCount],
+				               *chunkMaxBins = &maxBins[chunk * entryCount];
+				for (SizeType i=0; i<entryCount; ++i) {
+					m_minBins[i] += chunkMinBins[i];
+					m_maxBins[i] += chunkMaxBins[i];
 				}
 			}
 		}
@@ -2518,11 +2650,15 @@ protected:
 		 * \brief Given a suitable split candiate, compute tight bounding
 		 * boxes for the left and right subtrees and return associated
 		 * primitive lists.
+		 *
+		 * When \c chunkCount is larger than one, the primitives are
+		 * classified in parallel. The resulting primitive lists are
+		 * identical to those of the serial version.
 		 */
 		Partition partition(
 				BuildContext &ctx, const Derived *derived, IndexType *primIndices,
 				SplitCandidate &split, bool isLeftChild, Float traversalCost,
-				Float queryCost) {
+				Float queryCost, int chunkCount = 1) {
 			SizeType numLeft = 0, numRight = 0;
 			AABBType leftBounds, rightBounds;
 			const int axis = split.axis;
@@ -2538,28 +2674,34 @@ protected:
 				rightIndices = primIndices;
 			}
 
-			for (SizeType i=0; i<m_primCount; ++i) {
-				const IndexType primIndex = primIndices[i];
-				const AABBType aabb = derived->getAABB(primIndex);
-				int startIdx = computeIndex(math::castflt_down(aabb.min[axis]), axis);
-				int endIdx   = computeIndex(math::castflt_up  (aabb.max[axis]), axis);
-
-				if (endIdx <= split.leftBin) {
-					KDAssert(numLeft < split.numLeft);
-					leftBounds.expandBy(aabb);
-					leftIndices[numLeft++] = primIndex;
-				} else if (startIdx > split.leftBin) {
-					KDAssert(numRight < split.numRight);
-					rightBounds.expandBy(aabb);
-					rightIndices[numRight++] = primIndex;
-				} else {
-					leftBounds.expandBy(aabb);
-					rightBounds.expandBy(aabb);
-					KDAssert(numLeft < split.numLeft);
-					KDAssert(numRight < split.numRight);
-					leftIndices[numLeft++] = primIndex;
-					rightIndices[numRight++] = primIndex;
+			if (chunkCount <= 1) {
+				for (SizeType i=0; i<m_primCount; ++i) {
+					const IndexType primIndex = primIndices[i];
+					const AABBType aabb = derived->getAABB(primIndex);
+					int startIdx = computeIndex(math::castflt_down(aabb.min[axis]), axis);
+					int endIdx   = computeIndex(math::castflt_up  (aabb.max[axis]), axis);
+
+					if (endIdx <= split.leftBin) {
+						KDAssert(numLeft < split.numLeft);
+						leftBounds.expandBy(aabb);
+						leftIndices[numLeft++] = primIndex;
+					} else if (startIdx > split.leftBin) {
+						KDAssert(numRight < split.numRight);
+						rightBounds.expandBy(aabb);
+						rightIndices[numRight++] = primIndex;
+					} else {
+						leftBounds.expandBy(aabb);
+						rightBounds.expandBy(aabb);
+						KDAssert(numLeft < split.numLeft);
+						KDAssert(numRight < split.numRight);
+						leftIndices[numLeft++] = primIndex;
+						rightIndices[numRight++] = primIndex;
+					}
 				}
+			} else {
+				partitionParallel(derived, primIndices, split, leftIndices,
+					rightIndices, leftBounds, rightBounds, numLeft, numRight,
+					chunkCount);
 			}
 			leftBounds.clip(m_aabb);
 			rightBounds.clip(m_aabb);
@@ -2579,6 +2721,108 @@ protected:
 			return Partition(leftBounds, leftIndices,
 				rightBounds, rightIndices);
 		}
+	protected:
+		/// Bin the primitives <tt>indices[start..end-1]</tt> into the given histograms
+		void binRange(const Derived *derived, const IndexType *indices,
+				SizeType start, SizeType end, SizeType *minBins,
+				SizeType *maxBins) const {
+			for (SizeType i=start; i<end; ++i) {
+				const AABBType aabb = derived->getAABB(indices[i]);
+				for (int axis=0; axis<PointType::dim; ++axis) {
+					minBins[axis * m_binCount + computeIndex(math::castflt_down(aabb.min[axis]), axis)]++;
+					maxBins[axis * m_binCount + computeIndex(math::castflt_up  (aabb.max[axis]), axis)]++;
+				}
+			}
+		}
+
+		/**
+		 * \brief Parallel version of the partitioning loop
+		 *
+		 * The first pass classifies the primitives of each chunk and
+		 * computes per-chunk counts and bounds. A prefix sum over the
+		 * counts then determines where each chunk writes its output, and
+		 * a second pass scatters the indices. Since one of the output
+		 * lists may alias \c primIndices, the second pass reads from
+		 * a copy.
+		 */
+		void partitionParallel(const Derived *derived, const IndexType *primIndices,
+				const SplitCandidate &split, IndexType *leftIndices,
+				IndexType *rightIndices, AABBType &leftBounds, AABBType &rightBounds,
+				SizeType &numLeft, SizeType &numRight, int chunkCount) const {
+			enum {
+				ELeft = 1,
+				ERight = 2
+			};
+
+			const int axis = split.axis;
+			std::vector<uint8_t> side(m_primCount);
+			std::vector<IndexType> source(primIndices, primIndices + m_primCount);
+			std::vector<SizeType> leftOffset(chunkCount + 1, 0),
+			                      rightOffset(chunkCount + 1, 0);
+			std::vector<AABBType> chunkLeftBounds(chunkCount),
+			                      chunkRightBounds(chunkCount);
+
+			#if defined(MTS_OPENMP)
+				#pragma omp parallel for schedule(static)
+			#endif
+			for (int chunk=0; chunk<chunkCount; ++chunk) {
+				SizeType start = getChunkStart(m_primCount, chunk, chunkCount),
+				         end   = getChunkStart(m_primCount, chunk+1, chunkCount),
+				         chunkLeft = 0, chunkRight = 0;
+				AABBType &chunkLeftAABB = chunkLeftBounds[chunk],
+				         &chunkRightAABB = chunkRightBounds[chunk];
+
+				for (SizeType i=start; i<end; ++i) {
+					const AABBType aabb = derived->getAABB(source[i]);
+					int startIdx = computeIndex(math::castflt_down(aabb.min[axis]), axis);
+					int endIdx   = computeIndex(math::castflt_up  (aabb.max[axis]), axis);
+
+					uint8_t value = 0;
+					if (startIdx <= split.leftBin) {
+						chunkLeftAABB.expandBy(aabb);
+						value |= ELeft;
+						++chunkLeft;
+					}
+					if (endIdx > split.leftBin) {
+						chunkRightAABB.expandBy(aabb);
+						value |= ERight;
+						++chunkRight;
+					}
+					side[i] = value;
+				}
+				leftOffset[chunk+1] = chunkLeft;
+				rightOffset[chunk+1] = chunkRight;
+			}
+
+			for (int chunk=0; chunk<chunkCount; ++chunk) {
+				leftOffset[chunk+1] += leftOffset[chunk];
+				rightOffset[chunk+1] += rightOffset[chunk];
+				leftBounds.expandBy(chunkLeftBounds[chunk]);
+				rightBounds.expandBy(chunkRightBounds[chunk]);
+			}
+			numLeft = leftOffset[chunkCount];
+			numRight = rightOffset[chunkCount];
+			KDAssert(numLeft == split.numLeft);
+			KDAssert(numRight == split.numRight);
+
+			#if defined(MTS_OPENMP)
+				#pragma omp parallel for schedule(static)
+			#endif
+			for (int chunk=0; chunk<chunkCount; ++chunk) {
+				SizeType start = getChunkStart(m_primCount, chunk, chunkCount),
+				         end   = getChunkStart(m_primCount, chunk+1, chunkCount);
+				IndexType *left = leftIndices + leftOffset[chunk],
+				          *right = rightIndices + rightOffset[chunk];
+
+				for (SizeType i=start; i<end; ++i) {
+					if (side[i] & ELeft)
+						*left++ = source[i];
+					if (side[i] & ERight)
+						*right++ = source[i];
+				}
+			}
+		}
+
 	private:
 		SizeType *m_minBins;
 		SizeType *m_maxBins;
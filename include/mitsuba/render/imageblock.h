@@ -24,6 +24,9 @@
 #include <mitsuba/core/sched.h>
 #include <mitsuba/core/rfilter.h>
 
+/// Side length of the tiles that are guarded by separate locks (see \ref ImageBlock::setConcurrentPut())
+#define MTS_IMAGEBLOCK_TILE_SIZE 32
+
 MTS_NAMESPACE_BEGIN
 
 /**
@@ -99,8 +102,50 @@ public:
 	/// Clear everything to zero
 	inline void clear() { m_bitmap->clear(); }
 
-	/// Accumulate another image block into this one
+	/**
+	 * \brief Set the number of leading channels that are written
+	 * by \ref put(const Point2 &, const Float *)
+	 *
+	 * The remaining channels bypass the reconstruction filter; callers
+	 * can write them directly into the underlying bitmap (e.g. to store
+	 * per-pixel AOVs). By default, all channels are filtered.
+	 */
+	inline void setFilteredChannelCount(int count) { m_filteredChannels = count; }
+
+	/// Return the number of leading channels that are written by \ref put()
+	inline int getFilteredChannelCount() const { return m_filteredChannels; }
+
+	/**
+	 * \brief Enable or disable concurrent accumulation using
+	 * \ref put(const ImageBlock *)
+	 *
+	 * When enabled, the block is split into square tiles of
+	 * \ref MTS_IMAGEBLOCK_TILE_SIZE pixels, which are aligned to the
+	 * start of the interior region, and each tile is protected by its
+	 * own lock. Several threads can then merge blocks at the same time,
+	 * and they only wait for each other when their blocks overlap the
+	 * same tile -- with the default block size, this only happens in
+	 * the border regions of neighboring blocks.
+	 *
+	 * This is meant for large accumulation buffers (e.g. the storage of
+	 * a film) and must not be changed while other threads are using
+	 * the block.
+	 */
+	void setConcurrentPut(bool value);
+
+	/// Can \ref put(const ImageBlock *) be called by several threads at the same time?
+	inline bool getConcurrentPut() const { return !m_tileLocks.empty(); }
+
+	/**
+	 * \brief Accumulate another image block into this one
+	 *
+	 * \sa setConcurrentPut()
+	 */
 	inline void put(const ImageBlock *block) {
+		if (EXPECT_NOT_TAKEN(!m_tileLocks.empty())) {
+			putConcurrent(block);
+			return;
+		}
 		m_bitmap->accumulate(block->getBitmap(),
 			Point2i(block->getOffset() - m_offset
 				- Vector2i(block->getBorderSize() - m_borderSize)));
@@ -137,15 +182,16 @@ public:
 	 *    Denotes the sample position in fractional pixel coordinates
 	 * \param value
 	 *    Pointer to an array containing each channel of the sample values.
-	 *    The array must match the length given by \ref getChannelCount()
+	 *    The array must match the length given by \ref getFilteredChannelCount()
 	 * \return \c false if one of the sample values was \a invalid, e.g.
 	 *    NaN or negative. A warning is also printed in this case
 	 */
 	FINLINE bool put(const Point2 &_pos, const Float *value) {
-		const int channels = m_bitmap->getChannelCount();
+		const int channels = m_bitmap->getChannelCount(),
+		          filtered = m_filteredChannels;
 
 		/* Check if all sample values are valid */
-		for (int i=0; i<channels; ++i) {
+		for (int i=0; i<filtered; ++i) {
 			if (EXPECT_NOT_TAKEN((!std::isfinite(value[i]) || value[i] < 0) && m_warn))
 				goto bad_sample;
 		}
@@ -165,11 +211,19 @@ public:
 			              max(std::min((int) std::floor(pos.x + filterRadius), size.x - 1),
 			                  std::min((int) std::floor(pos.y + filterRadius), size.y - 1));
 
+			if (min.x == max.x && min.y == max.y) {
+				/* Fast path: the footprint consists of a single pixel, which is
+				   almost always the case when rendering with the box filter */
+				const Float weight = m_filter->evalDiscretized(min.x-pos.x)
+					* m_filter->evalDiscretized(min.y-pos.y);
+				splat(m_bitmap->getFloatData() + (min.y * (size_t) size.x + min.x)
+					* channels, weight, value, filtered);
+				return true;
+			}
+
 			/* Lookup values from the pre-rasterized filter */
-			for (int x=min.x, idx = 0; x<=max.x; ++x)
-				m_weightsX[idx++] = m_filter->evalDiscretized(x-pos.x);
-			for (int y=min.y, idx = 0; y<=max.y; ++y)
-				m_weightsY[idx++] = m_filter->evalDiscretized(y-pos.y);
+			m_filter->evalDiscretizedRange(min.x, pos.x, max.x - min.x + 1, m_weightsX);
+			m_filter->evalDiscretizedRange(min.y, pos.y, max.y - min.y + 1, m_weightsY);
 
 			/* Rasterize the filtered sample into the framebuffer */
 			for (int y=min.y, yr=0; y<=max.y; ++y, ++yr) {
@@ -178,10 +232,8 @@ public:
 					+ (y * (size_t) size.x + min.x) * channels;
 
 				for (int x=min.x, xr=0; x<=max.x; ++x, ++xr) {
-					const Float weight = m_weightsX[xr] * weightY;
-
-					for (int k=0; k<channels; ++k)
-						*dest++ += weight * value[k];
+					splat(dest, m_weightsX[xr] * weightY, value, filtered);
+					dest += channels;
 				}
 			}
 		}
@@ -192,9 +244,9 @@ public:
 		{
 			std::ostringstream oss;
 			oss << "Invalid sample value : [";
-			for (int i=0; i<channels; ++i) {
+			for (int i=0; i<filtered; ++i) {
 				oss << value[i];
-				if (i+1 < channels)
+				if (i+1 < filtered)
 					oss << ", ";
 			}
 			oss << "]";
@@ -217,6 +269,7 @@ public:
 		copy->m_size = m_size;
 		copy->m_offset = m_offset;
 		copy->m_warn = m_warn;
+		copy->m_filteredChannels = m_filteredChannels;
 	}
 
 	// ======================================================================
@@ -225,6 +278,19 @@ public:
 
 	void load(Stream *stream);
 	void save(Stream *stream) const;
+
+	/**
+	 * \brief Serialize the block using half precision values
+	 *
+	 * Since the block stores unnormalized sums of weighted samples, which
+	 * can exceed the range of half precision numbers (+/- 65504), every
+	 * channel is first divided by a power of two that maps its largest
+	 * magnitude below 2^15. The values of each channel are then
+	 * delta-encoded along the block and written as separate high and low
+	 * byte planes, which makes the result compress well.
+	 */
+	void saveCompact(Stream *stream) const;
+	void loadCompact(Stream *stream);
 	std::string toString() const;
 
 	//! @}
@@ -232,6 +298,27 @@ public:
 
 	MTS_DECLARE_CLASS()
 protected:
+	/**
+	 * \brief Accumulate a weighted sample into a pixel
+	 *
+	 * Uses the same operations as the scalar code, i.e. the
+	 * result does not depend on the availability of SSE
+	 */
+	static FINLINE void splat(Float *dest, Float weight, const Float *value, int channels) {
+		int k = 0;
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+		const __m128 weight4 = _mm_set1_ps(weight);
+		for (; k+4 <= channels; k += 4)
+			_mm_storeu_ps(dest + k, _mm_add_ps(_mm_loadu_ps(dest + k),
+				_mm_mul_ps(weight4, _mm_loadu_ps(value + k))));
+#endif
+		for (; k<channels; ++k)
+			dest[k] += weight * value[k];
+	}
+
+	/// Accumulate another image block while holding the locks of the affected tiles
+	void putConcurrent(const ImageBlock *block);
+
 	/// Virtual destructor
 	virtual ~ImageBlock();
 protected:
@@ -239,9 +326,12 @@ protected:
 	Point2i m_offset;
 	Vector2i m_size;
 	int m_borderSize;
+	int m_filteredChannels;
 	const ReconstructionFilter *m_filter;
 	Float *m_weightsX, *m_weightsY;
 	bool m_warn;
+	ref_vector<Mutex> m_tileLocks;
+	int m_tilesX;
 };
 
 
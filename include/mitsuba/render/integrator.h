@@ -362,6 +362,21 @@ public:
 	bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
 		int sceneResID, int sensorResID, int samplerResID);
 
+	/**
+	 * \brief Render several views of the scene at once
+	 *
+	 * Every view is rendered by its own sensor, while the scene and its
+	 * acceleration data structures are shared. All views are scheduled
+	 * as a single \ref MultiViewRenderProcess. Films are neither cleared
+	 * nor developed by this method.
+	 *
+	 * \param sensorResIDs
+	 *     Resource IDs of the sensors of the views, whose films
+	 *     must have the same crop size
+	 */
+	bool renderViews(Scene *scene, RenderQueue *queue, const RenderJob *job,
+		int sceneResID, const std::vector<int> &sensorResIDs, int samplerResID);
+
 	/**
 	 * This can be called asynchronously to cancel a running render job.
 	 * In this case, <tt>render()</tt> will quit with a return value of
@@ -0,0 +1,366 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_OBJLEXER_H_)
+#define __MITSUBA_RENDER_OBJLEXER_H_
+
+#include <mitsuba/core/mmap.h>
+#include <cstring>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Allocation-free lexer for Wavefront OBJ and MTL files
+ *
+ * The file is memory-mapped, and keywords, numbers and face
+ * vertex references are parsed directly from the mapped bytes.
+ * Lines ending with a backslash are joined with the following
+ * line, as required by the OBJ specification.
+ *
+ * Typical usage:
+ * \code
+ * ref<OBJLexer> lexer = new OBJLexer(path);
+ * while (lexer->nextLine()) {
+ *     OBJLexer::Token keyword = lexer->readToken();
+ *     if (keyword == "v") {
+ *         Point p;
+ *         lexer->readFloat(p.x); lexer->readFloat(p.y); lexer->readFloat(p.z);
+ *     } ...
+ * }
+ * \endcode
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER OBJLexer : public Object {
+public:
+	/// Non-owning reference to a range of characters within the file
+	struct Token {
+		const char *data;
+		size_t length;
+
+		inline Token() : data(NULL), length(0) { }
+		inline Token(const char *data, size_t length)
+			: data(data), length(length) { }
+
+		/// Is this the empty token (i.e. the end of the line was reached)?
+		inline bool empty() const { return length == 0; }
+
+		/// Compare against a null-terminated string
+		inline bool operator==(const char *str) const {
+			size_t i = 0;
+			for (; i<length; ++i) {
+				if (str[i] != data[i])
+					return false;
+			}
+			return str[i] == '\0';
+		}
+
+		inline bool operator!=(const char *str) const {
+			return !operator==(str);
+		}
+
+		/// Return a copy of the token as a string
+		inline std::string str() const { return std::string(data, length); }
+	};
+
+	/// Map the specified OBJ or MTL file into memory
+	OBJLexer(const fs::path &filename);
+
+	/**
+	 * \brief Lex a range of characters that is owned by the caller
+	 *
+	 * The range must remain valid for the lifetime of the lexer
+	 */
+	OBJLexer(const char *start, const char *end);
+
+	/// Return the first character of the input
+	inline const char *getStart() const { return m_start; }
+
+	/// Return one past the last character of the input
+	inline const char *getEnd() const { return m_end; }
+
+	/// Return the current read position
+	inline const char *getPosition() const { return m_pos; }
+
+	/**
+	 * \brief Advance to the next non-empty line
+	 *
+	 * Any unread content of the current line is skipped.
+	 * \return \c false when the end of the input was reached
+	 */
+	inline bool nextLine() {
+		if (m_started) {
+			while (m_pos < m_end) {
+				if (*m_pos == '\n') {
+					++m_pos;
+					break;
+				}
+				size_t skip = continuation(m_pos);
+				m_pos += skip > 0 ? skip : 1;
+			}
+		}
+		m_started = true;
+
+		while (true) {
+			skipSpace();
+			if (m_pos >= m_end)
+				return false;
+			if (*m_pos != '\n')
+				return true;
+			++m_pos;
+		}
+	}
+
+	/// Is the current line exhausted?
+	inline bool atLineEnd() {
+		skipSpace();
+		return m_pos >= m_end || *m_pos == '\n';
+	}
+
+	/**
+	 * \brief Read the next whitespace-delimited token on the current line
+	 *
+	 * Returns an empty token when the end of the line was reached
+	 */
+	inline Token readToken() {
+		skipSpace();
+		const char *start = m_pos;
+		while (m_pos < m_end && !isSpace(*m_pos) && *m_pos != '\n'
+				&& continuation(m_pos) == 0)
+			++m_pos;
+		return Token(start, m_pos - start);
+	}
+
+	/**
+	 * \brief Return the remainder of the current line with leading
+	 * and trailing whitespace removed (e.g. a material name)
+	 */
+	std::string readRest();
+
+	/**
+	 * \brief Parse a floating point value
+	 *
+	 * Values whose digits fit into 53 bits (i.e. up to at least 15
+	 * significant digits) and whose decimal exponent is at most 22 are
+	 * converted with a single rounding step, since both factors are
+	 * exact in double precision. All other values are handed to
+	 * \c strtod, hence the result always matches the slow path.
+	 *
+	 * \return \c false if no value could be parsed, in which case
+	 * \c value is set to zero
+	 */
+	inline bool readFloat(Float &value) {
+		skipSpace();
+		const char *ptr = m_pos;
+		bool negative = false;
+		if (ptr < m_end && (*ptr == '-' || *ptr == '+'))
+			negative = *ptr++ == '-';
+
+		/* Accumulate up to 18 significant digits into an integer mantissa */
+		const uint64_t mantissaLimit = 100000000000000000ULL;
+		uint64_t mantissa = 0;
+		int exponent = 0;
+		bool hasDigits = false;
+
+		for (; ptr < m_end && isDigit(*ptr); ++ptr) {
+			if (mantissa < mantissaLimit)
+				mantissa = mantissa * 10 + (uint64_t) (*ptr - '0');
+			else
+				++exponent;
+			hasDigits = true;
+		}
+
+		if (ptr < m_end && *ptr == '.') {
+			for (++ptr; ptr < m_end && isDigit(*ptr); ++ptr) {
+				if (mantissa < mantissaLimit) {
+					mantissa = mantissa * 10 + (uint64_t) (*ptr - '0');
+					--exponent;
+				}
+				hasDigits = true;
+			}
+		}
+
+		if (hasDigits && ptr < m_end && (*ptr == 'e' || *ptr == 'E')) {
+			const char *expPtr = ptr + 1;
+			bool expNegative = false;
+			if (expPtr < m_end && (*expPtr == '-' || *expPtr == '+'))
+				expNegative = *expPtr++ == '-';
+			if (expPtr < m_end && isDigit(*expPtr)) {
+				int expValue = 0;
+				for (; expPtr < m_end && isDigit(*expPtr); ++expPtr) {
+					if (expValue < 10000)
+						expValue = expValue * 10 + (*expPtr - '0');
+				}
+				exponent += expNegative ? -expValue : expValue;
+				ptr = expPtr;
+			}
+		}
+
+		/* Anything unusual (nan, inf, trailing garbage) takes the slow path.
+		   So do values that can't be converted with a single rounding step */
+		if (!hasDigits || (ptr < m_end && !isSpace(*ptr) && *ptr != '\n')
+				|| mantissa > (1ULL << 53) || exponent < -22 || exponent > 22)
+			return readFloatSlow(value);
+
+		double result = (double) mantissa;
+		if (exponent < 0)
+			result /= pow10(-exponent);
+		else if (exponent > 0)
+			result *= pow10(exponent);
+
+		value = (Float) (negative ? -result : result);
+		m_pos = ptr;
+		return true;
+	}
+
+	/**
+	 * \brief Parse a (possibly negative) integer
+	 *
+	 * \return \c false if no value could be parsed, in which case
+	 * \c value is set to zero
+	 */
+	inline bool readInt(int &value) {
+		skipSpace();
+		if (!parseInt(value)) {
+			value = 0;
+			readToken();
+			return false;
+		}
+		if (m_pos < m_end && !isSpace(*m_pos) && *m_pos != '\n') {
+			readToken();
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * \brief Parse a face vertex reference of the form \c p, \c p/uv,
+	 * \c p//n or \c p/uv/n.
+	 *
+	 * Only the indices that are present are written, the others are
+	 * left unchanged.
+	 *
+	 * \return \c false when the end of the line was reached
+	 */
+	inline bool readFaceVertex(int &p, int &uv, int &n) {
+		if (atLineEnd())
+			return false;
+
+		parseInt(p);
+		if (m_pos < m_end && *m_pos == '/') {
+			++m_pos;
+			if (m_pos < m_end && *m_pos == '/') {
+				++m_pos;
+				parseInt(n);
+			} else {
+				parseInt(uv);
+				if (m_pos < m_end && *m_pos == '/') {
+					++m_pos;
+					parseInt(n);
+				}
+			}
+		}
+
+		if (m_pos < m_end && !isSpace(*m_pos) && *m_pos != '\n'
+				&& continuation(m_pos) == 0)
+			Log(EError, "Invalid OBJ face format!");
+
+		return true;
+	}
+
+	/// Return a string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~OBJLexer() { }
+
+	static inline bool isSpace(char c) {
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+
+	static inline bool isDigit(char c) {
+		return c >= '0' && c <= '9';
+	}
+
+	/**
+	 * \brief If \c ptr points to a backslash that only has whitespace
+	 * before the end of the line, return the number of characters up
+	 * to and including the newline. Otherwise, return zero.
+	 */
+	inline size_t continuation(const char *ptr) const {
+		if (*ptr != '\\')
+			return 0;
+		const char *it = ptr + 1;
+		while (it < m_end && isSpace(*it))
+			++it;
+		if (it < m_end && *it == '\n')
+			return (size_t) (it - ptr) + 1;
+		return 0;
+	}
+
+	/// Skip whitespace and line continuations
+	inline void skipSpace() {
+		while (m_pos < m_end) {
+			if (isSpace(*m_pos)) {
+				++m_pos;
+			} else {
+				size_t skip = continuation(m_pos);
+				if (skip == 0)
+					break;
+				m_pos += skip;
+			}
+		}
+	}
+
+	/// Parse an integer at the current position, if there is one
+	inline bool parseInt(int &value) {
+		const char *ptr = m_pos;
+		bool negative = false;
+		if (ptr < m_end && (*ptr == '-' || *ptr == '+'))
+			negative = *ptr++ == '-';
+		if (ptr >= m_end || !isDigit(*ptr))
+			return false;
+		int result = 0;
+		for (; ptr < m_end && isDigit(*ptr); ++ptr)
+			result = result * 10 + (*ptr - '0');
+		value = negative ? -result : result;
+		m_pos = ptr;
+		return true;
+	}
+
+	/// Return 10^exponent for a non-negative exponent
+	static inline double pow10(int exponent) {
+		return exponent < (int) (sizeof(m_pow10) / sizeof(double))
+			? m_pow10[exponent] : std::pow(10.0, (double) exponent);
+	}
+
+	/// Fallback float parser based on \c strtod
+	bool readFloatSlow(Float &value);
+private:
+	ref<MemoryMappedFile> m_file;
+	const char *m_start, *m_end, *m_pos;
+	bool m_started;
+	static const double m_pow10[23];
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_OBJLEXER_H_ */
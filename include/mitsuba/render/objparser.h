@@ -0,0 +1,130 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_OBJPARSER_H_)
+#define __MITSUBA_RENDER_OBJPARSER_H_
+
+#include <mitsuba/render/objlexer.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Parallel parser for the geometry of Wavefront OBJ files
+ *
+ * The memory-mapped file is split into chunks at line boundaries, which
+ * are parsed concurrently. A subsequent serial merge pass concatenates
+ * the chunks in file order and converts relative (negative) indices
+ * into absolute ones, so that the result does not depend on the number
+ * of chunks or threads.
+ *
+ * Polygons are triangulated as fans, assuming a convex shape. All other
+ * statements (\c usemtl, \c g, \c mtllib, etc.) are recorded in file
+ * order, along with the number of faces that precede them, so that
+ * loaders can replay them against the face list.
+ *
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER OBJParser : public Object {
+public:
+	/**
+	 * \brief Triangle referencing vertex attributes
+	 *
+	 * Indices are absolute and 1-based, and zero denotes
+	 * an attribute that was not specified.
+	 */
+	struct Face {
+		int p[3];
+		int uv[3];
+		int n[3];
+
+		inline Face() {
+			memset(this, 0, sizeof(Face));
+		}
+	};
+
+	/// Non-geometric statement (e.g. \c usemtl or \c g)
+	struct Statement {
+		/// Keyword that started the line
+		std::string keyword;
+		/// Remainder of the line with surrounding whitespace removed
+		std::string value;
+		/// Number of faces that precede this statement in the file
+		size_t faceIndex;
+	};
+
+	/**
+	 * \brief Parse the specified OBJ file
+	 *
+	 * \param filename
+	 *    Path to the OBJ file
+	 * \param minChunkSize
+	 *    Files are split into at most one chunk per this many
+	 *    bytes. Smaller files are parsed on the calling thread.
+	 */
+	OBJParser(const fs::path &filename, size_t minChunkSize = 1024*1024);
+
+	/// Return the vertex positions
+	inline const std::vector<Point> &getPositions() const { return m_positions; }
+
+	/// Return the vertex normals
+	inline const std::vector<Normal> &getNormals() const { return m_normals; }
+
+	/// Return the texture coordinates (non-const version)
+	inline std::vector<Point2> &getTexcoords() { return m_texcoords; }
+
+	/// Return the texture coordinates
+	inline const std::vector<Point2> &getTexcoords() const { return m_texcoords; }
+
+	/// Return the triangulated faces
+	inline const std::vector<Face> &getFaces() const { return m_faces; }
+
+	/// Return the non-geometric statements in file order
+	inline const std::vector<Statement> &getStatements() const { return m_statements; }
+
+	/// Return the number of chunks that were parsed in parallel
+	inline size_t getChunkCount() const { return m_chunkCount; }
+
+	/// Return a string representation
+	std::string toString() const;
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~OBJParser() { }
+private:
+	struct Chunk;
+
+	/// Parse the lines of a single chunk
+	static void parseChunk(OBJLexer *lexer, Chunk &chunk);
+
+	/// Append a chunk to the parsed data and resolve its relative indices
+	void merge(Chunk &chunk);
+private:
+	fs::path m_filename;
+	std::vector<Point> m_positions;
+	std::vector<Normal> m_normals;
+	std::vector<Point2> m_texcoords;
+	std::vector<Face> m_faces;
+	std::vector<Statement> m_statements;
+	size_t m_chunkCount;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_OBJPARSER_H_ */
@@ -74,8 +74,43 @@ public:
 		bool threadIsCritical = true,
 		bool interactive = false);
 
-	/// Write out the current (partially rendered) image
-	inline void flush() { m_scene->flush(m_queue, this); }
+	/**
+	 * \brief Render several views of the scene instead of the view
+	 * of its sensor
+	 *
+	 * For every view, a copy of the scene's sensor (and film) is created
+	 * that only differs in the camera-to-world transformation. All views
+	 * are rendered by a single parallel process, which shares the scene
+	 * and its kd-tree. View \c i is written to the destination file of the
+	 * scene with the suffix <tt>_i</tt> (zero-padded to three digits).
+	 *
+	 * This requires a sampling-based integrator and must be called
+	 * before the job is started.
+	 */
+	void setViews(const std::vector<Transform> &cameraToWorld);
+
+	/// Return the number of views set by \ref setViews() (or zero)
+	inline size_t getViewCount() const { return m_viewSensors.size(); }
+
+	/**
+	 * \brief Load a list of camera poses for \ref setViews()
+	 *
+	 * Every line specifies one camera-to-world transformation, either as
+	 * <tt>lookat ox oy oz tx ty tz ux uy uz</tt> (origin, target, and up
+	 * vector, as in the scene description format) or as
+	 * <tt>matrix m00 m01 ... m33</tt> (16 entries in row-major order).
+	 * Empty lines and lines starting with '#' are ignored.
+	 */
+	static std::vector<Transform> loadViews(const fs::path &filename);
+
+	/// Return the destination file of view \c index (see \ref setViews())
+	static fs::path getViewDestinationFile(const fs::path &destFile, size_t index);
+
+	/// Check whether the output of all \c viewCount views of a scene exists
+	static bool viewDestinationsExist(const Scene *scene, size_t viewCount);
+
+	/// Write out the current (partially rendered) image(s)
+	void flush();
 
 	/// Cancel a running render job
 	inline void cancel() { m_scene->cancel(); }
@@ -116,6 +151,8 @@ protected:
 	virtual ~RenderJob();
 	/// Run method
 	void run();
+	/// Render the views set by \ref setViews()
+	bool renderViews();
 private:
 	ref<Scene> m_scene;
 	ref<RenderQueue> m_queue;
@@ -125,6 +162,8 @@ private:
 	bool m_ownsSamplerResource;
 	bool m_cancelled;
 	bool m_interactive;
+	ref_vector<Sensor> m_viewSensors;
+	std::vector<int> m_viewSensorResIDs;
 };
 
 MTS_NAMESPACE_END
@@ -92,6 +92,58 @@ protected:
 	bool m_warnInvalid;
 };
 
+/**
+ * \brief Parallel process for rendering several views of the same scene.
+ *
+ * Each view is rendered by a separate sensor, while the scene and its
+ * acceleration data structures are shared. The images of all views are
+ * split into rectangular blocks that are scheduled as the work units of
+ * a single process, hence workers do not idle at the end of each view.
+ *
+ * The sensors must be bound to the process as the resources \c sensor0,
+ * \c sensor1, etc., and their films must have the same crop size.
+ *
+ * \sa SamplingIntegrator::renderViews()
+ * \ingroup librender
+ */
+class MTS_EXPORT_RENDER MultiViewRenderProcess : public ParallelProcess {
+public:
+	MultiViewRenderProcess(const RenderJob *parent, RenderQueue *queue,
+		int blockSize, const std::vector<Sensor *> &sensors);
+
+	/// Return the number of views
+	inline size_t getViewCount() const { return m_films.size(); }
+
+	// ======================================================================
+	//! @{ \name Implementation of the ParallelProcess interface
+	// ======================================================================
+
+	ref<WorkProcessor> createWorkProcessor() const;
+	void processResult(const WorkResult *result, bool cancelled);
+	EStatus generateWork(WorkUnit *unit, int worker);
+
+	//! @}
+	// ======================================================================
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~MultiViewRenderProcess();
+protected:
+	ref<RenderQueue> m_queue;
+	const RenderJob *m_parent;
+	ref_vector<Film> m_films;
+	Point2i m_offset;
+	Vector2i m_size, m_blockCount;
+	int m_blockSize;
+	int m_borderSize;
+	size_t m_blocksPerView;
+	size_t m_blockIndex;
+	int m_resultCount;
+	ref<Mutex> m_resultMutex;
+	ProgressReporter *m_progress;
+};
+
 MTS_NAMESPACE_END
 
 #endif /* __MITSUBA_RENDER_RENDERPROC_H_ */
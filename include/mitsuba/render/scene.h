@@ -24,7 +24,7 @@
 #include <mitsuba/core/pmf.h>
 #include <mitsuba/core/aabb.h>
 #include <mitsuba/render/trimesh.h>
-#include <mitsuba/render/skdtree.h>
+#include <mitsuba/render/accel.h>
 #include <mitsuba/render/sensor.h>
 #include <mitsuba/render/integrator.h>
 #include <mitsuba/render/bsdf.h>
@@ -185,7 +185,9 @@ public:
 	 * \return \c true if an intersection was found
 	 */
 	inline bool rayIntersect(const Ray &ray, Intersection &its) const {
-		return m_kdtree->rayIntersect(ray, its);
+		if (EXPECT_TAKEN(m_kdtree != NULL))
+			return m_kdtree->rayIntersect(ray, its);
+		return m_accel->rayIntersect(ray, its);
 	}
 
 	/**
@@ -219,7 +221,9 @@ public:
 	 */
 	inline bool rayIntersect(const Ray &ray, Float &t,
 			ConstShapePtr &shape, Normal &n, Point2 &uv) const {
-		return m_kdtree->rayIntersect(ray, t, shape, n, uv);
+		if (EXPECT_TAKEN(m_kdtree != NULL))
+			return m_kdtree->rayIntersect(ray, t, shape, n, uv);
+		return m_accel->rayIntersect(ray, t, shape, n, uv);
 	}
 
 	/**
@@ -239,7 +243,9 @@ public:
 	 * \return \c true if an intersection was found
 	 */
 	inline bool rayIntersect(const Ray &ray) const {
-		return m_kdtree->rayIntersect(ray);
+		if (EXPECT_TAKEN(m_kdtree != NULL))
+			return m_kdtree->rayIntersect(ray);
+		return m_accel->rayIntersect(ray);
 	}
 
 	/**
@@ -1066,11 +1072,29 @@ public:
 	/// Return the scene's film
 	inline const Film *getFilm() const { return m_sensor->getFilm(); }
 
-	/// Return the scene's kd-tree accelerator
+	/**
+	 * \brief Return the scene's kd-tree accelerator
+	 *
+	 * Returns \c NULL when the scene uses a different acceleration
+	 * data structure (see \ref getAccelerator()).
+	 */
 	inline ShapeKDTree *getKDTree() { return m_kdtree; }
-	/// Return the scene's kd-tree accelerator
+	/// Return the scene's kd-tree accelerator (or \c NULL, see above)
 	inline const ShapeKDTree *getKDTree() const { return m_kdtree.get(); }
 
+	/// Return the scene's acceleration data structure
+	inline Accelerator *getAccelerator() { return m_accel; }
+	/// Return the scene's acceleration data structure
+	inline const Accelerator *getAccelerator() const { return m_accel.get(); }
+
+	/**
+	 * \brief Replace the scene's acceleration data structure
+	 *
+	 * This must happen before \ref initialize() is called, and the
+	 * new data structure should not contain any shapes yet.
+	 */
+	void setAccelerator(Accelerator *accel);
+
 	/// Return the a list of all subsurface integrators
 	inline ref_vector<Subsurface> &getSubsurfaceIntegrators() { return m_ssIntegrators; }
 	/// Return the a list of all subsurface integrators
@@ -1144,6 +1168,7 @@ protected:
 	void addShape(Shape *shape);
 	/// \endcond
 private:
+	ref<Accelerator> m_accel;
 	ref<ShapeKDTree> m_kdtree;
 	ref<Sensor> m_sensor;
 	ref<Integrator> m_integrator;
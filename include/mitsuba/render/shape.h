@@ -466,6 +466,32 @@ public:
 	/// Set the BSDF of this shape
 	inline void setBSDF(BSDF *bsdf) { m_bsdf = bsdf; }
 
+	/**
+	 * \brief Return the identifier of the object that this shape belongs to
+	 *
+	 * Object IDs are positive and can be specified using the \c objectId
+	 * parameter. Otherwise, \ref Scene::initialize() numbers the shapes of
+	 * the scene description consecutively, starting above the largest
+	 * explicit ID (or at 1 if there is none); all parts of a compound
+	 * shape (e.g. the meshes of an OBJ file) share one ID.
+	 * A value of 0 means that no ID has been assigned yet.
+	 */
+	inline int getObjectID() const { return m_objectID; }
+	/// Set the identifier of the object that this shape belongs to
+	inline void setObjectID(int id) { m_objectID = id; }
+
+	/**
+	 * \brief Return the identifier of the part of an object that
+	 * this shape represents
+	 *
+	 * Part IDs are assigned by loaders of compound shapes (e.g. the
+	 * material groups of a ShapeNet model) or using the \c partId
+	 * parameter. A value of 0 means that the shape is not a part.
+	 */
+	inline int getPartID() const { return m_partID; }
+	/// Set the identifier of the part of an object that this shape represents
+	inline void setPartID(int id) { m_partID = id; }
+
 	/**
 	 * \brief Return the number of primitives (triangles, hairs, ..)
 	 * contributed to the scene by this shape
@@ -525,6 +551,7 @@ protected:
 	ref<Sensor> m_sensor;
 	ref<Medium> m_interiorMedium;
 	ref<Medium> m_exteriorMedium;
+	int m_objectID, m_partID;
 };
 
 MTS_NAMESPACE_END
@@ -23,6 +23,7 @@
 #include <mitsuba/render/shape.h>
 #include <mitsuba/render/sahkdtree3.h>
 #include <mitsuba/render/triaccel.h>
+#include <mitsuba/core/mmap.h>
 
 #if defined(MTS_KD_CONSERVE_MEMORY)
 #if defined(MTS_HAS_COHERENT_RT)
@@ -100,6 +101,24 @@ public:
 	/// Build the kd-tree (needs to be called before tracing any rays)
 	void build();
 
+	/**
+	 * \brief Set a directory, in which built kd-trees are cached
+	 *
+	 * When set, \ref build() computes a content hash of the mesh buffers
+	 * and the construction parameters and looks for a tree with the same
+	 * hash in this directory. If one is found, its node array, index list
+	 * and triangle data are memory-mapped instead of rebuilding the tree.
+	 * Otherwise, the tree is built as usual and then written to the cache.
+	 * An empty path (the default) disables the cache.
+	 */
+	inline void setCacheDirectory(const fs::path &path) { m_cacheDirectory = path; }
+
+	/// Return the kd-tree cache directory (or an empty path)
+	inline const fs::path &getCacheDirectory() const { return m_cacheDirectory; }
+
+	/// Was the kd-tree loaded from the cache?
+	inline bool isCached() const { return m_cacheFile != NULL; }
+
 	//! @}
 	// =============================================================
 
@@ -185,10 +204,83 @@ public:
 
 	/**
 	 * \brief Fallback for incoherent rays
+	 *
+	 * The rays are traversed one after the other, and detailed
+	 * intersection records can afterwards be created using
+	 * \ref fillPacketIntersectionRecord(). The \c temp parameter must
+	 * provide <tt>4*MTS_KD_INTERSECTION_TEMP</tt> bytes of storage.
+	 *
 	 * \sa rayIntesectPacket
 	 */
 	void rayIntersectPacketIncoherent(const RayPacket4 &packet,
 		const RayInterval4 &interval, Intersection4 &its, void *temp) const;
+
+	/**
+	 * \brief Fill a detailed intersection record for one of the rays of a
+	 * packet that was traced using \ref rayIntersectPacketIncoherent()
+	 *
+	 * \param ray
+	 *    The ray with the given index of the packet
+	 *
+	 * \param its4
+	 *    The intersection information of the packet query
+	 *
+	 * \param index
+	 *    Index of the ray within the packet
+	 *
+	 * \param temp
+	 *    The temporary storage that was passed to the packet query
+	 *
+	 * \param its
+	 *    A detailed intersection record, which will be filled
+	 *
+	 * \return \c true if the ray intersected a primitive
+	 */
+	bool fillPacketIntersectionRecord(const Ray &ray, const Intersection4 &its4,
+		int index, const void *temp, Intersection &its) const;
+
+	/**
+	 * \brief Intersect eight rays with the stored triangle meshes while
+	 * making use of ray coherence. Requires AVX2.
+	 *
+	 * This function may only be called when \ref getMaxPacketSize()
+	 * returns a value of at least 8. The direction signs of all rays must
+	 * agree (see \ref TRayPacket::load()), and \c temp must provide
+	 * <tt>8*MTS_KD_INTERSECTION_TEMP</tt> bytes of storage.
+	 */
+	void rayIntersectPacket(const RayPacket8 &packet,
+		const RayInterval8 &interval, Intersection8 &its, void *temp) const;
+
+	/**
+	 * \brief Intersect sixteen rays with the stored triangle meshes while
+	 * making use of ray coherence. Requires AVX-512.
+	 *
+	 * This function may only be called when \ref getMaxPacketSize()
+	 * returns 16. The direction signs of all rays must agree, and
+	 * \c temp must provide <tt>16*MTS_KD_INTERSECTION_TEMP</tt> bytes
+	 * of storage.
+	 */
+	void rayIntersectPacket(const RayPacket16 &packet,
+		const RayInterval16 &interval, Intersection16 &its, void *temp) const;
+
+	/// Fill a detailed intersection record for one of the rays of an 8-wide packet
+	bool fillPacketIntersectionRecord(const Ray &ray, const Intersection8 &its8,
+		int index, const void *temp, Intersection &its) const;
+
+	/// Fill a detailed intersection record for one of the rays of a 16-wide packet
+	bool fillPacketIntersectionRecord(const Ray &ray, const Intersection16 &its16,
+		int index, const void *temp, Intersection &its) const;
+
+	/**
+	 * \brief Return the widest ray packet that can be traced on this machine
+	 *
+	 * This takes both the instruction sets supported by the processor
+	 * (see \ref getSIMDWidth()) and the kernels that were compiled into
+	 * Mitsuba into account.
+	 *
+	 * \return 4 (SSE), 8 (AVX2) or 16 (AVX-512)
+	 */
+	static int getMaxPacketSize();
 #endif
 	//! @}
 	// =============================================================
@@ -345,79 +437,8 @@ protected:
 		const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
 		const Shape *shape = m_shapes[cache->shapeIndex];
 		if (m_triangleFlag[cache->shapeIndex]) {
-			const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
-			const Triangle &tri = trimesh->getTriangles()[cache->primIndex];
-			const Point *vertexPositions = trimesh->getVertexPositions();
-			const Normal *vertexNormals = trimesh->getVertexNormals();
-			const Point2 *vertexTexcoords = trimesh->getVertexTexcoords();
-			const Color3 *vertexColors = trimesh->getVertexColors();
-			const TangentSpace *vertexTangents = trimesh->getUVTangents();
-			const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
-
-			const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
-			const Point &p0 = vertexPositions[idx0];
-			const Point &p1 = vertexPositions[idx1];
-			const Point &p2 = vertexPositions[idx2];
-
-			if (BarycentricPos)
-				its.p = p0 * b.x + p1 * b.y + p2 * b.z;
-			else
-				its.p = ray(its.t);
-
-			Vector side1(p1-p0), side2(p2-p0);
-			Normal faceNormal(cross(side1, side2));
-			Float length = faceNormal.length();
-			if (!faceNormal.isZero())
-				faceNormal /= length;
-
-			if (EXPECT_NOT_TAKEN(vertexTangents)) {
-				const TangentSpace &ts = vertexTangents[cache->primIndex];
-				its.dpdu = ts.dpdu;
-				its.dpdv = ts.dpdv;
-			} else {
-				its.dpdu = side1;
-				its.dpdv = side2;
-			}
-
-			if (EXPECT_TAKEN(vertexNormals)) {
-				const Normal
-					&n0 = vertexNormals[idx0],
-					&n1 = vertexNormals[idx1],
-					&n2 = vertexNormals[idx2];
-
-				its.shFrame.n = normalize(n0 * b.x + n1 * b.y + n2 * b.z);
-
-				/* Ensure that the geometric & shading normals face the same direction */
-				if (dot(faceNormal, its.shFrame.n) < 0)
-					faceNormal = -faceNormal;
-			} else {
-				its.shFrame.n = faceNormal;
-			}
-			its.geoFrame = Frame(faceNormal);
-
-			if (EXPECT_TAKEN(vertexTexcoords)) {
-				const Point2 &t0 = vertexTexcoords[idx0];
-				const Point2 &t1 = vertexTexcoords[idx1];
-				const Point2 &t2 = vertexTexcoords[idx2];
-				its.uv = t0 * b.x + t1 * b.y + t2 * b.z;
-			} else {
-				its.uv = Point2(b.y, b.z);
-			}
-
-			if (EXPECT_NOT_TAKEN(vertexColors)) {
-				const Color3 &c0 = vertexColors[idx0],
-							 &c1 = vertexColors[idx1],
-							 &c2 = vertexColors[idx2];
-				Color3 result(c0 * b.x + c1 * b.y + c2 * b.z);
-				its.color.fromLinearRGB(result[0], result[1],
-					result[2], Spectrum::EReflectance);
-			}
-
-			its.shape = trimesh;
-			its.hasUVPartials = false;
-			its.primIndex = cache->primIndex;
-			its.instance = NULL;
-			its.time = ray.time;
+			static_cast<const TriMesh *>(shape)->fillTriangleIntersectionRecord
+				<BarycentricPos>(ray, cache->primIndex, cache->u, cache->v, its);
 		} else {
 			shape->fillIntersectionRecord(ray,
 				reinterpret_cast<const uint8_t*>(temp) + 2*sizeof(IndexType), its);
@@ -457,8 +478,27 @@ protected:
 		return false;
 	}
 
+#if defined(MTS_HAS_COHERENT_RT)
+	/// N-wide coherent packet traversal (see \c skdtree_wide.h)
+	template <int N> void rayIntersectPacketWide(const TRayPacket<N> &packet,
+		const TRayInterval<N> &interval, TPacketIntersection<N> &its, void *temp) const;
+
+	/// Fill a detailed intersection record given the hit information of a packet query
+	bool fillPacketIntersectionRecord(const Ray &ray, Float t, Float u, Float v,
+		uint32_t primIndex, uint32_t shapeIndex, const void *temp, Intersection &its) const;
+#endif
+
 	/// Virtual destructor
 	virtual ~ShapeKDTree();
+
+	/// Hash the geometry and construction parameters to identify cached trees
+	uint64_t computeCacheHash() const;
+
+	/// Try to map a cached tree, returns \c false if there is no valid entry
+	bool loadCache(uint64_t hash);
+
+	/// Write the tree to the cache directory
+	void saveCache(uint64_t hash) const;
 private:
 	std::vector<const Shape *> m_shapes;
 	std::vector<bool> m_triangleFlag;
@@ -466,6 +506,8 @@ private:
 #if !defined(MTS_KD_CONSERVE_MEMORY)
 	TriAccel *m_triAccel;
 #endif
+	fs::path m_cacheDirectory;
+	ref<MemoryMappedFile> m_cacheFile;
 };
 
 MTS_NAMESPACE_END
@@ -0,0 +1,244 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_TRIACCEL_WIDE_H_)
+#define __MITSUBA_RENDER_TRIACCEL_WIDE_H_
+
+#include <mitsuba/render/triaccel.h>
+#include <mitsuba/core/ray_sse.h>
+#include <immintrin.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Thin wrapper around the N-wide single precision SIMD
+ * instructions that are used by the wide ray packet kernels
+ *
+ * Specializations exist for AVX2 (<tt>N=8</tt>) and AVX-512 (<tt>N=16</tt>),
+ * which are only available in translation units that are compiled
+ * with support for the respective instruction set, or when the header
+ * is included in a region of code that enables it and defines
+ * \c MTS_SIMD_AVX2 or \c MTS_SIMD_AVX512 (see \c skdtree_wide.h).
+ */
+template <int N> struct SIMDTraits;
+
+#if defined(__AVX2__) || defined(MTS_SIMD_AVX2)
+template <> struct SIMDTraits<8> {
+	typedef __m256  Vector;
+	typedef __m256i IntVector;
+	typedef __m256  Mask;
+
+	enum {
+		/// Value of \ref movemask() when all lanes are set
+		EAllLanes = 0xFF
+	};
+
+	static FINLINE Vector load(const float *ptr) { return _mm256_load_ps(ptr); }
+	static FINLINE void store(float *ptr, Vector v) { _mm256_store_ps(ptr, v); }
+	static FINLINE IntVector loadi(const uint32_t *ptr) { return _mm256_load_si256((const __m256i *) ptr); }
+	static FINLINE void storei(uint32_t *ptr, IntVector v) { _mm256_store_si256((__m256i *) ptr, v); }
+	static FINLINE Vector set1(float value) { return _mm256_set1_ps(value); }
+	static FINLINE IntVector set1i(uint32_t value) { return _mm256_set1_epi32((int) value); }
+	static FINLINE Vector zero() { return _mm256_setzero_ps(); }
+
+	static FINLINE Vector add(Vector a, Vector b) { return _mm256_add_ps(a, b); }
+	static FINLINE Vector sub(Vector a, Vector b) { return _mm256_sub_ps(a, b); }
+	static FINLINE Vector mul(Vector a, Vector b) { return _mm256_mul_ps(a, b); }
+	static FINLINE Vector div(Vector a, Vector b) { return _mm256_div_ps(a, b); }
+	static FINLINE Vector min(Vector a, Vector b) { return _mm256_min_ps(a, b); }
+	static FINLINE Vector max(Vector a, Vector b) { return _mm256_max_ps(a, b); }
+
+	static FINLINE Mask lt(Vector a, Vector b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+	static FINLINE Mask le(Vector a, Vector b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+	static FINLINE Mask gt(Vector a, Vector b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+	static FINLINE Mask ge(Vector a, Vector b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+
+	static FINLINE Mask maskAnd(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+	static FINLINE Mask maskOr(Mask a, Mask b) { return _mm256_or_ps(a, b); }
+	/// Compute <tt>b & ~a</tt>
+	static FINLINE Mask maskAndNot(Mask a, Mask b) { return _mm256_andnot_ps(a, b); }
+	static FINLINE Mask maskNone() { return _mm256_setzero_ps(); }
+	static FINLINE int movemask(Mask m) { return _mm256_movemask_ps(m); }
+	/// Inverse of \ref movemask()
+	static FINLINE Mask fromBits(int bits) {
+		const __m256i lanes = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+		return _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+			_mm256_and_si256(_mm256_set1_epi32(bits), lanes), lanes));
+	}
+
+	/// Return \c a in lanes where \c m is set, and \c b otherwise
+	static FINLINE Vector select(Mask m, Vector a, Vector b) { return _mm256_blendv_ps(b, a, m); }
+	static FINLINE IntVector selecti(Mask m, IntVector a, IntVector b) {
+		return _mm256_castps_si256(_mm256_blendv_ps(
+			_mm256_castsi256_ps(b), _mm256_castsi256_ps(a), m));
+	}
+};
+#endif
+
+#if defined(__AVX512F__) || defined(MTS_SIMD_AVX512)
+template <> struct SIMDTraits<16> {
+	typedef __m512    Vector;
+	typedef __m512i   IntVector;
+	typedef __mmask16 Mask;
+
+	enum {
+		/// Value of \ref movemask() when all lanes are set
+		EAllLanes = 0xFFFF
+	};
+
+	static FINLINE Vector load(const float *ptr) { return _mm512_load_ps(ptr); }
+	static FINLINE void store(float *ptr, Vector v) { _mm512_store_ps(ptr, v); }
+	static FINLINE IntVector loadi(const uint32_t *ptr) { return _mm512_load_si512((const void *) ptr); }
+	static FINLINE void storei(uint32_t *ptr, IntVector v) { _mm512_store_si512((void *) ptr, v); }
+	static FINLINE Vector set1(float value) { return _mm512_set1_ps(value); }
+	static FINLINE IntVector set1i(uint32_t value) { return _mm512_set1_epi32((int) value); }
+	static FINLINE Vector zero() { return _mm512_setzero_ps(); }
+
+	static FINLINE Vector add(Vector a, Vector b) { return _mm512_add_ps(a, b); }
+	static FINLINE Vector sub(Vector a, Vector b) { return _mm512_sub_ps(a, b); }
+	static FINLINE Vector mul(Vector a, Vector b) { return _mm512_mul_ps(a, b); }
+	static FINLINE Vector div(Vector a, Vector b) { return _mm512_div_ps(a, b); }
+	/* The unmasked _mm512_min/max_ps() merge into _mm512_undefined_ps(),
+	   which some GCC versions report as uninitialized -- use the masked
+	   variants with all lanes set and a defined source instead */
+	static FINLINE Vector min(Vector a, Vector b) { return _mm512_mask_min_ps(a, EAllLanes, a, b); }
+	static FINLINE Vector max(Vector a, Vector b) { return _mm512_mask_max_ps(a, EAllLanes, a, b); }
+
+	static FINLINE Mask lt(Vector a, Vector b) { return _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ); }
+	static FINLINE Mask le(Vector a, Vector b) { return _mm512_cmp_ps_mask(a, b, _CMP_LE_OQ); }
+	static FINLINE Mask gt(Vector a, Vector b) { return _mm512_cmp_ps_mask(a, b, _CMP_GT_OQ); }
+	static FINLINE Mask ge(Vector a, Vector b) { return _mm512_cmp_ps_mask(a, b, _CMP_GE_OQ); }
+
+	static FINLINE Mask maskAnd(Mask a, Mask b) { return (Mask) (a & b); }
+	static FINLINE Mask maskOr(Mask a, Mask b) { return (Mask) (a | b); }
+	/// Compute <tt>b & ~a</tt>
+	static FINLINE Mask maskAndNot(Mask a, Mask b) { return (Mask) (b & ~a); }
+	static FINLINE Mask maskNone() { return (Mask) 0; }
+	static FINLINE int movemask(Mask m) { return (int) m; }
+	/// Inverse of \ref movemask()
+	static FINLINE Mask fromBits(int bits) { return (Mask) bits; }
+
+	/// Return \c a in lanes where \c m is set, and \c b otherwise
+	static FINLINE Vector select(Mask m, Vector a, Vector b) { return _mm512_mask_blend_ps(m, b, a); }
+	static FINLINE IntVector selecti(Mask m, IntVector a, IntVector b) { return _mm512_mask_blend_epi32(m, b, a); }
+};
+#endif
+
+/**
+ * \brief N-wide version of the packet triangle intersection routine
+ * in \c triaccel_sse.h
+ *
+ * \return A mask of the lanes, for which a closer intersection was found
+ */
+template <int N> FINLINE typename SIMDTraits<N>::Mask rayIntersectPacket(
+		const TriAccel &tri, const TRayPacket<N> &packet,
+		typename SIMDTraits<N>::Vector mint, typename SIMDTraits<N>::Vector maxt,
+		typename SIMDTraits<N>::Mask inactive, TPacketIntersection<N> &its) {
+	typedef SIMDTraits<N> S;
+	typedef typename S::Vector Vector;
+	typedef typename S::Mask Mask;
+	static const int waldModulo[4] = { 1, 2, 0, 1 };
+	const int ku = waldModulo[tri.k], kv = waldModulo[tri.k+1];
+
+	/* Get the u and v components */
+	const Vector
+		o_u = S::load(packet.o[ku]), o_v = S::load(packet.o[kv]), o_k = S::load(packet.o[tri.k]),
+		d_u = S::load(packet.d[ku]), d_v = S::load(packet.d[kv]), d_k = S::load(packet.d[tri.k]);
+
+	const Vector
+		n_u = S::set1(tri.n_u),
+		n_v = S::set1(tri.n_v),
+		n_d = S::set1(tri.n_d);
+
+	/* Calculate the plane intersection */
+	const Vector
+		num   = S::sub(S::sub(S::sub(n_d, S::mul(o_u, n_u)), S::mul(o_v, n_v)), o_k),
+		denom = S::add(S::add(S::mul(d_u, n_u), S::mul(d_v, n_v)), d_k),
+		t     = S::div(num, denom);
+
+	Mask hasIts = S::maskAndNot(inactive,
+		S::maskAnd(S::gt(maxt, t), S::gt(t, mint)));
+
+	if (S::movemask(hasIts) == 0)
+		return hasIts;
+
+	const Vector
+		hu = S::add(o_u, S::sub(S::mul(t, d_u), S::set1(tri.a_u))),
+		hv = S::add(o_v, S::sub(S::mul(t, d_v), S::set1(tri.a_v)));
+
+	const Vector
+		u = S::add(S::mul(hv, S::set1(tri.b_nu)), S::mul(hu, S::set1(tri.b_nv))),
+		v = S::add(S::mul(hu, S::set1(tri.c_nu)), S::mul(hv, S::set1(tri.c_nv)));
+
+	const Vector zero = S::zero();
+	hasIts = S::maskAnd(hasIts, S::maskAnd(
+		S::maskAnd(S::ge(u, zero), S::ge(v, zero)),
+		S::ge(S::set1(1.0f), S::add(u, v))));
+
+	if (S::movemask(hasIts) == 0)
+		return hasIts;
+
+	S::store(its.t, S::select(hasIts, t, S::load(its.t)));
+	S::store(its.u, S::select(hasIts, u, S::load(its.u)));
+	S::store(its.v, S::select(hasIts, v, S::load(its.v)));
+	S::storei(its.primIndex, S::selecti(hasIts,
+		S::set1i(tri.primIndex), S::loadi(its.primIndex)));
+	S::storei(its.shapeIndex, S::selecti(hasIts,
+		S::set1i(tri.shapeIndex), S::loadi(its.shapeIndex)));
+
+	return hasIts;
+}
+
+/**
+ * \brief N-wide version of the NaN-aware slab test in \c aabb_sse.h
+ *
+ * \return \c false if none of the rays intersect the bounding box
+ */
+template <int N> FINLINE bool rayIntersectPacket(const AABB &aabb,
+		const TRayPacket<N> &packet, typename SIMDTraits<N>::Vector &mint,
+		typename SIMDTraits<N>::Vector &maxt) {
+	typedef SIMDTraits<N> S;
+	typedef typename S::Vector Vector;
+
+	const Vector
+		p_inf = S::set1(std::numeric_limits<float>::infinity()),
+		n_inf = S::set1(-std::numeric_limits<float>::infinity());
+
+	Vector lmin = n_inf, lmax = p_inf;
+	for (int axis=0; axis<3; ++axis) {
+		const Vector
+			o = S::load(packet.o[axis]),
+			dRcp = S::load(packet.dRcp[axis]),
+			l1 = S::mul(dRcp, S::sub(S::set1((float) aabb.min[axis]), o)),
+			l2 = S::mul(dRcp, S::sub(S::set1((float) aabb.max[axis]), o));
+
+		lmax = S::min(S::max(S::min(l1, p_inf), S::min(l2, p_inf)), lmax);
+		lmin = S::max(S::min(S::max(l1, n_inf), S::max(l2, n_inf)), lmin);
+	}
+
+	mint = lmin;
+	maxt = lmax;
+
+	return S::movemask(S::maskAnd(
+		S::ge(lmax, S::zero()), S::le(lmin, lmax))) != 0;
+}
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_TRIACCEL_WIDE_H_ */
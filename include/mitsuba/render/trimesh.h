@@ -232,13 +232,36 @@ public:
 	 * ensures that the faces  reference the same vertices.
 	 * This step is very useful as a pre-process when generating
 	 * high-quality smooth shading normals on meshes with creases.
-	 * Note: this function is fairly memory intensive and will require
-	 * approximately three 3x the storate used by the input mesh.
-	 * It will never try to merge vertices with equal positions but
-	 * different UV coordinates or vertex colors.
+	 * Vertices with identical attributes are grouped using a hash
+	 * table, and the clustering of the face normals around each
+	 * vertex runs in parallel. It will never try to merge vertices
+	 * with equal positions but different UV coordinates or vertex colors.
 	 */
 	void rebuildTopology(Float maxAngle);
 
+	/**
+	 * \brief Reference the geometry of another mesh instead of
+	 * storing a separate copy
+	 *
+	 * This is used to share identical meshes between several scenes
+	 * that are loaded by the same process (see \ref ResourceRegistry).
+	 * The buffers of \c source must not be modified anymore, which is
+	 * easiest to ensure by calling \ref computeNormals() and
+	 * \ref computeUVTangents() on it before sharing. Operations
+	 * of this mesh that would modify the shared buffers (e.g.
+	 * \ref rebuildTopology()) first create a private copy.
+	 *
+	 * Any existing geometry of this mesh is released. The name,
+	 * BSDF, and other attached objects are left unchanged.
+	 */
+	void shareGeometry(const TriMesh *source);
+
+	/// Does this mesh reference the geometry of another mesh?
+	inline bool isGeometryShared() const { return m_geometrySource.get() != NULL; }
+
+	/// Return the mesh owning the shared geometry (or \c NULL if not shared)
+	inline const TriMesh *getGeometrySource() const { return m_geometrySource.get(); }
+
 	/// Serialize to a file/network stream
 	void serialize(Stream *stream, InstanceManager *manager) const;
 
@@ -281,6 +304,104 @@ public:
 	void getNormalDerivative(const Intersection &its,
 		Vector &dndu, Vector &dndv, bool shadingFrame) const;
 
+	/**
+	 * \brief Fill a detailed intersection record for a ray that hit
+	 * one of the triangles of this mesh
+	 *
+	 * This function is used by the acceleration data structures. Note
+	 * that the shading frame and the \c wi field are not computed.
+	 *
+	 * \param ray
+	 *     The ray, whose distance to the intersection must have been
+	 *     stored in <tt>its.t</tt>
+	 * \param index
+	 *     Index of the intersected triangle
+	 * \param u
+	 *     First barycentric coordinate of the intersection
+	 * \param v
+	 *     Second barycentric coordinate of the intersection
+	 * \param its
+	 *     The intersection record to be filled
+	 * \tparam BarycentricPos
+	 *     Compute the intersection position using the barycentric
+	 *     coordinates instead of the ray distance?
+	 */
+	template <bool BarycentricPos> FINLINE void fillTriangleIntersectionRecord(
+			const Ray &ray, uint32_t index, Float u, Float v, Intersection &its) const {
+		const Triangle &tri = m_triangles[index];
+		const Point *vertexPositions = m_positions;
+		const Normal *vertexNormals = m_normals;
+		const Point2 *vertexTexcoords = m_texcoords;
+		const Color3 *vertexColors = m_colors;
+		const TangentSpace *vertexTangents = m_tangents;
+		const Vector b(1 - u - v, u, v);
+
+		const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
+		const Point &p0 = vertexPositions[idx0];
+		const Point &p1 = vertexPositions[idx1];
+		const Point &p2 = vertexPositions[idx2];
+
+		if (BarycentricPos)
+			its.p = p0 * b.x + p1 * b.y + p2 * b.z;
+		else
+			its.p = ray(its.t);
+
+		Vector side1(p1-p0), side2(p2-p0);
+		Normal faceNormal(cross(side1, side2));
+		Float length = faceNormal.length();
+		if (!faceNormal.isZero())
+			faceNormal /= length;
+
+		if (EXPECT_NOT_TAKEN(vertexTangents)) {
+			const TangentSpace &ts = vertexTangents[index];
+			its.dpdu = ts.dpdu;
+			its.dpdv = ts.dpdv;
+		} else {
+			its.dpdu = side1;
+			its.dpdv = side2;
+		}
+
+		if (EXPECT_TAKEN(vertexNormals)) {
+			const Normal
+				&n0 = vertexNormals[idx0],
+				&n1 = vertexNormals[idx1],
+				&n2 = vertexNormals[idx2];
+
+			its.shFrame.n = normalize(n0 * b.x + n1 * b.y + n2 * b.z);
+
+			/* Ensure that the geometric & shading normals face the same direction */
+			if (dot(faceNormal, its.shFrame.n) < 0)
+				faceNormal = -faceNormal;
+		} else {
+			its.shFrame.n = faceNormal;
+		}
+		its.geoFrame = Frame(faceNormal);
+
+		if (EXPECT_TAKEN(vertexTexcoords)) {
+			const Point2 &t0 = vertexTexcoords[idx0];
+			const Point2 &t1 = vertexTexcoords[idx1];
+			const Point2 &t2 = vertexTexcoords[idx2];
+			its.uv = t0 * b.x + t1 * b.y + t2 * b.z;
+		} else {
+			its.uv = Point2(b.y, b.z);
+		}
+
+		if (EXPECT_NOT_TAKEN(vertexColors)) {
+			const Color3 &c0 = vertexColors[idx0],
+						 &c1 = vertexColors[idx1],
+						 &c2 = vertexColors[idx2];
+			Color3 result(c0 * b.x + c1 * b.y + c2 * b.z);
+			its.color.fromLinearRGB(result[0], result[1],
+				result[2], Spectrum::EReflectance);
+		}
+
+		its.shape = this;
+		its.hasUVPartials = false;
+		its.primIndex = index;
+		its.instance = NULL;
+		its.time = ray.time;
+	}
+
 	/**
 	 * \brief Return the number of primitives (triangles, hairs, ..)
 	 * contributed to the scene by this shape
@@ -352,6 +473,12 @@ protected:
 
 	/// Prepare internal tables for sampling uniformly wrt. area
 	void prepareSamplingTable();
+
+	/// Release the geometry buffers, unless they are shared
+	void releaseGeometry();
+
+	/// Replace shared geometry buffers by a private copy
+	void detachGeometry();
 protected:
 	AABB m_aabb;
 	Triangle *m_triangles;
@@ -365,6 +492,9 @@ protected:
 	bool m_flipNormals;
 	bool m_faceNormals;
 
+	/// Mesh owning the buffers when they are shared (see \ref shareGeometry())
+	ref<const TriMesh> m_geometrySource;
+
 	/* Surface and distribution -- generated on demand */
 	DiscreteDistribution m_areaDistr;
 	Float m_surfaceArea;
@@ -0,0 +1,173 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_VERTEXWELDER_H_)
+#define __MITSUBA_RENDER_VERTEXWELDER_H_
+
+#include <mitsuba/mitsuba.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * \brief Flat open-addressing hash table that merges mesh vertices
+ * referencing the same (position, texcoord, normal) index triple
+ *
+ * This is meant for loaders of indexed formats such as Wavefront OBJ,
+ * where every triangle corner refers to separate attribute arrays.
+ * Since the vertex attributes are a function of the index triple,
+ * welding on the indices is exact and avoids comparing floating point
+ * values. Unique vertices are numbered in the order of insertion.
+ *
+ * A typical loader welds all corners of a mesh in a first pass, which
+ * yields the vertex count needed to allocate a \ref TriMesh. A second
+ * pass then writes the triangle indices obtained from \ref find() and
+ * the attributes of \ref getKey() directly into the mesh buffers.
+ *
+ * The table can be reused for several meshes by calling \ref clear(),
+ * which keeps the allocated memory.
+ *
+ * \ingroup librender
+ */
+class VertexWelder {
+public:
+	/// Attribute indices of a vertex (zero denotes a missing attribute)
+	struct Key {
+		int p, uv, n;
+
+		inline bool operator==(const Key &key) const {
+			return p == key.p && uv == key.uv && n == key.n;
+		}
+	};
+
+	/// Create an empty welder, optionally sized for the given vertex count
+	inline VertexWelder(size_t expectedVertexCount = 0) : m_mask(0) {
+		reserve(expectedVertexCount);
+	}
+
+	/// Ensure that the given number of vertices can be added without rehashing
+	inline void reserve(size_t vertexCount) {
+		m_keys.reserve(vertexCount);
+		size_t slotCount = 16;
+		while (slotCount < 2 * vertexCount)
+			slotCount *= 2;
+		if (slotCount > m_slots.size())
+			rehash(slotCount);
+	}
+
+	/**
+	 * \brief Remove all vertices, but keep the allocated memory
+	 *
+	 * Only the occupied slots are reset, hence the cost is proportional
+	 * to the vertex count and not to the (possibly much larger) table.
+	 */
+	inline void clear() {
+		for (size_t i=0; i<m_keys.size(); ++i) {
+			/* Earlier slots of the probe sequence may already be empty,
+			   so search for the index itself instead of stopping there */
+			size_t slot = hash(m_keys[i]) & m_mask;
+			while (m_slots[slot] != (uint32_t) i)
+				slot = (slot + 1) & m_mask;
+			m_slots[slot] = EEmpty;
+		}
+		m_keys.clear();
+	}
+
+	/**
+	 * \brief Return the index of the vertex with the given attribute
+	 * indices, adding it if it does not exist yet
+	 */
+	inline uint32_t insert(int p, int uv, int n) {
+		if (2 * (m_keys.size() + 1) > m_slots.size())
+			rehash(std::max(m_slots.size() * 2, (size_t) 16));
+
+		Key key = { p, uv, n };
+		size_t slot = hash(key) & m_mask;
+		while (true) {
+			uint32_t index = m_slots[slot];
+			if (index == EEmpty) {
+				index = (uint32_t) m_keys.size();
+				m_slots[slot] = index;
+				m_keys.push_back(key);
+				return index;
+			} else if (m_keys[index] == key) {
+				return index;
+			}
+			slot = (slot + 1) & m_mask;
+		}
+	}
+
+	/**
+	 * \brief Return the index of a previously inserted vertex,
+	 * or \c 0xFFFFFFFF if it does not exist
+	 */
+	inline uint32_t find(int p, int uv, int n) const {
+		if (m_slots.empty())
+			return EEmpty;
+		Key key = { p, uv, n };
+		size_t slot = hash(key) & m_mask;
+		while (true) {
+			uint32_t index = m_slots[slot];
+			if (index == EEmpty || m_keys[index] == key)
+				return index;
+			slot = (slot + 1) & m_mask;
+		}
+	}
+
+	/// Return the number of unique vertices
+	inline size_t getVertexCount() const { return m_keys.size(); }
+
+	/// Return the attribute indices of a unique vertex
+	inline const Key &getKey(size_t index) const { return m_keys[index]; }
+
+protected:
+	enum {
+		EEmpty = 0xFFFFFFFFU
+	};
+
+	static inline size_t hash(const Key &key) {
+		uint64_t h = (((uint64_t) (uint32_t) key.p << 32) | (uint32_t) key.uv)
+			* 0x9E3779B97F4A7C15ULL;
+		h ^= (uint64_t) (uint32_t) key.n * 0xC2B2AE3D27D4EB4FULL;
+		h ^= h >> 29;
+		h *= 0xBF58476D1CE4E5B9ULL;
+		h ^= h >> 32;
+		return (size_t) h;
+	}
+
+	/// Grow the table to the given power-of-two number of slots
+	inline void rehash(size_t slotCount) {
+		m_slots.assign(slotCount, EEmpty);
+		m_mask = slotCount - 1;
+		for (size_t i=0; i<m_keys.size(); ++i) {
+			size_t slot = hash(m_keys[i]) & m_mask;
+			while (m_slots[slot] != EEmpty)
+				slot = (slot + 1) & m_mask;
+			m_slots[slot] = (uint32_t) i;
+		}
+	}
+
+private:
+	std::vector<Key> m_keys;
+	std::vector<uint32_t> m_slots;
+	size_t m_mask;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __MITSUBA_RENDER_VERTEXWELDER_H_ */
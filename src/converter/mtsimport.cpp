@@ -36,6 +36,7 @@
 #include <mitsuba/hw/glrenderer.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/resregistry.h>
 #include <mitsuba/core/version.h>
 #if defined(__WINDOWS__)
 #include <mitsuba/core/getopt.h>
@@ -180,6 +181,7 @@ int mts_main(int argc, char **argv) {
 	Logger::staticInitialization();
 	Spectrum::staticInitialization();
 	Bitmap::staticInitialization();
+	ResourceRegistry::staticInitialization();
 
 	Thread::getThread()->getLogger()->setLogLevel(EInfo);
 
@@ -230,6 +232,7 @@ int mts_main(int argc, char **argv) {
 	XMLPlatformUtils::Terminate();
 
 	/* Shutdown the core framework */
+	ResourceRegistry::staticShutdown();
 	Bitmap::staticShutdown();
 	Spectrum::staticShutdown();
 	Logger::staticShutdown();
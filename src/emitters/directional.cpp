@@ -87,7 +87,7 @@ public:
 
 	ref<Shape> createShape(const Scene *scene) {
 		/* Create a bounding sphere that surrounds the scene */
-		m_bsphere = scene->getKDTree()->getAABB().getBSphere();
+		m_bsphere = scene->getAccelerator()->getAABB().getBSphere();
 		m_bsphere.radius *= 1.1f;
 		configure();
 		return NULL;
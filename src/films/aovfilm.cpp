@@ -0,0 +1,514 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/film.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/bitmap.h>
+#include <boost/algorithm/string.hpp>
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{aovfilm}{AOV film}
+ * \order{5}
+ * \parameters{
+ *     \parameter{width, height}{\Integer}{
+ *       Width and height of the camera sensor in pixels
+ *       \default{768, 576}
+ *     }
+ *     \parameter{pixelFormat}{\String}{Pixel format of the regular
+ *         image: \code{rgb} or \code{rgba} \default{\code{rgb}}
+ *     }
+ *     \parameter{beautyFormat}{\String}{Output format of the regular
+ *         image: \code{half}, \code{float}, or \code{png} (see below)
+ *         \default{\code{half}}
+ *     }
+ *     \parameter{aovs}{\String}{Comma-separated list of AOVs and their
+ *         output formats, e.g. \code{"depth:png16, shNormal:png"}
+ *     }
+ *     \parameter{depthScale}{\Float}{Scale factor that is applied to
+ *         \code{depth}, \code{distance} and \code{position} values when
+ *         writing them in an integer format \default{1000, i.e. millimeters
+ *         when the scene is specified in meters}
+ *     }
+ *     \parameter{cropOffsetX, cropOffsetY, cropWidth, cropHeight}{\Integer}{
+ *       These parameters can optionally be provided to select a sub-rectangle
+ *       of the output. In this case, Mitsuba will only render the requested
+ *       regions. \default{Unused}
+ *     }
+ *     \parameter{highQualityEdges}{\Boolean}{
+ *        If set to \code{true}, regions slightly outside of the film
+ *        plane will also be sampled. \default{\code{false}, i.e. disabled}
+ *     }
+ *     \parameter{\Unnamed}{\RFilter}{Reconstruction filter that should
+ *     be used for the regular image. \default{\code{gaussian}}}
+ * }
+ *
+ * This film is used together with the \pluginref{aov} integrator to
+ * write a rendering along with auxiliary per-pixel outputs (AOVs) of the
+ * first visible surface, e.g. to create training data for computer
+ * vision applications. The regular image is written to the destination
+ * file, and each AOV is written to a separate file whose name has the
+ * AOV name as a suffix (e.g. \code{chair\_depth.png}).
+ *
+ * The following AOVs are supported:
+ * \code{depth} (depth along the optical axis of the sensor),
+ * \code{distance} (ray distance), \code{position} (world space),
+ * \code{geoNormal} and \code{shNormal} (geometric and shading normals),
+ * \code{uv}, \code{albedo} (diffuse reflectance), \code{mask}
+ * (fraction of the AOV samples that hit a surface; the other AOVs are
+ * averaged over these samples), \code{objectId} and \code{partId}
+ * (integer segmentation labels), and \code{coverage}.
+ *
+ * The segmentation labels are not filtered or averaged: each pixel
+ * reports the object/part ID pair that was hit by most of its samples,
+ * and \code{coverage} stores the fraction of samples that hit this
+ * pair. Background pixels have the ID 0. Object IDs can be assigned
+ * using the \code{objectId} parameter of shapes and instances; by
+ * default, the $i$-th top-level shape of the scene receives the ID $i$.
+ * When some shapes have explicit IDs, the automatic numbering starts
+ * above the largest of them to avoid collisions.
+ * Part IDs are specified using the \code{partId} shape parameter; the
+ * \pluginref{shapenet} plugin numbers the material groups of a model
+ * starting at 1.
+ *
+ * Each AOV can be written in one of the following formats:
+ * \code{png} (8 bit PNG), \code{png16} (16 bit PNG), \code{half}
+ * (\code{float16} OpenEXR), \code{float} (\code{float32} OpenEXR), and
+ * \code{uint32} (\code{uint32} OpenEXR). The floating point formats store the
+ * raw values. The integer formats store normals mapped from $[-1, 1]$ to the
+ * full range of the format; \code{uv}, \code{albedo} and \code{mask}
+ * are mapped from $[0, 1]$. The values of \code{depth}, \code{distance} and
+ * \code{position} are multiplied by \code{depthScale} instead, and IDs
+ * are stored as they are. \code{uint32} output is limited to these
+ * AOVs. All integer values are rounded and clamped to the range of the
+ * format. To keep the IDs exact, they can't be written in the \code{half}
+ * format, and a warning is printed when they exceed the range of a PNG
+ * format. Two-channel PNG files
+ * (i.e. \code{uv}) use the RGB format with an empty blue channel.
+ *
+ * \begin{xml}[caption=RGB, 16 bit depth in millimeters, normals and a mask]
+ * <film type="aovfilm">
+ *     <integer name="width" value="224"/>
+ *     <integer name="height" value="224"/>
+ *     <string name="aovs" value="depth:png16, shNormal:png, uv:half, mask:png"/>
+ * </film>
+ * \end{xml}
+ *
+ * \remarks{
+ * \item This film only works with the \pluginref{aov} integrator.
+ * }
+ */
+class AOVFilm : public Film {
+public:
+	/// Output formats
+	enum EFormat {
+		EPNG8 = 0,
+		EPNG16,
+		EHalf,
+		EFloat32,
+		EUInt32
+	};
+
+	AOVFilm(const Properties &props) : Film(props) {
+		std::string pixelFormat = boost::to_lower_copy(
+			props.getString("pixelFormat", "rgb"));
+		std::string beautyFormat = boost::to_lower_copy(
+			props.getString("beautyFormat", "half"));
+		std::vector<std::string> aovs = tokenize(
+			props.getString("aovs", ""), ", ");
+		m_depthScale = props.getFloat("depthScale", 1000.0f);
+
+		if (pixelFormat == "rgb")
+			m_pixelFormat = Bitmap::ERGB;
+		else if (pixelFormat == "rgba")
+			m_pixelFormat = Bitmap::ERGBA;
+		else
+			Log(EError, "The \"pixelFormat\" parameter must either be "
+				"equal to \"rgb\" or \"rgba\"!");
+
+		m_beautyFormat = parseFormat(beautyFormat);
+		if (m_beautyFormat != EPNG8 && m_beautyFormat != EHalf && m_beautyFormat != EFloat32)
+			Log(EError, "The \"beautyFormat\" parameter must either be "
+				"equal to \"half\", \"float\", or \"png\"!");
+
+		if (aovs.empty())
+			Log(EError, "At least one AOV must be specified!");
+
+		for (size_t i=0; i<aovs.size(); ++i) {
+			std::vector<std::string> tokens = tokenize(aovs[i], ":");
+			AOV::EType type;
+			if (tokens.size() != 2 || !AOV::fromString(tokens[0], type))
+				Log(EError, "Could not parse the AOV specification \"%s\"!", aovs[i].c_str());
+			EFormat format = parseFormat(boost::to_lower_copy(tokens[1]));
+			if (format == EUInt32 && isNormalized(type))
+				Log(EError, "The \"uint32\" format is only supported for the "
+					"\"depth\", \"distance\", \"position\", \"objectId\" and "
+					"\"partId\" AOVs!");
+			if (format == EHalf && isID(type))
+				Log(EError, "The \"half\" format can't represent all IDs exactly, "
+					"please use \"png16\", \"uint32\", or \"float\" instead!");
+			m_types.push_back(type);
+			m_formats.push_back(format);
+		}
+
+		computeLayout();
+		m_storage = new ImageBlock(Bitmap::EMultiChannel, m_cropSize, NULL, m_channelCount);
+		m_storage->setConcurrentPut(true);
+	}
+
+	AOVFilm(Stream *stream, InstanceManager *manager)
+		: Film(stream, manager) {
+		m_pixelFormat = (Bitmap::EPixelFormat) stream->readUInt();
+		m_beautyFormat = (EFormat) stream->readUInt();
+		m_depthScale = stream->readFloat();
+		size_t count = stream->readSize();
+		for (size_t i=0; i<count; ++i) {
+			m_types.push_back((AOV::EType) stream->readUInt());
+			m_formats.push_back((EFormat) stream->readUInt());
+		}
+		computeLayout();
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		Film::serialize(stream, manager);
+		stream->writeUInt(m_pixelFormat);
+		stream->writeUInt(m_beautyFormat);
+		stream->writeFloat(m_depthScale);
+		stream->writeSize(m_types.size());
+		for (size_t i=0; i<m_types.size(); ++i) {
+			stream->writeUInt(m_types[i]);
+			stream->writeUInt(m_formats[i]);
+		}
+	}
+
+	static EFormat parseFormat(const std::string &format) {
+		if (format == "png")
+			return EPNG8;
+		else if (format == "png16")
+			return EPNG16;
+		else if (format == "half")
+			return EHalf;
+		else if (format == "float")
+			return EFloat32;
+		else if (format == "uint32")
+			return EUInt32;
+		SLog(EError, "Unknown output format \"%s\"! Must be one of \"png\", "
+			"\"png16\", \"half\", \"float\", or \"uint32\".", format.c_str());
+		return EHalf;
+	}
+
+	/// Are the values of this AOV type stored in the [0, 1] range of integer formats?
+	static bool isNormalized(AOV::EType type) {
+		return type != AOV::EDepth && type != AOV::EDistance && type != AOV::EPosition
+			&& !isID(type);
+	}
+
+	/// Does this AOV type store integer labels?
+	static bool isID(AOV::EType type) {
+		return type == AOV::EObjectID || type == AOV::EPartID;
+	}
+
+	/// Assign channels to the AOVs (after spectrum, alpha and weight)
+	void computeLayout() {
+		m_channelCount = SPECTRUM_SAMPLES + 2;
+		m_aovs.resize(m_types.size());
+		for (size_t i=0; i<m_types.size(); ++i) {
+			m_aovs[i].type = m_types[i];
+			m_aovs[i].offset = m_channelCount;
+			m_channelCount += AOV::getChannelCount(m_types[i]);
+		}
+	}
+
+	void clear() {
+		m_storage->clear();
+	}
+
+	void put(const ImageBlock *block) {
+		if (EXPECT_NOT_TAKEN(block->getChannelCount() != m_channelCount))
+			Log(EError, "The AOV film requires the AOV integrator!");
+		m_storage->put(block);
+	}
+
+	bool supportsConcurrentPut() const {
+		return true;
+	}
+
+	std::vector<AOV> getAOVs() const {
+		return m_aovs;
+	}
+
+	void setBitmap(const Bitmap *bitmap, Float multiplier) {
+		ref<Bitmap> source = const_cast<Bitmap *>(bitmap)->convert(
+			Bitmap::ESpectrumAlphaWeight, Bitmap::EFloat, 1.0f, multiplier);
+		if (source->getSize() != m_storage->getSize())
+			Log(EError, "setBitmap(): Unsupported bitmap size!");
+
+		m_storage->clear();
+		size_t nPixels = (size_t) source->getWidth() * (size_t) source->getHeight();
+		const Float *sourceData = source->getFloatData();
+		Float *target = m_storage->getBitmap()->getFloatData();
+		for (size_t i=0; i<nPixels; ++i) {
+			memcpy(target, sourceData, sizeof(Float) * (SPECTRUM_SAMPLES + 2));
+			sourceData += SPECTRUM_SAMPLES + 2;
+			target += m_channelCount;
+		}
+	}
+
+	void addBitmap(const Bitmap *bitmap, Float multiplier) {
+		/* Only accumulating spectrum-valued floating point images
+		   is supported (see HDRFilm::addBitmap()) */
+		Vector2i size = bitmap->getSize();
+		if (bitmap->getPixelFormat() != Bitmap::ESpectrum ||
+			bitmap->getComponentFormat() != Bitmap::EFloat ||
+			bitmap->getGamma() != 1.0f ||
+			size != m_storage->getSize()) {
+			Log(EError, "addBitmap(): Unsupported bitmap format!");
+		}
+
+		size_t nPixels = (size_t) size.x * (size_t) size.y;
+		const Float *source = bitmap->getFloatData();
+		Float *target = m_storage->getBitmap()->getFloatData();
+		for (size_t i=0; i<nPixels; ++i) {
+			Float weight = target[SPECTRUM_SAMPLES + 1];
+			if (weight == 0)
+				weight = target[SPECTRUM_SAMPLES + 1] = 1;
+			weight *= multiplier;
+			for (size_t j=0; j<SPECTRUM_SAMPLES; ++j)
+				target[j] += *source++ * weight;
+			target += m_channelCount;
+		}
+	}
+
+	bool develop(const Point2i &sourceOffset, const Vector2i &size,
+			const Point2i &targetOffset, Bitmap *target) const {
+		const Bitmap *source = m_storage->getBitmap();
+		const FormatConverter *cvt = FormatConverter::getInstance(
+			std::make_pair(Bitmap::EFloat, target->getComponentFormat())
+		);
+
+		size_t sourceBpp = source->getBytesPerPixel();
+		size_t targetBpp = target->getBytesPerPixel();
+
+		const uint8_t *sourceData = source->getUInt8Data()
+			+ (sourceOffset.x + sourceOffset.y * source->getWidth()) * sourceBpp;
+		uint8_t *targetData = target->getUInt8Data()
+			+ (targetOffset.x + targetOffset.y * target->getWidth()) * targetBpp;
+
+		/* Only develop the regular image */
+		for (int i=0; i<size.y; ++i) {
+			for (int j=0; j<size.x; ++j) {
+				Float weight = ((const Float *) (sourceData + j*sourceBpp))[SPECTRUM_SAMPLES + 1];
+				Float invWeight = weight != 0 ? ((Float) 1 / weight) : (Float) 0;
+				cvt->convert(Bitmap::ESpectrum, 1.0f, sourceData + j*sourceBpp,
+					target->getPixelFormat(), target->getGamma(), targetData + j * targetBpp,
+					1, invWeight);
+			}
+
+			sourceData += source->getWidth() * sourceBpp;
+			targetData += target->getWidth() * targetBpp;
+		}
+
+		return true;
+	}
+
+	void setDestinationFile(const fs::path &destFile, uint32_t blockSize) {
+		m_destFile = destFile;
+	}
+
+	static std::string getExtension(EFormat format) {
+		return (format == EPNG8 || format == EPNG16) ? ".png" : ".exr";
+	}
+
+	/// Return the file name of the regular image
+	fs::path getBeautyFilename(const fs::path &baseName) const {
+		fs::path filename = baseName;
+		std::string properExtension = getExtension(m_beautyFormat);
+		if (boost::to_lower_copy(filename.extension().string()) != properExtension)
+			filename.replace_extension(properExtension);
+		return filename;
+	}
+
+	/// Return the file name of an AOV
+	fs::path getAOVFilename(const fs::path &baseName, size_t index) const {
+		fs::path filename = baseName;
+		std::string extension = boost::to_lower_copy(filename.extension().string());
+		if (extension == ".exr" || extension == ".png")
+			filename.replace_extension("");
+		filename = filename.parent_path() / (filename.filename().string()
+			+ "_" + AOV::getName(m_types[index]) + getExtension(m_formats[index]));
+		return filename;
+	}
+
+	/// Convert the values of an AOV into a bitmap for output
+	ref<Bitmap> developAOV(size_t index) const {
+		const AOV &aov = m_aovs[index];
+		const EFormat format = m_formats[index];
+		const int channels = AOV::getChannelCount(aov.type);
+		const bool png = format == EPNG8 || format == EPNG16;
+		const int outChannels = (png && channels == 2) ? 3 : channels;
+
+		Bitmap::EPixelFormat pixelFormat;
+		if (outChannels == 1)
+			pixelFormat = Bitmap::ELuminance;
+		else if (outChannels == 3)
+			pixelFormat = Bitmap::ERGB;
+		else
+			pixelFormat = Bitmap::EMultiChannel;
+
+		Bitmap::EComponentFormat componentFormat;
+		Float scale = 1, maxValue = 0;
+		switch (format) {
+			case EPNG8: componentFormat = Bitmap::EUInt8; maxValue = 0xFF; break;
+			case EPNG16: componentFormat = Bitmap::EUInt16; maxValue = 0xFFFF; break;
+			/* Largest single precision value that fits into 32 bits */
+			case EUInt32: componentFormat = Bitmap::EUInt32; maxValue = (Float) 0xFFFFFF00U; break;
+			case EHalf: componentFormat = Bitmap::EFloat16; break;
+			default: componentFormat = Bitmap::EFloat32; break;
+		}
+		if (maxValue != 0)
+			scale = isNormalized(aov.type) ? maxValue
+				: (isID(aov.type) ? 1 : m_depthScale);
+		bool clamped = false;
+		const bool remap = maxValue != 0 && (aov.type == AOV::EGeometricNormal
+			|| aov.type == AOV::EShadingNormal);
+
+		ref<Bitmap> bitmap = new Bitmap(pixelFormat, componentFormat, m_cropSize, outChannels);
+		const Float *source = m_storage->getBitmap()->getFloatData() + aov.offset;
+		size_t nValues = (size_t) m_cropSize.x * (size_t) m_cropSize.y * outChannels;
+
+		for (size_t i=0; i<nValues; i += outChannels) {
+			for (int ch=0; ch<outChannels; ++ch) {
+				Float value = ch < channels ? source[ch] : (Float) 0;
+				if (remap)
+					value = value * 0.5f + 0.5f;
+				if (maxValue != 0) {
+					value = std::floor(value * scale + 0.5f);
+					if (value > maxValue) {
+						value = maxValue;
+						clamped = true;
+					} else if (value < 0) {
+						value = 0;
+					}
+				}
+
+				switch (componentFormat) {
+					case Bitmap::EUInt8: bitmap->getUInt8Data()[i+ch] = (uint8_t) value; break;
+					case Bitmap::EUInt16: bitmap->getUInt16Data()[i+ch] = (uint16_t) value; break;
+					case Bitmap::EUInt32: bitmap->getUInt32Data()[i+ch] = (uint32_t) value; break;
+					case Bitmap::EFloat16: bitmap->getFloat16Data()[i+ch] = half((float) value); break;
+					default: bitmap->getFloat32Data()[i+ch] = (float) value; break;
+				}
+			}
+			source += m_channelCount;
+		}
+
+		if (clamped && isID(aov.type))
+			Log(EWarn, "Some values of the \"%s\" AOV exceed the range of its "
+				"output format and were clamped!", AOV::getName(aov.type).c_str());
+
+		if (pixelFormat == Bitmap::EMultiChannel) {
+			std::vector<std::string> channelNames;
+			channelNames.push_back("U");
+			channelNames.push_back("V");
+			bitmap->setChannelNames(channelNames);
+		}
+
+		return bitmap;
+	}
+
+	void develop(const Scene *scene, Float renderTime) {
+		if (m_destFile.empty())
+			return;
+
+		Log(EDebug, "Developing film ..");
+
+		/* Extract the spectrum, alpha and weight channels of the regular image */
+		ref<Bitmap> beauty = new Bitmap(Bitmap::ESpectrumAlphaWeight, Bitmap::EFloat, m_cropSize);
+		const Float *source = m_storage->getBitmap()->getFloatData();
+		Float *target = beauty->getFloatData();
+		size_t nPixels = (size_t) m_cropSize.x * (size_t) m_cropSize.y;
+		for (size_t i=0; i<nPixels; ++i) {
+			memcpy(target, source, sizeof(Float) * (SPECTRUM_SAMPLES + 2));
+			source += m_channelCount;
+			target += SPECTRUM_SAMPLES + 2;
+		}
+
+		if (m_beautyFormat == EPNG8)
+			beauty = beauty->convert(m_pixelFormat, Bitmap::EUInt8, -1.0f);
+		else
+			beauty = beauty->convert(m_pixelFormat, m_beautyFormat == EHalf
+				? Bitmap::EFloat16 : Bitmap::EFloat32);
+
+		fs::path filename = getBeautyFilename(m_destFile);
+		Log(EInfo, "Writing image to \"%s\" ..", filename.string().c_str());
+		ref<FileStream> stream = new FileStream(filename, FileStream::ETruncWrite);
+		beauty->write(m_beautyFormat == EPNG8 ? Bitmap::EPNG : Bitmap::EOpenEXR, stream);
+
+		for (size_t i=0; i<m_aovs.size(); ++i) {
+			ref<Bitmap> bitmap = developAOV(i);
+			filename = getAOVFilename(m_destFile, i);
+			Log(EInfo, "Writing %s AOV to \"%s\" ..",
+				AOV::getName(m_types[i]).c_str(), filename.string().c_str());
+			stream = new FileStream(filename, FileStream::ETruncWrite);
+			bitmap->write(getExtension(m_formats[i]) == ".png"
+				? Bitmap::EPNG : Bitmap::EOpenEXR, stream);
+		}
+	}
+
+	bool hasAlpha() const {
+		return m_pixelFormat == Bitmap::ERGBA;
+	}
+
+	bool destinationExists(const fs::path &baseName) const {
+		return fs::exists(getBeautyFilename(baseName));
+	}
+
+	std::string toString() const {
+		std::ostringstream oss;
+		oss << "AOVFilm[" << endl
+			<< "  size = " << m_size.toString() << "," << endl
+			<< "  pixelFormat = " << m_pixelFormat << "," << endl
+			<< "  beautyFormat = " << m_beautyFormat << "," << endl
+			<< "  aovs = { ";
+		for (size_t i=0; i<m_types.size(); ++i)
+			oss << AOV::getName(m_types[i]) << ":" << m_formats[i] << " ";
+		oss << "}," << endl
+			<< "  depthScale = " << m_depthScale << "," << endl
+			<< "  cropOffset = " << m_cropOffset.toString() << "," << endl
+			<< "  cropSize = " << m_cropSize.toString() << "," << endl
+			<< "  filter = " << indent(m_filter->toString()) << endl
+			<< "]";
+		return oss.str();
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	Bitmap::EPixelFormat m_pixelFormat;
+	EFormat m_beautyFormat;
+	std::vector<AOV::EType> m_types;
+	std::vector<EFormat> m_formats;
+	std::vector<AOV> m_aovs;
+	Float m_depthScale;
+	int m_channelCount;
+	fs::path m_destFile;
+	ref<ImageBlock> m_storage;
+};
+
+MTS_IMPLEMENT_CLASS_S(AOVFilm, false, Film)
+MTS_EXPORT_PLUGIN(AOVFilm, "AOV film");
+MTS_NAMESPACE_END
@@ -354,6 +354,7 @@ public:
 			m_storage = new ImageBlock(Bitmap::EMultiSpectrumAlphaWeight, m_cropSize,
 				NULL, (int) (SPECTRUM_SAMPLES * m_pixelFormats.size() + 2));
 		}
+		m_storage->setConcurrentPut(true);
 	}
 
 	HDRFilm(Stream *stream, InstanceManager *manager)
@@ -392,6 +393,10 @@ public:
 		m_storage->put(block);
 	}
 
+	bool supportsConcurrentPut() const {
+		return true;
+	}
+
 	void setBitmap(const Bitmap *bitmap, Float multiplier) {
 		bitmap->convert(m_storage->getBitmap(), multiplier);
 	}
@@ -193,6 +193,7 @@ public:
 		}
 
 		m_storage = new ImageBlock(Bitmap::ESpectrumAlphaWeight, m_cropSize);
+		m_storage->setConcurrentPut(true);
 	}
 
 	LDRFilm(Stream *stream, InstanceManager *manager)
@@ -227,6 +228,10 @@ public:
 		m_storage->put(block);
 	}
 
+	bool supportsConcurrentPut() const {
+		return true;
+	}
+
 	void setBitmap(const Bitmap *bitmap, Float multiplier) {
 		bitmap->convert(m_storage->getBitmap(), multiplier);
 	}
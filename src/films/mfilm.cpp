@@ -19,13 +19,258 @@
 #include <mitsuba/render/film.h>
 #include <mitsuba/core/bitmap.h>
 #include <mitsuba/core/plugin.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/lock.h>
 #include <boost/algorithm/string.hpp>
+#include <boost/crc.hpp>
 #include <boost/filesystem/fstream.hpp>
 #include <iomanip>
 #include "cnpy.h"
 
 MTS_NAMESPACE_BEGIN
 
+/**
+ * \brief Writes a tensor to a preallocated NumPy (.npy) file or to a
+ * single uncompressed member of a NumPy archive (.npz)
+ *
+ * The tensor consists of \c sliceCount slices along its first axis
+ * (e.g. one per rendered view), which can be written in any order and
+ * also repeatedly. Unwritten slices are filled with zeros. In the case
+ * of an archive, the CRC and the central directory are only valid
+ * after \ref finalize() has been called; this happens automatically
+ * once all slices have been written and when the writer is destroyed.
+ */
+class NumPyTensorWriter : public Object {
+public:
+	NumPyTensorWriter(const fs::path &filename, const std::string &variable,
+			const std::vector<size_t> &shape, size_t sliceCount,
+			Bitmap::EComponentFormat format, bool archive)
+			: m_filename(filename), m_archive(archive), m_zip64(false), m_sliceCount(sliceCount),
+			  m_written(sliceCount, false), m_remaining(sliceCount), m_crcSlices(0),
+			  m_dirty(true) {
+		m_mutex = new Mutex();
+
+		size_t componentSize = 0;
+		char type = 'f';
+		switch (format) {
+			case Bitmap::EFloat16: componentSize = 2; break;
+			case Bitmap::EFloat32: componentSize = 4; break;
+			case Bitmap::EFloat64: componentSize = 8; break;
+			case Bitmap::EUInt32: componentSize = 4; type = 'u'; break;
+			default:
+				Log(EError, "NumPyTensorWriter: unsupported component format!");
+		}
+
+		size_t elementCount = 1;
+		std::ostringstream oss;
+		oss << "{'descr': '"
+			<< (Stream::getHostByteOrder() == Stream::EBigEndian ? '>' : '<')
+			<< type << componentSize << "', 'fortran_order': False, 'shape': (";
+		for (size_t i=0; i<shape.size(); ++i) {
+			elementCount *= shape[i];
+			oss << shape[i] << (i+1 < shape.size() || shape.size() == 1 ? ", " : "");
+		}
+		oss << "), }";
+
+		/* Pad the preamble (magic, version, header length) and the
+		   header with spaces to a multiple of 64 bytes */
+		std::string header = oss.str();
+		size_t padding = 63 - (10 + header.length()) % 64;
+		header.append(padding, ' ');
+		header.push_back('\n');
+
+		m_npyHeader = std::string("\x93NUMPY\x01\x00", 8);
+		m_npyHeader.push_back((char) (header.length() & 0xFF));
+		m_npyHeader.push_back((char) (header.length() >> 8));
+		m_npyHeader.append(header);
+
+		m_sliceSize = elementCount * componentSize / sliceCount;
+		m_npySize = m_npyHeader.length() + m_sliceSize * sliceCount;
+		m_memberName = variable + ".npy";
+
+		m_stream = new FileStream(filename, FileStream::ETruncReadWrite);
+		m_stream->setByteOrder(Stream::ELittleEndian);
+		if (m_archive) {
+			m_zip64 = m_npySize >= 0xFFFFFFFFULL;
+			writeLocalHeader();
+		}
+		m_dataOffset = m_stream->getPos();
+		m_stream->write(m_npyHeader.c_str(), m_npyHeader.length());
+		m_stream->truncate(m_dataOffset + m_npySize);
+		m_crc.process_bytes(m_npyHeader.c_str(), m_npyHeader.length());
+	}
+
+	/// Write the slice with the given index
+	void write(size_t index, const void *data, size_t size) {
+		LockGuard lock(m_mutex);
+		if (index >= m_sliceCount || size != m_sliceSize)
+			Log(EError, "NumPyTensorWriter: slice %i of \"%s\" has an unexpected index or size!",
+				(int) index, m_filename.filename().string().c_str());
+
+		m_stream->seek(m_dataOffset + m_npyHeader.length() + index * m_sliceSize);
+		m_stream->write(data, size);
+
+		if (!m_written[index]) {
+			m_written[index] = true;
+			--m_remaining;
+		}
+
+		/* Maintain a running CRC while slices arrive in order */
+		if (index == m_crcSlices) {
+			m_crc.process_bytes(data, size);
+			++m_crcSlices;
+		} else if (index < m_crcSlices) {
+			m_crc.reset();
+			m_crc.process_bytes(m_npyHeader.c_str(), m_npyHeader.length());
+			m_crcSlices = 0;
+		}
+		m_dirty = true;
+	}
+
+	/// Have all slices been written at least once?
+	bool isComplete() const {
+		LockGuard lock(m_mutex);
+		return m_remaining == 0;
+	}
+
+	/// Complete the archive structure and flush the file to disk
+	void finalize() {
+		LockGuard lock(m_mutex);
+		if (!m_dirty)
+			return;
+
+		if (m_archive) {
+			/* Read back slices that were not covered by the running CRC */
+			if (m_crcSlices < m_sliceCount) {
+				std::vector<uint8_t> buffer(m_sliceSize);
+				m_stream->seek(m_dataOffset + m_npyHeader.length() + m_crcSlices * m_sliceSize);
+				for (; m_crcSlices < m_sliceCount; ++m_crcSlices) {
+					m_stream->read(&buffer[0], m_sliceSize);
+					m_crc.process_bytes(&buffer[0], m_sliceSize);
+				}
+			}
+			m_stream->seek(14);
+			m_stream->writeUInt(m_crc.checksum());
+			writeCentralDirectory(m_dataOffset + m_npySize);
+		}
+
+		m_stream->flush();
+		m_dirty = false;
+	}
+
+	/// Return the name of the output file
+	const fs::path &getFilename() const { return m_filename; }
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~NumPyTensorWriter() {
+		try {
+			finalize();
+		} catch (const std::exception &ex) {
+			/* Don't use Log(), which may throw from within the destructor */
+			Thread *thread = Thread::getThread();
+			Logger *logger = thread ? thread->getLogger() : NULL;
+			if (logger && EWarn >= logger->getLogLevel())
+				logger->log(EWarn, m_theClass, __FILE__, __LINE__,
+					"Could not finalize \"%s\": %s",
+					m_filename.string().c_str(), ex.what());
+		}
+	}
+
+	void writeLocalHeader() {
+		m_stream->writeUInt(0x04034b50);             // Local file header signature
+		m_stream->writeUShort(m_zip64 ? 45 : 20);    // Version needed to extract
+		m_stream->writeUShort(0);                    // Flags
+		m_stream->writeUShort(0);                    // Compression method (stored)
+		m_stream->writeUShort(0);                    // Modification time
+		m_stream->writeUShort(0x21);                 // Modification date (1980-01-01)
+		m_stream->writeUInt(0);                      // CRC-32 (patched by finalize())
+		m_stream->writeUInt(m_zip64 ? 0xFFFFFFFFU : (uint32_t) m_npySize);
+		m_stream->writeUInt(m_zip64 ? 0xFFFFFFFFU : (uint32_t) m_npySize);
+		m_stream->writeUShort((uint16_t) m_memberName.length());
+		m_stream->writeUShort(m_zip64 ? 20 : 0);     // Extra field length
+		m_stream->write(m_memberName.c_str(), m_memberName.length());
+		if (m_zip64) {
+			m_stream->writeUShort(0x0001);
+			m_stream->writeUShort(16);
+			m_stream->writeULong(m_npySize);
+			m_stream->writeULong(m_npySize);
+		}
+	}
+
+	void writeCentralDirectory(uint64_t offset) {
+		bool zip64 = m_zip64 || offset >= 0xFFFFFFFFULL;
+		m_stream->seek(offset);
+		m_stream->writeUInt(0x02014b50);             // Central file header signature
+		m_stream->writeUShort(zip64 ? 45 : 20);      // Version made by
+		m_stream->writeUShort(m_zip64 ? 45 : 20);    // Version needed to extract
+		m_stream->writeUShort(0);                    // Flags
+		m_stream->writeUShort(0);                    // Compression method (stored)
+		m_stream->writeUShort(0);                    // Modification time
+		m_stream->writeUShort(0x21);                 // Modification date
+		m_stream->writeUInt(m_crc.checksum());
+		m_stream->writeUInt(m_zip64 ? 0xFFFFFFFFU : (uint32_t) m_npySize);
+		m_stream->writeUInt(m_zip64 ? 0xFFFFFFFFU : (uint32_t) m_npySize);
+		m_stream->writeUShort((uint16_t) m_memberName.length());
+		m_stream->writeUShort(m_zip64 ? 20 : 0);     // Extra field length
+		m_stream->writeUShort(0);                    // Comment length
+		m_stream->writeUShort(0);                    // Disk number
+		m_stream->writeUShort(0);                    // Internal attributes
+		m_stream->writeUInt(0);                      // External attributes
+		m_stream->writeUInt(0);                      // Offset of the local header
+		m_stream->write(m_memberName.c_str(), m_memberName.length());
+		if (m_zip64) {
+			m_stream->writeUShort(0x0001);
+			m_stream->writeUShort(16);
+			m_stream->writeULong(m_npySize);
+			m_stream->writeULong(m_npySize);
+		}
+
+		uint64_t directorySize = m_stream->getPos() - offset;
+		if (zip64) {
+			uint64_t recordOffset = m_stream->getPos();
+			m_stream->writeUInt(0x06064b50);         // Zip64 end of central directory record
+			m_stream->writeULong(44);
+			m_stream->writeUShort(45);
+			m_stream->writeUShort(45);
+			m_stream->writeUInt(0);
+			m_stream->writeUInt(0);
+			m_stream->writeULong(1);
+			m_stream->writeULong(1);
+			m_stream->writeULong(directorySize);
+			m_stream->writeULong(offset);
+			m_stream->writeUInt(0x07064b50);         // Zip64 end of central directory locator
+			m_stream->writeUInt(0);
+			m_stream->writeULong(recordOffset);
+			m_stream->writeUInt(1);
+		}
+
+		m_stream->writeUInt(0x06054b50);             // End of central directory record
+		m_stream->writeUShort(0);
+		m_stream->writeUShort(0);
+		m_stream->writeUShort(1);
+		m_stream->writeUShort(1);
+		m_stream->writeUInt((uint32_t) directorySize);
+		m_stream->writeUInt(zip64 ? 0xFFFFFFFFU : (uint32_t) offset);
+		m_stream->writeUShort(0);                    // Comment length
+		m_stream->truncate(m_stream->getPos());
+	}
+
+private:
+	fs::path m_filename;
+	ref<FileStream> m_stream;
+	mutable ref<Mutex> m_mutex;
+	std::string m_npyHeader;
+	std::string m_memberName;
+	bool m_archive, m_zip64;
+	size_t m_sliceCount, m_sliceSize;
+	uint64_t m_npySize, m_dataOffset;
+	std::vector<bool> m_written;
+	size_t m_remaining, m_crcSlices;
+	boost::crc_32_type m_crc;
+	bool m_dirty;
+};
+
 /*!\plugin{mfilm}{MATLAB / Mathematica / NumPy film}
  * \order{4}
  * \parameters{
@@ -40,7 +285,18 @@ MTS_NAMESPACE_BEGIN
  *     }
  *     \parameter{fileFormat}{\String}{
  *       Specifies the desired output format; must be one of
- *       \code{matlab}, \code{mathematica}, or \code{numpy}. \default{\code{matlab}}
+ *       \code{matlab}, \code{mathematica}, \code{numpy}, or \code{npz}
+ *       (an uncompressed NumPy archive). \default{\code{matlab}}
+ *     }
+ *     \parameter{componentFormat}{\String}{
+ *       Component format of NumPy output; must be one of \code{float32}
+ *       or \code{float16}. \default{\code{float32}}
+ *     }
+ *     \parameter{batch}{\Boolean}{
+ *       Write the views of a multi-view render (\code{mitsuba -V}) into
+ *       a single NumPy tensor of shape (views, height, width, channels)
+ *       instead of one file per view. Only supported for NumPy output.
+ *       \default{\code{false}}
  *     }
  *     \parameter{digits}{\Integer}{
  *       Number of significant digits to be written \default{4}
@@ -77,13 +333,21 @@ MTS_NAMESPACE_BEGIN
  * This is useful when running Mitsuba as simulation step as part of a
  * larger virtual experiment. It can also come in handy when
  * verifying parts of the renderer using an automated test suite.
+ *
+ * When generating datasets, the \code{batch} parameter avoids creating
+ * one small file per view: all views of a multi-view render are written
+ * into one preallocated \code{.npy} file or \code{.npz} archive that is
+ * named after the scene's output file, where slice $i$ holds view $i$.
+ * The \code{viewIndex} and \code{viewCount} parameters that select the
+ * slice are filled in automatically by the renderer.
  */
 class MFilm : public Film {
 public:
 	enum EMode {
 		EMATLAB = 0,
 		EMathematica,
-		ENumPy
+		ENumPy,
+		ENumPyArchive
 	};
 
 	MFilm(const Properties &props) : Film(props) {
@@ -126,15 +390,40 @@ public:
 			m_fileFormat = EMathematica;
 		} else if (fileFormat == "numpy") {
 			m_fileFormat = ENumPy;
+		} else if (fileFormat == "npz") {
+			m_fileFormat = ENumPyArchive;
 		} else {
 			Log(EError, "The \"fileFormat\" parameter must either be equal to "
-				"\"matlab\" or \"mathematica\" or \"numpy\" or \"numpycompressed\"!");
+				"\"matlab\", \"mathematica\", \"numpy\", or \"npz\"!");
+		}
+
+		std::string componentFormat = boost::to_lower_copy(
+			props.getString("componentFormat", "float32"));
+
+		if (componentFormat == "float32") {
+			m_componentFormat = Bitmap::EFloat32;
+		} else if (componentFormat == "float16") {
+			m_componentFormat = Bitmap::EFloat16;
+		} else {
+			Log(EError, "The \"componentFormat\" parameter must either be equal to "
+				"\"float32\" or \"float16\"!");
 		}
 
 		m_digits = props.getInteger("digits", 4);
 		m_variable = props.getString("variable", "data");
+		m_batch = props.getBoolean("batch", false);
+		m_viewIndex = props.getInteger("viewIndex", 0);
+		m_viewCount = props.getInteger("viewCount", 1);
+
+		if ((m_batch || m_componentFormat != Bitmap::EFloat32)
+				&& m_fileFormat != ENumPy && m_fileFormat != ENumPyArchive)
+			Log(EError, "The \"batch\" and \"componentFormat\" parameters "
+				"require NumPy output!");
+		if (m_viewIndex < 0 || m_viewIndex >= m_viewCount)
+			Log(EError, "The \"viewIndex\" parameter must be in [0, viewCount)!");
 
 		m_storage = new ImageBlock(Bitmap::ESpectrumAlphaWeight, m_cropSize);
+		m_storage->setConcurrentPut(true);
 	}
 
 	MFilm(Stream *stream, InstanceManager *manager)
@@ -143,6 +432,21 @@ public:
 		m_fileFormat = (EMode) stream->readUInt();
 		m_digits = stream->readInt();
 		m_variable = stream->readString();
+		m_componentFormat = (Bitmap::EComponentFormat) stream->readUInt();
+		m_batch = stream->readBool();
+		m_viewIndex = stream->readInt();
+		m_viewCount = stream->readInt();
+	}
+
+	virtual ~MFilm() {
+		if (m_writer) {
+			/* The last film that refers to a writer removes it from the
+			   table, which finalizes the file */
+			LockGuard lock(m_writersMutex);
+			if (m_writer->getRefCount() == 2)
+				m_writers.erase(m_writer->getFilename().string());
+			m_writer = NULL;
+		}
 	}
 
 	void serialize(Stream *stream, InstanceManager *manager) const {
@@ -151,6 +455,10 @@ public:
 		stream->writeUInt(m_fileFormat);
 		stream->writeInt(m_digits);
 		stream->writeString(m_variable);
+		stream->writeUInt(m_componentFormat);
+		stream->writeBool(m_batch);
+		stream->writeInt(m_viewIndex);
+		stream->writeInt(m_viewCount);
 	}
 
 	void configure() {
@@ -172,6 +480,10 @@ public:
 		m_storage->put(block);
 	}
 
+	bool supportsConcurrentPut() const {
+		return true;
+	}
+
 	void setBitmap(const Bitmap *bitmap, Float multiplier) {
 		bitmap->convert(m_storage->getBitmap(), multiplier);
 	}
@@ -242,30 +554,57 @@ public:
 		m_destFile = destFile;
 	}
 
-	void develop(const Scene *scene, Float renderTime) {
-		if (m_destFile.empty())
-			return;
-
-		Log(EDebug, "Developing film ..");
-
-		fs::path filename = m_destFile;
-		std::string extension = boost::to_lower_copy(filename.extension().string());
+	/**
+	 * Return the output file for the given destination. In batch mode,
+	 * the suffix of the view is removed so that all views map to the
+	 * same file.
+	 */
+	fs::path getFilename(const fs::path &destFile) const {
+		fs::path filename = destFile;
 		std::string expectedExtension;
 		if (m_fileFormat == EMathematica || m_fileFormat == EMATLAB) {
 			expectedExtension = ".m";
 		} else if (m_fileFormat == ENumPy) {
 			expectedExtension = ".npy";
+		} else if (m_fileFormat == ENumPyArchive) {
+			expectedExtension = ".npz";
 		} else {
 			Log(EError, "Invalid file format!");
 		}
-		if (extension != expectedExtension)
+
+		if (m_batch) {
+			std::string stem = filename.stem().string(),
+			            suffix = formatString("_%03i", m_viewIndex);
+			if (boost::ends_with(stem, suffix))
+				filename = filename.parent_path() / (stem.substr(0,
+					stem.length() - suffix.length()) + filename.extension().string());
+		}
+
+		if (boost::to_lower_copy(filename.extension().string()) != expectedExtension)
 			filename.replace_extension(expectedExtension);
+		return filename;
+	}
+
+	void develop(const Scene *scene, Float renderTime) {
+		if (m_destFile.empty())
+			return;
+
+		Log(EDebug, "Developing film ..");
+
+		fs::path filename = getFilename(m_destFile);
+
+		if (m_fileFormat == ENumPyArchive || m_batch
+				|| m_componentFormat != Bitmap::EFloat32) {
+			ref<Bitmap> bitmap = m_storage->getBitmap()->convert(
+				m_pixelFormat, m_componentFormat);
+			developTensor(filename, bitmap);
+			return;
+		}
 
 		ref<Bitmap> bitmap = m_storage->getBitmap()->convert(
-			m_pixelFormat, Bitmap::EFloat);
+			m_pixelFormat, m_fileFormat == ENumPy ? Bitmap::EFloat32 : Bitmap::EFloat);
 
 		Log(EInfo, "Writing image to \"%s\" ..", filename.filename().string().c_str());
-
 		if (m_fileFormat == EMathematica || m_fileFormat == EMATLAB) {
 			fs::ofstream os(filename);
 			if (!os.good() || os.fail())
@@ -343,24 +682,53 @@ public:
 			if (bitmap->getChannelCount() == 1)
 				N = 2;
 
-			const Float *data = bitmap->getFloatData();
+			const float *data = bitmap->getFloat32Data();
 			cnpy::npy_save(filename.string(), data, shape_ptr, N, "w");
 		}
 	}
 
-	bool destinationExists(const fs::path &baseName) const {
-		fs::path filename = baseName;
-		std::string expectedExtension;
-		if (m_fileFormat == EMathematica || m_fileFormat == EMATLAB) {
-			expectedExtension = ".m";
-		} else if (m_fileFormat == ENumPy) {
-			expectedExtension = ".npy";
-		} else {
-			Log(EError, "Invalid file format!");
+	/// Write the image into a (possibly shared) tensor writer
+	void developTensor(const fs::path &filename, const Bitmap *bitmap) {
+		if (!m_writer || m_writer->getFilename() != filename) {
+			std::vector<size_t> shape;
+			if (m_batch)
+				shape.push_back((size_t) m_viewCount);
+			shape.push_back((size_t) bitmap->getHeight());
+			shape.push_back((size_t) bitmap->getWidth());
+			if (bitmap->getChannelCount() > 1 || m_batch)
+				shape.push_back((size_t) bitmap->getChannelCount());
+
+			LockGuard lock(m_writersMutex);
+			if (m_batch) {
+				std::map<std::string, ref<NumPyTensorWriter> >::iterator it =
+					m_writers.find(filename.string());
+				if (it != m_writers.end()) {
+					m_writer = it->second;
+				} else {
+					m_writer = new NumPyTensorWriter(filename, m_variable, shape,
+						m_viewCount, m_componentFormat, m_fileFormat == ENumPyArchive);
+					m_writers[filename.string()] = m_writer;
+				}
+			} else {
+				m_writer = new NumPyTensorWriter(filename, m_variable, shape,
+					1, m_componentFormat, m_fileFormat == ENumPyArchive);
+			}
 		}
-		if (boost::to_lower_copy(filename.extension().string()) != expectedExtension)
-			filename.replace_extension(expectedExtension);
-		return fs::exists(filename);
+
+		if (m_batch)
+			Log(EInfo, "Writing view %i/%i to \"%s\" ..", m_viewIndex + 1, m_viewCount,
+				filename.filename().string().c_str());
+		else
+			Log(EInfo, "Writing image to \"%s\" ..", filename.filename().string().c_str());
+
+		m_writer->write(m_batch ? (size_t) m_viewIndex : 0,
+			bitmap->getData(), bitmap->getBufferSize());
+		if (m_writer->isComplete())
+			m_writer->finalize();
+	}
+
+	bool destinationExists(const fs::path &baseName) const {
+		return fs::exists(getFilename(baseName));
 	}
 
 	bool hasAlpha() const {
@@ -378,6 +746,10 @@ public:
 			<< "  pixelFormat = " << m_pixelFormat << "," << endl
 			<< "  digits = " << m_digits << "," << endl
 			<< "  variable = \"" << m_variable << "\"," << endl
+			<< "  componentFormat = " << m_componentFormat << "," << endl
+			<< "  batch = " << m_batch << "," << endl
+			<< "  viewIndex = " << m_viewIndex << "," << endl
+			<< "  viewCount = " << m_viewCount << "," << endl
 			<< "  cropOffset = " << m_cropOffset.toString() << "," << endl
 			<< "  cropSize = " << m_cropSize.toString() << "," << endl
 			<< "  filter = " << indent(m_filter->toString()) << endl
@@ -393,8 +765,20 @@ protected:
 	ref<ImageBlock> m_storage;
 	std::string m_variable;
 	int m_digits;
+	Bitmap::EComponentFormat m_componentFormat;
+	bool m_batch;
+	int m_viewIndex, m_viewCount;
+	ref<NumPyTensorWriter> m_writer;
+
+	/// Writers of batched outputs, which are shared by the films of all views
+	static std::map<std::string, ref<NumPyTensorWriter> > m_writers;
+	static ref<Mutex> m_writersMutex;
 };
 
+std::map<std::string, ref<NumPyTensorWriter> > MFilm::m_writers;
+ref<Mutex> MFilm::m_writersMutex = new Mutex();
+
+MTS_IMPLEMENT_CLASS(NumPyTensorWriter, false, Object)
 MTS_IMPLEMENT_CLASS_S(MFilm, false, Film)
 MTS_EXPORT_PLUGIN(MFilm, "MATLAB / Mathematica / NumPy film");
 MTS_NAMESPACE_END
@@ -19,6 +19,8 @@
 #include <mitsuba/render/scene.h>
 #include <mitsuba/core/statistics.h>
 #include <boost/math/distributions/normal.hpp>
+#include <boost/algorithm/string.hpp>
+#include "adaptive_proc.h"
 
 MTS_NAMESPACE_BEGIN
 
@@ -38,7 +40,23 @@ MTS_NAMESPACE_BEGIN
  *         A negative value will be interpreted as $\infty$.
  *         \default{32---for instance, when 64 pixel samples are configured in
  *         the \code{sampler}, this means that the adaptive integrator
- *         will give up after 32*64=2048 samples}
+ *         will give up after 32*64=2048 samples. In the \code{image} mode,
+ *         this is the average number of samples per pixel over the
+ *         whole image, which can be freely distributed}
+ *     }
+ *     \parameter{mode}{\String}{
+ *         Specifies where the stopping decision is made:
+ *         \code{pixel} (separately for every pixel) or \code{image}
+ *         (for tiles of the image, see below) \default{\code{pixel}}
+ *     }
+ *     \parameter{initialSamples}{\Integer}{
+ *         \code{image} mode only: number of samples per pixel of the first
+ *         pass, which is also the average number of samples per pixel
+ *         that every following pass distributes \default{8}
+ *     }
+ *     \parameter{timeBudget}{\Float}{
+ *         \code{image} mode only: stop starting new tiles after this
+ *         many seconds. A value of zero disables the limit \default{0}
  *     }
  * }
  *
@@ -56,6 +74,32 @@ MTS_NAMESPACE_BEGIN
  * </integrator>
  * \end{xml}
  *
+ * In the \code{image} mode, the integrator instead renders the image in
+ * passes. The first pass takes \code{initialSamples} samples in every
+ * pixel. Afterwards, the relative error of each image tile (of the
+ * scene's block size) is estimated in the same way as above, and the
+ * samples of the next pass are given to the tiles that haven't reached
+ * \code{maxError} yet, in proportion to the number of samples they
+ * still need (but at most doubling their sample count per pass).
+ * Rendering stops once the average error over all pixels drops below
+ * \code{maxError}, or when the sample budget or the time budget is used
+ * up. Pixels where all samples were black, such as an empty background,
+ * are considered converged and thus only receive the samples of the first
+ * pass. This mode is a good fit for batch rendering with a fixed budget:
+ *
+ * \begin{xml}[caption={Rendering with the cost of 64 samples per pixel, which are spent on the noisy parts of the image}]
+ * <integrator type="adaptive">
+ *     <string name="mode" value="image"/>
+ *     <integer name="maxSampleFactor" value="1"/>
+ *     <float name="timeBudget" value="30"/>
+ *     <integrator type="path"/>
+ * </integrator>
+ *
+ * <sampler type="independent">
+ *     <integer name="sampleCount" value="64"/>
+ * </sampler>
+ * \end{xml}
+ *
  * \remarks{
  *    \item The adaptive integrator needs a variance estimate to work
  *     correctly. Hence, the underlying sample generator should be set to a reasonably
@@ -63,6 +107,9 @@ MTS_NAMESPACE_BEGIN
  *    \item This plugin uses a relatively simplistic error heuristic that does not
  *    share information between pixels and only reasons about variance in image space.
  *    In the future, it will likely be replaced with something more robust.
+ *    \item In the \code{image} mode, the reconstruction filter of tiles with
+ *    many samples also affects the border pixels of adjacent tiles more
+ *    strongly. A narrow filter (e.g. \code{box}) avoids visible seams.
  * }
  */
 class AdaptiveIntegrator : public SamplingIntegrator {
@@ -78,6 +125,24 @@ public:
 		/* Required P-value to accept a sample. */
 		m_pValue = props.getFloat("pValue", 0.05f);
 		m_verbose = props.getBoolean("verbose", false);
+
+		std::string mode = boost::to_lower_copy(props.getString("mode", "pixel"));
+		if (mode == "pixel")
+			m_imageMode = false;
+		else if (mode == "image")
+			m_imageMode = true;
+		else
+			Log(EError, "The 'mode' parameter must be equal to \"pixel\" or \"image\"!");
+
+		/* Samples per pixel of the first pass in the image mode */
+		m_initialSamples = props.getInteger("initialSamples", 8);
+		/* Time limit of the image mode in seconds (0 = unlimited) */
+		m_timeBudget = props.getFloat("timeBudget", 0.0f);
+
+		if (m_initialSamples < 2)
+			Log(EError, "At least two initial samples are needed to estimate the variance!");
+		if (m_timeBudget < 0)
+			Log(EError, "The time budget must be positive (or zero to disable it)!");
 	}
 
 	AdaptiveIntegrator(Stream *stream, InstanceManager *manager)
@@ -88,6 +153,9 @@ public:
 		m_quantile = stream->readFloat();
 		m_averageLuminance = stream->readFloat();
 		m_pValue = stream->readFloat();
+		m_imageMode = stream->readBool();
+		m_initialSamples = stream->readInt();
+		m_timeBudget = stream->readFloat();
 		m_verbose = false;
 	}
 
@@ -165,6 +233,218 @@ public:
 		return true;
 	}
 
+	bool render(Scene *scene, RenderQueue *queue, const RenderJob *job,
+			int sceneResID, int sensorResID, int samplerResID) {
+		if (!m_imageMode)
+			return SamplingIntegrator::render(scene, queue, job,
+				sceneResID, sensorResID, samplerResID);
+
+		typedef AdaptiveRenderProcess::Tile Tile;
+		ref<Scheduler> sched = Scheduler::getInstance();
+		ref<Sensor> sensor = static_cast<Sensor *>(sched->getResource(sensorResID));
+		ref<Film> film = sensor->getFilm();
+		const Sampler *sampler = static_cast<const Sampler *>(sched->getResource(samplerResID, 0));
+
+		/* Split the same region as BlockedRenderProcess into tiles */
+		int blockSize = scene->getBlockSize(),
+		    borderSize = film->getReconstructionFilter()->getBorderSize();
+		Point2i origin(0, 0);
+		Vector2i size = film->getCropSize();
+		if (film->hasHighQualityEdges()) {
+			origin -= Vector2i(borderSize);
+			size += Vector2i(2 * borderSize);
+		}
+
+		std::vector<Tile> tiles;
+		for (int y=0; y<size.y; y += blockSize) {
+			for (int x=0; x<size.x; x += blockSize) {
+				Tile tile;
+				tile.offset = origin + Vector2i(x, y);
+				tile.size = Vector2i(std::min(blockSize, size.x - x),
+					std::min(blockSize, size.y - y));
+				tile.sampleCount = m_initialSamples;
+				tile.sampleOffset = 0;
+				tiles.push_back(tile);
+			}
+		}
+
+		ref<Bitmap> statistics = new Bitmap(Bitmap::EMultiChannel, Bitmap::EFloat,
+			size, AdaptiveRenderProcess::EStatisticCount);
+		statistics->clear();
+
+		const Float pixelCount = (Float) size.x * (Float) size.y;
+		const Float budget = m_maxSampleFactor < 0 ? std::numeric_limits<Float>::infinity()
+			: (Float) m_maxSampleFactor * (Float) sampler->getSampleCount() * pixelCount;
+		const Float timeBudget = m_timeBudget > 0 ? m_timeBudget
+			: std::numeric_limits<Float>::infinity();
+		std::vector<Float> tileError(tiles.size()), tileSamples(tiles.size());
+
+		Log(EInfo, "Starting adaptive render job (%ix%i, %i tiles, %i initial samples, "
+			SIZE_T_FMT " %s)", film->getCropSize().x, film->getCropSize().y,
+			(int) tiles.size(), m_initialSamples, sched->getCoreCount(),
+			sched->getCoreCount() == 1 ? "core" : "cores");
+
+		ref<Timer> timer = new Timer();
+		int integratorResID = sched->registerResource(this);
+		Float used = 0;
+		bool success = true;
+
+		for (int pass = 1; ; ++pass) {
+			/* Only schedule tiles that receive samples in this pass */
+			std::vector<Tile> work;
+			for (size_t i=0; i<tiles.size(); ++i) {
+				if (tiles[i].sampleCount > 0)
+					work.push_back(tiles[i]);
+			}
+			if (work.empty())
+				break;
+
+			ref<ParallelProcess> proc = new AdaptiveRenderProcess(job, queue, work,
+				blockSize, statistics, origin, timeBudget - timer->getSeconds(), pass);
+			proc->bindResource("integrator", integratorResID);
+			proc->bindResource("scene", sceneResID);
+			proc->bindResource("sensor", sensorResID);
+			proc->bindResource("sampler", samplerResID);
+			scene->bindUsedResources(proc);
+			bindUsedResources(proc);
+			sched->schedule(proc);
+
+			m_process = proc;
+			sched->wait(proc);
+			m_process = NULL;
+
+			if (proc->getReturnStatus() != ParallelProcess::ESuccess) {
+				success = false;
+				break;
+			}
+			queue->signalRefresh(job);
+
+			Float error = estimateError(statistics, origin, tiles, tileError, tileSamples);
+
+			/* Only count the samples of tiles that were actually rendered
+			   (the pass may have run out of time before starting all of them) */
+			used = 0;
+			for (size_t i=0; i<tiles.size(); ++i)
+				used += tileSamples[i] * (Float) tiles[i].size.x * (Float) tiles[i].size.y;
+
+			AdaptiveRenderProcess *adaptiveProc = static_cast<AdaptiveRenderProcess *>(proc.get());
+			Log(EInfo, "Pass %i: rendered %i tiles, %.1f samples per pixel so far, "
+				"estimated error: %.2f%%", pass, adaptiveProc->getResultCount(),
+				used / pixelCount, error * 100);
+
+			if (error <= m_maxError) {
+				Log(EInfo, "Reached the target error after %s",
+					timeString(timer->getSeconds()).c_str());
+				break;
+			} else if (adaptiveProc->hasTimedOut()
+					|| timer->getSeconds() >= timeBudget) {
+				Log(EInfo, "Stopping, the time budget is used up");
+				break;
+			} else if (used >= budget) {
+				Log(EInfo, "Stopping, the sample budget is used up");
+				break;
+			}
+
+			/* The next pass continues the sample sequences of every tile */
+			for (size_t i=0; i<tiles.size(); ++i)
+				tiles[i].sampleOffset = (int) (tileSamples[i] + 0.5f);
+
+			Float passBudget = std::min(m_initialSamples * pixelCount, budget - used);
+			distributeSamples(tiles, tileError, tileSamples, passBudget);
+
+			/* Render the noisiest tiles first, in case the time runs out */
+			std::vector<std::pair<Float, size_t> > order(tiles.size());
+			for (size_t i=0; i<tiles.size(); ++i)
+				order[i] = std::make_pair(-tileError[i], i);
+			std::sort(order.begin(), order.end());
+			std::vector<Tile> sorted(tiles.size());
+			for (size_t i=0; i<tiles.size(); ++i)
+				sorted[i] = tiles[order[i].second];
+			tiles.swap(sorted);
+		}
+
+		sched->unregisterResource(integratorResID);
+		return success;
+	}
+
+	/**
+	 * Estimate the relative error of every tile from the per-pixel statistics
+	 * (using the same heuristic as the pixel mode). Also determines the average
+	 * number of samples per pixel of every tile. Returns the average error over
+	 * all pixels that received some radiance.
+	 */
+	Float estimateError(const Bitmap *statistics, const Point2i &origin,
+			const std::vector<AdaptiveRenderProcess::Tile> &tiles,
+			std::vector<Float> &tileError, std::vector<Float> &tileSamples) const {
+		const Float *data = statistics->getFloatData();
+		const int width = statistics->getWidth();
+		const Float minBase = m_averageLuminance * 0.01f;
+		Float errorSum = 0;
+		size_t errorCount = 0;
+
+		for (size_t i=0; i<tiles.size(); ++i) {
+			const AdaptiveRenderProcess::Tile &tile = tiles[i];
+			Float error = 0, samples = 0;
+			size_t count = 0;
+
+			for (int y=0; y<tile.size.y; ++y) {
+				const Float *pixel = data + ((tile.offset.y - origin.y + y) * (size_t) width
+					+ tile.offset.x - origin.x) * AdaptiveRenderProcess::EStatisticCount;
+
+				for (int x=0; x<tile.size.x; ++x, pixel += AdaptiveRenderProcess::EStatisticCount) {
+					Float n = pixel[AdaptiveRenderProcess::ESampleCount],
+					      mean = pixel[AdaptiveRenderProcess::ELuminanceMean],
+					      M2 = pixel[AdaptiveRenderProcess::ELuminanceM2];
+					samples += n;
+
+					/* Black pixels (e.g. the background) are converged */
+					if (n < 2 || (mean == 0 && M2 == 0))
+						continue;
+
+					Float variance = std::max((Float) 0, M2 / (n - 1));
+
+					/* Half width of the confidence interval relative to the mean */
+					error += m_quantile * std::sqrt(variance / n) / std::max(mean, minBase);
+					++count;
+				}
+			}
+
+			errorSum += error;
+			errorCount += count;
+			tileError[i] = count > 0 ? error / count : 0;
+			tileSamples[i] = samples / (tile.size.x * tile.size.y);
+		}
+
+		return errorCount > 0 ? errorSum / errorCount : 0;
+	}
+
+	/**
+	 * Give the samples of the next pass to the tiles that are above the
+	 * error threshold. Since the error decreases with the square root of
+	 * the sample count, each tile asks for the number of samples that it
+	 * needs to reach the threshold, but at most for as many as it already
+	 * has. These requests are scaled down to fit into \c passBudget.
+	 */
+	void distributeSamples(std::vector<AdaptiveRenderProcess::Tile> &tiles,
+			const std::vector<Float> &tileError, const std::vector<Float> &tileSamples,
+			Float passBudget) const {
+		std::vector<Float> requests(tiles.size(), 0.0f);
+		Float total = 0;
+
+		for (size_t i=0; i<tiles.size(); ++i) {
+			if (tileError[i] <= m_maxError)
+				continue;
+			Float ratio = tileError[i] / m_maxError;
+			requests[i] = std::min(tileSamples[i] * (ratio * ratio - 1), tileSamples[i]);
+			total += requests[i] * tiles[i].size.x * tiles[i].size.y;
+		}
+
+		Float scale = total > passBudget ? passBudget / total : (Float) 1;
+		for (size_t i=0; i<tiles.size(); ++i)
+			tiles[i].sampleCount = requests[i] > 0
+				? std::max(1, (int) (requests[i] * scale + 0.5f)) : 0;
+	}
+
 	void renderBlock(const Scene *scene, const Sensor *sensor,
 			Sampler *sampler, ImageBlock *block, const bool &stop,
 			const std::vector< TPoint2<uint8_t> > &points) const {
@@ -303,6 +583,9 @@ public:
 		stream->writeFloat(m_quantile);
 		stream->writeFloat(m_averageLuminance);
 		stream->writeFloat(m_pValue);
+		stream->writeBool(m_imageMode);
+		stream->writeInt(m_initialSamples);
+		stream->writeFloat(m_timeBudget);
 	}
 
 	void bindUsedResources(ParallelProcess *proc) const {
@@ -332,6 +615,7 @@ public:
 			<< "  maxError = " << m_maxError << "," << endl
 			<< "  quantile = " << m_quantile << "," << endl
 			<< "  pvalue = " << m_pValue << "," << endl
+			<< "  mode = " << (m_imageMode ? "image" : "pixel") << "," << endl
 			<< "  subIntegrator = " << indent(m_subIntegrator->toString()) << endl
 			<< "]";
 		return oss.str();
@@ -341,8 +625,9 @@ public:
 private:
 	ref<SamplingIntegrator> m_subIntegrator;
 	Float m_maxError, m_quantile, m_pValue, m_averageLuminance;
-	int m_maxSampleFactor;
-	bool m_verbose;
+	Float m_timeBudget;
+	int m_maxSampleFactor, m_initialSamples;
+	bool m_verbose, m_imageMode;
 };
 
 MTS_IMPLEMENT_CLASS_S(AdaptiveIntegrator, false, SamplingIntegrator)
@@ -0,0 +1,355 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/sfcurve.h>
+#include <mitsuba/render/rectwu.h>
+#include "adaptive_proc.h"
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * Image region along with the number of samples per pixel and
+ * the number of samples per pixel that were taken in earlier passes
+ */
+class AdaptiveWorkUnit : public RectangularWorkUnit {
+public:
+	inline AdaptiveWorkUnit() : m_sampleCount(0), m_sampleOffset(0) { }
+
+	void set(const WorkUnit *wu) {
+		RectangularWorkUnit::set(wu);
+		m_sampleCount = static_cast<const AdaptiveWorkUnit *>(wu)->m_sampleCount;
+		m_sampleOffset = static_cast<const AdaptiveWorkUnit *>(wu)->m_sampleOffset;
+	}
+
+	void load(Stream *stream) {
+		RectangularWorkUnit::load(stream);
+		m_sampleCount = stream->readInt();
+		m_sampleOffset = stream->readInt();
+	}
+
+	void save(Stream *stream) const {
+		RectangularWorkUnit::save(stream);
+		stream->writeInt(m_sampleCount);
+		stream->writeInt(m_sampleOffset);
+	}
+
+	inline int getSampleCount() const { return m_sampleCount; }
+	inline void setSampleCount(int sampleCount) { m_sampleCount = sampleCount; }
+
+	inline int getSampleOffset() const { return m_sampleOffset; }
+	inline void setSampleOffset(int sampleOffset) { m_sampleOffset = sampleOffset; }
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~AdaptiveWorkUnit() { }
+private:
+	int m_sampleCount, m_sampleOffset;
+};
+
+/// Image block that also carries the per-pixel sample statistics
+class AdaptiveImageBlock : public ImageBlock {
+public:
+	AdaptiveImageBlock(const Vector2i &size, const ReconstructionFilter *filter)
+		: ImageBlock(Bitmap::ESpectrumAlphaWeight, size, filter) {
+		m_statistics = new Bitmap(Bitmap::EMultiChannel, Bitmap::EFloat,
+			size, AdaptiveRenderProcess::EStatisticCount);
+	}
+
+	/* The statistics are always sent in full precision,
+	   since the variance estimate depends on all digits */
+	void load(Stream *stream) {
+		ImageBlock::load(stream);
+		loadStatistics(stream);
+	}
+
+	void save(Stream *stream) const {
+		ImageBlock::save(stream);
+		saveStatistics(stream);
+	}
+
+	void loadCompact(Stream *stream) {
+		ImageBlock::loadCompact(stream);
+		loadStatistics(stream);
+	}
+
+	void saveCompact(Stream *stream) const {
+		ImageBlock::saveCompact(stream);
+		saveStatistics(stream);
+	}
+
+	inline Bitmap *getStatistics() { return m_statistics; }
+	inline const Bitmap *getStatistics() const { return m_statistics.get(); }
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~AdaptiveImageBlock() { }
+
+	inline void loadStatistics(Stream *stream) {
+		stream->readFloatArray(m_statistics->getFloatData(),
+			m_statistics->getPixelCount() * AdaptiveRenderProcess::EStatisticCount);
+	}
+
+	inline void saveStatistics(Stream *stream) const {
+		stream->writeFloatArray(m_statistics->getFloatData(),
+			m_statistics->getPixelCount() * AdaptiveRenderProcess::EStatisticCount);
+	}
+private:
+	ref<Bitmap> m_statistics;
+};
+
+class AdaptiveBlockRenderer : public WorkProcessor {
+public:
+	AdaptiveBlockRenderer(int blockSize) : m_blockSize(blockSize) { }
+
+	AdaptiveBlockRenderer(Stream *stream, InstanceManager *manager) {
+		m_blockSize = stream->readInt();
+	}
+
+	ref<WorkUnit> createWorkUnit() const {
+		return new AdaptiveWorkUnit();
+	}
+
+	ref<WorkResult> createWorkResult() const {
+		return new AdaptiveImageBlock(Vector2i(m_blockSize),
+			m_sensor->getFilm()->getReconstructionFilter());
+	}
+
+	void prepare() {
+		Scene *scene = static_cast<Scene *>(getResource("scene"));
+		m_scene = new Scene(scene);
+		m_sampler = static_cast<Sampler *>(getResource("sampler"));
+		m_sensor = static_cast<Sensor *>(getResource("sensor"));
+		m_integrator = static_cast<SamplingIntegrator *>(getResource("integrator"));
+		m_scene->removeSensor(scene->getSensor());
+		m_scene->addSensor(m_sensor);
+		m_scene->setSensor(m_sensor);
+		m_scene->setSampler(m_sampler);
+		m_scene->setIntegrator(m_integrator);
+		m_integrator->wakeup(m_scene, m_resources);
+		m_scene->wakeup(m_scene, m_resources);
+		m_scene->initializeBidirectional();
+	}
+
+	void process(const WorkUnit *workUnit, WorkResult *workResult,
+		const bool &stop) {
+		const AdaptiveWorkUnit *wu = static_cast<const AdaptiveWorkUnit *>(workUnit);
+		AdaptiveImageBlock *block = static_cast<AdaptiveImageBlock *>(workResult);
+
+		block->setOffset(wu->getOffset());
+		block->setSize(wu->getSize());
+		block->clear();
+		block->getStatistics()->clear();
+		m_hilbertCurve.initialize(TVector2<uint8_t>(wu->getSize()));
+		const std::vector< TPoint2<uint8_t> > &points = m_hilbertCurve.getPoints();
+
+		const size_t sampleCount = (size_t) wu->getSampleCount(),
+		             sampleOffset = (size_t) wu->getSampleOffset(),
+		             samplerSampleCount = m_sampler->getSampleCount();
+		/* Scale the ray differentials by the total number of samples per pixel,
+		   so that samples of later passes are filtered like the earlier ones */
+		Float diffScaleFactor = 1.0f / std::sqrt((Float) (sampleOffset + sampleCount));
+		bool needsApertureSample = m_sensor->needsApertureSample();
+		bool needsTimeSample = m_sensor->needsTimeSample();
+
+		RadianceQueryRecord rRec(m_scene, m_sampler);
+		Point2 apertureSample(0.5f);
+		Float timeSample = 0.5f;
+		RayDifferential sensorRay;
+
+		uint32_t queryType = RadianceQueryRecord::ESensorRay;
+		if (!m_sensor->getFilm()->hasAlpha()) /* Don't compute an alpha channel if we don't have to */
+			queryType &= ~RadianceQueryRecord::EOpacity;
+
+		Float *statistics = block->getStatistics()->getFloatData();
+		const int width = block->getStatistics()->getWidth();
+
+		for (size_t i = 0; i<points.size(); ++i) {
+			Point2i offset = Point2i(points[i]) + Vector2i(block->getOffset());
+			if (stop)
+				break;
+
+			/* Continue the sample sequence of the pixel where the previous
+			   pass left off. Tiles may take more samples than the sampler
+			   provides sample arrays for -- start over when they run out */
+			double mean = 0, M2 = 0;
+			for (size_t j = 0; j<sampleCount; j++) {
+				size_t sampleIndex = (sampleOffset + j) % samplerSampleCount;
+				if (j == 0 || sampleIndex == 0)
+					m_sampler->generate(offset);
+				m_sampler->setSampleIndex(sampleIndex);
+
+				rRec.newQuery(queryType, m_sensor->getMedium());
+				rRec.extra = RadianceQueryRecord::EAdaptiveQuery;
+				Point2 samplePos(Point2(offset) + Vector2(rRec.nextSample2D()));
+
+				if (needsApertureSample)
+					apertureSample = rRec.nextSample2D();
+				if (needsTimeSample)
+					timeSample = rRec.nextSample1D();
+
+				Spectrum spec = m_sensor->sampleRayDifferential(
+					sensorRay, samplePos, apertureSample, timeSample);
+
+				sensorRay.scaleDifferential(diffScaleFactor);
+
+				spec *= m_integrator->Li(sensorRay, rRec);
+
+				/* Invalid samples are discarded by put() and count as black */
+				Float luminance = block->put(samplePos, spec, rRec.alpha)
+					? spec.getLuminance() : (Float) 0;
+
+				/* Numerically robust online variance estimation using an
+				   algorithm proposed by Donald Knuth (TAOCP vol.2, 3rd ed., p.232) */
+				double delta = luminance - mean;
+				mean += delta / (double) (j + 1);
+				M2 += delta * (luminance - mean);
+			}
+
+			Float *pixel = statistics + (points[i].y * width + points[i].x)
+				* AdaptiveRenderProcess::EStatisticCount;
+			pixel[AdaptiveRenderProcess::ESampleCount] = (Float) sampleCount;
+			pixel[AdaptiveRenderProcess::ELuminanceMean] = (Float) mean;
+			pixel[AdaptiveRenderProcess::ELuminanceM2] = (Float) M2;
+		}
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		stream->writeInt(m_blockSize);
+	}
+
+	ref<WorkProcessor> clone() const {
+		return new AdaptiveBlockRenderer(m_blockSize);
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~AdaptiveBlockRenderer() { }
+private:
+	ref<Scene> m_scene;
+	ref<Sensor> m_sensor;
+	ref<Sampler> m_sampler;
+	ref<SamplingIntegrator> m_integrator;
+	int m_blockSize;
+	HilbertCurve2D<uint8_t> m_hilbertCurve;
+};
+
+AdaptiveRenderProcess::AdaptiveRenderProcess(const RenderJob *parent, RenderQueue *queue,
+		const std::vector<Tile> &tiles, int blockSize, Bitmap *statistics,
+		const Point2i &origin, Float timeout, int pass) : m_queue(queue),
+		m_parent(parent), m_tiles(tiles), m_tileIndex(0), m_blockSize(blockSize),
+		m_statistics(statistics), m_origin(origin), m_timeout(timeout),
+		m_timedOut(false), m_resultCount(0) {
+	m_resultMutex = new Mutex();
+	m_timer = new Timer();
+	m_progress = new ProgressReporter(formatString("Rendering (pass %i)", pass),
+		m_tiles.size(), m_parent);
+}
+
+AdaptiveRenderProcess::~AdaptiveRenderProcess() {
+	if (m_progress)
+		delete m_progress;
+}
+
+ref<WorkProcessor> AdaptiveRenderProcess::createWorkProcessor() const {
+	return new AdaptiveBlockRenderer(m_blockSize);
+}
+
+void AdaptiveRenderProcess::processResult(const WorkResult *result, bool cancelled) {
+	const AdaptiveImageBlock *block = static_cast<const AdaptiveImageBlock *>(result);
+
+	/* The tiles of a pass don't overlap, hence their
+	   statistics can be merged without locking */
+	if (!cancelled)
+		mergeStatistics(block->getStatistics(),
+			Point2i(block->getOffset() - m_origin), block->getSize());
+
+	bool concurrent = m_film->supportsConcurrentPut();
+	if (concurrent)
+		m_film->put(block);
+
+	UniqueLock lock(m_resultMutex);
+	if (!concurrent)
+		m_film->put(block);
+	m_progress->update(++m_resultCount);
+	lock.unlock();
+	m_queue->signalWorkEnd(m_parent, block, cancelled);
+}
+
+void AdaptiveRenderProcess::mergeStatistics(const Bitmap *source,
+		const Point2i &targetOffset, const Vector2i &size) {
+	const Float *src = source->getFloatData();
+	Float *target = m_statistics->getFloatData();
+	const int srcWidth = source->getWidth(), targetWidth = m_statistics->getWidth();
+
+	for (int y=0; y<size.y; ++y) {
+		const Float *a = src + y * (size_t) srcWidth * EStatisticCount;
+		Float *b = target + ((targetOffset.y + y) * (size_t) targetWidth
+			+ targetOffset.x) * EStatisticCount;
+
+		for (int x=0; x<size.x; ++x, a += EStatisticCount, b += EStatisticCount) {
+			double nA = a[ESampleCount], nB = b[ESampleCount];
+			if (nA == 0)
+				continue;
+
+			/* Combine the mean and M2 of both sample sets (Chan et al.,
+			   "Updating formulae and a pairwise algorithm for computing
+			   sample variances", 1979) */
+			double n = nA + nB,
+			       delta = (double) a[ELuminanceMean] - (double) b[ELuminanceMean];
+			b[ESampleCount] = (Float) n;
+			b[ELuminanceMean] = (Float) (b[ELuminanceMean] + delta * nA / n);
+			b[ELuminanceM2] = (Float) ((double) b[ELuminanceM2] + a[ELuminanceM2]
+				+ delta * delta * nA * nB / n);
+		}
+	}
+}
+
+ParallelProcess::EStatus AdaptiveRenderProcess::generateWork(WorkUnit *unit, int worker) {
+	if (m_tileIndex >= m_tiles.size())
+		return EFailure;
+
+	/* Tiles that were already started are still finished */
+	if (m_timer->getSeconds() > m_timeout) {
+		m_timedOut = true;
+		return EFailure;
+	}
+
+	const Tile &tile = m_tiles[m_tileIndex++];
+	AdaptiveWorkUnit *wu = static_cast<AdaptiveWorkUnit *>(unit);
+	wu->setOffset(tile.offset);
+	wu->setSize(tile.size);
+	wu->setSampleCount(tile.sampleCount);
+	wu->setSampleOffset(tile.sampleOffset);
+	m_queue->signalWorkBegin(m_parent, wu, worker);
+	return ESuccess;
+}
+
+void AdaptiveRenderProcess::bindResource(const std::string &name, int id) {
+	if (name == "sensor") {
+		m_film = static_cast<Sensor *>(Scheduler::getInstance()->getResource(id))->getFilm();
+		if (m_blockSize < m_film->getReconstructionFilter()->getBorderSize())
+			Log(EError, "The block size must be larger than the image reconstruction filter radius!");
+	}
+	ParallelProcess::bindResource(name, id);
+}
+
+MTS_IMPLEMENT_CLASS(AdaptiveWorkUnit, false, RectangularWorkUnit)
+MTS_IMPLEMENT_CLASS(AdaptiveImageBlock, false, ImageBlock)
+MTS_IMPLEMENT_CLASS_S(AdaptiveBlockRenderer, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS(AdaptiveRenderProcess, false, ParallelProcess)
+MTS_NAMESPACE_END
@@ -0,0 +1,110 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#if !defined(__ADAPTIVE_PROC_H)
+#define __ADAPTIVE_PROC_H
+
+#include <mitsuba/render/scene.h>
+#include <mitsuba/render/renderqueue.h>
+#include <mitsuba/core/timer.h>
+
+MTS_NAMESPACE_BEGIN
+
+/**
+ * Parallel process that renders one pass of the image-space adaptive
+ * integrator. Every tile of the image is rendered with its own number of
+ * samples per pixel, and the samples are accumulated into the film.
+ * In addition, the process records the number of samples as well as the
+ * mean and the sum of squared deviations from the mean (M2) of the sample
+ * luminances of every pixel, which are used to estimate the remaining error.
+ */
+class AdaptiveRenderProcess : public ParallelProcess {
+public:
+	/// Channels of the per-pixel statistics
+	enum EStatistic {
+		ESampleCount = 0,
+		ELuminanceMean,
+		ELuminanceM2,
+		EStatisticCount
+	};
+
+	/**
+	 * Image tile along with the number of samples per pixel for this pass
+	 * and the number of samples per pixel that it received in earlier passes
+	 */
+	struct Tile {
+		Point2i offset;
+		Vector2i size;
+		int sampleCount;
+		int sampleOffset;
+	};
+
+	/**
+	 * \param tiles
+	 *    Tiles to be rendered in this pass (in this order)
+	 * \param statistics
+	 *    Float bitmap with \ref EStatisticCount channels, into which
+	 *    the per-pixel statistics of this pass are merged
+	 * \param origin
+	 *    Pixel position of the upper left corner of \c statistics
+	 * \param timeout
+	 *    No more tiles are started after this many seconds
+	 */
+	AdaptiveRenderProcess(const RenderJob *parent, RenderQueue *queue,
+		const std::vector<Tile> &tiles, int blockSize, Bitmap *statistics,
+		const Point2i &origin, Float timeout, int pass);
+
+	/// Were some of the tiles skipped because the pass ran out of time?
+	inline bool hasTimedOut() const { return m_timedOut; }
+
+	/// Return the number of tiles that were rendered
+	inline int getResultCount() const { return m_resultCount; }
+
+	ref<WorkProcessor> createWorkProcessor() const;
+	void processResult(const WorkResult *result, bool cancelled);
+	void bindResource(const std::string &name, int id);
+	EStatus generateWork(WorkUnit *unit, int worker);
+
+	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~AdaptiveRenderProcess();
+
+	/// Merge the statistics of a tile into \c m_statistics
+	void mergeStatistics(const Bitmap *source,
+		const Point2i &targetOffset, const Vector2i &size);
+private:
+	ref<RenderQueue> m_queue;
+	ref<Film> m_film;
+	const RenderJob *m_parent;
+	std::vector<Tile> m_tiles;
+	size_t m_tileIndex;
+	int m_blockSize;
+	ref<Bitmap> m_statistics;
+	Point2i m_origin;
+	ref<Timer> m_timer;
+	Float m_timeout;
+	bool m_timedOut;
+	int m_resultCount;
+	ref<Mutex> m_resultMutex;
+	ProgressReporter *m_progress;
+};
+
+MTS_NAMESPACE_END
+
+#endif /* __ADAPTIVE_PROC_H */
@@ -0,0 +1,433 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/scene.h>
+#include <mitsuba/render/renderproc.h>
+
+MTS_NAMESPACE_BEGIN
+
+/*!\plugin{aov}{AOV integrator}
+ * \order{19}
+ * \parameters{
+ *     \parameter{aovSamples}{\Integer}{Number of samples per pixel that
+ *     are used to compute the AOVs. Their values are averaged over
+ *     the samples that hit a surface \default{1}}
+ *     \parameter{\Unnamed}{\Integrator}{Sub-integrator that renders the
+ *     regular image (e.g. \pluginref{path})}
+ * }
+ *
+ * This integrator renders an image using a nested integrator and, in the
+ * same pass, records auxiliary per-pixel outputs (AOVs) such as depth,
+ * surface normals, UV coordinates or an object mask. The list of AOVs and
+ * their output formats are specified by the film, which must be
+ * an \pluginref{aovfilm}.
+ *
+ * In contrast to the combination of \pluginref{multichannel} and
+ * \pluginref{field}, the AOVs are only evaluated for the first
+ * \code{aovSamples} samples of each pixel, and they reuse the
+ * intersection that the nested integrator needs anyway. They are not
+ * blurred by the reconstruction filter, hence their cost is negligible
+ * compared to the regular rendering. Since the AOVs of a surface are
+ * averaged only over the samples that hit it, pixels on silhouettes
+ * report the values of the surface instead of blending them with
+ * zero. The \code{mask} stores the fraction of these samples that hit a
+ * surface, and pixels where none of them did store zero in all AOV
+ * channels.
+ *
+ * The integer \code{objectId} and \code{partId} labels and their
+ * \code{coverage} are the exception: they are determined from all samples
+ * of a pixel, which then reports the ID pair hit by most of its samples
+ * (again without any filtering). These require an intersection for every
+ * sample, which the nested integrator computes regardless.
+ *
+ * \begin{xml}[caption=Rendering an image together with depth, normals and a mask]
+ * <integrator type="aov">
+ *     <integrator type="path"/>
+ * </integrator>
+ *
+ * <sensor type="perspective">
+ *     <film type="aovfilm">
+ *         <string name="aovs" value="depth:png16, shNormal:png, mask:png"/>
+ *     </film>
+ * </sensor>
+ * \end{xml}
+ *
+ * \remarks{
+ * \item The nested integrator must conform to Mitsuba's basic
+ * \emph{SamplingIntegrator} interface (see \pluginref{multichannel}).
+ * }
+ */
+
+class AOVIntegrator : public SamplingIntegrator {
+public:
+	AOVIntegrator(const Properties &props) : SamplingIntegrator(props) {
+		m_aovSamples = props.getSize("aovSamples", 1);
+		if (m_aovSamples == 0)
+			Log(EError, "The 'aovSamples' parameter must be positive!");
+	}
+
+	AOVIntegrator(Stream *stream, InstanceManager *manager)
+	 : SamplingIntegrator(stream, manager) {
+		m_subIntegrator = static_cast<SamplingIntegrator *>(manager->getInstance(stream));
+		m_aovSamples = stream->readSize();
+		m_aovs.resize(stream->readSize());
+		for (size_t i=0; i<m_aovs.size(); ++i) {
+			m_aovs[i].type = (AOV::EType) stream->readInt();
+			m_aovs[i].offset = stream->readInt();
+		}
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		SamplingIntegrator::serialize(stream, manager);
+		manager->serialize(stream, m_subIntegrator.get());
+		stream->writeSize(m_aovSamples);
+		stream->writeSize(m_aovs.size());
+		for (size_t i=0; i<m_aovs.size(); ++i) {
+			stream->writeInt((int) m_aovs[i].type);
+			stream->writeInt(m_aovs[i].offset);
+		}
+	}
+
+	void configure() {
+		SamplingIntegrator::configure();
+		if (!m_subIntegrator)
+			Log(EError, "No sub-integrator was specified!");
+	}
+
+	bool preprocess(const Scene *scene, RenderQueue *queue,
+		const RenderJob *job, int sceneResID, int sensorResID,
+		int samplerResID) {
+		if (!SamplingIntegrator::preprocess(scene, queue, job, sceneResID,
+				sensorResID, samplerResID))
+			return false;
+		return m_subIntegrator->preprocess(scene, queue, job, sceneResID,
+				sensorResID, samplerResID);
+	}
+
+	bool render(Scene *scene,
+			RenderQueue *queue, const RenderJob *job,
+			int sceneResID, int sensorResID, int samplerResID) {
+		ref<Scheduler> sched = Scheduler::getInstance();
+		ref<Sensor> sensor = static_cast<Sensor *>(sched->getResource(sensorResID));
+		ref<Film> film = sensor->getFilm();
+
+		size_t nCores = sched->getCoreCount();
+		const Sampler *sampler = static_cast<const Sampler *>(sched->getResource(samplerResID, 0));
+		size_t sampleCount = sampler->getSampleCount();
+
+		m_aovs = film->getAOVs();
+		if (m_aovs.empty())
+			Log(EError, "The AOV integrator requires a film that records AOVs (e.g. aovfilm)!");
+
+		int channelCount = SPECTRUM_SAMPLES + 2;
+		for (size_t i=0; i<m_aovs.size(); ++i)
+			channelCount += AOV::getChannelCount(m_aovs[i].type);
+
+		Log(EInfo, "Starting render job (%ix%i, " SIZE_T_FMT " %s, " SIZE_T_FMT
+			" %s, " SSE_STR ") ..", film->getCropSize().x, film->getCropSize().y,
+			sampleCount, sampleCount == 1 ? "sample" : "samples", nCores,
+			nCores == 1 ? "core" : "cores");
+
+		/* This is a sampling-based integrator - parallelize */
+		ref<BlockedRenderProcess> proc = new BlockedRenderProcess(job,
+			queue, scene->getBlockSize());
+
+		proc->setPixelFormat(Bitmap::EMultiChannel, channelCount);
+
+		int integratorResID = sched->registerResource(this);
+		proc->bindResource("integrator", integratorResID);
+		proc->bindResource("scene", sceneResID);
+		proc->bindResource("sensor", sensorResID);
+		proc->bindResource("sampler", samplerResID);
+		scene->bindUsedResources(proc);
+		bindUsedResources(proc);
+		sched->schedule(proc);
+
+		m_process = proc;
+		sched->wait(proc);
+		m_process = NULL;
+		sched->unregisterResource(integratorResID);
+
+		return proc->getReturnStatus() == ParallelProcess::ESuccess;
+	}
+
+	/// Add the AOVs of a surface interaction to a per-pixel sum
+	void accumulateAOVs(const Transform &worldToSensor,
+			const Intersection &its, Float *sum) const {
+		if (!its.isValid())
+			return;
+
+		for (size_t i=0; i<m_aovs.size(); ++i) {
+			Float *value = sum + m_aovs[i].offset;
+
+			switch (m_aovs[i].type) {
+				case AOV::EDepth:
+					value[0] += worldToSensor(its.p).z;
+					break;
+				case AOV::EDistance:
+					value[0] += its.t;
+					break;
+				case AOV::EPosition:
+					for (int k=0; k<3; ++k)
+						value[k] += its.p[k];
+					break;
+				case AOV::EGeometricNormal:
+					for (int k=0; k<3; ++k)
+						value[k] += its.geoFrame.n[k];
+					break;
+				case AOV::EShadingNormal:
+					for (int k=0; k<3; ++k)
+						value[k] += its.shFrame.n[k];
+					break;
+				case AOV::EUV:
+					value[0] += its.uv.x;
+					value[1] += its.uv.y;
+					break;
+				case AOV::EAlbedo: {
+						const BSDF *bsdf = its.getBSDF();
+						if (bsdf) {
+							Float r, g, b;
+							bsdf->getDiffuseReflectance(its).toLinearRGB(r, g, b);
+							value[0] += r; value[1] += g; value[2] += b;
+						}
+					}
+					break;
+				case AOV::EMask:
+					value[0] += 1;
+					break;
+				case AOV::EObjectID:
+				case AOV::EPartID:
+				case AOV::ECoverage:
+					/* Determined per pixel, see renderBlock() */
+					break;
+				default:
+					Log(EError, "Internal error!");
+			}
+		}
+	}
+
+	/// Number of samples of a pixel that hit a certain object/part ID pair
+	struct IDCount {
+		int objectID, partID;
+		size_t count;
+
+		inline IDCount(int objectID, int partID)
+			: objectID(objectID), partID(partID), count(0) { }
+	};
+
+	/// Count a sample of the current pixel
+	static inline void countID(std::vector<IDCount> &counts, const Intersection &its) {
+		int objectID = 0, partID = 0;
+		if (its.isValid()) {
+			objectID = (its.instance ? its.instance : its.shape)->getObjectID();
+			partID = its.shape->getPartID();
+		}
+
+		for (size_t i=0; i<counts.size(); ++i) {
+			if (counts[i].objectID == objectID && counts[i].partID == partID) {
+				counts[i].count++;
+				return;
+			}
+		}
+		counts.push_back(IDCount(objectID, partID));
+		counts.back().count++;
+	}
+
+	void renderBlock(const Scene *scene,
+			const Sensor *sensor, Sampler *sampler, ImageBlock *block,
+			const bool &stop, const std::vector< TPoint2<uint8_t> > &points) const {
+
+		Float diffScaleFactor = 1.0f /
+			std::sqrt((Float) sampler->getSampleCount());
+
+		bool needsApertureSample = sensor->needsApertureSample();
+		bool needsTimeSample = sensor->needsTimeSample();
+
+		RadianceQueryRecord rRec(scene, sampler);
+		Point2 apertureSample(0.5f);
+		Float timeSample = 0.5f;
+		RayDifferential sensorRay;
+
+		/* Only the leading spectrum, alpha and weight channels are
+		   filtered -- the AOVs are directly written into their pixel */
+		block->clear();
+		block->setFilteredChannelCount(SPECTRUM_SAMPLES + 2);
+
+		Bitmap *bitmap = block->getBitmap();
+		const int channels = bitmap->getChannelCount(),
+		          borderSize = block->getBorderSize();
+		const size_t aovSamples = std::min(m_aovSamples, sampler->getSampleCount());
+		const Float invAOVSamples = 1 / (Float) aovSamples;
+
+		/* Integer IDs and the coverage use all samples of a pixel */
+		bool hasIDs = false, hasDepth = false;
+		for (size_t i=0; i<m_aovs.size(); ++i) {
+			hasIDs |= AOV::isCoverageBased(m_aovs[i].type);
+			hasDepth |= m_aovs[i].type == AOV::EDepth;
+		}
+		std::vector<IDCount> idCounts;
+
+		/* The depth needs the inverse sensor transformation, which only
+		   has to be recomputed when the time of the ray changes */
+		Transform worldToSensor;
+		Float worldToSensorTime = std::numeric_limits<Float>::quiet_NaN();
+
+		uint32_t queryType = RadianceQueryRecord::ESensorRay;
+		Float *aovSum = (Float *) alloca(sizeof(Float) * channels);
+		Float temp[SPECTRUM_SAMPLES + 2];
+
+		for (size_t i = 0; i<points.size(); ++i) {
+			Point2i offset = Point2i(points[i]) + Vector2i(block->getOffset());
+			if (stop)
+				break;
+
+			sampler->generate(offset);
+			memset(aovSum, 0, sizeof(Float) * channels);
+			idCounts.clear();
+			size_t hits = 0;
+
+			for (size_t j = 0; j<sampler->getSampleCount(); j++) {
+				rRec.newQuery(queryType, sensor->getMedium());
+				Point2 samplePos(Point2(offset) + Vector2(rRec.nextSample2D()));
+
+				if (needsApertureSample)
+					apertureSample = rRec.nextSample2D();
+
+				if (needsTimeSample)
+					timeSample = rRec.nextSample1D();
+
+				Spectrum spec = sensor->sampleRayDifferential(
+					sensorRay, samplePos, apertureSample, timeSample);
+
+				sensorRay.scaleDifferential(diffScaleFactor);
+
+				if (j < aovSamples || hasIDs) {
+					/* The sub-integrator reuses this intersection */
+					rRec.rayIntersect(sensorRay);
+					if (j < aovSamples && rRec.its.isValid()) {
+						if (hasDepth && sensorRay.time != worldToSensorTime) {
+							worldToSensor = sensor->getWorldTransform()->eval(
+								sensorRay.time).inverse();
+							worldToSensorTime = sensorRay.time;
+						}
+						accumulateAOVs(worldToSensor, rRec.its, aovSum);
+						hits++;
+					}
+					if (hasIDs)
+						countID(idCounts, rRec.its);
+				}
+
+				spec *= m_subIntegrator->Li(sensorRay, rRec);
+
+				for (int k = 0; k<SPECTRUM_SAMPLES; ++k)
+					temp[k] = spec[k];
+				temp[SPECTRUM_SAMPLES] = rRec.alpha;
+				temp[SPECTRUM_SAMPLES + 1] = 1.0f;
+				block->put(samplePos, temp);
+				sampler->advance();
+			}
+
+			Float *dest = bitmap->getFloatData() + ((points[i].y + borderSize)
+				* (size_t) bitmap->getWidth() + points[i].x + borderSize) * channels;
+			/* Average over the samples that hit a surface, except for
+			   the mask, which records the fraction of these samples */
+			const Float invHits = hits > 0 ? 1 / (Float) hits : (Float) 0;
+			for (int k = SPECTRUM_SAMPLES + 2; k<channels; ++k)
+				dest[k] = aovSum[k] * invHits;
+			for (size_t k=0; k<m_aovs.size(); ++k) {
+				if (m_aovs[k].type == AOV::EMask)
+					dest[m_aovs[k].offset] = hits * invAOVSamples;
+			}
+
+			if (hasIDs && !idCounts.empty()) {
+				/* Report the IDs that were hit by most samples */
+				const IDCount *best = &idCounts[0];
+				size_t total = 0;
+				for (size_t k=0; k<idCounts.size(); ++k) {
+					if (idCounts[k].count > best->count)
+						best = &idCounts[k];
+					total += idCounts[k].count;
+				}
+
+				for (size_t k=0; k<m_aovs.size(); ++k) {
+					Float &value = dest[m_aovs[k].offset];
+					switch (m_aovs[k].type) {
+						case AOV::EObjectID: value = (Float) best->objectID; break;
+						case AOV::EPartID: value = (Float) best->partID; break;
+						case AOV::ECoverage: value = best->count / (Float) total; break;
+						default: break;
+					}
+				}
+			}
+		}
+	}
+
+	void bindUsedResources(ParallelProcess *proc) const {
+		SamplingIntegrator::bindUsedResources(proc);
+		m_subIntegrator->bindUsedResources(proc);
+	}
+
+	void wakeup(ConfigurableObject *parent, std::map<std::string, SerializableObject *> &params) {
+		SamplingIntegrator::wakeup(parent, params);
+		m_subIntegrator->wakeup(parent, params);
+	}
+
+	void configureSampler(const Scene *scene, Sampler *sampler) {
+		SamplingIntegrator::configureSampler(scene, sampler);
+		m_subIntegrator->configureSampler(scene, sampler);
+	}
+
+	void addChild(const std::string &name, ConfigurableObject *child) {
+		if (child->getClass()->derivesFrom(MTS_CLASS(SamplingIntegrator))) {
+			if (m_subIntegrator)
+				Log(EError, "The AOV integrator only supports a single sub-integrator!");
+			m_subIntegrator = static_cast<SamplingIntegrator *>(child);
+		} else {
+			SamplingIntegrator::addChild(name, child);
+		}
+	}
+
+	Spectrum Li(const RayDifferential &r, RadianceQueryRecord &rRec) const {
+		return m_subIntegrator->Li(r, rRec);
+	}
+
+	const Integrator *getSubIntegrator(int idx) const {
+		if (idx != 0)
+			return NULL;
+		return m_subIntegrator.get();
+	}
+
+	std::string toString() const {
+		std::ostringstream oss;
+		oss << "AOVIntegrator[" << endl
+			<< "  aovSamples = " << m_aovSamples << "," << endl
+			<< "  subIntegrator = " << indent(m_subIntegrator->toString()) << endl
+			<< "]";
+		return oss.str();
+	}
+
+	MTS_DECLARE_CLASS()
+private:
+	ref<SamplingIntegrator> m_subIntegrator;
+	std::vector<AOV> m_aovs;
+	size_t m_aovSamples;
+};
+
+MTS_IMPLEMENT_CLASS_S(AOVIntegrator, false, SamplingIntegrator)
+MTS_EXPORT_PLUGIN(AOVIntegrator, "AOV integrator");
+MTS_NAMESPACE_END
@@ -0,0 +1,589 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/scene.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/qmc.h>
+
+#if defined(MTS_HAS_COHERENT_RT)
+#include <mitsuba/core/ray_sse.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter avgPathLength("Wavefront path tracer", "Average path length", EAverage);
+static StatsCounter avgWavefrontSize("Wavefront path tracer", "Average wavefront size", EAverage);
+
+/*! \plugin{wavefrontpath}{Wavefront path tracer}
+ * \order{18}
+ * \parameters{
+ *     \parameter{maxDepth}{\Integer}{Specifies the longest path depth
+ *         in the generated output image (where \code{-1} corresponds to $\infty$).
+ *	       A value of \code{1} will only render directly visible light sources.
+ *	       \code{2} will lead to single-bounce (direct-only) illumination,
+ *	       and so on. \default{\code{-1}}
+ *	   }
+ *	   \parameter{rrDepth}{\Integer}{Specifies the minimum path depth, after
+ *	      which the implementation will start to use the ``russian roulette''
+ *	      path termination criterion. \default{\code{5}}
+ *	   }
+ *     \parameter{strictNormals}{\Boolean}{Be strict about potential
+ *        inconsistencies involving shading normals? See the description of
+ *        \pluginref{path} for details.\default{no, i.e. \code{false}}
+ *     }
+ *     \parameter{hideEmitters}{\Boolean}{Hide directly visible emitters?
+ *        See page~\pageref{sec:hideemitters} for details.
+ *        \default{no, i.e. \code{false}}
+ *     }
+ *     \parameter{wavefrontSize}{\Integer}{Maximum number of paths that are
+ *        traced simultaneously by each worker thread. \default{\code{4096}}
+ *     }
+ * }
+ *
+ * This integrator computes the same estimate as the \pluginref{path} plugin,
+ * but it reorganizes the computation: instead of tracing one path after
+ * the other, it generates the camera rays of many pixel samples of an image
+ * block at once and then advances all of these paths together, one bounce
+ * at a time. Each bounce consists of separate stages that process queues of
+ * paths: shading (emission, emitter sampling and BSDF sampling), a shadow
+ * ray test for all emitter samples, and the intersection of all continued
+ * paths with the scene. When Mitsuba is compiled with support for coherent
+ * ray tracing, the intersection stage passes groups of four rays to the
+ * kd-tree packet traversal routines.
+ *
+ * Processing the paths in stages improves the instruction and data cache
+ * locality of each stage, which can make this integrator faster than
+ * \pluginref{path} on scenes with large numbers of shapes and materials.
+ * The \code{wavefrontSize} parameter bounds the memory that is needed to
+ * hold the state of the active paths.
+ *
+ * Since the samplers in Mitsuba generate their samples in a fixed sequence
+ * per pixel sample, only the camera sample (pixel position, aperture
+ * and time) is taken from the selected sampler. The random numbers used
+ * by later bounces are generated by hashing a path-specific seed with the
+ * sample dimension (see \code{sampleTEA}). The resulting images are
+ * statistically equivalent to those of \pluginref{path} but differ
+ * in their noise pattern.
+ *
+ * \remarks{
+ *    \item This integrator does not handle participating media
+ * }
+ */
+class WavefrontPathTracer : public MonteCarloIntegrator {
+public:
+	/// Flags that describe the state of a path
+	enum EPathFlags {
+		/// The path has undergone a non-null scattering event
+		EScattered   = 0x01,
+
+		/// The current ray was generated by sampling a BSDF
+		EBSDFSample  = 0x02,
+
+		/// .. and that BSDF sample was from a delta component
+		EDeltaSample = 0x04
+	};
+
+	/**
+	 * \brief State of a set of paths in structure-of-arrays layout
+	 *
+	 * Each stage only touches the arrays it needs, and the stages
+	 * communicate by means of queues that store path indices.
+	 */
+	struct PathQueue {
+		/* Per-path state */
+		std::vector<RayDifferential> ray;
+		std::vector<Intersection> its;
+		std::vector<DirectSamplingRecord> dRec;
+		std::vector<Spectrum> throughput;
+		std::vector<Spectrum> weight;
+		std::vector<Spectrum> Li;
+		std::vector<Point2> samplePos;
+		std::vector<Float> alpha;
+		std::vector<Float> eta;
+		std::vector<Float> bsdfPdf;
+		std::vector<uint32_t> seed;
+		std::vector<uint32_t> dimension;
+		std::vector<int> depth;
+		std::vector<int> type;
+		std::vector<uint8_t> flags;
+
+		/* Paths that are processed by the next shading stage */
+		std::vector<uint32_t> active;
+
+		/* Paths that will continue with another bounce */
+		std::vector<uint32_t> next;
+
+		/* Pending shadow rays and their contributions */
+		std::vector<Ray> shadowRay;
+		std::vector<Spectrum> shadowValue;
+		std::vector<uint32_t> shadowPath;
+
+		inline size_t size() const { return ray.size(); }
+
+		void resize(size_t size) {
+			ray.resize(size);
+			its.resize(size);
+			dRec.resize(size);
+			throughput.resize(size);
+			weight.resize(size);
+			Li.resize(size);
+			samplePos.resize(size);
+			alpha.resize(size);
+			eta.resize(size);
+			bsdfPdf.resize(size);
+			seed.resize(size);
+			dimension.resize(size);
+			depth.resize(size);
+			type.resize(size);
+			flags.resize(size);
+		}
+
+		/// Initialize the state of a new path
+		inline void init(uint32_t i, int _type, int _depth, uint32_t _seed) {
+			throughput[i] = Spectrum(1.0f);
+			weight[i] = Spectrum(1.0f);
+			Li[i] = Spectrum(0.0f);
+			alpha[i] = 1.0f;
+			eta[i] = 1.0f;
+			bsdfPdf[i] = 0.0f;
+			seed[i] = _seed;
+			dimension[i] = 0;
+			depth[i] = _depth;
+			type[i] = _type;
+			flags[i] = 0;
+		}
+
+		/// Draw a 1D sample from the hashed sequence of a path
+		inline Float next1D(uint32_t i) {
+			return sampleTEAFloat(seed[i], dimension[i]++);
+		}
+
+		/// Draw a 2D sample from the hashed sequence of a path
+		inline Point2 next2D(uint32_t i) {
+			Float x = next1D(i);
+			return Point2(x, next1D(i));
+		}
+	};
+
+	WavefrontPathTracer(const Properties &props)
+		: MonteCarloIntegrator(props) {
+		m_wavefrontSize = props.getSize("wavefrontSize", 4096);
+		if (m_wavefrontSize == 0)
+			Log(EError, "The 'wavefrontSize' parameter must be positive!");
+	}
+
+	/// Unserialize from a binary data stream
+	WavefrontPathTracer(Stream *stream, InstanceManager *manager)
+		: MonteCarloIntegrator(stream, manager) {
+		m_wavefrontSize = stream->readSize();
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		MonteCarloIntegrator::serialize(stream, manager);
+		stream->writeSize(m_wavefrontSize);
+	}
+
+	void renderBlock(const Scene *scene, const Sensor *sensor,
+		Sampler *sampler, ImageBlock *block, const bool &stop,
+		const std::vector< TPoint2<uint8_t> > &points) const {
+
+		Float diffScaleFactor = 1.0f /
+			std::sqrt((Float) sampler->getSampleCount());
+
+		bool needsApertureSample = sensor->needsApertureSample();
+		bool needsTimeSample = sensor->needsTimeSample();
+		size_t sampleCount = sampler->getSampleCount();
+
+		int queryType = RadianceQueryRecord::ESensorRay;
+		if (!sensor->getFilm()->hasAlpha()) /* Don't compute an alpha channel if we don't have to */
+			queryType &= ~RadianceQueryRecord::EOpacity;
+
+		Point2 apertureSample(0.5f);
+		Float timeSample = 0.5f;
+		size_t pointIndex = 0, sampleIndex = 0;
+		uint32_t pathCounter = 0;
+
+		PathQueue queue;
+		queue.resize(std::min(m_wavefrontSize, points.size() * sampleCount));
+
+		block->clear();
+
+		while (pointIndex < points.size() && !stop) {
+			/* ==================================================================== */
+			/*                        Camera ray generation                         */
+			/* ==================================================================== */
+
+			uint32_t pathCount = 0;
+			Point2i offset;
+			queue.active.clear();
+
+			while (pathCount < queue.size() && pointIndex < points.size()) {
+				offset = Point2i(points[pointIndex]) + Vector2i(block->getOffset());
+				if (sampleIndex == 0)
+					sampler->generate(offset);
+
+				uint32_t i = pathCount++;
+				Point2 samplePos(Point2(offset) + Vector2(sampler->next2D()));
+
+				if (needsApertureSample)
+					apertureSample = sampler->next2D();
+				if (needsTimeSample)
+					timeSample = sampler->next1D();
+
+				queue.init(i, queryType, 1, createSeed(sampler->next1D(), pathCounter++));
+				queue.samplePos[i] = samplePos;
+				queue.weight[i] = sensor->sampleRayDifferential(
+					queue.ray[i], samplePos, apertureSample, timeSample);
+				queue.ray[i].scaleDifferential(diffScaleFactor);
+				queue.active.push_back(i);
+
+				sampler->advance();
+				if (++sampleIndex == sampleCount) {
+					sampleIndex = 0;
+					++pointIndex;
+				}
+			}
+
+			intersect(scene, queue, queue.active);
+
+			for (uint32_t i=0; i<pathCount; ++i) {
+				if ((queue.type[i] & RadianceQueryRecord::EOpacity) && !queue.its[i].isValid())
+					queue.alpha[i] = 0.0f;
+				queue.type[i] &= ~RadianceQueryRecord::EIntersection;
+			}
+
+			trace(scene, sampler, queue);
+
+			for (uint32_t i=0; i<pathCount; ++i)
+				block->put(queue.samplePos[i], queue.weight[i] * queue.Li[i], queue.alpha[i]);
+		}
+	}
+
+	Spectrum Li(const RayDifferential &ray, RadianceQueryRecord &rRec) const {
+		/* Trace a wavefront consisting of a single path */
+		PathQueue queue;
+		queue.resize(1);
+
+		/* Perform the first ray intersection (or ignore if the
+		   intersection has already been provided). */
+		rRec.rayIntersect(ray);
+
+		queue.init(0, rRec.type, rRec.depth, createSeed(rRec.nextSample1D(), 0));
+		queue.ray[0] = ray;
+		queue.its[0] = rRec.its;
+		queue.active.push_back(0);
+
+		trace(rRec.scene, rRec.sampler, queue);
+
+		rRec.depth = queue.depth[0];
+		return queue.Li[0];
+	}
+
+	/**
+	 * \brief Advance all paths in the \c active queue (whose first
+	 * intersection is already known) until they terminate
+	 */
+	void trace(const Scene *scene, Sampler *sampler, PathQueue &queue) const {
+		avgWavefrontSize.incrementBase();
+		avgWavefrontSize += queue.active.size();
+
+		for (size_t i=0; i<queue.active.size(); ++i)
+			avgPathLength.incrementBase();
+
+		while (!queue.active.empty()) {
+			queue.next.clear();
+			queue.shadowRay.clear();
+			queue.shadowValue.clear();
+			queue.shadowPath.clear();
+
+			/* Shading, emitter sampling and BSDF sampling */
+			for (size_t i=0; i<queue.active.size(); ++i)
+				shade(scene, sampler, queue, queue.active[i]);
+
+			/* Shadow test for all emitter samples */
+			for (size_t i=0; i<queue.shadowRay.size(); ++i) {
+				if (!scene->rayIntersect(queue.shadowRay[i]))
+					queue.Li[queue.shadowPath[i]] += queue.shadowValue[i];
+			}
+
+			/* Find the next vertex of all continued paths */
+			intersect(scene, queue, queue.next);
+
+			queue.active.swap(queue.next);
+		}
+	}
+
+	/// Intersect the current rays of the paths in \c indices with the scene
+	void intersect(const Scene *scene, PathQueue &queue,
+			const std::vector<uint32_t> &indices) const {
+#if defined(MTS_HAS_COHERENT_RT)
+		const ShapeKDTree *kdtree = scene->getKDTree();
+		if (!kdtree) {
+			/* Packet tracing requires the kd-tree accelerator */
+			for (size_t i=0; i<indices.size(); ++i)
+				scene->rayIntersect(queue.ray[indices[i]], queue.its[indices[i]]);
+			return;
+		}
+
+		RayPacket4 MM_ALIGN16 packet;
+		RayInterval4 MM_ALIGN16 interval;
+		uint8_t MM_ALIGN16 temp[4 * MTS_KD_INTERSECTION_TEMP];
+
+		for (size_t i=0; i<indices.size(); i += 4) {
+			size_t count = std::min(indices.size() - i, (size_t) 4);
+			Intersection4 MM_ALIGN16 its4;
+
+			/* Pad incomplete packets with the last ray */
+			for (size_t j=0; j<4; ++j) {
+				const Ray &ray = queue.ray[indices[i + std::min(j, count - 1)]];
+				for (int axis=0; axis<3; ++axis) {
+					packet.o[axis].f[j] = ray.o[axis];
+					packet.d[axis].f[j] = ray.d[axis];
+					packet.dRcp[axis].f[j] = ray.dRcp[axis];
+				}
+				packet.time.f[j] = ray.time;
+				interval.mint.f[j] = ray.mint;
+				interval.maxt.f[j] = ray.maxt;
+			}
+
+			kdtree->rayIntersectPacketIncoherent(packet, interval, its4, temp);
+
+			for (size_t j=0; j<count; ++j) {
+				uint32_t index = indices[i + j];
+				kdtree->fillPacketIntersectionRecord(queue.ray[index],
+					its4, (int) j, temp, queue.its[index]);
+			}
+		}
+#else
+		for (size_t i=0; i<indices.size(); ++i)
+			scene->rayIntersect(queue.ray[indices[i]], queue.its[indices[i]]);
+#endif
+	}
+
+	/**
+	 * \brief Process the current vertex of a path
+	 *
+	 * This completes the BSDF sample that led to the vertex, accounts for
+	 * emission, queues a shadow ray for the emitter sample and finally
+	 * samples the BSDF to continue the path.
+	 */
+	void shade(const Scene *scene, Sampler *sampler, PathQueue &queue, uint32_t i) const {
+		/* Some aliases */
+		RayDifferential &ray = queue.ray[i];
+		Intersection &its = queue.its[i];
+		DirectSamplingRecord &dRec = queue.dRec[i];
+		Spectrum &throughput = queue.throughput[i];
+		Spectrum &Li = queue.Li[i];
+		int &type = queue.type[i];
+		int &depth = queue.depth[i];
+		uint8_t &flags = queue.flags[i];
+		bool scattered = flags & EScattered;
+
+		if (flags & EBSDFSample) {
+			bool hitEmitter = false;
+			Spectrum value;
+
+			if (its.isValid()) {
+				/* Intersected something - check if it was a luminaire */
+				if (its.isEmitter()) {
+					value = its.Le(-ray.d);
+					dRec.setQuery(ray, its);
+					hitEmitter = true;
+				}
+			} else {
+				/* Intersected nothing -- perhaps there is an environment map? */
+				const Emitter *env = scene->getEnvironmentEmitter();
+
+				if (!env || (m_hideEmitters && !scattered))
+					return finish(queue, i);
+
+				value = env->evalEnvironment(ray);
+				if (!env->fillDirectSamplingRecord(dRec, ray))
+					return finish(queue, i);
+				hitEmitter = true;
+			}
+
+			/* If a luminaire was hit, estimate the local illumination and
+			   weight using the power heuristic */
+			if (hitEmitter &&
+				(type & RadianceQueryRecord::EDirectSurfaceRadiance)) {
+				/* Compute the prob. of generating that direction using the
+				   implemented direct illumination sampling technique */
+				const Float lumPdf = !(flags & EDeltaSample) ?
+					scene->pdfEmitterDirect(dRec) : 0;
+				Li += throughput * value * miWeight(queue.bsdfPdf[i], lumPdf);
+			}
+
+			/* Set the recursive query type. Stop if no surface was hit by the
+			   BSDF sample or if indirect illumination was not requested */
+			if (!its.isValid() || !(type & RadianceQueryRecord::EIndirectSurfaceRadiance))
+				return finish(queue, i);
+			type = RadianceQueryRecord::ERadianceNoEmission;
+
+			if (depth++ >= m_rrDepth) {
+				/* Russian roulette (see the 'path' plugin) */
+				Float q = std::min(throughput.max() * queue.eta[i] * queue.eta[i], (Float) 0.95f);
+				if (queue.next1D(i) >= q)
+					return finish(queue, i);
+				throughput /= q;
+			}
+		}
+
+		if (depth > m_maxDepth && m_maxDepth >= 0)
+			return finish(queue, i);
+
+		if (!its.isValid()) {
+			/* If no intersection could be found, potentially return
+			   radiance from a environment luminaire if it exists */
+			if ((type & RadianceQueryRecord::EEmittedRadiance)
+				&& (!m_hideEmitters || scattered))
+				Li += throughput * scene->evalEnvironment(ray);
+			return finish(queue, i);
+		}
+
+		const BSDF *bsdf = its.getBSDF(ray);
+
+		/* Possibly include emitted radiance if requested */
+		if (its.isEmitter() && (type & RadianceQueryRecord::EEmittedRadiance)
+			&& (!m_hideEmitters || scattered))
+			Li += throughput * its.Le(-ray.d);
+
+		/* Include radiance from a subsurface scattering model if requested */
+		if (its.hasSubsurface() && (type & RadianceQueryRecord::ESubsurfaceRadiance))
+			Li += throughput * its.LoSub(scene, sampler, -ray.d, depth);
+
+		if ((depth >= m_maxDepth && m_maxDepth > 0)
+			|| (m_strictNormals && dot(ray.d, its.geoFrame.n)
+				* Frame::cosTheta(its.wi) >= 0)) {
+			/* Only continue if:
+			   1. The current path length is below the specifed maximum
+			   2. If 'strictNormals'=true, when the geometric and shading
+			      normals classify the incident direction to the same side */
+			return finish(queue, i);
+		}
+
+		/* ==================================================================== */
+		/*                     Direct illumination sampling                     */
+		/* ==================================================================== */
+
+		dRec = DirectSamplingRecord(its);
+
+		if (type & RadianceQueryRecord::EDirectSurfaceRadiance &&
+			(bsdf->getType() & BSDF::ESmooth)) {
+			/* Visibility is tested by the subsequent shadow ray stage */
+			Spectrum value = scene->sampleEmitterDirect(dRec, queue.next2D(i), false);
+			if (!value.isZero()) {
+				const Emitter *emitter = static_cast<const Emitter *>(dRec.object);
+
+				/* Allocate a record for querying the BSDF */
+				BSDFSamplingRecord bRec(its, its.toLocal(dRec.d), ERadiance);
+
+				/* Evaluate BSDF * cos(theta) */
+				const Spectrum bsdfVal = bsdf->eval(bRec);
+
+				/* Prevent light leaks due to the use of shading normals */
+				if (!bsdfVal.isZero() && (!m_strictNormals
+						|| dot(its.geoFrame.n, dRec.d) * Frame::cosTheta(bRec.wo) > 0)) {
+
+					/* Calculate prob. of having generated that direction
+					   using BSDF sampling */
+					Float bsdfPdf = (emitter->isOnSurface() && dRec.measure == ESolidAngle)
+						? bsdf->pdf(bRec) : 0;
+
+					/* Weight using the power heuristic */
+					Float weight = miWeight(dRec.pdf, bsdfPdf);
+					queue.shadowRay.push_back(Ray(dRec.ref, dRec.d, Epsilon,
+						dRec.dist * (1 - ShadowEpsilon), dRec.time));
+					queue.shadowValue.push_back(throughput * value * bsdfVal * weight);
+					queue.shadowPath.push_back(i);
+				}
+			}
+		}
+
+		/* ==================================================================== */
+		/*                            BSDF sampling                             */
+		/* ==================================================================== */
+
+		/* Sample BSDF * cos(theta) */
+		Float bsdfPdf;
+		BSDFSamplingRecord bRec(its, sampler, ERadiance);
+		Spectrum bsdfWeight = bsdf->sample(bRec, bsdfPdf, queue.next2D(i));
+		if (bsdfWeight.isZero())
+			return finish(queue, i);
+
+		if (bRec.sampledType != BSDF::ENull)
+			flags |= EScattered;
+
+		/* Prevent light leaks due to the use of shading normals */
+		const Vector wo = its.toWorld(bRec.wo);
+		Float woDotGeoN = dot(its.geoFrame.n, wo);
+		if (m_strictNormals && woDotGeoN * Frame::cosTheta(bRec.wo) <= 0)
+			return finish(queue, i);
+
+		/* Keep track of the throughput and relative
+		   refractive index along the path */
+		throughput *= bsdfWeight;
+		queue.eta[i] *= bRec.eta;
+		queue.bsdfPdf[i] = bsdfPdf;
+
+		flags |= EBSDFSample;
+		if (bRec.sampledType & BSDF::EDelta)
+			flags |= EDeltaSample;
+		else
+			flags &= ~EDeltaSample;
+
+		/* Queue a ray in this direction */
+		ray = Ray(its.p, wo, ray.time);
+		queue.next.push_back(i);
+	}
+
+	/// Record statistics of a path that has terminated
+	inline void finish(PathQueue &queue, uint32_t i) const {
+		avgPathLength += queue.depth[i];
+	}
+
+	/// Create the seed of the hashed sample sequence of a path
+	inline static uint32_t createSeed(Float sample, uint32_t index) {
+		return (uint32_t) sampleTEA((uint32_t) (sample * (Float) 4294967296.0), index);
+	}
+
+	inline Float miWeight(Float pdfA, Float pdfB) const {
+		pdfA *= pdfA;
+		pdfB *= pdfB;
+		return pdfA / (pdfA + pdfB);
+	}
+
+	std::string toString() const {
+		std::ostringstream oss;
+		oss << "WavefrontPathTracer[" << endl
+			<< "  maxDepth = " << m_maxDepth << "," << endl
+			<< "  rrDepth = " << m_rrDepth << "," << endl
+			<< "  strictNormals = " << m_strictNormals << "," << endl
+			<< "  wavefrontSize = " << m_wavefrontSize << endl
+			<< "]";
+		return oss.str();
+	}
+
+	MTS_DECLARE_CLASS()
+private:
+	size_t m_wavefrontSize;
+};
+
+MTS_IMPLEMENT_CLASS_S(WavefrontPathTracer, false, MonteCarloIntegrator)
+MTS_EXPORT_PLUGIN(WavefrontPathTracer, "Wavefront path tracer");
+MTS_NAMESPACE_END
@@ -38,6 +38,10 @@ void Mutex::lock() {
 	d->mutex.lock();
 }
 
+bool Mutex::tryLock() {
+	return d->mutex.try_lock();
+}
+
 void Mutex::unlock() {
 	d->mutex.unlock();
 }
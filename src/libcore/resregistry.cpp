@@ -0,0 +1,185 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/resregistry.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/transform.h>
+#include <boost/filesystem.hpp>
+
+MTS_NAMESPACE_BEGIN
+
+ref<ResourceRegistry> ResourceRegistry::m_instance;
+
+ResourceRegistry::ResourceRegistry() : m_useCounter(0), m_retainedCount(16) {
+	m_mutex = new Mutex();
+	m_cond = new ConditionVariable(m_mutex);
+}
+
+ref<Object> ResourceRegistry::get(const std::string &key, const Loader &loader) {
+	static StatsCounter registryHits("Resource registry", "Shared resources reused");
+	static StatsCounter registryMisses("Resource registry", "Shared resources loaded");
+	std::vector<ref<Object> > released;
+	UniqueLock lock(m_mutex);
+
+	while (true) {
+		std::map<std::string, Entry>::iterator it = m_entries.find(key);
+		if (it == m_entries.end())
+			break;
+		if (!it->second.loading) {
+			++registryHits;
+			it->second.lastUse = ++m_useCounter;
+			return it->second.resource;
+		}
+		/* Another thread is currently loading this resource */
+		m_cond->wait();
+	}
+
+	/* Drop unused resources before allocating a new one */
+	collectLocked(released, m_retainedCount);
+
+	m_entries[key] = Entry();
+	lock.unlock();
+
+	ref<Object> resource;
+	try {
+		resource = loader();
+	} catch (...) {
+		lock.lock();
+		m_entries.erase(key);
+		m_cond->broadcast();
+		throw;
+	}
+
+	lock.lock();
+	if (resource.get()) {
+		Entry &entry = m_entries[key];
+		entry.resource = resource;
+		entry.lastUse = ++m_useCounter;
+		entry.loading = false;
+		++registryMisses;
+	} else {
+		m_entries.erase(key);
+	}
+	m_cond->broadcast();
+
+	return resource;
+}
+
+size_t ResourceRegistry::collect() {
+	/* Resources are destroyed after the lock has been released */
+	std::vector<ref<Object> > released;
+	LockGuard lock(m_mutex);
+	collectLocked(released, 0);
+	return released.size();
+}
+
+void ResourceRegistry::setRetainedCount(size_t count) {
+	std::vector<ref<Object> > released;
+	LockGuard lock(m_mutex);
+	m_retainedCount = count;
+	collectLocked(released, count);
+}
+
+template <typename Iterator> static bool usedEarlier(
+		const std::pair<uint64_t, Iterator> &a, const std::pair<uint64_t, Iterator> &b) {
+	return a.first < b.first;
+}
+
+void ResourceRegistry::collectLocked(std::vector<ref<Object> > &released, size_t retain) {
+	typedef std::map<std::string, Entry>::iterator Iterator;
+	std::vector<std::pair<uint64_t, Iterator> > unused;
+	for (Iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
+		if (!it->second.loading && it->second.resource->getRefCount() == 1)
+			unused.push_back(std::make_pair(it->second.lastUse, it));
+	}
+
+	if (unused.size() <= retain)
+		return;
+
+	/* Release the least recently used resources */
+	size_t count = unused.size() - retain;
+	std::nth_element(unused.begin(), unused.begin() + (count - 1),
+		unused.end(), &usedEarlier<Iterator>);
+	for (size_t i=0; i<count; ++i) {
+		released.push_back(unused[i].second->second.resource);
+		m_entries.erase(unused[i].second);
+	}
+}
+
+void ResourceRegistry::clear() {
+	std::vector<ref<Object> > released;
+	LockGuard lock(m_mutex);
+	for (std::map<std::string, Entry>::iterator it = m_entries.begin();
+			it != m_entries.end();) {
+		if (!it->second.loading) {
+			released.push_back(it->second.resource);
+			m_entries.erase(it++);
+		} else {
+			++it;
+		}
+	}
+}
+
+size_t ResourceRegistry::getResourceCount() const {
+	LockGuard lock(m_mutex);
+	return m_entries.size();
+}
+
+std::string ResourceRegistry::getFileKey(const fs::path &path) {
+	boost::system::error_code ec;
+	uint64_t timestamp = (uint64_t) fs::last_write_time(path, ec);
+	if (ec.value())
+		SLog(EError, "Could not determine modification time of \"%s\"!",
+			path.string().c_str());
+	return formatString("%s@%llu", fs::absolute(path).string().c_str(),
+		(unsigned long long) timestamp);
+}
+
+std::string ResourceRegistry::getTransformKey(const Transform &trafo) {
+	const Matrix4x4 &matrix = trafo.getMatrix();
+	std::ostringstream oss;
+	for (int i=0; i<4; ++i)
+		for (int j=0; j<4; ++j)
+			oss << (i+j > 0 ? "," : "") << formatString("%a", (double) matrix(i, j));
+	return oss.str();
+}
+
+void ResourceRegistry::staticInitialization() {
+	m_instance = new ResourceRegistry();
+}
+
+void ResourceRegistry::staticShutdown() {
+	if (m_instance) {
+		m_instance->clear();
+		m_instance = NULL;
+	}
+}
+
+std::string ResourceRegistry::toString() const {
+	LockGuard lock(m_mutex);
+	std::ostringstream oss;
+	oss << "ResourceRegistry[" << endl;
+	for (std::map<std::string, Entry>::const_iterator it = m_entries.begin();
+			it != m_entries.end(); ++it)
+		oss << "  \"" << it->first << "\"" << (it->second.loading ? " (loading)" : "") << endl;
+	oss << "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(ResourceRegistry, false, Object)
+MTS_NAMESPACE_END
@@ -17,8 +17,11 @@
 */
 
 #include <mitsuba/core/sched.h>
+#include <mitsuba/core/sched_remote.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/mstream.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/atomic.h>
 
 #include <boost/thread/thread.hpp>
 
@@ -56,6 +59,9 @@ Scheduler::Scheduler() {
 	m_workAvailable = new ConditionVariable(m_mutex);
 	m_resourceCounter = 0;
 	m_processCounter = 0;
+	m_workBatchSize = 4;
+	m_queuedWork = 0;
+	m_queuedBatches = 0;
 	m_running = false;
 }
 
@@ -74,9 +80,34 @@ void Scheduler::unregisterWorker(Worker *worker) {
 	LockGuard lock(m_mutex);
 	m_workers.erase(std::remove(m_workers.begin(), m_workers.end(), worker),
 		m_workers.end());
+
+	/* Hand any queued work units over to another local worker */
+	if (!worker->m_workQueue.empty()) {
+		Worker *target = NULL;
+		for (size_t i=0; i<m_workers.size(); ++i) {
+			if (!m_workers[i]->isRemoteWorker()) {
+				target = m_workers[i];
+				break;
+			}
+		}
+		if (!target)
+			Log(EError, "unregisterWorker(): cannot remove the last local worker "
+				"while it still has queued work units!");
+		LockGuard queueLock(target->m_workQueueMutex);
+		target->m_workQueue.insert(target->m_workQueue.end(),
+			worker->m_workQueue.begin(), worker->m_workQueue.end());
+		worker->m_workQueue.clear();
+	}
 	worker->decRef();
 }
 
+void Scheduler::setWorkBatchSize(int batchSize) {
+	Assert(!m_running);
+	if (batchSize < 1)
+		Log(EError, "setWorkBatchSize(): the batch size must be positive!");
+	m_workBatchSize = batchSize;
+}
+
 Worker *Scheduler::getWorker(int index) {
 	Worker *result = NULL;
 	LockGuard lock(m_mutex);
@@ -378,6 +409,9 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
 	for (size_t i=0; i<m_workers.size(); ++i)
 		m_workers[i]->signalProcessCancellation(rec->id);
 
+	/* Work units that were generated in advance won't be processed */
+	rec->inflight -= discardQueuedWork(rec->id);
+
 	/* Ensure that this process won't be scheduled again */
 	m_localQueue.erase(std::remove(m_localQueue.begin(), m_localQueue.end(), rec->id),
 		m_localQueue.end());
@@ -426,7 +460,15 @@ bool Scheduler::cancel(ParallelProcess *process, bool reduceInflight) {
 
 Scheduler::EStatus Scheduler::acquireWork(Item &item,
 		bool local, bool onlyTry, bool keepLock) {
-	UniqueLock lock(m_mutex);
+	static StatsCounter prefetched("Scheduler", "Work units generated in advance", EPercentage);
+
+	/* Local workers first try to avoid the main lock by taking work
+	   units that were generated in advance */
+	if (local && !keepLock && m_running && acquireQueuedWork(item))
+		return EOK;
+
+	UniqueLock lock(m_mutex, false);
+	lockScheduler(lock);
 	std::deque<int> &queue = local ? m_localQueue : m_remoteQueue;
 	while (true) {
 		if (onlyTry && queue.size() == 0) {
@@ -435,8 +477,20 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
 
 		/* Wait until work is available and return false
 		   if stop() is called */
-		while (queue.size() == 0 && m_running)
+		while (queue.size() == 0 && m_running) {
+			if (local && !keepLock && m_queuedWork > 0) {
+				/* Another worker still has queued work units. Try to
+				   steal one, and otherwise sleep until more are queued */
+				uint32_t queuedBatches = m_queuedBatches;
+				lock.unlock();
+				if (acquireQueuedWork(item))
+					return EOK;
+				lockScheduler(lock);
+				if (queuedBatches != m_queuedBatches)
+					continue;
+			}
 			m_workAvailable->wait();
+		}
 
 		if (!m_running) {
 			return EStop;
@@ -485,6 +539,44 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
 
 	item.rec->inflight++;
 	item.stop = false;
+	prefetched.incrementBase();
+
+	if (local && !keepLock && m_workBatchSize > 1) {
+		/* Generate additional work units for the queue of this worker */
+		Worker *worker = m_startedWorkers[item.workerIndex];
+		int count = 0;
+		for (; count < m_workBatchSize - 1; ++count) {
+			ref<WorkUnit> workUnit = item.wp->createWorkUnit();
+			ParallelProcess::EStatus wStatus;
+			try {
+				wStatus = item.proc->generateWork(workUnit, item.workerIndex);
+			} catch (const std::exception &) {
+				/* The next acquisition will run into the same problem and
+				   cancel the process. Finish the current work unit first */
+				break;
+			}
+
+			if (wStatus != ParallelProcess::ESuccess) {
+				if (wStatus == ParallelProcess::EFailure)
+					item.rec->morework = false;
+				item.rec->active = false;
+				queue.pop_front();
+				break;
+			}
+
+			item.rec->inflight++;
+			LockGuard queueLock(worker->m_workQueueMutex);
+			worker->m_workQueue.push_back(QueuedWork(item.id, workUnit));
+		}
+
+		if (count > 0) {
+			prefetched += count;
+			prefetched.incrementBase(count);
+			atomicAdd(&m_queuedWork, count);
+			++m_queuedBatches;
+			m_workAvailable->broadcast();
+		}
+	}
 
 	if (!keepLock)
 		lock.unlock();
@@ -495,6 +587,113 @@ Scheduler::EStatus Scheduler::acquireWork(Item &item,
 	return EOK;
 }
 
+bool Scheduler::acquireQueuedWork(Item &item) {
+	static StatsCounter stolen("Scheduler", "Stolen work units", EPercentage);
+
+	if (m_queuedWork <= 0)
+		return false;
+
+	/* The owner processes its queue in FIFO order, while other
+	   workers steal from the back */
+	QueuedWork work;
+	Worker *self = m_startedWorkers[item.workerIndex];
+	{
+		LockGuard queueLock(self->m_workQueueMutex);
+		if (!self->m_workQueue.empty()) {
+			work = self->m_workQueue.front();
+			self->m_workQueue.pop_front();
+		}
+	}
+
+	if (work.id == -1) {
+		size_t workerCount = m_startedWorkers.size();
+		for (size_t i=1; i<workerCount && work.id == -1; ++i) {
+			Worker *victim = m_startedWorkers[(item.workerIndex + i) % workerCount];
+			if (victim->isRemoteWorker())
+				continue;
+			LockGuard queueLock(victim->m_workQueueMutex);
+			if (!victim->m_workQueue.empty()) {
+				work = victim->m_workQueue.back();
+				victim->m_workQueue.pop_back();
+				++stolen;
+			}
+		}
+		if (work.id == -1)
+			return false;
+	}
+
+	atomicAdd(&m_queuedWork, -1);
+	stolen.incrementBase();
+
+	if (item.id != work.id) {
+		try {
+			setProcessByID(item, work.id);
+		} catch (const std::exception &ex) {
+			Log(EWarn, "Caught an exception - canceling process %i: %s",
+				work.id, ex.what());
+			UniqueLock lock(m_mutex);
+			ParallelProcess *proc = m_idToProcess[work.id];
+			lock.unlock();
+			item.id = -1;
+			if (proc)
+				cancel(proc, true);
+			return false;
+		}
+	}
+
+	item.workUnit = work.workUnit;
+	item.stop = false;
+	return true;
+}
+
+int Scheduler::discardQueuedWork(int id) {
+	int count = 0;
+	for (size_t i=0; i<m_workers.size(); ++i) {
+		Worker *worker = m_workers[i];
+		LockGuard queueLock(worker->m_workQueueMutex);
+		std::deque<QueuedWork> &queue = worker->m_workQueue;
+		for (std::deque<QueuedWork>::iterator it = queue.begin(); it != queue.end();) {
+			if (it->id == id) {
+				it = queue.erase(it);
+				++count;
+			} else {
+				++it;
+			}
+		}
+	}
+	if (count > 0)
+		atomicAdd(&m_queuedWork, -count);
+	return count;
+}
+
+void Scheduler::lockScheduler(UniqueLock &lock) {
+	static StatsCounter contended("Scheduler", "Contended lock acquisitions", EPercentage);
+
+	if (!lock.tryLock()) {
+		++contended;
+		lock.lock();
+	}
+	contended.incrementBase();
+}
+
+void Scheduler::releaseWork(Item &item) {
+	ProcessRecord *rec = item.rec;
+	try {
+		item.proc->processResult(item.workResult, item.stop);
+	} catch (const std::exception &ex) {
+		Log(EWarn, "Caught an exception - canceling process %i: %s",
+			item.id, ex.what());
+		cancel(item.proc, true);
+		return;
+	}
+	UniqueLock lock(m_mutex, false);
+	lockScheduler(lock);
+	--rec->inflight;
+	rec->cond->signal();
+	if (rec->inflight == 0 && !rec->morework && !item.stop)
+		signalProcessTermination(item.proc, item.rec);
+}
+
 void Scheduler::signalProcessTermination(ParallelProcess *proc, ProcessRecord *rec) {
 #if defined(DEBUG_SCHED)
 	Log(rec->logLevel, "Process %i is complete.", rec->id);
@@ -529,10 +728,16 @@ void Scheduler::start() {
 	if (m_workers.size() == 0)
 		Log(EError, "Cannot start the scheduler - there are no registered workers!");
 
+	UniqueLock lock(m_mutex);
+	m_startedWorkers.clear();
+	m_startedWorkers.insert(m_startedWorkers.end(),
+		m_workers.begin(), m_workers.end());
+	lock.unlock();
+
 	int coreIndex = 0;
-	for (size_t i=0; i<m_workers.size(); ++i) {
-		m_workers[i]->start(this, (int) i, coreIndex);
-		coreIndex += (int) m_workers[i]->getCoreCount();
+	for (size_t i=0; i<m_startedWorkers.size(); ++i) {
+		m_startedWorkers[i]->start(this, (int) i, coreIndex);
+		coreIndex += (int) m_startedWorkers[i]->getCoreCount();
 	}
 }
 
@@ -552,6 +757,7 @@ void Scheduler::pause() {
 	/* Decrement reference counts to any referenced objects */
 	for (size_t i=0; i<m_workers.size(); ++i)
 		m_workers[i]->clear();
+	m_startedWorkers.clear();
 }
 
 void Scheduler::stop() {
@@ -571,6 +777,11 @@ void Scheduler::stop() {
 	m_idToProcess.clear();
 	m_localQueue.clear();
 	m_remoteQueue.clear();
+	for (size_t i=0; i<m_workers.size(); ++i) {
+		LockGuard queueLock(m_workers[i]->m_workQueueMutex);
+		m_workers[i]->m_workQueue.clear();
+	}
+	m_queuedWork = 0;
 	for (std::map<int, ResourceRecord *>::iterator
 		it = m_resources.begin(); it != m_resources.end(); ++it) {
 		ResourceRecord *rec = (*it).second;
@@ -603,11 +814,13 @@ std::string Scheduler::Item::toString() const {
 
 void Scheduler::staticInitialization() {
 	m_scheduler = new Scheduler();
+	StreamBackend::staticInitialization();
 }
 
 void Scheduler::staticShutdown() {
 	m_scheduler->stop();
 	m_scheduler = NULL;
+	StreamBackend::staticShutdown();
 }
 
 /* ==================================================================== */
@@ -615,6 +828,7 @@ void Scheduler::staticShutdown() {
 /* ==================================================================== */
 
 Worker::Worker(const std::string &name) : Thread(name), m_coreCount(0), m_isRemote(false) {
+	m_workQueueMutex = new Mutex();
 }
 
 void Worker::clear() {
@@ -19,8 +19,20 @@
 #include <mitsuba/core/sched_remote.h>
 #include <mitsuba/core/sstream.h>
 #include <mitsuba/core/mstream.h>
+#include <mitsuba/core/zstream.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/version.h>
+#include <boost/crc.hpp>
+#include <list>
+
+/* Minimum, maximum and (approximate) average size of resource chunks */
+#define MTS_CHUNK_MIN_SIZE (16*1024)
+#define MTS_CHUNK_MAX_SIZE (256*1024)
+#define MTS_CHUNK_MASK     0xFFFF000000000000ULL
+
+/* Revision of the network protocol, which is part of the version string
+   that is compared during the handshake. Increase it on every change. */
+#define MTS_PROTOCOL_REVISION 4
 
 MTS_NAMESPACE_BEGIN
 
@@ -38,18 +50,180 @@ private:
 	ref<ParallelProcess> m_proc;
 };
 
-RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(name), m_stream(stream) {
-	const size_t dataLength = strlen(MTS_VERSION)+3;
-	char *data = (char *) alloca(dataLength);
-	strncpy(data, MTS_VERSION, strlen(MTS_VERSION)+1);
-	data[dataLength-2] = SPECTRUM_SAMPLES;
+/**
+ * \brief Set of cached resource chunks with least-recently-used eviction
+ *
+ * A \ref RemoteWorker mirrors the cache of a \ref StreamBackend without
+ * storing the chunk contents. Since both sides perform the same sequence
+ * of lookups and insertions, they evict the same chunks and stay in sync
+ * without having to communicate about it.
+ *
+ * Chunks are identified by two independent 64-bit checksums (FNV-1a
+ * and CRC-64) together with their size. Nothing verifies a chunk that
+ * is taken from the cache, hence a single 64-bit hash is not enough to
+ * rule out that a collision substitutes the wrong data into a resource.
+ */
+class ChunkCache {
+public:
+	/// Checksums and size of a chunk
+	struct Key {
+		uint64_t hash, crc;
+		uint32_t size;
+
+		inline Key() : hash(0), crc(0), size(0) { }
+
+		/// Compute the key of a chunk
+		Key(const uint8_t *data, uint32_t size) : size(size) {
+			boost::crc_optimal<64, 0x42F0E1EBA9EA3693ULL,
+				0xFFFFFFFFFFFFFFFFULL, 0xFFFFFFFFFFFFFFFFULL, true, true> crc64;
+			crc64.process_bytes(data, size);
+			hash = hashBytes(data, size);
+			crc = crc64.checksum();
+		}
+
+		/// Unserialize a key from a stream
+		Key(Stream *stream) {
+			hash = stream->readULong();
+			crc = stream->readULong();
+			size = stream->readUInt();
+		}
+
+		/// Serialize a key to a stream
+		void serialize(Stream *stream) const {
+			stream->writeULong(hash);
+			stream->writeULong(crc);
+			stream->writeUInt(size);
+		}
+
+		inline bool operator<(const Key &key) const {
+			if (hash != key.hash)
+				return hash < key.hash;
+			if (crc != key.crc)
+				return crc < key.crc;
+			return size < key.size;
+		}
+	};
+
+	struct Entry {
+		ref<MemoryStream> data;
+		std::list<Key>::iterator pos;
+	};
+
+	ChunkCache(size_t capacity) : m_capacity(capacity), m_size(0) { }
+
+	/// Look up a chunk and mark it as recently used (returns \c NULL on a miss)
+	Entry *touch(const Key &key) {
+		std::map<Key, Entry>::iterator it = m_entries.find(key);
+		if (it == m_entries.end())
+			return NULL;
+		m_order.splice(m_order.end(), m_order, it->second.pos);
+		return &it->second;
+	}
+
+	/// Insert a chunk and evict the least recently used ones if necessary
+	void insert(const Key &key, MemoryStream *data) {
+		if (touch(key))
+			return;
+		Entry &entry = m_entries[key];
+		entry.data = data;
+		entry.pos = m_order.insert(m_order.end(), key);
+		m_size += key.size;
+
+		while (m_size > m_capacity && m_order.size() > 1) {
+			m_size -= m_order.front().size;
+			m_entries.erase(m_order.front());
+			m_order.pop_front();
+		}
+	}
+
+	/// Copy all entries (from least to most recently used) into another cache
+	void copyTo(ChunkCache *cache) {
+		for (std::list<Key>::const_iterator it = m_order.begin();
+				it != m_order.end(); ++it)
+			cache->insert(*it, m_entries.find(*it)->second.data);
+	}
+
+	/// Write the keys of all entries (from least to most recently used)
+	void serialize(Stream *stream) const {
+		stream->writeUInt((uint32_t) m_order.size());
+		for (std::list<Key>::const_iterator it = m_order.begin();
+				it != m_order.end(); ++it)
+			it->serialize(stream);
+	}
+
+	inline size_t getCapacity() const { return m_capacity; }
+private:
+	std::map<Key, Entry> m_entries;
+	std::list<Key> m_order;
+	size_t m_capacity, m_size;
+};
+
+/* Chunks received by earlier connections, which are shared by all stream
+   backends (created by StreamBackend::staticInitialization()) */
+static ref<Mutex> __chunkCacheMutex;
+static ChunkCache *__chunkCache = NULL;
+
+/// Random table used by the rolling hash of \ref findChunks()
+static struct GearTable {
+	uint64_t values[256];
+
+	GearTable() {
+		uint64_t state = 0x9E3779B97F4A7C15ULL;
+		for (int i=0; i<256; ++i) {
+			/* SplitMix64 */
+			uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+			z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+			z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+			values[i] = z ^ (z >> 31);
+		}
+	}
+} __gearTable;
+
+/**
+ * \brief Split a serialized resource into content-defined chunks
+ *
+ * Chunk boundaries are placed where a rolling hash of the last 64 bytes
+ * matches a bit pattern. Unlike fixed-size blocks, this causes identical
+ * data (e.g. a mesh) to produce the same chunks regardless of its
+ * offset within the resource.
+ */
+static void findChunks(const uint8_t *data, size_t size, std::vector<size_t> &ends) {
+	size_t start = 0;
+	while (start < size) {
+		size_t end = std::min(start + MTS_CHUNK_MAX_SIZE, size),
+		       pos = std::min(start + MTS_CHUNK_MIN_SIZE, end);
+		uint64_t hash = 0;
+		while (pos < end) {
+			hash = (hash << 1) + __gearTable.values[data[pos++]];
+			if ((hash & MTS_CHUNK_MASK) == 0)
+				break;
+		}
+		ends.push_back(pos);
+		start = pos;
+	}
+}
+
+/// Version string and configuration, which must match on both sides of a connection
+static std::string getHandshakeData() {
+	std::string data = formatString("%s/%i", MTS_VERSION, MTS_PROTOCOL_REVISION);
+	data += '\0';
+	data += (char) SPECTRUM_SAMPLES;
 #ifdef DOUBLE_PRECISION
-	data[dataLength-1] = 1;
+	data += (char) 1;
 #else
-	data[dataLength-1] = 0;
+	data += (char) 0;
 #endif
+	return data;
+}
+
+RemoteWorker::RemoteWorker(const std::string &name, Stream *stream, int transportFlags)
+	: Worker(name), m_stream(stream), m_transportFlags(transportFlags) {
+	if (transportFlags & ~EAllTransportFlags)
+		Log(EError, "Invalid transport flags (%i)!", transportFlags);
+	std::string data = getHandshakeData();
 	m_stream->writeShort(StreamBackend::EHello);
-	m_stream->write(data, dataLength);
+	m_stream->write(data.c_str(), data.length());
+	m_stream->writeInt(m_transportFlags);
 	m_stream->flush();
 
 	int msg = m_stream->readShort();
@@ -59,6 +233,19 @@ RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(nam
 		Log(EError, "Received an invalid response!");
 	m_coreCount = m_stream->readShort();
 	m_nodeName = m_stream->readString();
+
+	/* The server answers with the subset of the transport flags that it supports */
+	int acceptedFlags = m_stream->readInt() & m_transportFlags;
+	if (acceptedFlags != m_transportFlags)
+		Log(EWarn, "\"%s\" does not support all requested transport flags "
+			"(requested %i, using %i)", m_nodeName.c_str(), m_transportFlags, acceptedFlags);
+	m_transportFlags = acceptedFlags;
+
+	/* Mirror the chunk cache of the remote side */
+	m_chunkCache = new ChunkCache(m_stream->readSize());
+	uint32_t chunkCount = m_stream->readUInt();
+	for (uint32_t i=0; i<chunkCount; ++i)
+		m_chunkCache->insert(ChunkCache::Key(m_stream), NULL);
 	m_mutex = new Mutex();
 	m_finishCond = new ConditionVariable(m_mutex);
 	m_memStream = new MemoryStream();
@@ -67,8 +254,8 @@ RemoteWorker::RemoteWorker(const std::string &name, Stream *stream) : Worker(nam
 	m_reader->start();
 	m_inFlight = 0;
 	m_isRemote = true;
-	Log(EDebug, "Connection to \"%s\" established (%i cores).",
-		m_nodeName.c_str(), m_coreCount);
+	Log(EDebug, "Connection to \"%s\" established (%i cores, %i cached "
+		"resource chunks).", m_nodeName.c_str(), m_coreCount, chunkCount);
 }
 
 RemoteWorker::~RemoteWorker() {
@@ -85,6 +272,66 @@ RemoteWorker::~RemoteWorker() {
 		Log(EWarn, "Could not flush buffer: %s", e.what());
 	}
 	m_reader->join();
+	delete m_chunkCache;
+}
+
+int RemoteWorker::parseTransportFlags(const std::string &options) {
+	std::vector<std::string> tokens = tokenize(options, ",");
+	int flags = 0;
+	for (size_t i=0; i<tokens.size(); ++i) {
+		if (tokens[i] == "zlib")
+			flags |= ECompressResults;
+		else if (tokens[i] == "half")
+			flags |= ECompactResults;
+		else
+			SLog(EError, "Invalid transport option \"%s\" (must be "
+				"\"zlib\" or \"half\")!", tokens[i].c_str());
+	}
+	return flags;
+}
+
+void RemoteWorker::saveWorkResult(Stream *stream, const WorkResult *result, int transportFlags) {
+	if (!(transportFlags & ECompressResults)) {
+		if (transportFlags & ECompactResults)
+			result->saveCompact(stream);
+		else
+			result->save(stream);
+		return;
+	}
+
+	ref<MemoryStream> mstream = new MemoryStream();
+	{
+		/* The compressed stream is completed when the ZStream is destroyed */
+		ref<ZStream> zstream = new ZStream(mstream, ZStream::EDeflateStream, Z_BEST_SPEED);
+		zstream->setByteOrder(stream->getByteOrder());
+		if (transportFlags & ECompactResults)
+			result->saveCompact(zstream);
+		else
+			result->save(zstream);
+	}
+	stream->writeSize(mstream->getPos());
+	stream->write(mstream->getData(), mstream->getPos());
+}
+
+void RemoteWorker::loadWorkResult(Stream *stream, WorkResult *result, int transportFlags) {
+	if (!(transportFlags & ECompressResults)) {
+		if (transportFlags & ECompactResults)
+			result->loadCompact(stream);
+		else
+			result->load(stream);
+		return;
+	}
+
+	size_t size = stream->readSize();
+	ref<MemoryStream> mstream = new MemoryStream(size);
+	stream->copyTo(mstream, size);
+	mstream->seek(0);
+	ref<ZStream> zstream = new ZStream(mstream);
+	zstream->setByteOrder(stream->getByteOrder());
+	if (transportFlags & ECompactResults)
+		result->loadCompact(zstream);
+	else
+		result->load(zstream);
 }
 
 void RemoteWorker::start(Scheduler *scheduler, int workerIndex, int coreOffset) {
@@ -164,12 +411,35 @@ void RemoteWorker::run() {
 			for (size_t i=0; i<resources.size(); ++i) {
 				int resID = resources[i].first;
 				const MemoryStream *resStream = resources[i].second;
-				Log(EDebug, "Sending resource %i to \"%s\" (%i KB)", resID, m_nodeName.c_str(),
-					resStream->getPos() / 1024);
+				const uint8_t *data = resStream->getData();
+				std::vector<size_t> ends;
+				findChunks(data, resStream->getPos(), ends);
+
 				m_memStream->writeShort(StreamBackend::ENewResource);
 				m_memStream->writeInt(resID);
 				m_memStream->writeSize(resStream->getPos());
-				m_memStream->write(resStream->getData(), resStream->getPos());
+				m_memStream->writeUInt((uint32_t) ends.size());
+
+				/* Only send chunks, which the remote side does not already have */
+				size_t start = 0, sent = 0;
+				for (size_t j=0; j<ends.size(); ++j) {
+					uint32_t size = (uint32_t) (ends[j] - start);
+					ChunkCache::Key key(data + start, size);
+					key.serialize(m_memStream);
+					if (m_chunkCache->touch(key)) {
+						m_memStream->writeBool(false);
+					} else {
+						m_memStream->writeBool(true);
+						m_memStream->write(data + start, size);
+						m_chunkCache->insert(key, NULL);
+						sent += size;
+					}
+					start = ends[j];
+				}
+
+				Log(EDebug, "Sending resource %i to \"%s\" (%i KB, %i KB were cached)",
+					resID, m_nodeName.c_str(), (int) (sent / 1024),
+					(int) ((resStream->getPos() - sent) / 1024));
 			}
 
 			for (size_t i=0; i<multiResources.size(); i += m_coreCount) {
@@ -279,7 +549,8 @@ void RemoteWorkerReader::run() {
 
 			switch (msg) {
 				case StreamBackend::EWorkResult:
-					m_schedItem.workResult->load(m_stream);
+					RemoteWorker::loadWorkResult(m_stream,
+						m_schedItem.workResult, m_parent->m_transportFlags);
 					m_schedItem.stop = false;
 					m_parent->releaseWork(m_schedItem);
 					m_parent->signalCompletion();
@@ -322,13 +593,27 @@ void RemoteWorkerReader::run() {
 
 StreamBackend::StreamBackend(const std::string &thrName, Scheduler *scheduler,
 		const std::string &nodeName, Stream *stream, bool detach) : Thread(thrName),
-		m_scheduler(scheduler), m_nodeName(nodeName), m_stream(stream), m_detach(detach) {
+		m_scheduler(scheduler), m_nodeName(nodeName), m_stream(stream),
+		m_chunkCache(NULL), m_transportFlags(0), m_detach(detach) {
 	m_sendMutex = new Mutex();
 	m_memStream = new MemoryStream();
 	m_memStream->setByteOrder(Stream::ENetworkByteOrder);
 }
 
-StreamBackend::~StreamBackend() { }
+StreamBackend::~StreamBackend() {
+	delete m_chunkCache;
+}
+
+void StreamBackend::staticInitialization() {
+	__chunkCacheMutex = new Mutex();
+	__chunkCache = new ChunkCache(MTS_CHUNK_CACHE_SIZE);
+}
+
+void StreamBackend::staticShutdown() {
+	delete __chunkCache;
+	__chunkCache = NULL;
+	__chunkCacheMutex = NULL;
+}
 
 void StreamBackend::run() {
 	if (m_detach)
@@ -345,19 +630,14 @@ void StreamBackend::run() {
 		return;
 	}
 
-	const size_t dataLength = strlen(MTS_VERSION)+3;
-	char *data    = (char *) alloca(dataLength),
-		 *refData = (char *) alloca(dataLength);
-	strncpy(refData, MTS_VERSION, strlen(MTS_VERSION)+1);
-	refData[dataLength-2] = SPECTRUM_SAMPLES;
-#ifdef DOUBLE_PRECISION
-	refData[dataLength-1] = 1;
-#else
-	refData[dataLength-1] = 0;
-#endif
-	m_stream->read(data, dataLength);
+	/* Read the version string up to its terminator, since clients with
+	   a different protocol revision may send a string of another length */
+	std::string data = m_stream->readString();
+	data += '\0';
+	data += (char) m_stream->readUChar();
+	data += (char) m_stream->readUChar();
 
-	if (memcmp(data, refData, dataLength) != 0) {
+	if (data != getHandshakeData()) {
 		m_stream->writeShort(EIncompatible);
 		m_stream->flush();
 		Log(EWarn, "The client either the wrong version, or it is compiled "
@@ -365,10 +645,22 @@ void StreamBackend::run() {
 		return;
 	}
 
-	Log(EDebug, "Program versions match.");
+	m_transportFlags = m_stream->readInt() & RemoteWorker::EAllTransportFlags;
+	Log(EDebug, "Program versions match (transport flags: %i).", m_transportFlags);
 	m_memStream->writeShort(EHello);
 	m_memStream->writeShort((short) m_scheduler->getCoreCount());
 	m_memStream->writeString(m_nodeName);
+	m_memStream->writeInt(m_transportFlags);
+
+	/* Start with the chunks left behind by earlier connections and
+	   tell the other side about them */
+	m_chunkCache = new ChunkCache(MTS_CHUNK_CACHE_SIZE);
+	{
+		LockGuard lock(__chunkCacheMutex);
+		__chunkCache->copyTo(m_chunkCache);
+	}
+	m_memStream->writeSize(m_chunkCache->getCapacity());
+	m_chunkCache->serialize(m_memStream);
 	m_memStream->seek(0);
 	m_memStream->copyTo(m_stream);
 	m_stream->flush();
@@ -391,10 +683,27 @@ void StreamBackend::run() {
 				case ENewResource: {
 						int id = m_stream->readInt();
 						size_t size = m_stream->readSize();
+						uint32_t chunkCount = m_stream->readUInt();
 						ref<InstanceManager> manager = new InstanceManager();
 						ref<MemoryStream> mstream = new MemoryStream(size);
 						mstream->setByteOrder(Stream::ENetworkByteOrder);
-						m_stream->copyTo(mstream, size);
+						for (uint32_t i=0; i<chunkCount; ++i) {
+							ChunkCache::Key key(m_stream);
+							ref<MemoryStream> chunk;
+							if (m_stream->readBool()) {
+								chunk = new MemoryStream(key.size);
+								m_stream->copyTo(chunk, key.size);
+								m_chunkCache->insert(key, chunk);
+							} else {
+								ChunkCache::Entry *entry = m_chunkCache->touch(key);
+								if (!entry)
+									Log(EError, "The resource chunk cache is out of sync!");
+								chunk = entry->data;
+							}
+							LockGuard lock(__chunkCacheMutex);
+							__chunkCache->insert(key, chunk);
+							mstream->write(chunk->getData(), key.size);
+						}
 						mstream->seek(0);
 						ref<SerializableObject> res = static_cast<SerializableObject *>(manager->getInstance(mstream));
 						m_resources[id] = m_scheduler->registerResource(res);
@@ -522,7 +831,7 @@ void StreamBackend::sendWorkResult(int id, const WorkResult *result, bool cancel
 	m_memStream->writeShort(cancelled ? ECancelledWorkResult : EWorkResult);
 	m_memStream->writeInt(id);
 	if (!cancelled)
-		result->save(m_memStream);
+		RemoteWorker::saveWorkResult(m_memStream, result, m_transportFlags);
 	try {
 		m_memStream->seek(0);
 		m_memStream->copyTo(m_stream);
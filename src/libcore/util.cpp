@@ -38,6 +38,12 @@
 #include <malloc.h>
 #endif
 
+#if defined(__MSVC__)
+# include <intrin.h>
+#elif defined(__i386__) || defined(__x86_64__)
+# include <cpuid.h>
+#endif
+
 #if defined(__WINDOWS__)
 # include <windows.h>
 # include <winsock2.h>
@@ -351,6 +357,69 @@ void restoreFPExceptions(bool oldState) {
 	}
 }
 
+#if defined(__MSVC__) || defined(__i386__) || defined(__x86_64__)
+static void cpuid(uint32_t leaf, uint32_t regs[4]) {
+#if defined(__MSVC__)
+	__cpuidex(reinterpret_cast<int *>(regs), (int) leaf, 0);
+#else
+	__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/// Return the register state that is saved by the OS on context switches
+static uint64_t xgetbv() {
+#if defined(__MSVC__)
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ __volatile__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	return ((uint64_t) edx << 32) | eax;
+#endif
+}
+#endif
+
+static int __cached_simd_width = 0;
+
+int getSIMDWidth() {
+	if (__cached_simd_width)
+		return __cached_simd_width;
+
+	int width = 4;
+#if defined(__MSVC__) || defined(__i386__) || defined(__x86_64__)
+	uint32_t regs[4];
+	cpuid(0, regs);
+	uint32_t maxLeaf = regs[0];
+
+	cpuid(1, regs);
+	bool fma = regs[2] & (1 << 12), osxsave = regs[2] & (1 << 27),
+	     avx = regs[2] & (1 << 28);
+
+	/* Check that the OS saves the YMM (and ZMM) registers */
+	if (maxLeaf >= 7 && osxsave && avx) {
+		uint64_t xcr0 = xgetbv();
+		cpuid(7, regs);
+		bool avx2 = regs[1] & (1 << 5), avx512f = regs[1] & (1 << 16);
+
+		if ((xcr0 & 0x06) == 0x06 && avx2 && fma)
+			width = 8;
+		if ((xcr0 & 0xE6) == 0xE6 && avx512f && width == 8)
+			width = 16;
+	}
+#endif
+
+	__cached_simd_width = width;
+	return width;
+}
+
+uint64_t hashBytes(const void *data, size_t size, uint64_t hash) {
+	const uint8_t *ptr = static_cast<const uint8_t *>(data);
+	for (size_t i=0; i<size; ++i) {
+		hash ^= ptr[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
 std::string getHostName() {
 	char hostName[128];
 	if (gethostname(hostName, sizeof(hostName)) != 0)
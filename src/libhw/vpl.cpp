@@ -100,8 +100,7 @@ void VPLShaderManager::setScene(const Scene *scene) {
 
 			if (shape->getClass()->getName() == "Instance") {
 				const Instance *instance = static_cast<const Instance *>(shape);
-				const std::vector<const Shape *> &instantiatedShapes =
-						instance->getShapeGroup()->getKDTree()->getShapes();
+				const std::vector<const Shape *> &instantiatedShapes = instance->getShapes();
 
 				for (size_t j=0; j<instantiatedShapes.size(); ++j) {
 					shape = instantiatedShapes[j];
@@ -164,8 +163,7 @@ void VPLShaderManager::setScene(const Scene *scene) {
 
 		if (shape->getClass()->getName() == "Instance") {
 			const Instance *instance = static_cast<const Instance *>(shape);
-			const std::vector<const Shape *> &instantiatedShapes =
-					instance->getShapeGroup()->getKDTree()->getShapes();
+			const std::vector<const Shape *> &instantiatedShapes = instance->getShapes();
 			const AnimatedTransform *atrafo = instance->getWorldTransform();
 			const Matrix4x4 &trafo = atrafo->eval(0).getMatrix();
 
@@ -363,7 +361,7 @@ void VPLShaderManager::setVPL(const VPL &vpl) {
 		}
 
 		if (m_nearClip >= m_farClip) {
-			BSphere bsphere(m_scene->getKDTree()->getAABB().getBSphere());
+			BSphere bsphere(m_scene->getAccelerator()->getAABB().getBSphere());
 			Float minDist = 0;
 
 			if ((vpl.type == ESurfaceVPL || vpl.type == EPointEmitterVPL) &&
@@ -384,7 +382,7 @@ void VPLShaderManager::setVPL(const VPL &vpl) {
 	} else {
 		m_shadowMapType = ShadowMapGenerator::EDirectional;
 		m_shadowMapTransform = m_shadowGen->directionalFindGoodFrame(
-			m_scene->getKDTree()->getAABB(), vpl.its.shFrame.n);
+			m_scene->getAccelerator()->getAABB(), vpl.its.shFrame.n);
 	}
 
 	bool is2D =
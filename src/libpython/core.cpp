@@ -4,6 +4,7 @@
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/resregistry.h>
 #include <mitsuba/core/sched.h>
 #include <mitsuba/core/transform.h>
 #include <mitsuba/core/properties.h>
@@ -67,6 +68,7 @@ static void initializeFramework() {
 	Logger::staticInitialization();
 	Spectrum::staticInitialization();
 	Bitmap::staticInitialization();
+	ResourceRegistry::staticInitialization();
 	Scheduler::staticInitialization();
 	SHVector::staticInitialization();
 	SceneHandler::staticInitialization();
@@ -78,6 +80,7 @@ static void shutdownFramework() {
 	SceneHandler::staticShutdown();
 	SHVector::staticShutdown();
 	Scheduler::staticShutdown();
+	ResourceRegistry::staticShutdown();
 	Bitmap::staticShutdown();
 	Spectrum::staticShutdown();
 	Logger::staticShutdown();
@@ -1794,6 +1797,8 @@ void export_core() {
 		.def("unregisterWorker", &Scheduler::unregisterWorker)
 		.def("getWorkerCount", &Scheduler::getWorkerCount)
 		.def("getLocalWorkerCount", &Scheduler::getLocalWorkerCount)
+		.def("setWorkBatchSize", &Scheduler::setWorkBatchSize)
+		.def("getWorkBatchSize", &Scheduler::getWorkBatchSize)
 		.def("getWorker", &Scheduler::getWorker, BP_RETURN_VALUE)
 		.def("start", &Scheduler::start)
 		.def("pause", &Scheduler::pause)
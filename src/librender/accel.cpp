@@ -0,0 +1,150 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/accel.h>
+#include <mitsuba/render/bvh.h>
+#include <boost/algorithm/string.hpp>
+
+MTS_NAMESPACE_BEGIN
+
+ref<Accelerator> Accelerator::create(const Properties &props) {
+	std::string type = boost::to_lower_copy(props.getString("accel", "kdtree"));
+
+	if (type == "kdtree")
+		return new KDTreeAccelerator(props);
+	else if (type == "bvh")
+		return new ShapeBVH(props);
+	else
+		SLog(EError, "Unknown acceleration data structure \"%s\" (must be "
+			"\"kdtree\" or \"bvh\")!", type.c_str());
+	return NULL;
+}
+
+KDTreeAccelerator::KDTreeAccelerator() {
+	m_kdtree = new ShapeKDTree();
+}
+
+KDTreeAccelerator::KDTreeAccelerator(const Properties &props) {
+	m_kdtree = new ShapeKDTree();
+	/* kd-tree construction: Enable primitive clipping? Generally leads to a
+	  significant improvement of the resulting tree. */
+	if (props.hasProperty("kdClip"))
+		m_kdtree->setClip(props.getBoolean("kdClip"));
+	/* kd-tree construction: Relative cost of a triangle intersection operation
+	   in the surface area heuristic. */
+	if (props.hasProperty("kdIntersectionCost"))
+		m_kdtree->setQueryCost(props.getFloat("kdIntersectionCost"));
+	/* kd-tree construction: Relative cost of a kd-tree traversal operation
+	   in the surface area heuristic. */
+	if (props.hasProperty("kdTraversalCost"))
+		m_kdtree->setTraversalCost(props.getFloat("kdTraversalCost"));
+	/* kd-tree construction: Bonus factor for cutting away regions of empty space */
+	if (props.hasProperty("kdEmptySpaceBonus"))
+		m_kdtree->setEmptySpaceBonus(props.getFloat("kdEmptySpaceBonus"));
+	/* kd-tree construction: A kd-tree node containing this many or fewer
+	   primitives will not be split */
+	if (props.hasProperty("kdStopPrims"))
+		m_kdtree->setStopPrims(props.getInteger("kdStopPrims"));
+	/* kd-tree construction: Maximum tree depth */
+	if (props.hasProperty("kdMaxDepth"))
+		m_kdtree->setMaxDepth(props.getInteger("kdMaxDepth"));
+	/* kd-tree construction: Specify the number of primitives, at which the
+	   builder will switch from (approximate) Min-Max binning to the accurate
+	   O(n log n) SAH-based optimization method. */
+	if (props.hasProperty("kdExactPrimitiveThreshold"))
+		m_kdtree->setExactPrimitiveThreshold(props.getInteger("kdExactPrimitiveThreshold"));
+	/* kd-tree construction: use multiple processors? */
+	if (props.hasProperty("kdParallelBuild"))
+		m_kdtree->setParallelBuild(props.getBoolean("kdParallelBuild"));
+	/* kd-tree construction: specify whether or not bad splits can be "retracted". */
+	if (props.hasProperty("kdRetract"))
+		m_kdtree->setRetract(props.getBoolean("kdRetract"));
+	/* kd-tree construction: Set the number of bad refines allowed to happen
+	   in succession before a leaf node will be created.*/
+	if (props.hasProperty("kdMaxBadRefines"))
+		m_kdtree->setMaxBadRefines(props.getInteger("kdMaxBadRefines"));
+	/* kd-tree construction: Directory, in which built trees are cached
+	   and looked up by a content hash of the geometry */
+	if (props.hasProperty("kdCache"))
+		m_kdtree->setCacheDirectory(props.getString("kdCache"));
+}
+
+KDTreeAccelerator::KDTreeAccelerator(Stream *stream, InstanceManager *manager)
+ : Accelerator(stream, manager) {
+	m_kdtree = new ShapeKDTree();
+	m_kdtree->setQueryCost(stream->readFloat());
+	m_kdtree->setTraversalCost(stream->readFloat());
+	m_kdtree->setEmptySpaceBonus(stream->readFloat());
+	m_kdtree->setStopPrims(stream->readInt());
+	m_kdtree->setClip(stream->readBool());
+	m_kdtree->setMaxDepth(stream->readUInt());
+	m_kdtree->setExactPrimitiveThreshold(stream->readUInt());
+	m_kdtree->setParallelBuild(stream->readBool());
+	m_kdtree->setRetract(stream->readBool());
+	m_kdtree->setMaxBadRefines(stream->readUInt());
+}
+
+void KDTreeAccelerator::serialize(Stream *stream, InstanceManager *manager) const {
+	stream->writeFloat(m_kdtree->getQueryCost());
+	stream->writeFloat(m_kdtree->getTraversalCost());
+	stream->writeFloat(m_kdtree->getEmptySpaceBonus());
+	stream->writeInt(m_kdtree->getStopPrims());
+	stream->writeBool(m_kdtree->getClip());
+	stream->writeUInt(m_kdtree->getMaxDepth());
+	stream->writeUInt(m_kdtree->getExactPrimitiveThreshold());
+	stream->writeBool(m_kdtree->getParallelBuild());
+	stream->writeBool(m_kdtree->getRetract());
+	stream->writeUInt(m_kdtree->getMaxBadRefines());
+}
+
+ref<Accelerator> KDTreeAccelerator::createEmpty() const {
+	ref<KDTreeAccelerator> accel = new KDTreeAccelerator();
+	ShapeKDTree *kdtree = accel->getKDTree();
+	kdtree->setQueryCost(m_kdtree->getQueryCost());
+	kdtree->setTraversalCost(m_kdtree->getTraversalCost());
+	kdtree->setEmptySpaceBonus(m_kdtree->getEmptySpaceBonus());
+	kdtree->setStopPrims(m_kdtree->getStopPrims());
+	kdtree->setClip(m_kdtree->getClip());
+	kdtree->setMaxDepth(m_kdtree->getMaxDepth());
+	kdtree->setExactPrimitiveThreshold(m_kdtree->getExactPrimitiveThreshold());
+	kdtree->setParallelBuild(m_kdtree->getParallelBuild());
+	kdtree->setRetract(m_kdtree->getRetract());
+	kdtree->setMaxBadRefines(m_kdtree->getMaxBadRefines());
+	kdtree->setCacheDirectory(m_kdtree->getCacheDirectory());
+	return accel.get();
+}
+
+std::string KDTreeAccelerator::toString() const {
+	std::ostringstream oss;
+	oss << "KDTreeAccelerator[" << endl
+		<< "  queryCost = " << m_kdtree->getQueryCost() << "," << endl
+		<< "  traversalCost = " << m_kdtree->getTraversalCost() << "," << endl
+		<< "  emptySpaceBonus = " << m_kdtree->getEmptySpaceBonus() << "," << endl
+		<< "  stopPrims = " << m_kdtree->getStopPrims() << "," << endl
+		<< "  clip = " << m_kdtree->getClip() << "," << endl
+		<< "  maxDepth = " << m_kdtree->getMaxDepth() << "," << endl
+		<< "  parallelBuild = " << m_kdtree->getParallelBuild() << "," << endl
+		<< "  cacheDirectory = \"" << m_kdtree->getCacheDirectory().string() << "\"," << endl
+		<< "  built = " << m_kdtree->isBuilt() << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(Accelerator, true, SerializableObject)
+MTS_IMPLEMENT_CLASS_S(KDTreeAccelerator, false, Accelerator)
+MTS_NAMESPACE_END
@@ -0,0 +1,749 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/bvh.h>
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/core/statistics.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/core/sse.h>
+
+#if defined(MTS_SSE) && defined(SINGLE_PRECISION)
+#define MTS_BVH_SSE 1
+#endif
+
+/// Subtrees below this depth are collapsed into a single leaf
+#define MTS_BVH_MAXDEPTH 64
+
+/// Maximum number of bins of the surface area heuristic
+#define MTS_BVH_MAXBINS 64
+
+MTS_NAMESPACE_BEGIN
+
+static StatsCounter bvhRaysTraced("BVH", "Normal rays traced");
+static StatsCounter bvhShadowRaysTraced("BVH", "Shadow rays traced");
+
+/**
+ * \brief Node of a BVH with \c N children
+ *
+ * The child bounding boxes are stored in a structure-of-arrays layout
+ * (indexed by <tt>[min/max][axis][child]</tt>), which permits testing
+ * four of them at once using SSE instructions. Unused slots have an
+ * empty bounding box, which is never intersected.
+ */
+template <int N> struct BVHNode {
+	/// Bounding boxes of the children
+	float bounds[2][3][N];
+
+	/// Index of an inner child node or offset of the first primitive of a leaf
+	uint32_t child[N];
+
+	/// Number of primitives of leaf children (zero for inner nodes)
+	uint32_t primCount[N];
+
+	inline void clear() {
+		for (int i=0; i<N; ++i) {
+			for (int axis=0; axis<3; ++axis) {
+				bounds[0][axis][i] = std::numeric_limits<float>::infinity();
+				bounds[1][axis][i] = -std::numeric_limits<float>::infinity();
+			}
+			child[i] = primCount[i] = 0;
+		}
+	}
+
+	/// Set the bounding box of a child (rounding outwards)
+	inline void setBounds(int i, const AABB &aabb) {
+		for (int axis=0; axis<3; ++axis) {
+			float min = (float) aabb.min[axis], max = (float) aabb.max[axis];
+#if !defined(SINGLE_PRECISION)
+			if ((Float) min > aabb.min[axis])
+				min = nextafterf(min, -std::numeric_limits<float>::infinity());
+			if ((Float) max < aabb.max[axis])
+				max = nextafterf(max, std::numeric_limits<float>::infinity());
+#endif
+			bounds[0][axis][i] = min;
+			bounds[1][axis][i] = max;
+		}
+	}
+
+	/**
+	 * \brief Intersect a ray with the bounding boxes of all children
+	 *
+	 * \return A bit mask of the intersected children. The entry
+	 * distances are written to \c tnear.
+	 */
+	FINLINE int rayIntersect(const float *o, const float *dRcp, const int *signs,
+			float mint, float maxt, float *tnear) const {
+		int mask = 0;
+#if defined(MTS_BVH_SSE)
+		const __m128
+			ox = _mm_set1_ps(o[0]), oy = _mm_set1_ps(o[1]), oz = _mm_set1_ps(o[2]),
+			rx = _mm_set1_ps(dRcp[0]), ry = _mm_set1_ps(dRcp[1]), rz = _mm_set1_ps(dRcp[2]),
+			rayMinT = _mm_set1_ps(mint), rayMaxT = _mm_set1_ps(maxt);
+
+		for (int i=0; i<N; i += 4) {
+			const __m128
+				nearX = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&bounds[signs[0]][0][i]), ox), rx),
+				nearY = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&bounds[signs[1]][1][i]), oy), ry),
+				nearZ = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&bounds[signs[2]][2][i]), oz), rz),
+				farX = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&bounds[1-signs[0]][0][i]), ox), rx),
+				farY = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&bounds[1-signs[1]][1][i]), oy), ry),
+				farZ = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(&bounds[1-signs[2]][2][i]), oz), rz);
+
+			const __m128
+				tn = _mm_max_ps(_mm_max_ps(nearX, nearY), _mm_max_ps(nearZ, rayMinT)),
+				tf = _mm_min_ps(_mm_min_ps(farX, farY), _mm_min_ps(farZ, rayMaxT));
+
+			_mm_storeu_ps(tnear + i, tn);
+			mask |= _mm_movemask_ps(_mm_cmple_ps(tn, tf)) << i;
+		}
+#else
+		for (int i=0; i<N; ++i) {
+			float tn = mint, tf = maxt;
+			for (int axis=0; axis<3; ++axis) {
+				float nearT = (bounds[signs[axis]][axis][i] - o[axis]) * dRcp[axis],
+				      farT = (bounds[1-signs[axis]][axis][i] - o[axis]) * dRcp[axis];
+				tn = std::max(tn, nearT);
+				tf = std::min(tf, farT);
+			}
+			tnear[i] = tn;
+			if (tn <= tf)
+				mask |= 1 << i;
+		}
+#endif
+		return mask;
+	}
+};
+
+/// Top-down BVH builder based on the binned surface area heuristic
+template <int N> struct BVHBuilder {
+	typedef BVHNode<N> Node;
+
+	/// Contiguous range of the primitive index list
+	struct Range {
+		uint32_t begin, end;
+		AABB aabb, centroidAABB;
+
+		inline uint32_t size() const { return end - begin; }
+	};
+
+	/// Subtree that is constructed in parallel after the top levels
+	struct Task {
+		Range range;
+		uint32_t node;
+		int slot, depth;
+	};
+
+	/// Predicate that classifies primitives with respect to a bin boundary
+	struct BinPredicate {
+		const Point *centroids;
+		int axis, bin, binCount;
+		Float min, scale;
+
+		inline bool operator()(uint32_t index) const {
+			return computeBin(centroids[index][axis], min, scale, binCount) <= bin;
+		}
+	};
+
+	const AABB *primAABBs;
+	const Point *centroids;
+	uint32_t *indices;
+	uint32_t maxLeafSize;
+	int binCount;
+
+	static inline int computeBin(Float value, Float min, Float scale, int binCount) {
+		int bin = (int) ((value - min) * scale);
+		return std::max(0, std::min(bin, binCount - 1));
+	}
+
+	/// Create a range and compute its bounding boxes
+	Range createRange(uint32_t begin, uint32_t end) const {
+		Range range;
+		range.begin = begin;
+		range.end = end;
+		for (uint32_t i=begin; i<end; ++i) {
+			range.aabb.expandBy(primAABBs[indices[i]]);
+			range.centroidAABB.expandBy(centroids[indices[i]]);
+		}
+		return range;
+	}
+
+	/**
+	 * \brief Split a range into two using the binned surface area
+	 * heuristic. Falls back to a median split when all centroids coincide.
+	 */
+	void split(const Range &range, Range &left, Range &right) const {
+		AABB binAABBs[MTS_BVH_MAXBINS], rightAABB;
+		uint32_t binCounts[MTS_BVH_MAXBINS];
+		Float rightAreas[MTS_BVH_MAXBINS];
+		uint32_t rightCounts[MTS_BVH_MAXBINS];
+
+		const Vector extents = range.centroidAABB.getExtents();
+		Float bestCost = std::numeric_limits<Float>::infinity();
+		int bestAxis = -1, bestBin = -1;
+
+		for (int axis=0; axis<3; ++axis) {
+			if (!(extents[axis] > 0))
+				continue;
+
+			const Float min = range.centroidAABB.min[axis],
+			            scale = binCount / extents[axis];
+
+			for (int i=0; i<binCount; ++i) {
+				binAABBs[i].reset();
+				binCounts[i] = 0;
+			}
+
+			for (uint32_t i=range.begin; i<range.end; ++i) {
+				uint32_t index = indices[i];
+				int bin = computeBin(centroids[index][axis], min, scale, binCount);
+				binAABBs[bin].expandBy(primAABBs[index]);
+				binCounts[bin]++;
+			}
+
+			/* Sweep from the right to compute the cost of the right side */
+			uint32_t count = 0;
+			rightAABB.reset();
+			for (int i=binCount-1; i>0; --i) {
+				rightAABB.expandBy(binAABBs[i]);
+				count += binCounts[i];
+				rightCounts[i] = count;
+				rightAreas[i] = count > 0 ? rightAABB.getSurfaceArea() : 0;
+			}
+
+			/* Sweep from the left and evaluate all split candidates */
+			AABB leftAABB;
+			count = 0;
+			for (int i=0; i<binCount-1; ++i) {
+				leftAABB.expandBy(binAABBs[i]);
+				count += binCounts[i];
+				if (count == 0 || rightCounts[i+1] == 0)
+					continue;
+
+				Float cost = count * leftAABB.getSurfaceArea()
+					+ rightCounts[i+1] * rightAreas[i+1];
+
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = i;
+				}
+			}
+		}
+
+		uint32_t mid = range.begin + range.size() / 2;
+		if (bestAxis != -1) {
+			BinPredicate pred;
+			pred.centroids = centroids;
+			pred.axis = bestAxis;
+			pred.bin = bestBin;
+			pred.binCount = binCount;
+			pred.min = range.centroidAABB.min[bestAxis];
+			pred.scale = binCount / extents[bestAxis];
+
+			uint32_t split = (uint32_t) (std::partition(indices + range.begin,
+				indices + range.end, pred) - indices);
+			if (split != range.begin && split != range.end)
+				mid = split;
+		}
+
+		left = createRange(range.begin, mid);
+		right = createRange(mid, range.end);
+	}
+
+	/**
+	 * \brief Recursively construct the subtree of a range and
+	 * return the index of its root node
+	 *
+	 * When \c tasks is not \c NULL, ranges with fewer than \c taskSize
+	 * primitives are not processed but deferred to a list of tasks.
+	 */
+	uint32_t build(std::vector<Node> &nodes, const Range &range, int depth,
+			std::vector<Task> *tasks, uint32_t taskSize) const {
+		Range children[N];
+		int childCount = 1;
+		children[0] = range;
+
+		/* Repeatedly split the child with the largest surface area */
+		while (childCount < N) {
+			int largest = -1;
+			Float largestArea = -1;
+			for (int i=0; i<childCount; ++i) {
+				if (children[i].size() <= maxLeafSize)
+					continue;
+				Float area = children[i].aabb.getSurfaceArea();
+				if (area > largestArea) {
+					largest = i;
+					largestArea = area;
+				}
+			}
+			if (largest == -1)
+				break;
+
+			Range left, right;
+			split(children[largest], left, right);
+			children[largest] = left;
+			children[childCount++] = right;
+		}
+
+		uint32_t nodeIndex = (uint32_t) nodes.size();
+		nodes.push_back(Node());
+		nodes[nodeIndex].clear();
+
+		for (int i=0; i<childCount; ++i) {
+			const Range &child = children[i];
+			nodes[nodeIndex].setBounds(i, child.aabb);
+
+			if (child.size() <= maxLeafSize || depth + 1 >= MTS_BVH_MAXDEPTH) {
+				nodes[nodeIndex].child[i] = child.begin;
+				nodes[nodeIndex].primCount[i] = child.size();
+			} else if (tasks && child.size() < taskSize) {
+				Task task;
+				task.range = child;
+				task.node = nodeIndex;
+				task.slot = i;
+				task.depth = depth + 1;
+				tasks->push_back(task);
+			} else {
+				uint32_t childIndex = build(nodes, child, depth + 1, tasks, taskSize);
+				nodes[nodeIndex].child[i] = childIndex;
+			}
+		}
+
+		return nodeIndex;
+	}
+};
+
+ShapeBVH::ShapeBVH() : m_triAccel(NULL), m_nodes(NULL), m_nodeCount(0),
+		m_primitiveCount(0), m_width(4), m_maxLeafSize(4), m_binCount(16),
+		m_parallelBuild(true), m_built(false) {
+}
+
+ShapeBVH::ShapeBVH(const Properties &props) : m_triAccel(NULL), m_nodes(NULL),
+		m_nodeCount(0), m_primitiveCount(0), m_built(false) {
+	/* BVH construction: number of children per node (4 or 8) */
+	setWidth(props.getInteger("bvhWidth", 4));
+	/* BVH construction: nodes with this many or fewer primitives become leaves */
+	m_maxLeafSize = props.getInteger("bvhMaxLeafSize", 4);
+	/* BVH construction: number of bins of the surface area heuristic */
+	m_binCount = props.getInteger("bvhBinCount", 16);
+	/* BVH construction: use multiple processors? */
+	m_parallelBuild = props.getBoolean("bvhParallelBuild", true);
+
+	if (m_maxLeafSize < 1)
+		Log(EError, "The maximum BVH leaf size must be positive!");
+	if (m_binCount < 2 || m_binCount > MTS_BVH_MAXBINS)
+		Log(EError, "The number of BVH bins must be between 2 and %i!",
+			MTS_BVH_MAXBINS);
+}
+
+ShapeBVH::ShapeBVH(Stream *stream, InstanceManager *manager)
+ : Accelerator(stream, manager), m_triAccel(NULL), m_nodes(NULL),
+	m_nodeCount(0), m_primitiveCount(0), m_built(false) {
+	m_width = stream->readInt();
+	m_maxLeafSize = stream->readInt();
+	m_binCount = stream->readInt();
+	m_parallelBuild = stream->readBool();
+}
+
+ShapeBVH::~ShapeBVH() {
+	if (m_triAccel)
+		freeAligned(m_triAccel);
+	if (m_nodes)
+		freeAligned(m_nodes);
+	for (size_t i=0; i<m_shapes.size(); ++i)
+		m_shapes[i]->decRef();
+}
+
+void ShapeBVH::serialize(Stream *stream, InstanceManager *manager) const {
+	stream->writeInt(m_width);
+	stream->writeInt(m_maxLeafSize);
+	stream->writeInt(m_binCount);
+	stream->writeBool(m_parallelBuild);
+}
+
+void ShapeBVH::setWidth(int width) {
+	if (width != 4 && width != 8)
+		Log(EError, "The BVH width must be 4 or 8 (got %i)!", width);
+	m_width = width;
+}
+
+ref<Accelerator> ShapeBVH::createEmpty() const {
+	ref<ShapeBVH> bvh = new ShapeBVH();
+	bvh->setWidth(m_width);
+	bvh->setMaxLeafSize(m_maxLeafSize);
+	bvh->setBinCount(m_binCount);
+	bvh->setParallelBuild(m_parallelBuild);
+	return bvh.get();
+}
+
+void ShapeBVH::addShape(const Shape *shape) {
+	Assert(!m_built);
+	if (shape->isCompound())
+		Log(EError, "Cannot add compound shapes to a BVH - expand them first!");
+	shape->incRef();
+	m_shapes.push_back(shape);
+}
+
+void ShapeBVH::build() {
+	if (m_width == 4)
+		buildInternal<4>();
+	else
+		buildInternal<8>();
+	m_built = true;
+}
+
+template <int N> void ShapeBVH::buildInternal() {
+	typedef BVHBuilder<N> Builder;
+	typedef typename Builder::Node Node;
+	typedef typename Builder::Range Range;
+	typedef typename Builder::Task Task;
+
+	ref<Timer> timer = new Timer();
+
+	m_primitiveCount = 0;
+	for (size_t i=0; i<m_shapes.size(); ++i) {
+		const Shape *shape = m_shapes[i];
+		if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
+			m_primitiveCount += static_cast<const TriMesh *>(shape)->getTriangleCount();
+		else
+			m_primitiveCount += 1;
+	}
+
+	if (m_primitiveCount > (size_t) std::numeric_limits<uint32_t>::max())
+		Log(EError, "The BVH supports at most 2^32 primitives!");
+
+	m_aabb.reset();
+	if (m_primitiveCount == 0)
+		return;
+
+	Log(EDebug, "Constructing a %i-wide BVH (" SIZE_T_FMT " primitives) ..",
+		N, m_primitiveCount);
+
+	/* Compute the bounding boxes and precompute the triangle
+	   intersection information of all primitives */
+	std::vector<AABB> primAABBs(m_primitiveCount);
+	std::vector<Point> centroids(m_primitiveCount);
+	std::vector<uint32_t> indices(m_primitiveCount);
+	TriAccel *triAccel = static_cast<TriAccel *>(
+		allocAligned(m_primitiveCount * sizeof(TriAccel)));
+
+	size_t offset = 0;
+	for (size_t i=0; i<m_shapes.size(); ++i) {
+		const Shape *shape = m_shapes[i];
+		if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh))) {
+			const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+			const Triangle *triangles = mesh->getTriangles();
+			const Point *positions = mesh->getVertexPositions();
+			int triangleCount = (int) mesh->getTriangleCount();
+
+			#if defined(MTS_OPENMP)
+				#pragma omp parallel for if (m_parallelBuild) schedule(static)
+			#endif
+			for (int j=0; j<triangleCount; ++j) {
+				const Triangle &tri = triangles[j];
+				size_t idx = offset + j;
+				primAABBs[idx] = tri.getAABB(positions);
+				centroids[idx] = primAABBs[idx].getCenter();
+				triAccel[idx].load(positions[tri.idx[0]],
+					positions[tri.idx[1]], positions[tri.idx[2]]);
+				triAccel[idx].shapeIndex = (uint32_t) i;
+				triAccel[idx].primIndex = (uint32_t) j;
+			}
+			offset += triangleCount;
+		} else {
+			/* Create a 'fake' triangle, which redirects to a Shape */
+			primAABBs[offset] = shape->getAABB();
+			centroids[offset] = primAABBs[offset].getCenter();
+			memset(&triAccel[offset], 0, sizeof(TriAccel));
+			triAccel[offset].shapeIndex = (uint32_t) i;
+			triAccel[offset].k = KNoTriangleFlag;
+			offset++;
+		}
+	}
+
+	for (size_t i=0; i<m_primitiveCount; ++i)
+		indices[i] = (uint32_t) i;
+
+	Builder builder;
+	builder.primAABBs = &primAABBs[0];
+	builder.centroids = &centroids[0];
+	builder.indices = &indices[0];
+	builder.maxLeafSize = (uint32_t) m_maxLeafSize;
+	builder.binCount = m_binCount;
+
+	Range root = builder.createRange(0, (uint32_t) m_primitiveCount);
+	m_aabb = root.aabb;
+
+	/* Construct the top levels of the hierarchy on the main thread
+	   and defer smaller subtrees to a list of tasks */
+	std::vector<Node> nodes;
+	std::vector<Task> tasks;
+	uint32_t taskSize = (uint32_t) std::max(m_primitiveCount
+		/ (8 * (size_t) getCoreCount()), (size_t) 1024);
+	builder.build(nodes, root, 0, m_parallelBuild ? &tasks : NULL, taskSize);
+
+	/* Construct the deferred subtrees in parallel */
+	std::vector<std::vector<Node> > subtrees(tasks.size());
+	#if defined(MTS_OPENMP)
+		#pragma omp parallel for schedule(dynamic)
+	#endif
+	for (int i=0; i<(int) tasks.size(); ++i)
+		builder.build(subtrees[i], tasks[i].range, tasks[i].depth, NULL, 0);
+
+	/* Append the subtrees and relocate their node indices */
+	for (size_t i=0; i<tasks.size(); ++i) {
+		std::vector<Node> &subtree = subtrees[i];
+		uint32_t nodeOffset = (uint32_t) nodes.size();
+		for (size_t j=0; j<subtree.size(); ++j) {
+			Node &node = subtree[j];
+			for (int k=0; k<N; ++k) {
+				if (node.primCount[k] == 0)
+					node.child[k] += nodeOffset;
+			}
+		}
+		nodes.insert(nodes.end(), subtree.begin(), subtree.end());
+		nodes[tasks[i].node].child[tasks[i].slot] = nodeOffset;
+		std::vector<Node>().swap(subtree);
+	}
+
+	/* Store the nodes and the triangle data in traversal order */
+	m_nodeCount = nodes.size();
+	m_nodes = allocAligned(m_nodeCount * sizeof(Node));
+	memcpy(m_nodes, &nodes[0], m_nodeCount * sizeof(Node));
+
+	m_triAccel = static_cast<TriAccel *>(
+		allocAligned(m_primitiveCount * sizeof(TriAccel)));
+	for (size_t i=0; i<m_primitiveCount; ++i)
+		m_triAccel[i] = triAccel[indices[i]];
+	freeAligned(triAccel);
+
+	Log(EInfo, "Constructed a %i-wide BVH in %i ms (" SIZE_T_FMT " nodes, %s, "
+		SIZE_T_FMT " subtrees built in parallel)", N, timer->getMilliseconds(),
+		m_nodeCount, memString(m_nodeCount * sizeof(Node)
+			+ m_primitiveCount * sizeof(TriAccel)).c_str(), tasks.size());
+}
+
+template <int N, bool ShadowRay> bool ShapeBVH::rayIntersectInternal(const Ray &ray,
+		Float mint, Float maxt, Float &t, void *temp) const {
+	typedef BVHNode<N> Node;
+
+	/// Traversal stack entry (inner nodes have a primitive count of zero)
+	struct StackEntry {
+		float tnear;
+		uint32_t child;
+		uint32_t primCount;
+	};
+
+	const Node *nodes = static_cast<const Node *>(m_nodes);
+	IntersectionCache *cache = static_cast<IntersectionCache *>(temp);
+	StackEntry stack[(MTS_BVH_MAXDEPTH + 1) * N];
+	int stackSize = 0;
+	bool foundIntersection = false;
+
+	const float o[3] = { (float) ray.o.x, (float) ray.o.y, (float) ray.o.z };
+	const float dRcp[3] = { (float) ray.dRcp.x, (float) ray.dRcp.y, (float) ray.dRcp.z };
+	const int signs[3] = { ray.d.x < 0 ? 1 : 0, ray.d.y < 0 ? 1 : 0, ray.d.z < 0 ? 1 : 0 };
+	float tnear[N];
+
+	stack[0].tnear = (float) mint;
+	stack[0].child = 0;
+	stack[0].primCount = 0;
+	stackSize = 1;
+
+	while (stackSize > 0) {
+		const StackEntry entry = stack[--stackSize];
+		if (entry.tnear > maxt)
+			continue;
+
+		if (entry.primCount == 0) {
+			/* Push the intersected children so that the closest one is on top */
+			const Node &node = nodes[entry.child];
+			int mask = node.rayIntersect(o, dRcp, signs, (float) mint,
+				(float) maxt, tnear);
+			int base = stackSize;
+
+			for (int i=0; mask != 0; ++i, mask >>= 1) {
+				if (!(mask & 1))
+					continue;
+				int j = stackSize++;
+				while (j > base && stack[j-1].tnear < tnear[i]) {
+					stack[j] = stack[j-1];
+					--j;
+				}
+				stack[j].tnear = tnear[i];
+				stack[j].child = node.child[i];
+				stack[j].primCount = node.primCount[i];
+			}
+			continue;
+		}
+
+		/* Arrived at a leaf -- intersect against its primitives */
+		for (uint32_t i=entry.child, end=entry.child + entry.primCount; i<end; ++i) {
+			const TriAccel &ta = m_triAccel[i];
+			if (EXPECT_TAKEN(ta.k != KNoTriangleFlag)) {
+				Float u, v, tempT;
+				if (ta.rayIntersect(ray, mint, maxt, u, v, tempT)) {
+					if (ShadowRay)
+						return true;
+					maxt = t = tempT;
+					cache->shapeIndex = ta.shapeIndex;
+					cache->primIndex = ta.primIndex;
+					cache->u = u;
+					cache->v = v;
+					foundIntersection = true;
+				}
+			} else {
+				const Shape *shape = m_shapes[ta.shapeIndex];
+				if (ShadowRay) {
+					if (shape->rayIntersect(ray, mint, maxt))
+						return true;
+				} else {
+					Float tempT;
+					if (shape->rayIntersect(ray, mint, maxt, tempT,
+							reinterpret_cast<uint8_t *>(temp) + 2*sizeof(uint32_t))) {
+						maxt = t = tempT;
+						cache->shapeIndex = ta.shapeIndex;
+						cache->primIndex = KNoTriangleFlag;
+						foundIntersection = true;
+					}
+				}
+			}
+		}
+	}
+
+	return foundIntersection;
+}
+
+template <bool ShadowRay> FINLINE bool ShapeBVH::rayIntersectDispatch(
+		const Ray &ray, Float &t, void *temp) const {
+	Float mint, maxt;
+	if (EXPECT_NOT_TAKEN(!m_nodes) || !m_aabb.rayIntersect(ray, mint, maxt))
+		return false;
+
+	/* Use an adaptive ray epsilon */
+	Float rayMinT = ray.mint;
+	if (rayMinT == Epsilon)
+		rayMinT *= std::max(std::max(std::max(std::abs(ray.o.x),
+			std::abs(ray.o.y)), std::abs(ray.o.z)), Epsilon);
+
+	if (rayMinT > mint) mint = rayMinT;
+	if (ray.maxt < maxt) maxt = ray.maxt;
+
+	if (EXPECT_NOT_TAKEN(maxt <= mint))
+		return false;
+
+	if (m_width == 4)
+		return rayIntersectInternal<4, ShadowRay>(ray, mint, maxt, t, temp);
+	else
+		return rayIntersectInternal<8, ShadowRay>(ray, mint, maxt, t, temp);
+}
+
+void ShapeBVH::fillIntersectionRecord(const Ray &ray, const void *temp,
+		Intersection &its) const {
+	const IntersectionCache *cache = static_cast<const IntersectionCache *>(temp);
+	const Shape *shape = m_shapes[cache->shapeIndex];
+
+	if (cache->primIndex != KNoTriangleFlag)
+		static_cast<const TriMesh *>(shape)->fillTriangleIntersectionRecord<true>(
+			ray, cache->primIndex, cache->u, cache->v, its);
+	else
+		shape->fillIntersectionRecord(ray,
+			static_cast<const uint8_t *>(temp) + 2*sizeof(uint32_t), its);
+
+	computeShadingFrame(its.shFrame.n, its.dpdu, its.shFrame);
+	its.wi = its.toLocal(-ray.d);
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray, Intersection &its) const {
+	uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+	its.t = std::numeric_limits<Float>::infinity();
+
+	++bvhRaysTraced;
+	if (rayIntersectDispatch<false>(ray, its.t, temp)) {
+		fillIntersectionRecord(ray, temp, its);
+		return true;
+	}
+	return false;
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray, Float &t, ConstShapePtr &shape,
+		Normal &n, Point2 &uv) const {
+	uint8_t temp[MTS_KD_INTERSECTION_TEMP];
+	t = std::numeric_limits<Float>::infinity();
+
+	++bvhRaysTraced;
+	if (!rayIntersectDispatch<false>(ray, t, temp))
+		return false;
+
+	const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(temp);
+	shape = m_shapes[cache->shapeIndex];
+
+	if (cache->primIndex != KNoTriangleFlag) {
+		const TriMesh *trimesh = static_cast<const TriMesh *>(shape);
+		const Triangle &tri = trimesh->getTriangles()[cache->primIndex];
+		const Point *vertexPositions = trimesh->getVertexPositions();
+		const Point2 *vertexTexcoords = trimesh->getVertexTexcoords();
+		const uint32_t idx0 = tri.idx[0], idx1 = tri.idx[1], idx2 = tri.idx[2];
+		const Point &p0 = vertexPositions[idx0];
+		const Point &p1 = vertexPositions[idx1];
+		const Point &p2 = vertexPositions[idx2];
+		n = normalize(cross(p1-p0, p2-p0));
+
+		if (EXPECT_TAKEN(vertexTexcoords)) {
+			const Vector b(1 - cache->u - cache->v, cache->u, cache->v);
+			uv = vertexTexcoords[idx0] * b.x + vertexTexcoords[idx1] * b.y
+				+ vertexTexcoords[idx2] * b.z;
+		} else {
+			uv = Point2(0.0f);
+		}
+	} else {
+		Intersection its;
+		its.t = t;
+		shape->fillIntersectionRecord(ray,
+			reinterpret_cast<const uint8_t *>(temp) + 2*sizeof(uint32_t), its);
+		n = its.geoFrame.n;
+		uv = its.uv;
+		if (its.shape)
+			shape = its.shape;
+	}
+	return true;
+}
+
+bool ShapeBVH::rayIntersect(const Ray &ray) const {
+	Float t = std::numeric_limits<Float>::infinity();
+	++bvhShadowRaysTraced;
+	return rayIntersectDispatch<true>(ray, t, NULL);
+}
+
+std::string ShapeBVH::toString() const {
+	std::ostringstream oss;
+	oss << "ShapeBVH[" << endl
+		<< "  width = " << m_width << "," << endl
+		<< "  maxLeafSize = " << m_maxLeafSize << "," << endl
+		<< "  binCount = " << m_binCount << "," << endl
+		<< "  parallelBuild = " << m_parallelBuild << "," << endl
+		<< "  shapes = " << m_shapes.size() << "," << endl
+		<< "  primitiveCount = " << m_primitiveCount << "," << endl
+		<< "  nodeCount = " << m_nodeCount << "," << endl
+		<< "  built = " << m_built << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS_S(ShapeBVH, false, Accelerator)
+MTS_NAMESPACE_END
@@ -86,6 +86,37 @@ void Film::addChild(const std::string &name, ConfigurableObject *child) {
 	}
 }
 
+std::vector<AOV> Film::getAOVs() const {
+	return std::vector<AOV>();
+}
+
+static const char *__aovNames[] = {
+	"depth", "distance", "position", "geoNormal", "shNormal",
+	"uv", "albedo", "mask", "objectId", "partId", "coverage"
+};
+
+static const int __aovChannelCounts[] = {
+	1, 1, 3, 3, 3, 2, 3, 1, 1, 1, 1
+};
+
+int AOV::getChannelCount(EType type) {
+	return __aovChannelCounts[type];
+}
+
+std::string AOV::getName(EType type) {
+	return __aovNames[type];
+}
+
+bool AOV::fromString(const std::string &name, EType &type) {
+	for (int i=0; i<ETypeCount; ++i) {
+		if (name == __aovNames[i]) {
+			type = (EType) i;
+			return true;
+		}
+	}
+	return false;
+}
+
 void Film::configure() {
 	if (m_filter == NULL) {
 		/* No reconstruction filter has been selected. Load a Gaussian filter by default */
@@ -22,12 +22,14 @@ MTS_NAMESPACE_BEGIN
 
 ImageBlock::ImageBlock(Bitmap::EPixelFormat fmt, const Vector2i &size,
 		const ReconstructionFilter *filter, int channels, bool warn) : m_offset(0),
-		m_size(size), m_filter(filter), m_weightsX(NULL), m_weightsY(NULL), m_warn(warn) {
+		m_size(size), m_filter(filter), m_weightsX(NULL), m_weightsY(NULL), m_warn(warn),
+		m_tilesX(0) {
 	m_borderSize = filter ? filter->getBorderSize() : 0;
 
 	/* Allocate a small bitmap data structure for the block */
 	m_bitmap = new Bitmap(fmt, Bitmap::EFloat,
 		size + Vector2i(2 * m_borderSize), channels);
+	m_filteredChannels = m_bitmap->getChannelCount();
 
 	if (filter) {
 		/* Temporary buffers used in put() */
@@ -42,6 +44,58 @@ ImageBlock::~ImageBlock() {
 		delete[] m_weightsX;
 }
 
+void ImageBlock::setConcurrentPut(bool value) {
+	const int tileSize = MTS_IMAGEBLOCK_TILE_SIZE;
+	m_tileLocks.clear();
+	m_tilesX = 0;
+	if (!value)
+		return;
+
+	/* Tiles are aligned to the start of the interior region */
+	const int shift = (tileSize - m_borderSize % tileSize) % tileSize;
+	const Vector2i &size = m_bitmap->getSize();
+	m_tilesX = (size.x + shift + tileSize - 1) / tileSize;
+	int tilesY = (size.y + shift + tileSize - 1) / tileSize;
+
+	m_tileLocks.reserve((size_t) m_tilesX * tilesY);
+	for (int i=0; i<m_tilesX * tilesY; ++i)
+		m_tileLocks.push_back(new Mutex());
+}
+
+void ImageBlock::putConcurrent(const ImageBlock *block) {
+	const int tileSize = MTS_IMAGEBLOCK_TILE_SIZE;
+	const int shift = (tileSize - m_borderSize % tileSize) % tileSize;
+	const Bitmap *source = block->getBitmap();
+	const Point2i targetOffset = Point2i(block->getOffset() - m_offset
+		- Vector2i(block->getBorderSize() - m_borderSize));
+
+	/* Region of this block that is affected by the merge */
+	const Point2i
+		start(std::max(targetOffset.x, 0), std::max(targetOffset.y, 0)),
+		end(std::min(targetOffset.x + source->getWidth(), m_bitmap->getWidth()),
+		    std::min(targetOffset.y + source->getHeight(), m_bitmap->getHeight()));
+
+	if (start.x >= end.x || start.y >= end.y)
+		return;
+
+	/* Merge one tile at a time. Only a single lock is held at any
+	   point, hence the order of the tiles does not matter */
+	for (int ty = (start.y + shift) / tileSize; ty <= (end.y - 1 + shift) / tileSize; ++ty) {
+		for (int tx = (start.x + shift) / tileSize; tx <= (end.x - 1 + shift) / tileSize; ++tx) {
+			Point2i tileStart(
+				std::max(start.x, tx * tileSize - shift),
+				std::max(start.y, ty * tileSize - shift));
+			Point2i tileEnd(
+				std::min(end.x, (tx + 1) * tileSize - shift),
+				std::min(end.y, (ty + 1) * tileSize - shift));
+
+			LockGuard lock(m_tileLocks[ty * m_tilesX + tx]);
+			m_bitmap->accumulate(source, Point2i(tileStart - targetOffset),
+				tileStart, tileEnd - tileStart);
+		}
+	}
+}
+
 void ImageBlock::load(Stream *stream) {
 	m_offset = Point2i(stream);
 	m_size = Vector2i(stream);
@@ -60,6 +114,80 @@ void ImageBlock::save(Stream *stream) const {
 		(size_t) m_bitmap->getSize().y * m_bitmap->getChannelCount());
 }
 
+void ImageBlock::saveCompact(Stream *stream) const {
+	m_offset.serialize(stream);
+	m_size.serialize(stream);
+
+	const Float *data = m_bitmap->getFloatData();
+	int channels = m_bitmap->getChannelCount();
+	size_t pixels = (size_t) m_bitmap->getSize().x * (size_t) m_bitmap->getSize().y,
+	       count = pixels * channels;
+
+	/* Scale each channel by a power of two (which is exact), so that
+	   its largest finite magnitude lies in [2^14, 2^15) */
+	std::vector<Float> invScales(channels);
+	for (int ch=0; ch<channels; ++ch) {
+		Float maxValue = 0;
+		for (size_t i=0; i<pixels; ++i) {
+			Float value = std::abs(data[i * channels + ch]);
+			if (value > maxValue && value <= std::numeric_limits<Float>::max())
+				maxValue = value;
+		}
+		int exponent = 15;
+		if (maxValue > 0)
+			std::frexp(maxValue, &exponent);
+		/* Keep the scale factors representable in single precision */
+		exponent = math::clamp(exponent - 15, -110, 110);
+		stream->writeShort((short) exponent);
+		invScales[ch] = std::ldexp((Float) 1, -exponent);
+	}
+
+	/* Store the difference to the previous pixel of each channel
+	   (modulo 2^16), and arrange the result as two byte planes */
+	std::vector<uint8_t> planes(2 * count);
+	uint8_t *high = &planes[0], *low = high + count;
+	for (int ch=0; ch<channels; ++ch) {
+		uint16_t prev = 0;
+		for (size_t i=0; i<pixels; ++i) {
+			size_t idx = i * channels + ch;
+			half value((float) (data[idx] * invScales[ch]));
+			uint16_t bits = value.bits(), delta = (uint16_t) (bits - prev);
+			size_t pos = ch * pixels + i;
+			high[pos] = (uint8_t) (delta >> 8);
+			low[pos] = (uint8_t) delta;
+			prev = bits;
+		}
+	}
+	stream->write(&planes[0], planes.size());
+}
+
+void ImageBlock::loadCompact(Stream *stream) {
+	m_offset = Point2i(stream);
+	m_size = Vector2i(stream);
+
+	Float *data = m_bitmap->getFloatData();
+	int channels = m_bitmap->getChannelCount();
+	size_t pixels = (size_t) m_bitmap->getSize().x * (size_t) m_bitmap->getSize().y,
+	       count = pixels * channels;
+
+	std::vector<Float> scales(channels);
+	for (int ch=0; ch<channels; ++ch)
+		scales[ch] = std::ldexp((Float) 1, (int) stream->readShort());
+
+	std::vector<uint8_t> planes(2 * count);
+	stream->read(&planes[0], planes.size());
+	const uint8_t *high = &planes[0], *low = high + count;
+	for (int ch=0; ch<channels; ++ch) {
+		uint16_t prev = 0;
+		for (size_t i=0; i<pixels; ++i) {
+			size_t pos = ch * pixels + i;
+			half value;
+			value.setBits((uint16_t) (prev + ((high[pos] << 8) | low[pos])));
+			data[i * channels + ch] = (Float) (float) value * scales[ch];
+			prev = value.bits();
+		}
+	}
+}
 
 std::string ImageBlock::toString() const {
 	std::ostringstream oss;
@@ -128,6 +128,47 @@ bool SamplingIntegrator::render(Scene *scene,
 	return proc->getReturnStatus() == ParallelProcess::ESuccess;
 }
 
+bool SamplingIntegrator::renderViews(Scene *scene,
+		RenderQueue *queue, const RenderJob *job, int sceneResID,
+		const std::vector<int> &sensorResIDs, int samplerResID) {
+	ref<Scheduler> sched = Scheduler::getInstance();
+	std::vector<Sensor *> sensors(sensorResIDs.size());
+	for (size_t i=0; i<sensorResIDs.size(); ++i)
+		sensors[i] = static_cast<Sensor *>(sched->getResource(sensorResIDs[i]));
+	if (sensors.empty())
+		Log(EError, "At least one view must be specified!");
+	const Film *film = sensors[0]->getFilm();
+
+	size_t nCores = sched->getCoreCount();
+	const Sampler *sampler = static_cast<const Sampler *>(sched->getResource(samplerResID, 0));
+	size_t sampleCount = sampler->getSampleCount();
+
+	Log(EInfo, "Starting render job (" SIZE_T_FMT " views of %ix%i, " SIZE_T_FMT
+		" %s, " SIZE_T_FMT " %s, " SSE_STR ") ..", sensors.size(),
+		film->getCropSize().x, film->getCropSize().y,
+		sampleCount, sampleCount == 1 ? "sample" : "samples", nCores,
+		nCores == 1 ? "core" : "cores");
+
+	ref<ParallelProcess> proc = new MultiViewRenderProcess(job,
+		queue, scene->getBlockSize(), sensors);
+	int integratorResID = sched->registerResource(this);
+	proc->bindResource("integrator", integratorResID);
+	proc->bindResource("scene", sceneResID);
+	for (size_t i=0; i<sensorResIDs.size(); ++i)
+		proc->bindResource(formatString("sensor%i", (int) i), sensorResIDs[i]);
+	proc->bindResource("sampler", samplerResID);
+	scene->bindUsedResources(proc);
+	bindUsedResources(proc);
+	sched->schedule(proc);
+
+	m_process = proc;
+	sched->wait(proc);
+	m_process = NULL;
+	sched->unregisterResource(integratorResID);
+
+	return proc->getReturnStatus() == ParallelProcess::ESuccess;
+}
+
 void SamplingIntegrator::bindUsedResources(ParallelProcess *) const {
 	/* Do nothing by default */
 }
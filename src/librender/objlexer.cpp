@@ -0,0 +1,100 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/objlexer.h>
+
+MTS_NAMESPACE_BEGIN
+
+const double OBJLexer::m_pow10[23] = {
+	1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,
+	1e8,  1e9,  1e10, 1e11, 1e12, 1e13, 1e14, 1e15,
+	1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+OBJLexer::OBJLexer(const fs::path &filename)
+		: m_start(NULL), m_end(NULL), m_pos(NULL), m_started(false) {
+	if (!fs::exists(filename))
+		Log(EError, "The file \"%s\" does not exist!", filename.string().c_str());
+
+	/* Empty files cannot be mapped */
+	if (fs::file_size(filename) == 0)
+		return;
+
+	m_file = new MemoryMappedFile(filename);
+	m_start = m_pos = static_cast<const char *>(m_file->getData());
+	m_end = m_start + m_file->getSize();
+}
+
+OBJLexer::OBJLexer(const char *start, const char *end)
+	: m_start(start), m_end(end), m_pos(start), m_started(false) { }
+
+std::string OBJLexer::readRest() {
+	skipSpace();
+	std::string result;
+	const char *start = m_pos;
+
+	while (m_pos < m_end && *m_pos != '\n') {
+		size_t skip = continuation(m_pos);
+		if (skip > 0) {
+			result.append(start, m_pos);
+			m_pos += skip;
+			start = m_pos;
+		} else {
+			++m_pos;
+		}
+	}
+	result.append(start, m_pos);
+
+	size_t length = result.length();
+	while (length > 0 && isSpace(result[length-1]))
+		--length;
+	result.resize(length);
+
+	return result;
+}
+
+bool OBJLexer::readFloatSlow(Float &value) {
+	Token token = readToken();
+	char buf[64];
+
+	size_t length = std::min(token.length, sizeof(buf) - 1);
+	memcpy(buf, token.data, length);
+	buf[length] = '\0';
+
+	char *end = NULL;
+	double result = std::strtod(buf, &end);
+	if (end == buf) {
+		value = 0;
+		return false;
+	}
+	value = (Float) result;
+	return true;
+}
+
+std::string OBJLexer::toString() const {
+	std::ostringstream oss;
+	oss << "OBJLexer[" << endl
+		<< "  file = " << (m_file.get() ? m_file->getFilename().string() : "<memory>") << "," << endl
+		<< "  size = " << (m_end - m_start) << "," << endl
+		<< "  position = " << (m_pos - m_start) << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(OBJLexer, false, Object)
+MTS_NAMESPACE_END
@@ -0,0 +1,287 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/objparser.h>
+#include <mitsuba/core/timer.h>
+#include <climits>
+
+#if defined(MTS_OPENMP)
+# include <omp.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+/// Geometry and statements of one chunk of the file
+struct OBJParser::Chunk {
+	const char *start, *end;
+	std::vector<Point> positions;
+	std::vector<Normal> normals;
+	std::vector<Point2> texcoords;
+	std::vector<Face> faces;
+	std::vector<Statement> statements;
+
+	/**
+	 * Faces with relative indices. These were resolved against the
+	 * attribute counts within the chunk, and \c relativeMask records
+	 * which of the nine indices still need the offset of the chunk
+	 */
+	std::vector<uint32_t> relativeFaces;
+	std::vector<uint16_t> relativeMask;
+
+	/// Number of skipped faces with fewer than three vertices
+	size_t degenerateFaces;
+
+	std::string error;
+
+	inline Chunk() : start(NULL), end(NULL), degenerateFaces(0) { }
+};
+
+/**
+ * Is the newline at \c ptr the end of a line, i.e. not preceded by
+ * a backslash that continues the line?
+ */
+static bool isLineEnd(const char *start, const char *ptr) {
+	while (ptr > start) {
+		char c = *(--ptr);
+		if (c == '\\')
+			return false;
+		else if (c != ' ' && c != '\t' && c != '\r')
+			return true;
+	}
+	return true;
+}
+
+/**
+ * Store a parsed face index, unless it was not specified (\c INT_MIN).
+ * Negative indices are resolved against the current attribute count
+ * of the chunk and flagged in \c relative.
+ */
+static inline void resolve(int &target, int index, size_t count, uint8_t &relative, int bit) {
+	if (index == INT_MIN)
+		return;
+	if (index < 0) {
+		index += (int) count + 1;
+		relative |= (uint8_t) (1 << bit);
+	} else {
+		relative &= (uint8_t) ~(1 << bit);
+	}
+	target = index;
+}
+
+OBJParser::OBJParser(const fs::path &filename, size_t minChunkSize)
+		: m_filename(filename), m_chunkCount(0) {
+	ref<Timer> timer = new Timer();
+	ref<OBJLexer> lexer = new OBJLexer(filename);
+	const char *start = lexer->getStart(), *end = lexer->getEnd();
+	size_t size = (size_t) (end - start);
+
+	size_t chunkCount = 1;
+	#if defined(MTS_OPENMP)
+		chunkCount = std::min((size_t) mts_omp_get_max_threads() * 4,
+			size / std::max(minChunkSize, (size_t) 1));
+		chunkCount = std::max(chunkCount, (size_t) 1);
+	#endif
+
+	/* Split at line boundaries close to equally spaced offsets */
+	std::vector<Chunk> chunks(chunkCount);
+	const char *chunkStart = start;
+	for (size_t i=0; i<chunkCount; ++i) {
+		const char *chunkEnd = end;
+		if (i+1 < chunkCount) {
+			chunkEnd = std::max(chunkStart, start + (size * (i+1)) / chunkCount);
+			while (chunkEnd < end && (*chunkEnd != '\n' || !isLineEnd(chunkStart, chunkEnd)))
+				++chunkEnd;
+			if (chunkEnd < end)
+				++chunkEnd;
+		}
+		chunks[i].start = chunkStart;
+		chunks[i].end = chunkEnd;
+		chunkStart = chunkEnd;
+	}
+
+	if (chunkCount == 1) {
+		parseChunk(lexer, chunks[0]);
+	} else {
+		#if defined(MTS_OPENMP)
+			#pragma omp parallel for schedule(dynamic)
+		#endif
+		for (int i=0; i<(int) chunkCount; ++i) {
+			ref<OBJLexer> chunkLexer = new OBJLexer(chunks[i].start, chunks[i].end);
+			parseChunk(chunkLexer, chunks[i]);
+		}
+	}
+
+	/* Merge in file order */
+	size_t positionCount = 0, normalCount = 0, texcoordCount = 0, faceCount = 0,
+	       degenerateFaces = 0;
+	for (size_t i=0; i<chunkCount; ++i) {
+		if (!chunks[i].error.empty())
+			Log(EError, "Error while parsing \"%s\": %s",
+				filename.filename().string().c_str(), chunks[i].error.c_str());
+		positionCount += chunks[i].positions.size();
+		normalCount += chunks[i].normals.size();
+		texcoordCount += chunks[i].texcoords.size();
+		faceCount += chunks[i].faces.size();
+		degenerateFaces += chunks[i].degenerateFaces;
+	}
+
+	if (degenerateFaces > 0)
+		Log(EWarn, "\"%s\": skipped " SIZE_T_FMT " face(s) with fewer than three vertices",
+			filename.filename().string().c_str(), degenerateFaces);
+
+	m_positions.reserve(positionCount);
+	m_normals.reserve(normalCount);
+	m_texcoords.reserve(texcoordCount);
+	m_faces.reserve(faceCount);
+
+	for (size_t i=0; i<chunkCount; ++i)
+		merge(chunks[i]);
+
+	m_chunkCount = chunkCount;
+
+	Log(EDebug, "Parsed \"%s\" in " SIZE_T_FMT " chunk(s) (took %i ms)",
+		filename.filename().string().c_str(), chunkCount, timer->getMilliseconds());
+}
+
+void OBJParser::parseChunk(OBJLexer *lexer, Chunk &chunk) {
+	try {
+		while (lexer->nextLine()) {
+			OBJLexer::Token keyword = lexer->readToken();
+
+			if (keyword == "v") {
+				Point p;
+				lexer->readFloat(p.x);
+				lexer->readFloat(p.y);
+				lexer->readFloat(p.z);
+				chunk.positions.push_back(p);
+			} else if (keyword == "vn") {
+				Normal n;
+				lexer->readFloat(n.x);
+				lexer->readFloat(n.y);
+				lexer->readFloat(n.z);
+				chunk.normals.push_back(n);
+			} else if (keyword == "vt") {
+				Point2 uv;
+				lexer->readFloat(uv.x);
+				lexer->readFloat(uv.y);
+				chunk.texcoords.push_back(uv);
+			} else if (keyword == "f") {
+				/* Handle n-gons assuming a convex shape */
+				Face t;
+				uint8_t relative[3] = { 0, 0, 0 };
+				int corner = 0, p, uv, n;
+
+				while (p = uv = n = INT_MIN, lexer->readFaceVertex(p, uv, n)) {
+					int slot = std::min(corner, 2);
+					if (corner >= 3) {
+						/* The previous third vertex becomes the second one,
+						   and the new one inherits any unspecified index */
+						t.p[1] = t.p[2];
+						t.uv[1] = t.uv[2];
+						t.n[1] = t.n[2];
+						relative[1] = relative[2];
+					}
+
+					resolve(t.p[slot], p, chunk.positions.size(), relative[slot], 0);
+					resolve(t.uv[slot], uv, chunk.texcoords.size(), relative[slot], 1);
+					resolve(t.n[slot], n, chunk.normals.size(), relative[slot], 2);
+
+					if (++corner < 3)
+						continue;
+
+					uint16_t mask = 0;
+					for (int i=0; i<3; ++i) {
+						for (int j=0; j<3; ++j) {
+							if (relative[i] & (1 << j))
+								mask |= (uint16_t) (1 << (3*j + i));
+						}
+					}
+					if (mask != 0) {
+						chunk.relativeFaces.push_back((uint32_t) chunk.faces.size());
+						chunk.relativeMask.push_back(mask);
+					}
+					chunk.faces.push_back(t);
+				}
+
+				if (corner < 3)
+					chunk.degenerateFaces++;
+			} else if (keyword.data[0] != '#') {
+				Statement statement;
+				statement.keyword = keyword.str();
+				statement.value = lexer->readRest();
+				statement.faceIndex = chunk.faces.size();
+				chunk.statements.push_back(statement);
+			}
+		}
+	} catch (const std::exception &e) {
+		/* Exceptions must not escape from an OpenMP region */
+		chunk.error = e.what();
+	}
+}
+
+void OBJParser::merge(Chunk &chunk) {
+	const int positionOffset = (int) m_positions.size(),
+	          texcoordOffset = (int) m_texcoords.size(),
+	          normalOffset = (int) m_normals.size();
+	const size_t faceOffset = m_faces.size();
+
+	for (size_t i=0; i<chunk.relativeFaces.size(); ++i) {
+		Face &face = chunk.faces[chunk.relativeFaces[i]];
+		uint16_t mask = chunk.relativeMask[i];
+		for (int j=0; j<3; ++j) {
+			if (mask & (1 << j))
+				face.p[j] += positionOffset;
+			if (mask & (1 << (3+j)))
+				face.uv[j] += texcoordOffset;
+			if (mask & (1 << (6+j)))
+				face.n[j] += normalOffset;
+		}
+	}
+
+	for (size_t i=0; i<chunk.statements.size(); ++i)
+		chunk.statements[i].faceIndex += faceOffset;
+
+	m_positions.insert(m_positions.end(), chunk.positions.begin(), chunk.positions.end());
+	m_normals.insert(m_normals.end(), chunk.normals.begin(), chunk.normals.end());
+	m_texcoords.insert(m_texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+	m_faces.insert(m_faces.end(), chunk.faces.begin(), chunk.faces.end());
+	m_statements.insert(m_statements.end(), chunk.statements.begin(), chunk.statements.end());
+
+	/* Release the memory of the chunk early */
+	std::vector<Point>().swap(chunk.positions);
+	std::vector<Normal>().swap(chunk.normals);
+	std::vector<Point2>().swap(chunk.texcoords);
+	std::vector<Face>().swap(chunk.faces);
+}
+
+std::string OBJParser::toString() const {
+	std::ostringstream oss;
+	oss << "OBJParser[" << endl
+		<< "  filename = \"" << m_filename.string() << "\"," << endl
+		<< "  positions = " << m_positions.size() << "," << endl
+		<< "  normals = " << m_normals.size() << "," << endl
+		<< "  texcoords = " << m_texcoords.size() << "," << endl
+		<< "  faces = " << m_faces.size() << "," << endl
+		<< "  statements = " << m_statements.size() << "," << endl
+		<< "  chunks = " << m_chunkCount << endl
+		<< "]";
+	return oss.str();
+}
+
+MTS_IMPLEMENT_CLASS(OBJParser, false, Object)
+MTS_NAMESPACE_END
@@ -18,7 +18,10 @@
 
 #include <mitsuba/render/renderjob.h>
 #include <mitsuba/render/renderproc.h>
+#include <mitsuba/core/plugin.h>
 #include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/algorithm/string.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -82,6 +85,140 @@ RenderJob::~RenderJob() {
 		sched->unregisterResource(m_samplerResID);
 	if (m_ownsSensorResource)
 		sched->unregisterResource(m_sensorResID);
+	for (size_t i=0; i<m_viewSensorResIDs.size(); ++i)
+		sched->unregisterResource(m_viewSensorResIDs[i]);
+}
+
+void RenderJob::setViews(const std::vector<Transform> &cameraToWorld) {
+	ref<Scheduler> sched = Scheduler::getInstance();
+	const Sensor *sensor = m_scene->getSensor();
+	const Film *film = sensor->getFilm();
+	PluginManager *pluginMgr = PluginManager::getInstance();
+
+	for (size_t i=0; i<m_viewSensorResIDs.size(); ++i)
+		sched->unregisterResource(m_viewSensorResIDs[i]);
+	m_viewSensors.clear();
+	m_viewSensorResIDs.clear();
+
+	fs::path destFile = m_scene->getDestinationFile();
+	for (size_t i=0; i<cameraToWorld.size(); ++i) {
+		/* Re-instantiate the sensor and film from their properties. Films
+		   that write all views into one file use the view index and count */
+		Properties filmProps(film->getProperties());
+		filmProps.setInteger("viewIndex", (int) i, false);
+		filmProps.setInteger("viewCount", (int) cameraToWorld.size(), false);
+		ref<Film> viewFilm = static_cast<Film *> (pluginMgr->createObject(
+			MTS_CLASS(Film), filmProps));
+		viewFilm->addChild(const_cast<ReconstructionFilter *>(
+			film->getReconstructionFilter()));
+		viewFilm->configure();
+
+		Properties props(sensor->getProperties());
+		props.setTransform("toWorld", cameraToWorld[i], false);
+		ref<Sensor> viewSensor = static_cast<Sensor *> (pluginMgr->createObject(
+			MTS_CLASS(Sensor), props));
+		viewSensor->addChild(viewFilm);
+		viewSensor->addChild(const_cast<Sampler *>(sensor->getSampler()));
+		if (sensor->getMedium())
+			viewSensor->addChild(const_cast<Medium *>(sensor->getMedium()));
+		viewSensor->configure();
+
+		viewFilm->setDestinationFile(getViewDestinationFile(destFile, i),
+			m_scene->getBlockSize());
+
+		m_viewSensors.push_back(viewSensor);
+		m_viewSensorResIDs.push_back(sched->registerResource(viewSensor));
+	}
+}
+
+std::vector<Transform> RenderJob::loadViews(const fs::path &filename) {
+	fs::ifstream is(filename);
+	if (is.fail())
+		SLog(EError, "Unable to open the view file \"%s\"!", filename.string().c_str());
+
+	std::vector<Transform> views;
+	std::string line;
+	int lineNumber = 0;
+	while (std::getline(is, line)) {
+		std::istringstream iss(line);
+		std::string keyword, rest;
+		++lineNumber;
+
+		if (!(iss >> keyword) || keyword[0] == '#')
+			continue;
+		boost::to_lower(keyword);
+
+		if (keyword == "lookat") {
+			Float v[9];
+			for (int i=0; i<9; ++i)
+				iss >> v[i];
+			Point origin(v[0], v[1], v[2]), target(v[3], v[4], v[5]);
+			Vector up(v[6], v[7], v[8]);
+			if (iss.fail() || (iss >> rest))
+				SLog(EError, "\"%s\" [line %i]: expected nine values after 'lookat'!",
+					filename.string().c_str(), lineNumber);
+			if (cross(target - origin, up).isZero())
+				SLog(EError, "\"%s\" [line %i]: invalid 'lookat' specification!",
+					filename.string().c_str(), lineNumber);
+			views.push_back(Transform::lookAt(origin, target, up));
+		} else if (keyword == "matrix") {
+			Matrix4x4 matrix;
+			for (int i=0; i<4; ++i)
+				for (int j=0; j<4; ++j)
+					iss >> matrix(i, j);
+			if (iss.fail() || (iss >> rest))
+				SLog(EError, "\"%s\" [line %i]: expected 16 values after 'matrix'!",
+					filename.string().c_str(), lineNumber);
+			views.push_back(Transform(matrix));
+		} else {
+			SLog(EError, "\"%s\" [line %i]: unknown keyword \"%s\" (expected "
+				"'lookat' or 'matrix')!", filename.string().c_str(), lineNumber,
+				keyword.c_str());
+		}
+	}
+
+	if (views.empty())
+		SLog(EError, "The view file \"%s\" does not contain any views!",
+			filename.string().c_str());
+
+	return views;
+}
+
+void RenderJob::flush() {
+	if (m_viewSensors.empty()) {
+		m_scene->flush(m_queue, this);
+	} else {
+		Float renderTime = m_queue->getRenderTime(this);
+		for (size_t i=0; i<m_viewSensors.size(); ++i)
+			m_viewSensors[i]->getFilm()->develop(m_scene, renderTime);
+	}
+}
+
+fs::path RenderJob::getViewDestinationFile(const fs::path &destFile, size_t index) {
+	return destFile.parent_path() / formatString("%s_%03i%s",
+		destFile.stem().string().c_str(), (int) index,
+		destFile.extension().string().c_str());
+}
+
+bool RenderJob::viewDestinationsExist(const Scene *scene, size_t viewCount) {
+	const Film *film = scene->getFilm();
+	for (size_t i=0; i<viewCount; ++i) {
+		if (!film->destinationExists(getViewDestinationFile(scene->getDestinationFile(), i)))
+			return false;
+	}
+	return true;
+}
+
+bool RenderJob::renderViews() {
+	ref<Integrator> integrator = m_scene->getIntegrator();
+	if (!integrator->getClass()->derivesFrom(MTS_CLASS(SamplingIntegrator)))
+		Log(EError, "Rendering multiple views requires a sampling-based integrator!");
+
+	for (size_t i=0; i<m_viewSensors.size(); ++i)
+		m_viewSensors[i]->getFilm()->clear();
+
+	return static_cast<SamplingIntegrator *>(integrator.get())->renderViews(
+		m_scene, m_queue, this, m_sceneResID, m_viewSensorResIDs, m_samplerResID);
 }
 
 void RenderJob::run() {
@@ -90,8 +227,9 @@ void RenderJob::run() {
 	m_cancelled = false;
 
 	try {
-		m_scene->getFilm()->setDestinationFile(m_scene->getDestinationFile(),
-			m_scene->getBlockSize());
+		if (m_viewSensors.empty())
+			m_scene->getFilm()->setDestinationFile(m_scene->getDestinationFile(),
+				m_scene->getBlockSize());
 
 		if (!m_scene->preprocess(m_queue, this, m_sceneResID, m_sensorResID, m_samplerResID)) {
 			m_cancelled = true;
@@ -100,13 +238,22 @@ void RenderJob::run() {
 		}
 
 		if (!m_cancelled) {
-			if (!m_scene->render(m_queue, this, m_sceneResID, m_sensorResID, m_samplerResID)) {
+			bool success = m_viewSensors.empty()
+				? m_scene->render(m_queue, this, m_sceneResID, m_sensorResID, m_samplerResID)
+				: renderViews();
+			if (!success) {
 				m_cancelled = true;
 				Log(EWarn, "Rendering of scene \"%s\" did not complete successfully!",
 					m_scene->getSourceFile().filename().string().c_str());
 			}
 			Log(EInfo, "Render time: %s", timeString(m_queue->getRenderTime(this), true).c_str());
-			m_scene->postprocess(m_queue, this, m_sceneResID, m_sensorResID, m_samplerResID);
+			if (m_viewSensors.empty()) {
+				m_scene->postprocess(m_queue, this, m_sceneResID, m_sensorResID, m_samplerResID);
+			} else {
+				m_scene->getIntegrator()->postprocess(m_scene, m_queue, this,
+					m_sceneResID, m_sensorResID, m_samplerResID);
+				flush();
+			}
 		}
 	} catch (const std::exception &ex) {
 		Log(EWarn, "Rendering of scene \"%s\" did not complete successfully, caught exception: %s",
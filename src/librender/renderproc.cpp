@@ -141,8 +141,15 @@ ref<WorkProcessor> BlockedRenderProcess::createWorkProcessor() const {
 
 void BlockedRenderProcess::processResult(const WorkResult *result, bool cancelled) {
 	const ImageBlock *block = static_cast<const ImageBlock *>(result);
+
+	/* Films that support it merge blocks outside of the result lock */
+	bool concurrent = m_film->supportsConcurrentPut();
+	if (concurrent)
+		m_film->put(block);
+
 	UniqueLock lock(m_resultMutex);
-	m_film->put(block);
+	if (!concurrent)
+		m_film->put(block);
 	m_progress->update(++m_resultCount);
 	lock.unlock();
 	m_queue->signalWorkEnd(m_parent, block, cancelled);
@@ -181,6 +188,244 @@ void BlockedRenderProcess::bindResource(const std::string &name, int id) {
 	BlockedImageProcess::bindResource(name, id);
 }
 
+/// Image region of one of several views
+class ViewWorkUnit : public RectangularWorkUnit {
+public:
+	inline ViewWorkUnit() : m_view(0) { }
+
+	void set(const WorkUnit *wu) {
+		RectangularWorkUnit::set(wu);
+		m_view = static_cast<const ViewWorkUnit *>(wu)->m_view;
+	}
+
+	void load(Stream *stream) {
+		RectangularWorkUnit::load(stream);
+		m_view = stream->readInt();
+	}
+
+	void save(Stream *stream) const {
+		RectangularWorkUnit::save(stream);
+		stream->writeInt(m_view);
+	}
+
+	inline int getView() const { return m_view; }
+	inline void setView(int view) { m_view = view; }
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~ViewWorkUnit() { }
+private:
+	int m_view;
+};
+
+/// Image block that remembers the view it belongs to
+class ViewImageBlock : public ImageBlock {
+public:
+	ViewImageBlock(Bitmap::EPixelFormat fmt, const Vector2i &size,
+		const ReconstructionFilter *filter) : ImageBlock(fmt, size, filter), m_view(0) { }
+
+	void load(Stream *stream) {
+		ImageBlock::load(stream);
+		m_view = stream->readInt();
+	}
+
+	void save(Stream *stream) const {
+		ImageBlock::save(stream);
+		stream->writeInt(m_view);
+	}
+
+	inline int getView() const { return m_view; }
+	inline void setView(int view) { m_view = view; }
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~ViewImageBlock() { }
+private:
+	int m_view;
+};
+
+class MultiViewRenderer : public WorkProcessor {
+public:
+	MultiViewRenderer(int blockSize, int viewCount)
+		: m_blockSize(blockSize), m_viewCount(viewCount) { }
+
+	MultiViewRenderer(Stream *stream, InstanceManager *manager) {
+		m_blockSize = stream->readInt();
+		m_viewCount = stream->readInt();
+	}
+
+	ref<WorkUnit> createWorkUnit() const {
+		return new ViewWorkUnit();
+	}
+
+	ref<WorkResult> createWorkResult() const {
+		return new ViewImageBlock(Bitmap::ESpectrumAlphaWeight,
+			Vector2i(m_blockSize),
+			m_sensors[0]->getFilm()->getReconstructionFilter());
+	}
+
+	void prepare() {
+		Scene *scene = static_cast<Scene *>(getResource("scene"));
+		m_sampler = static_cast<Sampler *>(getResource("sampler"));
+		m_integrator = static_cast<SamplingIntegrator *>(getResource("integrator"));
+
+		/* Every view gets a scene copy that uses its sensor (as in
+		   BlockRenderer). The copies share the geometry and kd-tree */
+		m_sensors.resize(m_viewCount);
+		m_scenes.resize(m_viewCount);
+		for (int i=0; i<m_viewCount; ++i) {
+			m_sensors[i] = static_cast<Sensor *>(getResource(formatString("sensor%i", i)));
+			m_scenes[i] = new Scene(scene);
+			m_scenes[i]->removeSensor(scene->getSensor());
+			m_scenes[i]->addSensor(m_sensors[i]);
+			m_scenes[i]->setSensor(m_sensors[i]);
+			m_scenes[i]->setSampler(m_sampler);
+			m_scenes[i]->setIntegrator(m_integrator);
+		}
+
+		m_integrator->wakeup(m_scenes[0], m_resources);
+		for (int i=0; i<m_viewCount; ++i) {
+			m_scenes[i]->wakeup(m_scenes[i], m_resources);
+			m_scenes[i]->initializeBidirectional();
+		}
+	}
+
+	void process(const WorkUnit *workUnit, WorkResult *workResult,
+		const bool &stop) {
+		const ViewWorkUnit *rect = static_cast<const ViewWorkUnit *>(workUnit);
+		ViewImageBlock *block = static_cast<ViewImageBlock *>(workResult);
+
+#ifdef MTS_DEBUG_FP
+		enableFPExceptions();
+#endif
+
+		block->setView(rect->getView());
+		block->setOffset(rect->getOffset());
+		block->setSize(rect->getSize());
+		m_hilbertCurve.initialize(TVector2<uint8_t>(rect->getSize()));
+		m_integrator->renderBlock(m_scenes[rect->getView()], m_sensors[rect->getView()],
+			m_sampler, block, stop, m_hilbertCurve.getPoints());
+
+#ifdef MTS_DEBUG_FP
+		disableFPExceptions();
+#endif
+	}
+
+	void serialize(Stream *stream, InstanceManager *manager) const {
+		stream->writeInt(m_blockSize);
+		stream->writeInt(m_viewCount);
+	}
+
+	ref<WorkProcessor> clone() const {
+		return new MultiViewRenderer(m_blockSize, m_viewCount);
+	}
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~MultiViewRenderer() { }
+private:
+	ref_vector<Scene> m_scenes;
+	ref_vector<Sensor> m_sensors;
+	ref<Sampler> m_sampler;
+	ref<SamplingIntegrator> m_integrator;
+	int m_blockSize;
+	int m_viewCount;
+	HilbertCurve2D<uint8_t> m_hilbertCurve;
+};
+
+MultiViewRenderProcess::MultiViewRenderProcess(const RenderJob *parent, RenderQueue *queue,
+		int blockSize, const std::vector<Sensor *> &sensors) : m_queue(queue), m_parent(parent),
+		m_blockSize(blockSize), m_blockIndex(0), m_resultCount(0), m_progress(NULL) {
+	m_resultMutex = new Mutex();
+
+	if (sensors.empty())
+		Log(EError, "At least one view must be specified!");
+
+	for (size_t i=0; i<sensors.size(); ++i)
+		m_films.push_back(sensors[i]->getFilm());
+
+	const Film *film = m_films[0];
+	m_borderSize = film->getReconstructionFilter()->getBorderSize();
+	m_offset = Point2i(0, 0);
+	m_size = film->getCropSize();
+
+	if (film->hasHighQualityEdges()) {
+		m_offset.x -= m_borderSize;
+		m_offset.y -= m_borderSize;
+		m_size.x += 2 * m_borderSize;
+		m_size.y += 2 * m_borderSize;
+	}
+
+	for (size_t i=1; i<m_films.size(); ++i) {
+		if (m_films[i]->getCropSize() != film->getCropSize())
+			Log(EError, "All views must be rendered at the same resolution!");
+	}
+
+	if (m_blockSize < m_borderSize)
+		Log(EError, "The block size must be larger than the image reconstruction filter radius!");
+
+	m_blockCount = Vector2i(
+		(m_size.x + m_blockSize - 1) / m_blockSize,
+		(m_size.y + m_blockSize - 1) / m_blockSize);
+	m_blocksPerView = (size_t) m_blockCount.x * (size_t) m_blockCount.y;
+	m_progress = new ProgressReporter("Rendering",
+		m_blocksPerView * m_films.size(), m_parent);
+}
+
+MultiViewRenderProcess::~MultiViewRenderProcess() {
+	if (m_progress)
+		delete m_progress;
+}
+
+ref<WorkProcessor> MultiViewRenderProcess::createWorkProcessor() const {
+	return new MultiViewRenderer(m_blockSize, (int) m_films.size());
+}
+
+void MultiViewRenderProcess::processResult(const WorkResult *result, bool cancelled) {
+	const ViewImageBlock *block = static_cast<const ViewImageBlock *>(result);
+	Film *film = m_films[block->getView()];
+
+	bool concurrent = film->supportsConcurrentPut();
+	if (concurrent)
+		film->put(block);
+
+	UniqueLock lock(m_resultMutex);
+	if (!concurrent)
+		film->put(block);
+	m_progress->update(++m_resultCount);
+	lock.unlock();
+	m_queue->signalWorkEnd(m_parent, block, cancelled);
+}
+
+ParallelProcess::EStatus MultiViewRenderProcess::generateWork(WorkUnit *unit, int worker) {
+	if (m_blockIndex >= m_blocksPerView * m_films.size())
+		return EFailure;
+
+	/* Blocks are generated in scanline order, one view after the other */
+	int view = (int) (m_blockIndex / m_blocksPerView);
+	int index = (int) (m_blockIndex % m_blocksPerView);
+	++m_blockIndex;
+
+	Point2i offset(
+		m_offset.x + (index % m_blockCount.x) * m_blockSize,
+		m_offset.y + (index / m_blockCount.x) * m_blockSize);
+	Vector2i size(
+		std::min(m_blockSize, m_offset.x + m_size.x - offset.x),
+		std::min(m_blockSize, m_offset.y + m_size.y - offset.y));
+
+	ViewWorkUnit *rect = static_cast<ViewWorkUnit *>(unit);
+	rect->setView(view);
+	rect->setOffset(offset);
+	rect->setSize(size);
+
+	m_queue->signalWorkBegin(m_parent, rect, worker);
+	return ESuccess;
+}
+
 MTS_IMPLEMENT_CLASS(BlockedRenderProcess, false, BlockedImageProcess)
+MTS_IMPLEMENT_CLASS(MultiViewRenderProcess, false, ParallelProcess)
+MTS_IMPLEMENT_CLASS(ViewWorkUnit, false, RectangularWorkUnit)
+MTS_IMPLEMENT_CLASS(ViewImageBlock, false, ImageBlock)
 MTS_IMPLEMENT_CLASS_S(BlockRenderer, false, WorkProcessor)
+MTS_IMPLEMENT_CLASS_S(MultiViewRenderer, false, WorkProcessor)
 MTS_NAMESPACE_END
@@ -31,56 +31,21 @@ MTS_NAMESPACE_BEGIN
 
 Scene::Scene()
  : NetworkedObject(Properties()), m_blockSize(DEFAULT_BLOCKSIZE) {
-	m_kdtree = new ShapeKDTree();
+	setAccelerator(new KDTreeAccelerator());
 	m_sourceFile = new fs::path();
 	m_destinationFile = new fs::path();
 }
 
 Scene::Scene(const Properties &props)
  : NetworkedObject(props), m_blockSize(DEFAULT_BLOCKSIZE) {
-	m_kdtree = new ShapeKDTree();
-	/* kd-tree construction: Enable primitive clipping? Generally leads to a
-	  significant improvement of the resulting tree. */
-	if (props.hasProperty("kdClip"))
-		m_kdtree->setClip(props.getBoolean("kdClip"));
-	/* kd-tree construction: Relative cost of a triangle intersection operation
-	   in the surface area heuristic. */
-	if (props.hasProperty("kdIntersectionCost"))
-		m_kdtree->setQueryCost(props.getFloat("kdIntersectionCost"));
-	/* kd-tree construction: Relative cost of a kd-tree traversal operation
-	   in the surface area heuristic. */
-	if (props.hasProperty("kdTraversalCost"))
-		m_kdtree->setTraversalCost(props.getFloat("kdTraversalCost"));
-	/* kd-tree construction: Bonus factor for cutting away regions of empty space */
-	if (props.hasProperty("kdEmptySpaceBonus"))
-		m_kdtree->setEmptySpaceBonus(props.getFloat("kdEmptySpaceBonus"));
-	/* kd-tree construction: A kd-tree node containing this many or fewer
-	   primitives will not be split */
-	if (props.hasProperty("kdStopPrims"))
-		m_kdtree->setStopPrims(props.getInteger("kdStopPrims"));
-	/* kd-tree construction: Maximum tree depth */
-	if (props.hasProperty("kdMaxDepth"))
-		m_kdtree->setMaxDepth(props.getInteger("kdMaxDepth"));
-	/* kd-tree construction: Specify the number of primitives, at which the
-	   builder will switch from (approximate) Min-Max binning to the accurate
-	   O(n log n) SAH-based optimization method. */
-	if (props.hasProperty("kdExactPrimitiveThreshold"))
-		m_kdtree->setExactPrimitiveThreshold(props.getInteger("kdExactPrimitiveThreshold"));
-	/* kd-tree construction: use multiple processors? */
-	if (props.hasProperty("kdParallelBuild"))
-		m_kdtree->setParallelBuild(props.getBoolean("kdParallelBuild"));
-	/* kd-tree construction: specify whether or not bad splits can be "retracted". */
-	if (props.hasProperty("kdRetract"))
-		m_kdtree->setRetract(props.getBoolean("kdRetract"));
-	/* kd-tree construction: Set the number of bad refines allowed to happen
-	   in succession before a leaf node will be created.*/
-	if (props.hasProperty("kdMaxBadRefines"))
-		m_kdtree->setMaxBadRefines(props.getInteger("kdMaxBadRefines"));
+	/* Acceleration data structure: 'kdtree' or 'bvh' (see Accelerator::create) */
+	setAccelerator(Accelerator::create(props));
 	m_sourceFile = new fs::path();
 	m_destinationFile = new fs::path();
 }
 
 Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
+	m_accel = scene->m_accel;
 	m_kdtree = scene->m_kdtree;
 	m_blockSize = scene->m_blockSize;
 	m_aabb = scene->m_aabb;
@@ -105,17 +70,7 @@ Scene::Scene(Scene *scene) : NetworkedObject(Properties()) {
 
 Scene::Scene(Stream *stream, InstanceManager *manager)
  : NetworkedObject(stream, manager) {
-	m_kdtree = new ShapeKDTree();
-	m_kdtree->setQueryCost(stream->readFloat());
-	m_kdtree->setTraversalCost(stream->readFloat());
-	m_kdtree->setEmptySpaceBonus(stream->readFloat());
-	m_kdtree->setStopPrims(stream->readInt());
-	m_kdtree->setClip(stream->readBool());
-	m_kdtree->setMaxDepth(stream->readUInt());
-	m_kdtree->setExactPrimitiveThreshold(stream->readUInt());
-	m_kdtree->setParallelBuild(stream->readBool());
-	m_kdtree->setRetract(stream->readBool());
-	m_kdtree->setMaxBadRefines(stream->readUInt());
+	setAccelerator(static_cast<Accelerator *>(manager->getInstance(stream)));
 	m_blockSize = stream->readUInt();
 	m_degenerateSensor = stream->readBool();
 	m_degenerateEmitters = stream->readBool();
@@ -172,16 +127,7 @@ Scene::~Scene() {
 void Scene::serialize(Stream *stream, InstanceManager *manager) const {
 	ConfigurableObject::serialize(stream, manager);
 
-	stream->writeFloat(m_kdtree->getQueryCost());
-	stream->writeFloat(m_kdtree->getTraversalCost());
-	stream->writeFloat(m_kdtree->getEmptySpaceBonus());
-	stream->writeInt(m_kdtree->getStopPrims());
-	stream->writeBool(m_kdtree->getClip());
-	stream->writeUInt(m_kdtree->getMaxDepth());
-	stream->writeUInt(m_kdtree->getExactPrimitiveThreshold());
-	stream->writeBool(m_kdtree->getParallelBuild());
-	stream->writeBool(m_kdtree->getRetract());
-	stream->writeUInt(m_kdtree->getMaxBadRefines());
+	manager->serialize(stream, m_accel.get());
 	stream->writeUInt(m_blockSize);
 	stream->writeBool(m_degenerateSensor);
 	stream->writeBool(m_degenerateEmitters);
@@ -316,11 +262,19 @@ void Scene::configure() {
 }
 
 void Scene::invalidate() {
-	m_kdtree = new ShapeKDTree();
+	setAccelerator(m_accel->createEmpty());
+}
+
+void Scene::setAccelerator(Accelerator *accel) {
+	m_accel = accel;
+	if (accel->getClass()->derivesFrom(MTS_CLASS(KDTreeAccelerator)))
+		m_kdtree = static_cast<KDTreeAccelerator *>(accel)->getKDTree();
+	else
+		m_kdtree = NULL;
 }
 
 void Scene::initialize() {
-	if (!m_kdtree->isBuilt()) {
+	if (!m_accel->isBuilt()) {
 		/* Expand all geometry */
 		ref_vector<Shape> temp;
 		temp.reserve(m_shapes.size());
@@ -329,8 +283,24 @@ void Scene::initialize() {
 		m_shapes.swap(temp);
 		size_t primitiveCount = 0, effPrimitiveCount = 0;
 
+		/* Automatically assigned object IDs start above the explicit ones */
+		int maxObjectID = 0;
+		for (size_t i=0; i<temp.size(); ++i)
+			maxObjectID = std::max(maxObjectID, temp[i]->getObjectID());
+
 		for (size_t i=0; i<temp.size(); ++i) {
+			size_t firstShape = m_shapes.size();
 			addShape(temp[i]);
+
+			/* Shapes without an explicit object ID are numbered by their
+			   position in the scene description (see Shape::getObjectID()) */
+			int objectID = temp[i]->getObjectID() != 0
+				? temp[i]->getObjectID() : maxObjectID + (int) i + 1;
+			for (size_t j=firstShape; j<m_shapes.size(); ++j) {
+				if (m_shapes[j]->getObjectID() == 0)
+					m_shapes[j]->setObjectID(objectID);
+			}
+
 			primitiveCount += temp[i]->getPrimitiveCount();
 			effPrimitiveCount += temp[i]->getEffectivePrimitiveCount();
 			temp[i] = NULL;
@@ -341,10 +311,10 @@ void Scene::initialize() {
 				SIZE_T_FMT ".", primitiveCount, effPrimitiveCount);
 		}
 
-		/* Build the kd-tree */
-		m_kdtree->build();
+		/* Build the acceleration data structure */
+		m_accel->build();
 
-		m_aabb = m_kdtree->getAABB();
+		m_aabb = m_accel->getAABB();
 	}
 
 	/* Make sure that there are no duplicates */
@@ -384,7 +354,7 @@ void Scene::initialize() {
 }
 
 void Scene::initializeBidirectional() {
-	m_aabb = m_kdtree->getAABB();
+	m_aabb = m_accel->getAABB();
 	m_degenerateEmitters = true;
 	m_specialShapes.clear();
 
@@ -586,7 +556,7 @@ void Scene::addShape(Shape *shape) {
 		if (shape->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
 			m_meshes.push_back(static_cast<TriMesh *>(shape));
 
-		m_kdtree->addShape(shape);
+		m_accel->addShape(shape);
 		m_shapes.push_back(shape);
 	}
 }
@@ -598,7 +568,7 @@ std::string Scene::toString() const {
 		<< "  sensor = " << indent(m_sensor.toString()) << "," << endl
 		<< "  sampler = " << indent(m_sampler.toString()) << "," << endl
 		<< "  integrator = " << indent(m_integrator.toString()) << "," << endl
-		<< "  kdtree = " << indent(m_kdtree.toString()) << "," << endl
+		<< "  accel = " << indent(m_accel.toString()) << "," << endl
 		<< "  environmentEmitter = " << indent(m_environmentEmitter.toString()) << "," << endl
 		<< "  shapes = " << indent(containerToString(m_shapes.begin(), m_shapes.end())) << "," << endl
 		<< "  emitters = " << indent(containerToString(m_emitters.begin(), m_emitters.end())) << "," << endl
@@ -839,7 +809,7 @@ Spectrum Scene::sampleEmitterDirect(DirectSamplingRecord &dRec,
 		if (testVisibility) {
 			Ray ray(dRec.ref, dRec.d, Epsilon,
 					dRec.dist*(1-ShadowEpsilon), dRec.time);
-			if (m_kdtree->rayIntersect(ray))
+			if (rayIntersect(ray))
 				return Spectrum(0.0f);
 		}
 		dRec.object = emitter;
@@ -905,7 +875,7 @@ Spectrum Scene::sampleSensorDirect(DirectSamplingRecord &dRec,
 		if (testVisibility) {
 			Ray ray(dRec.ref, dRec.d, Epsilon,
 					dRec.dist*(1-ShadowEpsilon), dRec.time);
-			if (m_kdtree->rayIntersect(ray))
+			if (rayIntersect(ray))
 				return Spectrum(0.0f);
 		}
 		dRec.object = m_sensor.get();
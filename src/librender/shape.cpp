@@ -30,6 +30,10 @@ MTS_NAMESPACE_BEGIN
 Shape::Shape(const Properties &props)
  : ConfigurableObject(props) {
 	m_name = props.getID();
+	m_objectID = props.getInteger("objectId", 0);
+	m_partID = props.getInteger("partId", 0);
+	if (m_objectID < 0 || m_partID < 0)
+		Log(EError, "Object and part IDs must not be negative!");
 }
 
 Shape::Shape(Stream *stream, InstanceManager *manager)
@@ -41,6 +45,8 @@ Shape::Shape(Stream *stream, InstanceManager *manager)
 	m_sensor = static_cast<Sensor *>(manager->getInstance(stream));
 	m_interiorMedium = static_cast<Medium *>(manager->getInstance(stream));
 	m_exteriorMedium = static_cast<Medium *>(manager->getInstance(stream));
+	m_objectID = stream->readInt();
+	m_partID = stream->readInt();
 }
 
 Shape::~Shape() { }
@@ -193,6 +199,8 @@ void Shape::serialize(Stream *stream, InstanceManager *manager) const {
 	manager->serialize(stream, m_sensor.get());
 	manager->serialize(stream, m_interiorMedium.get());
 	manager->serialize(stream, m_exteriorMedium.get());
+	stream->writeInt(m_objectID);
+	stream->writeInt(m_partID);
 }
 
 Float Shape::getSurfaceArea() const { NotImplementedError("getSurfaceArea"); }
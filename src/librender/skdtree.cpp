@@ -18,15 +18,30 @@
 
 #include <mitsuba/render/skdtree.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mstream.h>
 
 #if defined(MTS_SSE)
 #include <mitsuba/core/sse.h>
 #include <mitsuba/core/aabb_sse.h>
 #include <mitsuba/render/triaccel_sse.h>
+#include "skdtree_wide.h"
 #endif
 
+/// Version of the on-disk kd-tree cache format
+#define MTS_KD_CACHE_VERSION 1
+
 MTS_NAMESPACE_BEGIN
 
+namespace stats {
+	StatsCounter kdBoundsTime("kd-tree construction", "Scene bounds (ms)");
+	StatsCounter kdBinningTime("kd-tree construction", "Min-max binning (ms)");
+	StatsCounter kdPartitionTime("kd-tree construction", "Partitioning (ms)");
+	StatsCounter kdEventListTime("kd-tree construction", "Event list creation, all threads (ms)");
+	StatsCounter kdSubtreeTime("kd-tree construction", "O(n log n) subtrees, all threads (ms)");
+	StatsCounter kdLayoutTime("kd-tree construction", "Memory layout optimization (ms)");
+}
+
 ShapeKDTree::ShapeKDTree() {
 #if !defined(MTS_KD_CONSERVE_MEMORY)
 	m_triAccel = NULL;
@@ -35,6 +50,14 @@ ShapeKDTree::ShapeKDTree() {
 }
 
 ShapeKDTree::~ShapeKDTree() {
+	if (m_cacheFile) {
+		/* The tree data belongs to the memory-mapped cache file */
+		m_nodes = NULL;
+		m_indices = NULL;
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+		m_triAccel = NULL;
+#endif
+	}
 #if !defined(MTS_KD_CONSERVE_MEMORY)
 	if (m_triAccel)
 		freeAligned(m_triAccel);
@@ -69,6 +92,16 @@ void ShapeKDTree::build() {
 	for (size_t i=1; i<m_shapeMap.size(); ++i)
 		m_shapeMap[i] += m_shapeMap[i-1];
 
+	bool useCache = !m_cacheDirectory.empty() && getPrimitiveCount() > 0;
+	uint64_t cacheHash = 0;
+	if (useCache) {
+		ref<Timer> timer = new Timer();
+		cacheHash = computeCacheHash();
+		Log(EDebug, "Computed the kd-tree cache hash in %i ms", timer->getMilliseconds());
+		if (loadCache(cacheHash))
+			return;
+	}
+
 	SAHKDTree3D<ShapeKDTree>::buildInternal();
 
 #if !defined(MTS_KD_CONSERVE_MEMORY)
@@ -107,6 +140,195 @@ void ShapeKDTree::build() {
 	Log(m_logLevel, "");
 	KDAssert(idx == primCount);
 #endif
+
+	if (useCache)
+		saveCache(cacheHash);
+}
+
+uint64_t ShapeKDTree::computeCacheHash() const {
+	const uint32_t version = MTS_KD_CACHE_VERSION;
+	uint64_t hash = hashBytes(&version, sizeof(uint32_t));
+
+	/* Construction parameters (the parallel build produces equivalent trees) */
+	const Float costs[3] = { getTraversalCost(), getQueryCost(), getEmptySpaceBonus() };
+	const SizeType params[5] = { getStopPrims(), getMaxDepth(), getExactPrimitiveThreshold(),
+		getMaxBadRefines(), getMinMaxBins() };
+	const uint8_t flags[2] = { (uint8_t) getClip(), (uint8_t) getRetract() };
+	hash = hashBytes(costs, sizeof(costs), hash);
+	hash = hashBytes(params, sizeof(params), hash);
+	hash = hashBytes(flags, sizeof(flags), hash);
+
+	for (size_t i=0; i<m_shapes.size(); ++i) {
+		const Shape *shape = m_shapes[i];
+		if (m_triangleFlag[i]) {
+			const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+			const uint64_t counts[2] = { mesh->getTriangleCount(), mesh->getVertexCount() };
+			hash = hashBytes(counts, sizeof(counts), hash);
+			hash = hashBytes(mesh->getTriangles(), sizeof(Triangle) * counts[0], hash);
+			hash = hashBytes(mesh->getVertexPositions(), sizeof(Point) * counts[1], hash);
+		} else {
+			/* The builder only sees other shapes through their (clipped)
+			   bounding boxes, so these determine the resulting tree */
+			const std::string &name = shape->getClass()->getName();
+			hash = hashBytes(name.c_str(), name.length(), hash);
+			AABB aabb = shape->getAABB();
+			hash = hashBytes(&aabb, sizeof(AABB), hash);
+			Point center = aabb.getCenter();
+			for (int j=0; j<8; ++j) {
+				AABB octant(center);
+				octant.expandBy(aabb.getCorner(j));
+				AABB clipped = shape->getClippedAABB(octant);
+				hash = hashBytes(&clipped, sizeof(AABB), hash);
+			}
+		}
+	}
+
+	return hash;
+}
+
+/// Return the name of the cache file for a given hash
+static fs::path getCacheFilename(const fs::path &directory, uint64_t hash) {
+	return directory / formatString("kdtree-%016llx.kdc", (unsigned long long) hash);
+}
+
+/// Zero-pad a stream so that its position is \c remainder modulo 64
+static size_t padCacheStream(Stream *stream, size_t remainder) {
+	const uint8_t zeros[64] = { 0 };
+	size_t pos = stream->getPos();
+	size_t target = ((pos + 63 - remainder) / 64) * 64 + remainder;
+	stream->write(zeros, target - pos);
+	return target;
+}
+
+bool ShapeKDTree::loadCache(uint64_t hash) {
+	fs::path cacheFile = getCacheFilename(m_cacheDirectory, hash);
+	if (!fs::exists(cacheFile))
+		return false;
+
+	ref<Timer> timer = new Timer();
+	ref<MemoryMappedFile> mmap;
+	SizeType nodeCount, indexCount;
+	size_t nodeOffset, indexOffset, triAccelOffset;
+	AABB aabb, tightAABB;
+
+	try {
+		mmap = new MemoryMappedFile(cacheFile);
+		uint8_t *data = static_cast<uint8_t *>(mmap->getData());
+		size_t size = mmap->getSize();
+		ref<MemoryStream> stream = new MemoryStream(data, size);
+		stream->setByteOrder(Stream::ELittleEndian);
+
+		char identifier[3];
+		stream->read(identifier, 3);
+		if (identifier[0] != 'K' || identifier[1] != 'D' || identifier[2] != 'C'
+			|| stream->readUInt() != MTS_KD_CACHE_VERSION
+			|| stream->readUChar() != (uint8_t) sizeof(Float)
+			|| stream->readUChar() != (uint8_t) Stream::getHostByteOrder()
+			|| stream->readULong() != hash
+			|| stream->readUInt() != getPrimitiveCount()) {
+			Log(EInfo, "Cache file \"%s\" does not match, rebuilding the kd-tree",
+				cacheFile.filename().string().c_str());
+			return false;
+		}
+
+		nodeCount = stream->readUInt();
+		indexCount = stream->readUInt();
+		aabb = AABB(stream);
+		tightAABB = AABB(stream);
+		nodeOffset = stream->readSize();
+		indexOffset = stream->readSize();
+		triAccelOffset = stream->readSize();
+
+		if (nodeOffset + nodeCount * sizeof(KDNode) > size
+			|| indexOffset + indexCount * sizeof(IndexType) > size
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+			|| triAccelOffset == 0
+			|| triAccelOffset + getPrimitiveCount() * sizeof(TriAccel) > size
+#endif
+			)
+			Log(EError, "Truncated cache file");
+
+		/* Sibling nodes must share a 16-byte block (see KDNode::getSibling) */
+		if (((uintptr_t) (data + nodeOffset)) % 16 != 8
+				|| ((uintptr_t) (data + triAccelOffset)) % 16 != 0)
+			Log(EError, "Misaligned cache file contents");
+	} catch (const std::exception &e) {
+		Log(EWarn, "Unable to read the cache file \"%s\", rebuilding the kd-tree: %s",
+			cacheFile.string().c_str(), e.what());
+		return false;
+	}
+
+	uint8_t *data = static_cast<uint8_t *>(mmap->getData());
+	m_cacheFile = mmap;
+	m_nodeCount = nodeCount;
+	m_indexCount = indexCount;
+	m_nodes = reinterpret_cast<KDNode *>(data + nodeOffset);
+	m_indices = reinterpret_cast<IndexType *>(data + indexOffset);
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+	m_triAccel = reinterpret_cast<TriAccel *>(data + triAccelOffset);
+#endif
+	m_aabb = aabb;
+	m_tightAABB = tightAABB;
+
+	Log(EInfo, "Mapped the kd-tree from the cache file \"%s\" (%s) in %i ms",
+		cacheFile.filename().string().c_str(), memString(mmap->getSize()).c_str(),
+		timer->getMilliseconds());
+	return true;
+}
+
+void ShapeKDTree::saveCache(uint64_t hash) const {
+	fs::path cacheFile = getCacheFilename(m_cacheDirectory, hash);
+	fs::path tempFile = fs::unique_path(cacheFile.string() + ".%%%%-%%%%");
+
+	try {
+		if (!fs::exists(m_cacheDirectory))
+			fs::create_directories(m_cacheDirectory);
+
+		ref<FileStream> stream = new FileStream(tempFile, FileStream::ETruncReadWrite);
+		stream->setByteOrder(Stream::ELittleEndian);
+
+		stream->write("KDC", 3);
+		stream->writeUInt(MTS_KD_CACHE_VERSION);
+		stream->writeUChar((uint8_t) sizeof(Float));
+		stream->writeUChar((uint8_t) Stream::getHostByteOrder());
+		stream->writeULong(hash);
+		stream->writeUInt(getPrimitiveCount());
+		stream->writeUInt(m_nodeCount);
+		stream->writeUInt(m_indexCount);
+		m_aabb.serialize(stream);
+		m_tightAABB.serialize(stream);
+
+		/* The arrays are stored in host byte order so that they can be
+		   mapped directly. Their offsets are filled in at the end. */
+		size_t offsetPos = stream->getPos();
+		for (int i=0; i<3; ++i)
+			stream->writeSize(0);
+
+		size_t nodeOffset = padCacheStream(stream, 8);
+		stream->write(m_nodes, sizeof(KDNode) * m_nodeCount);
+		size_t indexOffset = padCacheStream(stream, 0);
+		stream->write(m_indices, sizeof(IndexType) * m_indexCount);
+		size_t triAccelOffset = 0;
+#if !defined(MTS_KD_CONSERVE_MEMORY)
+		triAccelOffset = padCacheStream(stream, 0);
+		stream->write(m_triAccel, sizeof(TriAccel) * getPrimitiveCount());
+#endif
+
+		stream->seek(offsetPos);
+		stream->writeSize(nodeOffset);
+		stream->writeSize(indexOffset);
+		stream->writeSize(triAccelOffset);
+		stream->close();
+
+		fs::rename(tempFile, cacheFile);
+		Log(EInfo, "Wrote the kd-tree to the cache file \"%s\"",
+			cacheFile.filename().string().c_str());
+	} catch (const std::exception &e) {
+		Log(EWarn, "Unable to write the cache file \"%s\": %s",
+			cacheFile.string().c_str(), e.what());
+		boost::system::error_code ec;
+		fs::remove(tempFile, ec);
+	}
 }
 
 bool ShapeKDTree::rayIntersect(const Ray &ray, Intersection &its) const {
@@ -361,7 +583,7 @@ void ShapeKDTree::rayIntersectPacketIncoherent(const RayPacket4 &packet,
 	++incoherentPackets;
 	for (int i=0; i<4; i++) {
 		Ray ray;
-		Float t;
+		Float t, mint, maxt;
 		for (int axis=0; axis<3; axis++) {
 			ray.o[axis] = packet.o[axis].f[i];
 			ray.d[axis] = packet.d[axis].f[i];
@@ -369,8 +591,23 @@ void ShapeKDTree::rayIntersectPacketIncoherent(const RayPacket4 &packet,
 		}
 		ray.mint = rayInterval.mint.f[i];
 		ray.maxt = rayInterval.maxt.f[i];
+		ray.time = packet.time.f[i];
+
+		/* Clip against the kd-tree AABB to determine the search interval */
+		if (!m_aabb.rayIntersect(ray, mint, maxt))
+			continue;
+
+		/* Use an adaptive ray epsilon */
+		Float rayMinT = ray.mint;
+		if (rayMinT == Epsilon)
+			rayMinT *= std::max(std::max(std::max(std::abs(ray.o.x),
+				std::abs(ray.o.y)), std::abs(ray.o.z)), Epsilon);
+
+		if (rayMinT > mint) mint = rayMinT;
+		if (ray.maxt < maxt) maxt = ray.maxt;
+
 		uint8_t *rayTemp = reinterpret_cast<uint8_t *>(temp) + i * MTS_KD_INTERSECTION_TEMP;
-		if (ray.mint < ray.maxt && rayIntersectHavran<false>(ray, ray.mint, ray.maxt, t, rayTemp)) {
+		if (mint < maxt && rayIntersectHavran<false>(ray, mint, maxt, t, rayTemp)) {
 			const IntersectionCache *cache = reinterpret_cast<const IntersectionCache *>(rayTemp);
 			its4.t.f[i] = t;
 			its4.shapeIndex.i[i] = cache->shapeIndex;
@@ -381,6 +618,66 @@ void ShapeKDTree::rayIntersectPacketIncoherent(const RayPacket4 &packet,
 	}
 }
 
+bool ShapeKDTree::fillPacketIntersectionRecord(const Ray &ray, Float t, Float u,
+		Float v, uint32_t primIndex, uint32_t shapeIndex, const void *temp,
+		Intersection &its) const {
+	its.t = t;
+	if (its.t == std::numeric_limits<Float>::infinity())
+		return false;
+
+	/* The coherent traversal does not store triangle hits in the
+	   temporary storage, so do it here. Other shapes keep their own
+	   data in place of the barycentric coordinates. */
+	IntersectionCache *cache = reinterpret_cast<IntersectionCache *>(
+		const_cast<void *>(temp));
+	cache->shapeIndex = shapeIndex;
+	cache->primIndex = primIndex;
+	if (primIndex != KNoTriangleFlag) {
+		cache->u = u;
+		cache->v = v;
+	}
+
+	fillIntersectionRecord<true>(ray, temp, its);
+	return true;
+}
+
+bool ShapeKDTree::fillPacketIntersectionRecord(const Ray &ray,
+		const Intersection4 &its4, int index, const void *temp,
+		Intersection &its) const {
+	return fillPacketIntersectionRecord(ray, its4.t.f[index], its4.u.f[index],
+		its4.v.f[index], its4.primIndex.ui[index], its4.shapeIndex.ui[index],
+		reinterpret_cast<const uint8_t *>(temp) + index * MTS_KD_INTERSECTION_TEMP, its);
+}
+
+bool ShapeKDTree::fillPacketIntersectionRecord(const Ray &ray,
+		const Intersection8 &its8, int index, const void *temp,
+		Intersection &its) const {
+	return fillPacketIntersectionRecord(ray, its8.t[index], its8.u[index],
+		its8.v[index], its8.primIndex[index], its8.shapeIndex[index],
+		reinterpret_cast<const uint8_t *>(temp) + index * MTS_KD_INTERSECTION_TEMP, its);
+}
+
+bool ShapeKDTree::fillPacketIntersectionRecord(const Ray &ray,
+		const Intersection16 &its16, int index, const void *temp,
+		Intersection &its) const {
+	return fillPacketIntersectionRecord(ray, its16.t[index], its16.u[index],
+		its16.v[index], its16.primIndex[index], its16.shapeIndex[index],
+		reinterpret_cast<const uint8_t *>(temp) + index * MTS_KD_INTERSECTION_TEMP, its);
+}
+
+int ShapeKDTree::getMaxPacketSize() {
+	static int maxPacketSize = 0;
+	if (maxPacketSize == 0) {
+		int simdWidth = getSIMDWidth(), packetSize = 4;
+		if (simdWidth >= 8 && hasPacket8Kernels())
+			packetSize = 8;
+		if (simdWidth >= 16 && hasPacket16Kernels())
+			packetSize = 16;
+		maxPacketSize = packetSize;
+	}
+	return maxPacketSize;
+}
+
 #endif
 
 MTS_IMPLEMENT_CLASS(ShapeKDTree, false, KDTreeBase)
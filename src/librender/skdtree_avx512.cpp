@@ -0,0 +1,48 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* 16-wide packet kernels. They are generated for AVX-512 (see skdtree_wide.h),
+   and only used when the processor supports them. */
+#define MTS_KD_PACKET_KERNELS 16
+#include "skdtree_wide.h"
+
+MTS_NAMESPACE_BEGIN
+
+#if defined(MTS_KD_HAS_PACKET_KERNELS)
+bool hasPacket16Kernels() {
+	return true;
+}
+
+void ShapeKDTree::rayIntersectPacket(const RayPacket16 &packet,
+		const RayInterval16 &interval, Intersection16 &its, void *temp) const {
+	rayIntersectPacketWide<16>(packet, interval, its, temp);
+}
+#else
+bool hasPacket16Kernels() {
+	return false;
+}
+
+#if defined(MTS_HAS_COHERENT_RT)
+void ShapeKDTree::rayIntersectPacket(const RayPacket16 &,
+		const RayInterval16 &, Intersection16 &, void *) const {
+	Log(EError, "rayIntersectPacket(): Mitsuba was compiled without AVX-512 support!");
+}
+#endif
+#endif
+
+MTS_NAMESPACE_END
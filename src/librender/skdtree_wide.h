@@ -0,0 +1,238 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#if !defined(__MITSUBA_RENDER_SKDTREE_WIDE_H_)
+#define __MITSUBA_RENDER_SKDTREE_WIDE_H_
+
+#include <mitsuba/render/skdtree.h>
+
+MTS_NAMESPACE_BEGIN
+
+/* The wide packet kernels are compiled in separate translation units
+   (skdtree_avx2.cpp and skdtree_avx512.cpp). These functions report
+   whether the compiler supports the respective instruction set. */
+
+/// Were the 8-wide packet kernels compiled with AVX2 support?
+extern bool hasPacket8Kernels();
+
+/// Were the 16-wide packet kernels compiled with AVX-512 support?
+extern bool hasPacket16Kernels();
+
+MTS_NAMESPACE_END
+
+/* The kernel translation units define MTS_KD_PACKET_KERNELS as the packet
+   width. Instead of compiling them with -mavx2 or -mavx512f, which could
+   also produce AVX versions of inline functions from the other headers
+   (and the linker is free to pick those for the whole library), only the
+   code below is generated for the instruction set of the kernels. */
+#if defined(MTS_KD_PACKET_KERNELS) && defined(MTS_HAS_COHERENT_RT) && \
+	(defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#if defined(__clang__)
+#if __has_extension(pragma_clang_attribute)
+#define MTS_KD_HAS_PACKET_KERNELS
+#endif
+#elif defined(__GNUC__)
+#if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define MTS_KD_HAS_PACKET_KERNELS
+#endif
+#elif defined(_MSC_VER)
+/* MSVC provides the intrinsics without any special compiler flags */
+#if _MSC_VER >= 1911
+#define MTS_KD_HAS_PACKET_KERNELS
+#endif
+#endif
+#endif
+
+#if defined(MTS_KD_HAS_PACKET_KERNELS)
+
+/* Everything that precedes the target region must be included here */
+#include <mitsuba/render/triaccel.h>
+#include <mitsuba/core/ray_sse.h>
+#include <immintrin.h>
+
+#if MTS_KD_PACKET_KERNELS == 8
+#define MTS_SIMD_AVX2
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+#else
+#define MTS_SIMD_AVX512
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx512f,avx2,fma"))), apply_to = function)
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx2,fma")
+#endif
+#endif
+
+#include <mitsuba/render/triaccel_wide.h>
+
+MTS_NAMESPACE_BEGIN
+
+/*
+ * N-wide port of ShapeKDTree::rayIntersectPacket() in skdtree.cpp. This
+ * template is only instantiated by the kernel translation units, since
+ * the SIMDTraits specializations require the matching instruction set.
+ * Apart from force-inlined helpers, the kernels must not call inline
+ * functions that could also be emitted by other translation units.
+ */
+template <int N> void ShapeKDTree::rayIntersectPacketWide(
+		const TRayPacket<N> &packet, const TRayInterval<N> &rayInterval,
+		TPacketIntersection<N> &its, void *temp) const {
+	typedef SIMDTraits<N> S;
+	typedef typename S::Vector Vector;
+	typedef typename S::Mask Mask;
+
+	/// Ray traversal stack entry
+	struct StackEntry {
+		/* Current ray interval */
+		Vector mint, maxt;
+		/* Pointer to the far child */
+		const KDNode * __restrict node;
+	};
+
+	StackEntry stack[MTS_KD_MAXDEPTH];
+	Vector mint, maxt;
+
+	const KDNode * __restrict currNode = m_nodes;
+	int stackIndex = 0;
+
+	/* First, intersect with the kd-tree AABB to determine
+	   the intersection search intervals */
+	if (!mitsuba::rayIntersectPacket<N>(m_aabb, packet, mint, maxt))
+		return;
+
+	const Vector
+		rayMinT = S::load(rayInterval.mint),
+		rayMaxT = S::load(rayInterval.maxt),
+		om_eps = S::set1(1-Epsilon),
+		op_eps = S::set1(1+Epsilon);
+
+	mint = S::max(mint, rayMinT);
+	maxt = S::min(maxt, rayMaxT);
+
+	Mask itsFound = S::gt(mint, maxt);
+	Mask masked = itsFound;
+	if (S::movemask(itsFound) == S::EAllLanes)
+		return;
+
+	while (currNode != NULL) {
+		while (EXPECT_TAKEN(!currNode->isLeaf())) {
+			const uint8_t axis = currNode->getAxis();
+
+			/* Calculate the plane intersection */
+			const Vector t = S::mul(S::sub(S::set1(currNode->getSplit()),
+				S::load(packet.o[axis])), S::load(packet.dRcp[axis]));
+
+			const Mask
+				startsAfterSplit = S::maskOr(masked, S::lt(t, mint)),
+				endsBeforeSplit = S::maskOr(masked, S::gt(t, maxt));
+
+			currNode = currNode->getLeft() + packet.signs[axis];
+
+			/* The interval completely lies on one side
+			   of the split plane */
+			if (EXPECT_TAKEN(S::movemask(startsAfterSplit) == S::EAllLanes)) {
+				currNode = currNode->getSibling();
+				continue;
+			}
+
+			if (EXPECT_TAKEN(S::movemask(endsBeforeSplit) == S::EAllLanes))
+				continue;
+
+			stack[stackIndex].node = currNode->getSibling();
+			stack[stackIndex].maxt = maxt;
+			stack[stackIndex].mint = S::max(t, mint);
+			maxt = S::min(t, maxt);
+			masked = S::maskOr(masked, S::gt(mint, maxt));
+			stackIndex++;
+		}
+
+		/* Arrived at a leaf node - intersect against primitives */
+		const IndexType primStart = currNode->getPrimStart();
+		const IndexType primEnd = currNode->getPrimEnd();
+
+		if (EXPECT_NOT_TAKEN(primStart != primEnd)) {
+			MM_ALIGN64 float searchStart[N], searchEnd[N];
+			S::store(searchStart, S::max(rayMinT, S::mul(mint, om_eps)));
+			S::store(searchEnd, S::min(rayMaxT, S::mul(maxt, op_eps)));
+
+			for (IndexType entry=primStart; entry != primEnd; entry++) {
+				const TriAccel &kdTri = m_triAccel[m_indices[entry]];
+				if (EXPECT_TAKEN(kdTri.k != KNoTriangleFlag)) {
+					itsFound = S::maskOr(itsFound, mitsuba::rayIntersectPacket<N>(kdTri,
+						packet, S::load(searchStart), S::load(searchEnd), masked, its));
+				} else {
+					const Shape *shape = m_shapes[kdTri.shapeIndex];
+					int maskedLanes = S::movemask(masked), hitLanes = 0;
+
+					for (int i=0; i<N; ++i) {
+						if (maskedLanes & (1 << i))
+							continue;
+						Ray ray;
+						for (int axis=0; axis<3; axis++) {
+							ray.o[axis] = packet.o[axis][i];
+							ray.d[axis] = packet.d[axis][i];
+							ray.dRcp[axis] = packet.dRcp[axis][i];
+						}
+						ray.time = packet.time[i];
+						Float t;
+
+						if (shape->rayIntersect(ray, searchStart[i], searchEnd[i], t,
+								reinterpret_cast<uint8_t *>(temp)
+								+ i * MTS_KD_INTERSECTION_TEMP + 2*sizeof(IndexType))) {
+							its.t[i] = t;
+							its.shapeIndex[i] = kdTri.shapeIndex;
+							its.primIndex[i] = KNoTriangleFlag;
+							hitLanes |= 1 << i;
+						}
+					}
+					itsFound = S::maskOr(itsFound, S::fromBits(hitLanes));
+				}
+				S::store(searchEnd, S::min(S::load(searchEnd), S::load(its.t)));
+			}
+		}
+
+		/* Abort if the tree has been traversed or if
+		   intersections have been found for all rays */
+		if (S::movemask(itsFound) == S::EAllLanes || --stackIndex < 0)
+			break;
+
+		/* Pop from the stack */
+		currNode = stack[stackIndex].node;
+		mint = stack[stackIndex].mint;
+		maxt = stack[stackIndex].maxt;
+		masked = S::maskOr(itsFound, S::gt(mint, maxt));
+	}
+}
+
+MTS_NAMESPACE_END
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
+
+#endif /* __MITSUBA_RENDER_SKDTREE_WIDE_H_ */
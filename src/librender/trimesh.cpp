@@ -337,18 +337,77 @@ int TriMesh::readOffsetDictionary(Stream *stream, short version,
 }
 
 TriMesh::~TriMesh() {
-	if (m_positions)
-		delete[] m_positions;
-	if (m_normals)
-		delete[] m_normals;
-	if (m_texcoords)
-		delete[] m_texcoords;
-	if (m_tangents)
-		delete[] m_tangents;
-	if (m_colors)
-		delete[] m_colors;
-	if (m_triangles)
-		delete[] m_triangles;
+	releaseGeometry();
+}
+
+void TriMesh::releaseGeometry() {
+	if (m_geometrySource.get()) {
+		m_geometrySource = NULL;
+	} else {
+		if (m_positions)
+			delete[] m_positions;
+		if (m_normals)
+			delete[] m_normals;
+		if (m_texcoords)
+			delete[] m_texcoords;
+		if (m_tangents)
+			delete[] m_tangents;
+		if (m_colors)
+			delete[] m_colors;
+		if (m_triangles)
+			delete[] m_triangles;
+	}
+	m_positions = NULL;
+	m_normals = NULL;
+	m_texcoords = NULL;
+	m_tangents = NULL;
+	m_colors = NULL;
+	m_triangles = NULL;
+}
+
+/// Allocate a copy of an array (or return \c NULL)
+template <typename T> static T *copyArray(const T *source, size_t count) {
+	if (!source)
+		return NULL;
+	T *result = new T[count];
+	std::copy(source, source + count, result);
+	return result;
+}
+
+void TriMesh::shareGeometry(const TriMesh *source) {
+	/* Always reference the mesh that owns the buffers */
+	if (source->m_geometrySource.get())
+		source = source->m_geometrySource.get();
+	if (source == this || source == m_geometrySource.get())
+		return;
+
+	releaseGeometry();
+	m_geometrySource = source;
+	m_triangles = source->m_triangles;
+	m_positions = source->m_positions;
+	m_normals = source->m_normals;
+	m_texcoords = source->m_texcoords;
+	m_tangents = source->m_tangents;
+	m_colors = source->m_colors;
+	m_triangleCount = source->m_triangleCount;
+	m_vertexCount = source->m_vertexCount;
+	m_aabb = source->m_aabb;
+	m_faceNormals = source->m_faceNormals;
+	m_flipNormals = source->m_flipNormals;
+	m_areaDistr.clear();
+	m_surfaceArea = m_invSurfaceArea = -1;
+}
+
+void TriMesh::detachGeometry() {
+	if (!m_geometrySource.get())
+		return;
+	m_triangles = copyArray(m_triangles, m_triangleCount);
+	m_positions = copyArray(m_positions, m_vertexCount);
+	m_normals = copyArray(m_normals, m_vertexCount);
+	m_texcoords = copyArray(m_texcoords, m_vertexCount);
+	m_tangents = copyArray(m_tangents, m_triangleCount);
+	m_colors = copyArray(m_colors, m_vertexCount);
+	m_geometrySource = NULL;
 }
 
 AABB TriMesh::getAABB() const {
@@ -455,22 +514,48 @@ struct vertex_key_order : public
 	}
 };
 
-/// Used in \ref TriMesh::rebuildTopology()
-struct TopoData {
-	size_t idx;   /// Triangle index
-	bool clustered; /// Has the tri-vert. pair been assigned to a cluster?
-	inline TopoData() { }
-	inline TopoData(size_t idx, bool clustered)
-		: idx(idx), clustered(clustered) { }
+/// Hash function for \ref Vertex, consistent with \ref vertex_key_order
+struct vertex_key_hash {
+	static inline uint64_t hashFloat(uint64_t h, Float value) {
+		uint64_t bits = 0;
+		if (value == 0)
+			value = 0; /* -0 and +0 are considered equal */
+		memcpy(&bits, &value, sizeof(Float));
+		h = (h ^ bits) * 0x9E3779B97F4A7C15ULL;
+		return h ^ (h >> 29);
+	}
+
+	static inline uint64_t hash(const Vertex &v) {
+		uint64_t h = 0;
+		for (int i=0; i<3; ++i)
+			h = hashFloat(h, v.p[i]);
+		for (int i=0; i<2; ++i)
+			h = hashFloat(h, v.uv[i]);
+		for (int i=0; i<Color3::dim; ++i)
+			h = hashFloat(h, v.col[i]);
+		h *= 0xBF58476D1CE4E5B9ULL;
+		return h ^ (h >> 32);
+	}
 };
 
+/// Orders vertex indices by the associated keys (used in \ref TriMesh::rebuildTopology())
+struct vertex_index_order : public
+	std::binary_function<uint32_t, uint32_t, bool> {
+	const std::vector<Vertex> &keys;
+	vertex_index_order(const std::vector<Vertex> &keys) : keys(keys) { }
+
+	bool operator()(uint32_t i1, uint32_t i2) const {
+		return vertex_key_order::compare(keys[i1], keys[i2]) < 0;
+	}
+};
 
 void TriMesh::rebuildTopology(Float maxAngle) {
-	typedef std::multimap<Vertex, TopoData, vertex_key_order> MMap;
-	typedef std::pair<Vertex, TopoData> MPair;
 	const Float dpThresh = std::cos(degToRad(maxAngle));
+	const uint32_t unassigned = 0xFFFFFFFFU;
 	size_t degenerateTriangles = 0;
 
+	detachGeometry();
+
 	if (m_normals) {
 		delete[] m_normals;
 		m_normals = NULL;
@@ -486,31 +571,15 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 			m_name.c_str(), m_triangleCount, m_vertexCount, maxAngle);
 	ref<Timer> timer = new Timer();
 
-	MMap vertexToFace;
-	std::vector<Point> newPositions;
-	std::vector<Point2> newTexcoords;
-	std::vector<Color3> newColors;
+	const int triangleCount = (int) m_triangleCount;
+	const size_t cornerCount = m_triangleCount * 3;
 	std::vector<Normal> faceNormals(m_triangleCount);
-	Triangle *newTriangles = new Triangle[m_triangleCount];
-
-	newPositions.reserve(m_vertexCount);
-	if (m_texcoords != NULL)
-		newTexcoords.reserve(m_vertexCount);
-	if (m_colors != NULL)
-		newColors.reserve(m_vertexCount);
 
-	/* Create an associative list and precompute a few things */
-	for (size_t i=0; i<m_triangleCount; ++i) {
+	#if defined(MTS_OPENMP)
+		#pragma omp parallel for reduction(+:degenerateTriangles)
+	#endif
+	for (int i=0; i<triangleCount; ++i) {
 		const Triangle &tri = m_triangles[i];
-		Vertex v;
-		for (int j=0; j<3; ++j) {
-			v.p = m_positions[tri.idx[j]];
-			if (m_texcoords)
-				v.uv = m_texcoords[tri.idx[j]];
-			if (m_colors)
-				v.col = m_colors[tri.idx[j]];
-			vertexToFace.insert(MPair(v, TopoData(i, false)));
-		}
 		Point v0 = m_positions[tri.idx[0]];
 		Point v1 = m_positions[tri.idx[1]];
 		Point v2 = m_positions[tri.idx[2]];
@@ -523,78 +592,172 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 			n = Normal(0.0f); /* Degenerate triangle */
 			degenerateTriangles++;
 		}
-
-		faceNormals[i] = Normal(n);
-		for (int j=0; j<3; ++j)
-			newTriangles[i].idx[j] = 0xFFFFFFFFU;
+		faceNormals[i] = n;
 	}
 
-	/* Under the reasonable assumption that the vertex degree is
-	   bounded by a constant, the following runs in O(n) */
-	for (MMap::iterator it = vertexToFace.begin(); it != vertexToFace.end();) {
-		MMap::iterator start = vertexToFace.lower_bound(it->first);
-		MMap::iterator end = vertexToFace.upper_bound(it->first);
-
-		/* Perform a greedy clustering of normals */
-		for (MMap::iterator it2 = start; it2 != end; it2++) {
-			const Vertex &v = it2->first;
-			const TopoData &t1 = it2->second;
-			Normal n1(faceNormals[t1.idx]);
-			if (t1.clustered)
-				continue;
+	/* Map every vertex to the group of vertices with identical
+	   attributes using a flat open-addressing hash table */
+	std::vector<Vertex> keys;
+	std::vector<uint32_t> vertexGroup(m_vertexCount);
+	keys.reserve(m_vertexCount);
+	{
+		size_t slotCount = 16;
+		while (slotCount < 2 * m_vertexCount)
+			slotCount *= 2;
+		std::vector<uint32_t> slots(slotCount, unassigned);
+		const size_t mask = slotCount - 1;
 
-			uint32_t vertexIdx = (uint32_t) newPositions.size();
-			newPositions.push_back(v.p);
+		for (size_t i=0; i<m_vertexCount; ++i) {
+			Vertex v;
+			v.p = m_positions[i];
 			if (m_texcoords)
-				newTexcoords.push_back(v.uv);
+				v.uv = m_texcoords[i];
 			if (m_colors)
-				newColors.push_back(v.col);
-
-			for (MMap::iterator it3 = it2; it3 != end; ++it3) {
-				TopoData &t2 = it3->second;
-				if (t2.clustered)
+				v.col = m_colors[i];
+
+			size_t slot = (size_t) vertex_key_hash::hash(v) & mask;
+			while (true) {
+				uint32_t group = slots[slot];
+				if (group == unassigned) {
+					group = (uint32_t) keys.size();
+					slots[slot] = group;
+					keys.push_back(v);
+				} else if (vertex_key_order::compare(keys[group], v) != 0) {
+					slot = (slot + 1) & mask;
 					continue;
-				Normal n2(faceNormals[t2.idx]);
-
-				if (n1 == n2 || dot(n1, n2) > dpThresh) {
-					const Triangle &tri = m_triangles[t2.idx];
-					Triangle &newTri = newTriangles[t2.idx];
-					for (int i=0; i<3; ++i) {
-						if (m_positions[tri.idx[i]] == v.p)
-							newTri.idx[i] = vertexIdx;
-					}
-					t2.clustered = true;
 				}
+				vertexGroup[i] = group;
+				break;
 			}
 		}
+	}
 
-		it = end;
+	/* Sort the groups by their attributes and build the
+	   vertex -> face adjacency in CSR form using a counting sort. Corners
+	   of a group remain ordered by their position in the triangle list */
+	const int groupCount = (int) keys.size();
+	std::vector<uint32_t> groupRank(groupCount), groups(groupCount + 1, 0);
+	{
+		std::vector<uint32_t> order(groupCount);
+		for (int i=0; i<groupCount; ++i)
+			order[i] = (uint32_t) i;
+		std::sort(order.begin(), order.end(), vertex_index_order(keys));
+		for (int i=0; i<groupCount; ++i)
+			groupRank[order[i]] = (uint32_t) i;
 	}
+	std::vector<Vertex>().swap(keys);
 
 	for (size_t i=0; i<m_triangleCount; ++i)
 		for (int j=0; j<3; ++j)
-			Assert(newTriangles[i].idx[j] != 0xFFFFFFFFU);
+			groups[groupRank[vertexGroup[m_triangles[i].idx[j]]] + 1]++;
+	for (int g=0; g<groupCount; ++g)
+		groups[g+1] += groups[g];
+
+	std::vector<uint32_t> corners(cornerCount);
+	{
+		std::vector<uint32_t> fill(groups.begin(), groups.end() - 1);
+		for (size_t i=0; i<m_triangleCount; ++i)
+			for (int j=0; j<3; ++j)
+				corners[fill[groupRank[vertexGroup[m_triangles[i].idx[j]]]]++] = (uint32_t) (3*i + j);
+	}
+
+	/* Perform a greedy clustering of the normals around every vertex.
+	   'cluster' receives the cluster index of every sorted corner */
+	std::vector<uint32_t> cluster(cornerCount, unassigned);
+	std::vector<uint32_t> vertexOffset(groupCount + 1, 0);
+
+	#if defined(MTS_OPENMP)
+		#pragma omp parallel for schedule(dynamic, 1024)
+	#endif
+	for (int g=0; g<groupCount; ++g) {
+		uint32_t start = groups[g], end = groups[g+1], clusterCount = 0;
+		for (uint32_t i=start; i<end; ++i) {
+			if (cluster[i] != unassigned)
+				continue;
+			const Normal &n1 = faceNormals[corners[i] / 3];
+			for (uint32_t k=i; k<end; ++k) {
+				if (cluster[k] != unassigned)
+					continue;
+				const Normal &n2 = faceNormals[corners[k] / 3];
+				if (n1 == n2 || dot(n1, n2) > dpThresh)
+					cluster[k] = clusterCount;
+			}
+			clusterCount++;
+		}
+		vertexOffset[g+1] = clusterCount;
+	}
+
+	/* Number the new vertices in the order of the sorted corners */
+	for (int g=0; g<groupCount; ++g)
+		vertexOffset[g+1] += vertexOffset[g];
+	const size_t vertexCount = vertexOffset[groupCount];
+
+	Point *newPositions = new Point[vertexCount];
+	Point2 *newTexcoords = m_texcoords ? new Point2[vertexCount] : NULL;
+	Color3 *newColors = m_colors ? new Color3[vertexCount] : NULL;
+	std::vector<uint32_t> rank(cornerCount);
+
+	#if defined(MTS_OPENMP)
+		#pragma omp parallel for schedule(dynamic, 1024)
+	#endif
+	for (int g=0; g<groupCount; ++g) {
+		uint32_t start = groups[g], end = groups[g+1], clusterCount = 0;
+		for (uint32_t i=start; i<end; ++i) {
+			uint32_t vertexIdx = vertexOffset[g] + cluster[i];
+			if (cluster[i] == clusterCount) {
+				/* The first corner of a cluster provides its attributes */
+				uint32_t source = m_triangles[corners[i] / 3].idx[corners[i] % 3];
+				newPositions[vertexIdx] = m_positions[source];
+				if (newTexcoords)
+					newTexcoords[vertexIdx] = m_texcoords[source];
+				if (newColors)
+					newColors[vertexIdx] = m_colors[source];
+				clusterCount++;
+			}
+			cluster[i] = vertexIdx;
+			rank[corners[i]] = i;
+		}
+	}
+
+	/* A corner references the vertex of the last corner (in sorted order)
+	   of the same triangle that has an identical position. This matches the
+	   order in which a sequential pass over the sorted corners would
+	   assign vertices to triangles. */
+	Triangle *newTriangles = new Triangle[m_triangleCount];
+
+	#if defined(MTS_OPENMP)
+		#pragma omp parallel for
+	#endif
+	for (int i=0; i<triangleCount; ++i) {
+		const Triangle &tri = m_triangles[i];
+		for (int j=0; j<3; ++j) {
+			const Point &p = m_positions[tri.idx[j]];
+			uint32_t last = rank[3*i + j];
+			for (int k=0; k<3; ++k) {
+				if (k != j && m_positions[tri.idx[k]] == p)
+					last = std::max(last, rank[3*i + k]);
+			}
+			newTriangles[i].idx[j] = cluster[last];
+		}
+	}
 
 	delete[] m_triangles;
 	m_triangles = newTriangles;
 
 	delete[] m_positions;
-	m_positions = new Point[newPositions.size()];
-	memcpy(m_positions, &newPositions[0], sizeof(Point) * newPositions.size());
+	m_positions = newPositions;
 
 	if (m_texcoords) {
 		delete[] m_texcoords;
-		m_texcoords = new Point2[newTexcoords.size()];
-		memcpy(m_texcoords, &newTexcoords[0], sizeof(Point2) * newTexcoords.size());
+		m_texcoords = newTexcoords;
 	}
 
 	if (m_colors) {
 		delete[] m_colors;
-		m_colors = new Color3[newColors.size()];
-		memcpy(m_colors, &newColors[0], sizeof(Color3) * newColors.size());
+		m_colors = newColors;
 	}
 
-	m_vertexCount = newPositions.size();
+	m_vertexCount = vertexCount;
 
 	if (degenerateTriangles > 0)
 		Log(EWarn, "Mesh contains " SIZE_T_FMT " degenerate triangles!", degenerateTriangles);
@@ -607,6 +770,15 @@ void TriMesh::rebuildTopology(Float maxAngle) {
 
 void TriMesh::computeNormals(bool force) {
 	int invalidNormals = 0;
+
+	if (m_geometrySource.get()) {
+		/* Copy shared buffers before modifying them */
+		bool modify = m_faceNormals ? (m_normals || m_flipNormals)
+			: (!m_normals || force || m_flipNormals);
+		if (modify)
+			detachGeometry();
+	}
+
 	if (m_faceNormals) {
 		if (m_normals) {
 			delete[] m_normals;
@@ -695,6 +867,7 @@ void TriMesh::computeUVTangents() {
 	if (m_tangents)
 		return;
 
+	detachGeometry();
 	m_tangents = new TangentSpace[m_triangleCount];
 	memset(m_tangents, 0, sizeof(TangentSpace)*m_triangleCount);
 
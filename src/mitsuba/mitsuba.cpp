@@ -30,8 +30,12 @@
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/appender.h>
 #include <mitsuba/core/sshstream.h>
+#include <mitsuba/core/cstream.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/zstream.h>
 #include <mitsuba/core/shvector.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/resregistry.h>
 #include <mitsuba/render/renderjob.h>
 #include <mitsuba/render/scenehandler.h>
 #include <fstream>
@@ -41,8 +45,16 @@
 #if defined(__WINDOWS__)
 #include <mitsuba/core/getopt.h>
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #else
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
 #include <signal.h>
+#define INVALID_SOCKET -1
+#define SOCKET int
 #endif
 
 using XERCES_CPP_NAMESPACE::SAXParser;
@@ -71,11 +83,23 @@ void help() {
 	cout <<  "                       out -- by default, \"~/mitsuba\" is used)" << endl << endl;
 	cout <<  "   -s file     Connect to additional Mitsuba servers specified in a file" << endl;
 	cout <<  "               with one name per line (same format as in -c)" << endl<< endl;
+	cout <<  "   -T opts     Transport options for the results of network nodes: a comma-" << endl;
+	cout <<  "               separated list containing 'zlib' (compression) and/or 'half'" << endl;
+	cout <<  "               (half precision image blocks, which is lossy)" << endl << endl;
 	cout <<  "   -j count    Simultaneously schedule several scenes. Can sometimes accelerate" << endl;
 	cout <<  "               rendering when large amounts of processing power are available" << endl;
 	cout <<  "               (e.g. when running Mitsuba on a cluster. Default: 1)" << endl << endl;
 	cout <<  "   -n name     Assign a node name to this instance (Default: host name)" << endl << endl;
 	cout <<  "   -x          Skip rendering of files where output already exists" << endl << endl;
+	cout <<  "   -d endpoint Run as a render daemon, which keeps plugins and shared geometry" << endl;
+	cout <<  "               loaded between jobs. Scene descriptions are received and the" << endl;
+	cout <<  "               rendered images are sent back over stdin/stdout (endpoint '-')" << endl;
+	cout <<  "               or over connections to a TCP port on the loopback interface." << endl;
+	cout <<  "               The protocol is documented in 'src/mitsuba/mitsuba.cpp'" << endl << endl;
+	cout <<  "   -V file     Render all camera poses listed in a file from a single scene" << endl;
+	cout <<  "               load. Each line contains 'lookat ox oy oz tx ty tz ux uy uz'" << endl;
+	cout <<  "               or 'matrix' followed by 16 row-major entries. View i is" << endl;
+	cout <<  "               written to the output file with the suffix _i" << endl << endl;
 	cout <<  "   -r sec      Write (partial) output images every 'sec' seconds" << endl << endl;
 	cout <<  "   -b res      Specify the block resolution used to split images into parallel" << endl;
 	cout <<  "               workloads (default: 32). Only applies to some integrators." << endl << endl;
@@ -126,6 +150,310 @@ private:
 	int m_timeout;
 };
 
+/**
+ * \brief Render daemon, which receives scene descriptions over a
+ * stream and sends the rendered images back (see the '-d' parameter)
+ *
+ * Since the process stays alive between jobs, plugins remain loaded.
+ * The previous scene is only released after its successor has been
+ * parsed, hence geometry that both share through the
+ * \ref ResourceRegistry does not have to be loaded again.
+ *
+ * All values are transmitted in network byte order, and strings are
+ * null-terminated. A request consists of
+ * <ul>
+ *    <li>a command byte (\ref ECommand)</li>
+ *    <li>a uint32 count followed by that many pairs of name and value
+ *        strings, which define scene parameters (as with '-D')</li>
+ *    <li>a string with a directory that is used to resolve relative
+ *        paths in the scene (may be empty)</li>
+ *    <li>the uint32 size of the XML scene description, followed by the
+ *        uint32 size of the payload and the payload itself. For
+ *        \ref ERenderCompressed, the payload is a zlib stream (e.g.
+ *        created using zlib's \c compress() function). Both sizes are
+ *        limited to 256 MiB.</li>
+ * </ul>
+ * Every render request is answered by a status byte (1 = success). On
+ * failure (including unknown commands), an error message string follows,
+ * and the daemon waits for the next request. On success, the uint32
+ * number of output files follows, and for each one its file name, its
+ * uint64 size and its contents.
+ */
+class RenderDaemon {
+public:
+	enum ECommand {
+		EQuit = 0,
+		ERender = 1,
+		ERenderCompressed = 2
+	};
+
+	/// Upper limit on the size of scene descriptions and payloads
+	enum {
+		EMaxRequestSize = 256 * 1024 * 1024
+	};
+
+	RenderDaemon(FileResolver *fileResolver, int blockSize)
+		: m_fileResolver(fileResolver), m_blockSize(blockSize), m_jobIdx(0) { }
+
+	/// Process requests until the stream is closed or a quit command is received
+	bool serve(Stream *stream) {
+		stream->setByteOrder(Stream::ENetworkByteOrder);
+
+		while (true) {
+			uint8_t command;
+			try {
+				command = stream->readUChar();
+			} catch (const std::exception &) {
+				return true; /* Connection closed */
+			}
+
+			if (command == EQuit) {
+				return false;
+			} else if (command != ERender && command != ERenderCompressed) {
+				/* The request can't be parsed, but the client may still
+				   send valid ones after receiving the error */
+				SLog(EWarn, "Render daemon: received an unknown command (%i)!", command);
+				sendError(stream, formatString("Unknown command (%i)!", command));
+				continue;
+			}
+
+			SceneHandler::ParameterMap parameters;
+			std::string basePath;
+			uint32_t xmlSize, payloadSize;
+			try {
+				uint32_t paramCount = stream->readUInt();
+				for (uint32_t i=0; i<paramCount; ++i) {
+					std::string name = stream->readString();
+					parameters[name] = stream->readString();
+				}
+				basePath = stream->readString();
+				xmlSize = stream->readUInt();
+				payloadSize = stream->readUInt();
+			} catch (const std::exception &e) {
+				SLog(EWarn, "Render daemon: could not read the request: %s", e.what());
+				return true; /* Connection closed */
+			}
+
+			std::string reason;
+			if (xmlSize > EMaxRequestSize || payloadSize > EMaxRequestSize)
+				reason = formatString("The request exceeds the size limit of %i MiB!",
+					EMaxRequestSize / (1024 * 1024));
+			else if (command == ERender && payloadSize != xmlSize)
+				reason = "Size mismatch!";
+
+			std::string xml;
+			ref<MemoryStream> payload;
+			try {
+				if (!reason.empty()) {
+					/* Skip the payload and reject the request */
+					skip(stream, payloadSize);
+				} else if (command == ERender) {
+					xml.resize(xmlSize);
+					if (!xml.empty())
+						stream->read(&xml[0], xml.size());
+				} else {
+					payload = new MemoryStream(payloadSize);
+					stream->copyTo(payload, payloadSize);
+				}
+			} catch (const std::exception &e) {
+				SLog(EWarn, "Render daemon: could not read the request: %s", e.what());
+				return true; /* Connection closed */
+			}
+
+			if (payload) {
+				try {
+					payload->seek(0);
+					ref<ZStream> zstream = new ZStream(payload);
+					xml.resize(xmlSize);
+					if (!xml.empty())
+						zstream->read(&xml[0], xml.size());
+				} catch (const std::exception &e) {
+					reason = formatString("Could not decompress the scene description: %s", e.what());
+				}
+			}
+
+			if (!reason.empty()) {
+				SLog(EWarn, "Render daemon: rejecting the request: %s", reason.c_str());
+				sendError(stream, reason);
+				continue;
+			}
+
+			std::vector<std::pair<std::string, ref<MemoryStream> > > files;
+			std::string error;
+			try {
+				render(xml, parameters, basePath, files);
+			} catch (const std::exception &e) {
+				error = e.what();
+			}
+
+			if (error.empty()) {
+				stream->writeUChar(1);
+				stream->writeUInt((uint32_t) files.size());
+				for (size_t i=0; i<files.size(); ++i) {
+					MemoryStream *data = files[i].second;
+					stream->writeString(files[i].first);
+					stream->writeULong((uint64_t) data->getSize());
+					stream->write(data->getData(), data->getSize());
+				}
+				stream->flush();
+			} else {
+				sendError(stream, error);
+			}
+		}
+	}
+
+	/// Accept connections on a loopback TCP port and serve them one at a time
+	void listen(int port) {
+		struct addrinfo hints, *servinfo, *p = NULL;
+		memset(&hints, 0, sizeof(struct addrinfo));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		char portName[8];
+		int rv, one = 1;
+		SOCKET sock = INVALID_SOCKET;
+
+		/* Without AI_PASSIVE, this resolves to the loopback interface */
+		snprintf(portName, sizeof(portName), "%i", port);
+		if ((rv = getaddrinfo(NULL, portName, &hints, &servinfo)) != 0)
+			SLog(EError, "Error in getaddrinfo(localhost:%i): %s", port, gai_strerror(rv));
+
+		for (p = servinfo; p != NULL; p = p->ai_next) {
+			sock = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+			if (sock == INVALID_SOCKET)
+				SocketStream::handleError("none", "socket");
+
+			/* Avoid "bind: socket already in use" */
+			if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *) &one, sizeof(int)) < 0)
+				SocketStream::handleError("none", "setsockopt");
+
+			if (bind(sock, p->ai_addr, (socklen_t) p->ai_addrlen) == -1) {
+				SocketStream::handleError("none", formatString("bind(localhost:%i)", port), EWarn);
+#if defined(__WINDOWS__)
+				closesocket(sock);
+#else
+				close(sock);
+#endif
+				continue;
+			}
+			break;
+		}
+
+		if (p == NULL)
+			SLog(EError, "Failed to bind to port %i!", port);
+		freeaddrinfo(servinfo);
+
+		if (::listen(sock, 1) == -1)
+			SocketStream::handleError("none", "listen");
+
+#if !defined(__WINDOWS__)
+		/* Ignore SIGPIPE -- a vanished client is handled as an error */
+		signal(SIGPIPE, SIG_IGN);
+#endif
+
+		SLog(EInfo, "Render daemon: listening on localhost:%i ..", port);
+
+		bool running = true;
+		while (running) {
+			SOCKET newSocket = accept(sock, NULL, NULL);
+			if (newSocket == INVALID_SOCKET) {
+#if !defined(__WINDOWS__)
+				if (errno == EINTR)
+					continue;
+#endif
+				SocketStream::handleError("none", "accept", EWarn);
+				continue;
+			}
+
+			try {
+				ref<SocketStream> stream = new SocketStream(newSocket);
+				SLog(EInfo, "Render daemon: accepted a connection from %s",
+					stream->getPeer().c_str());
+				running = serve(stream);
+			} catch (const std::exception &e) {
+				SLog(EWarn, "Render daemon: dropping the connection: %s", e.what());
+			}
+		}
+
+#if defined(__WINDOWS__)
+		closesocket(sock);
+#else
+		close(sock);
+#endif
+	}
+
+protected:
+	/// Answer a request with an error message
+	void sendError(Stream *stream, const std::string &message) {
+		stream->writeUChar(0);
+		stream->writeString(message);
+		stream->flush();
+	}
+
+	/// Read and discard \c size bytes of a request
+	void skip(Stream *stream, size_t size) {
+		char buffer[4096];
+		while (size > 0) {
+			size_t chunk = std::min(size, sizeof(buffer));
+			stream->read(buffer, chunk);
+			size -= chunk;
+		}
+	}
+
+	/// Render a scene and load all output files into memory
+	void render(const std::string &xml, const SceneHandler::ParameterMap &parameters,
+			const std::string &basePath, std::vector<std::pair<std::string, ref<MemoryStream> > > &files) {
+		ref<FileResolver> frClone = m_fileResolver->clone();
+		if (!basePath.empty())
+			frClone->prependPath(basePath);
+		Thread::getThread()->setFileResolver(frClone);
+
+		SLog(EInfo, "Render daemon: parsing scene description (job %i) ..", m_jobIdx);
+		ref<Scene> scene = SceneHandler::loadSceneFromString(xml, parameters);
+
+		/* The previous scene is no longer needed now that its
+		   shared resources have been picked up */
+		m_lastScene = scene;
+
+		/* The film chooses the file extension */
+		fs::path outputPath = fs::temp_directory_path()
+			/ fs::unique_path("mitsuba-%%%%-%%%%-%%%%");
+		fs::create_directories(outputPath);
+		scene->setDestinationFile(outputPath / "output");
+		scene->setBlockSize(m_blockSize);
+
+		try {
+			ref<RenderJob> job = new RenderJob(formatString("ren%i", m_jobIdx++),
+				scene, renderQueue, -1, -1, -1, true, false);
+			job->start();
+			bool success = job->wait();
+			renderQueue->waitLeft(0);
+
+			if (!success)
+				SLog(EError, "Rendering failed (see the log for details)");
+
+			fs::directory_iterator end, it(outputPath);
+			for (; it != end; ++it) {
+				ref<FileStream> fs = new FileStream(it->path(), FileStream::EReadOnly);
+				ref<MemoryStream> data = new MemoryStream(fs->getSize());
+				fs->copyTo(data, fs->getSize());
+				files.push_back(std::make_pair(it->path().filename().string(), data));
+			}
+		} catch (...) {
+			fs::remove_all(outputPath);
+			throw;
+		}
+
+		fs::remove_all(outputPath);
+		Statistics::getInstance()->resetAll();
+	}
+
+private:
+	ref<FileResolver> m_fileResolver;
+	ref<Scene> m_lastScene;
+	int m_blockSize;
+	int m_jobIdx;
+};
+
 int mitsuba_app(int argc, char **argv) {
 	int optchar;
 	char *end_ptr = NULL;
@@ -135,7 +463,8 @@ int mitsuba_app(int argc, char **argv) {
 		int nprocs_avail = getCoreCount(), nprocs = nprocs_avail;
 		int numParallelScenes = 1;
 		std::string nodeName = getHostName(),
-					networkHosts = "", destFile="";
+					networkHosts = "", destFile="", viewFile="",
+						daemonEndpoint = "";
 		bool quietMode = false, progressBars = true, skipExisting = false;
 		ELogLevel logLevel = EInfo;
 		ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver();
@@ -143,6 +472,7 @@ int mitsuba_app(int argc, char **argv) {
 		std::map<std::string, std::string, SimpleStringOrdering> parameters;
 		int blockSize = 32;
 		int flushTimer = -1;
+		int transportFlags = 0;
 
 		if (argc < 2) {
 			help();
@@ -151,7 +481,7 @@ int mitsuba_app(int argc, char **argv) {
 
 		optind = 1;
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "a:c:D:s:j:n:o:r:b:p:L:qhzvtwx")) != -1) {
+		while ((optchar = getopt(argc, argv, "a:c:d:D:s:j:n:o:r:b:p:L:T:V:qhzvtwx")) != -1) {
 			switch (optchar) {
 				case 'a': {
 						std::vector<std::string> paths = tokenize(optarg, ";");
@@ -162,6 +492,9 @@ int mitsuba_app(int argc, char **argv) {
 				case 'c':
 					networkHosts = networkHosts + std::string(";") + std::string(optarg);
 					break;
+				case 'd':
+					daemonEndpoint = optarg;
+					break;
 				case 'w':
 					treatWarningsAsErrors = true;
 					break;
@@ -190,6 +523,9 @@ int mitsuba_app(int argc, char **argv) {
 				case 'o':
 					destFile = optarg;
 					break;
+				case 'V':
+					viewFile = optarg;
+					break;
 				case 'v':
 					if (logLevel != EDebug)
 						logLevel = EDebug;
@@ -215,6 +551,9 @@ int mitsuba_app(int argc, char **argv) {
 				case 'x':
 					skipExisting = true;
 					break;
+				case 'T':
+					transportFlags = RemoteWorker::parseTransportFlags(optarg);
+					break;
 				case 'p':
 					nprocs = strtol(optarg, &end_ptr, 10);
 					if (*end_ptr != '\0')
@@ -268,8 +607,11 @@ int mitsuba_app(int argc, char **argv) {
 		}
 
 		log->addAppender(new StreamAppender(formatString("mitsuba.%s.log", nodeName.c_str())));
-		if (!quietMode)
-			log->addAppender(new StreamAppender(&std::cout));
+		if (!quietMode) {
+			/* In stdin/stdout daemon mode, stdout carries the protocol */
+			log->addAppender(new StreamAppender(daemonEndpoint == "-"
+				? &std::cerr : &std::cout));
+		}
 
 		SLog(EInfo, "Mitsuba version %s, Copyright (c) " MTS_YEAR " Wenzel Jakob",
 				Version(MTS_VERSION).toStringComplete().c_str());
@@ -311,7 +653,8 @@ int mitsuba_app(int argc, char **argv) {
 				stream = new SSHStream(tokens[0], tokens[1], cmdLine);
 			}
 			try {
-				scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream));
+				scheduler->registerWorker(new RemoteWorker(formatString("net%i", i),
+					stream, transportFlags));
 			} catch (std::runtime_error &e) {
 				if (hostName.find("@") != std::string::npos) {
 #if defined(__WINDOWS__)
@@ -364,6 +707,33 @@ int mitsuba_app(int argc, char **argv) {
 			flushThread->start();
 		}
 
+		std::vector<Transform> views;
+		if (!viewFile.empty())
+			views = RenderJob::loadViews(fileResolver->resolve(viewFile));
+
+		if (!daemonEndpoint.empty()) {
+			/* Scenes are only received through the daemon protocol */
+			if (optind < argc)
+				SLog(EWarn, "Ignoring the scene files on the command line in render daemon mode");
+			RenderDaemon daemon(fileResolver, blockSize);
+			if (daemonEndpoint == "-") {
+				ref<ConsoleStream> stream = new ConsoleStream();
+				daemon.serve(stream);
+			} else {
+				int port = strtol(daemonEndpoint.c_str(), &end_ptr, 10);
+				if (*end_ptr != '\0' || port <= 0 || port > 65535)
+					SLog(EError, "Invalid render daemon endpoint \"%s\" (must be "
+						"'-' or a port number)!", daemonEndpoint.c_str());
+				daemon.listen(port);
+			}
+
+			if (flushThread)
+				flushThread->quit();
+			delete handler;
+			delete parser;
+			return 0;
+		}
+
 		int jobIdx = 0;
 		for (int i=optind; i<argc; ++i) {
 			fs::path
@@ -384,11 +754,14 @@ int mitsuba_app(int argc, char **argv) {
 				fs::path(destFile) : (filePath / baseName));
 			scene->setBlockSize(blockSize);
 
-			if (scene->destinationExists() && skipExisting)
+			if (skipExisting && (views.empty() ? scene->destinationExists()
+					: RenderJob::viewDestinationsExist(scene, views.size())))
 				continue;
 
 			ref<RenderJob> thr = new RenderJob(formatString("ren%i", jobIdx++),
 				scene, renderQueue, -1, -1, -1, true, flushTimer > 0);
+			if (!views.empty())
+				thr->setViews(views);
 			thr->start();
 
 			renderQueue->waitLeft(numParallelScenes-1);
@@ -428,6 +801,7 @@ int mts_main(int argc, char **argv) {
 	FileStream::staticInitialization();
 	Spectrum::staticInitialization();
 	Bitmap::staticInitialization();
+	ResourceRegistry::staticInitialization();
 	Scheduler::staticInitialization();
 	SHVector::staticInitialization();
 	SceneHandler::staticInitialization();
@@ -452,6 +826,7 @@ int mts_main(int argc, char **argv) {
 	SceneHandler::staticShutdown();
 	SHVector::staticShutdown();
 	Scheduler::staticShutdown();
+	ResourceRegistry::staticShutdown();
 	Bitmap::staticShutdown();
 	Spectrum::staticShutdown();
 	FileStream::staticShutdown();
@@ -20,6 +20,7 @@
 #include <mitsuba/core/cstream.h>
 #include <mitsuba/core/sstream.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/resregistry.h>
 #include <mitsuba/core/sshstream.h>
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/shvector.h>
@@ -103,13 +104,14 @@ int mtssrv(int argc, char **argv) {
 					networkHosts = "";
 		bool quietMode = false;
 		ELogLevel logLevel = EInfo;
+		int transportFlags = 0;
 		std::string hostName = getFQDN();
 		FileResolver *fileResolver = Thread::getThread()->getFileResolver();
 		bool hostNameSet = false;
 
 		optind = 1;
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "a:c:s:n:p:i:l:L:qhv")) != -1) {
+		while ((optchar = getopt(argc, argv, "a:c:s:n:p:i:l:L:T:qhv")) != -1) {
 			switch (optchar) {
 				case 'a': {
 						std::vector<std::string> paths = tokenize(optarg, ";");
@@ -124,6 +126,9 @@ int mtssrv(int argc, char **argv) {
 					hostName = optarg;
 					hostNameSet = true;
 					break;
+				case 'T':
+					transportFlags = RemoteWorker::parseTransportFlags(optarg);
+					break;
 				case 's': {
 						std::ifstream is(optarg);
 						if (is.fail())
@@ -197,6 +202,9 @@ int mtssrv(int argc, char **argv) {
 					cout <<  "                       out -- by default, \"~/mitsuba\" is used)" << endl << endl;
 					cout <<  "   -s file     Connect to additional Mitsuba servers specified in a file" << endl;
 					cout <<  "               with one name per line (same format as in -c)" << endl<< endl;
+					cout <<  "   -T opts     Transport options for the results of network nodes: a comma-" << endl;
+					cout <<  "               separated list containing 'zlib' (compression) and/or 'half'" << endl;
+					cout <<  "               (half precision image blocks, which is lossy)" << endl << endl;
 					cout <<  "   -i name     IP address / host name on which to listen for connections" << endl << endl;
 					cout <<  "   -l port     Listen for connections on a certain port (Default: " << MTS_DEFAULT_PORT << ")." << endl;
 					cout <<  "               To listen on stdin, specify \"-ls\" (implies -q)" << endl << endl;
@@ -269,7 +277,8 @@ int mtssrv(int argc, char **argv) {
 				stream = new SSHStream(tokens[0], tokens[1], cmdLine);
 			}
 			try {
-				scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream));
+				scheduler->registerWorker(new RemoteWorker(formatString("net%i", i),
+					stream, transportFlags));
 			} catch (std::runtime_error &e) {
 				if (hostName.find("@") != std::string::npos) {
 #if defined(__WINDOWS__)
@@ -416,6 +425,7 @@ int mts_main(int argc, char **argv) {
 	FileStream::staticInitialization();
 	Spectrum::staticInitialization();
 	Bitmap::staticInitialization();
+	ResourceRegistry::staticInitialization();
 	Scheduler::staticInitialization();
 	SHVector::staticInitialization();
 
@@ -437,6 +447,7 @@ int mts_main(int argc, char **argv) {
 	/* Shutdown the core framework */
 	SHVector::staticShutdown();
 	Scheduler::staticShutdown();
+	ResourceRegistry::staticShutdown();
 	Bitmap::staticShutdown();
 	Spectrum::staticShutdown();
 	FileStream::staticShutdown();
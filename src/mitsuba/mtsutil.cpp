@@ -28,6 +28,7 @@
 #include <mitsuba/core/sshstream.h>
 #include <mitsuba/core/shvector.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/resregistry.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/version.h>
@@ -69,6 +70,9 @@ void help() {
 	cout <<  "                       out -- by default, \"~/mitsuba\" is used)" << endl << endl;
 	cout <<  "   -s file     Connect to additional Mitsuba servers specified in a file" << endl;
 	cout <<  "               with one name per line (same format as in -c)" << endl<< endl;
+	cout <<  "   -T opts     Transport options for the results of network nodes: a comma-" << endl;
+	cout <<  "               separated list containing 'zlib' (compression) and/or 'half'" << endl;
+	cout <<  "               (half precision image blocks, which is lossy)" << endl << endl;
 	cout <<  "   -n name     Assign a node name to this instance (Default: host name)" << endl << endl;
 	cout <<  "   -t          Execute all testcases" << endl << endl;
 	cout <<  "   -v          Be more verbose" << endl << endl;
@@ -146,6 +150,7 @@ int mtsutil(int argc, char **argv) {
 					networkHosts = "", destFile="";
 		bool quietMode = false;
 		ELogLevel logLevel = EInfo;
+		int transportFlags = 0;
 		FileResolver *fileResolver = Thread::getThread()->getFileResolver();
 		bool testCaseMode = false, treatWarningsAsErrors = false;
 
@@ -156,7 +161,7 @@ int mtsutil(int argc, char **argv) {
 
 		optind = 1;
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "+a:c:s:n:p:qhwvt")) != -1) {
+		while ((optchar = getopt(argc, argv, "+a:c:s:n:p:T:qhwvt")) != -1) {
 			switch (optchar) {
 				case 'a': {
 						std::vector<std::string> paths = tokenize(optarg, ";");
@@ -170,6 +175,9 @@ int mtsutil(int argc, char **argv) {
 				case 't':
 					testCaseMode = true;
 					break;
+				case 'T':
+					transportFlags = RemoteWorker::parseTransportFlags(optarg);
+					break;
 				case 'w':
 					treatWarningsAsErrors = true;
 					break;
@@ -269,7 +277,8 @@ int mtsutil(int argc, char **argv) {
 				stream = new SSHStream(tokens[0], tokens[1], cmdLine);
 			}
 			try {
-				scheduler->registerWorker(new RemoteWorker(formatString("net%i", i), stream));
+				scheduler->registerWorker(new RemoteWorker(formatString("net%i", i),
+					stream, transportFlags));
 			} catch (std::runtime_error &e) {
 				if (hostName.find("@") != std::string::npos) {
 #if defined(__WINDOWS__)
@@ -397,6 +406,7 @@ int mts_main(int argc, char **argv) {
 	FileStream::staticInitialization();
 	Spectrum::staticInitialization();
 	Bitmap::staticInitialization();
+	ResourceRegistry::staticInitialization();
 	Scheduler::staticInitialization();
 	SHVector::staticInitialization();
 	SceneHandler::staticInitialization();
@@ -421,6 +431,7 @@ int mts_main(int argc, char **argv) {
 	SceneHandler::staticShutdown();
 	SHVector::staticShutdown();
 	Scheduler::staticShutdown();
+	ResourceRegistry::staticShutdown();
 	Bitmap::staticShutdown();
 	Spectrum::staticShutdown();
 	FileStream::staticShutdown();
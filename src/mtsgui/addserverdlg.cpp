@@ -18,6 +18,7 @@
 
 #include "ui_addserverdlg.h"
 #include "addserverdlg.h"
+#include <mitsuba/core/sched_remote.h>
 
 #if !defined(__WINDOWS__)
 #include <pwd.h>
@@ -80,6 +81,11 @@ ServerConnection AddServerDialog::getConnection() const {
 	conn.port = ui->port->text().toInt();
 	conn.type = ui->directConnection->isChecked()
 		? EDirectConnection : ESSHConnection;
+	conn.transportFlags = 0;
+	if (ui->compressResults->isChecked())
+		conn.transportFlags |= RemoteWorker::ECompressResults;
+	if (ui->halfResults->isChecked())
+		conn.transportFlags |= RemoteWorker::ECompactResults;
 	return conn;
 }
 
@@ -55,26 +55,32 @@ struct ServerConnection {
 	EConnectionType type;
 	QString hostName, userName, instDir;
 	int port;
+	/// Transport flags of the remote worker (see \ref RemoteWorker::ETransportFlags)
+	int transportFlags;
 	RemoteWorker *worker;
 	bool isRegistered;
 
-	inline ServerConnection() : worker(NULL), isRegistered(false) { }
+	inline ServerConnection() : transportFlags(0), worker(NULL), isRegistered(false) { }
 
 	inline bool operator==(const ServerConnection &c) const {
 		return type == c.type && hostName == c.hostName
 			&& userName == c.userName && instDir == c.instDir
-			&& port == c.port && worker == c.worker
-			&& isRegistered == c.isRegistered;
+			&& port == c.port && transportFlags == c.transportFlags
+			&& worker == c.worker && isRegistered == c.isRegistered;
 	}
 
 	inline void fromVariant(QList<QVariant> list) {
 		type = (EConnectionType) list[0].toInt();
 		hostName = list[1].toString();
 		port = list[2].toInt();
+		int next = 3;
 		if (type == ESSHConnection) {
 			userName = list[3].toString();
 			instDir = list[4].toString();
+			next = 5;
 		}
+		/* Not present in connections saved by older versions */
+		transportFlags = list.size() > next ? list[next].toInt() : 0;
 	}
 
 	inline QList<QVariant> toVariant() const {
@@ -86,6 +92,7 @@ struct ServerConnection {
 			result.append(userName);
 			result.append(instDir);
 		}
+		result.append(transportFlags);
 		return result;
 	}
 
@@ -26,6 +26,7 @@
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/appender.h>
 #include <mitsuba/core/statistics.h>
+#include <mitsuba/core/resregistry.h>
 #include <mitsuba/render/scenehandler.h>
 
 #if defined(__OSX__)
@@ -177,6 +178,7 @@ int main(int argc, char *argv[]) {
 	Thread::initializeOpenMP(getCoreCount());
 	Spectrum::staticInitialization();
 	Bitmap::staticInitialization();
+	ResourceRegistry::staticInitialization();
 	Scheduler::staticInitialization();
 	SHVector::staticInitialization();
 	SceneHandler::staticInitialization();
@@ -310,6 +312,7 @@ int main(int argc, char *argv[]) {
 	SceneHandler::staticShutdown();
 	SHVector::staticShutdown();
 	Scheduler::staticShutdown();
+	ResourceRegistry::staticShutdown();
 	Bitmap::staticShutdown();
 	Spectrum::staticShutdown();
 	FileStream::staticShutdown();
@@ -2035,7 +2035,8 @@ bool ServerConnection::createWorker(QWidget *parent) {
 			stream = new SSHStream(userName.toStdString(),
 				hostName.toStdString(), cmdLine, port);
 		}
-		worker = new RemoteWorker(formatString("net%i", remoteWorkerCtr++), stream);
+		worker = new RemoteWorker(formatString("net%i", remoteWorkerCtr++),
+			stream, transportFlags);
 		return true;
 	} catch (const std::exception &e) {
 		QString extra;
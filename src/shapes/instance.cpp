@@ -17,6 +17,8 @@
 */
 
 #include "instance.h"
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/render/medium.h>
 
 MTS_NAMESPACE_BEGIN
 
@@ -29,6 +31,7 @@ MTS_NAMESPACE_BEGIN
  *	      Specifies an optional linear instance-to-world transformation.
  *        \default{none (i.e. instance space $=$ world space)}
  *     }
+ *     \parameter{\Unnamed}{\BSDF}{Optional material overrides (see below)}
  * }
  * \renderings{
  *    \rendering{Surface viewed from the top}{shape_instance_fractal_top}
@@ -45,10 +48,26 @@ MTS_NAMESPACE_BEGIN
  * This plugin implements a geometry instance used to efficiently replicate
  * geometry many times. For details on how to create instances, refer to
  * the \pluginref{shapegroup} plugin.
+ *
+ * By default, an instance uses the materials specified within the shape
+ * group. They can be replaced for individual instances by nesting BSDFs:
+ * a BSDF with a \code{name} attribute replaces the material of all
+ * meshes that have this name, or whose material has this identifier
+ * (e.g. a material name of an OBJ file). An unnamed BSDF replaces the
+ * materials of all remaining meshes. Overrides are implemented using
+ * lightweight meshes that reference the geometry of the shape group,
+ * hence they do not duplicate any triangle data:
+ * \vspace{5mm}
+ * \begin{xml}[caption={Replacing materials of an instance}]
+ * <shape type="instance">
+ *     <ref id="myShapeGroup"/>
+ *     <bsdf type="diffuse" name="Wood"/>
+ *     <bsdf type="roughconductor"/>
+ * </shape>
+ * \end{xml}
+ *
  * \remarks{
- *   \item Note that it is \emph{not} possible to assign a different
- *    material to each instance --- the material assignment specified within
- *    the shape group is the one that matters.
+ *   \item Materials can only be overridden for triangle meshes.
  *   \item Shape groups cannot be used to replicate shapes with
  *   attached emitters, sensors, or subsurface scattering models.
  * }
@@ -62,17 +81,86 @@ Instance::Instance(Stream *stream, InstanceManager *manager)
 	: Shape(stream, manager) {
 	m_shapeGroup = static_cast<ShapeGroup *>(manager->getInstance(stream));
 	m_transform = new AnimatedTransform(stream);
+	size_t materialCount = stream->readSize();
+	for (size_t i=0; i<materialCount; ++i) {
+		std::string name = stream->readString();
+		BSDF *bsdf = static_cast<BSDF *>(manager->getInstance(stream));
+		m_materials.push_back(std::make_pair(name, bsdf));
+	}
+	resolveShapes();
 }
 
 void Instance::serialize(Stream *stream, InstanceManager *manager) const {
 	Shape::serialize(stream, manager);
 	manager->serialize(stream, m_shapeGroup.get());
 	m_transform->serialize(stream);
+	stream->writeSize(m_materials.size());
+	for (size_t i=0; i<m_materials.size(); ++i) {
+		stream->writeString(m_materials[i].first);
+		manager->serialize(stream, m_materials[i].second.get());
+	}
 }
 
 void Instance::configure() {
 	if (!m_shapeGroup)
 		Log(EError, "A reference to a 'shapegroup' must be specified!");
+	resolveShapes();
+}
+
+void Instance::resolveShapes() {
+	const std::vector<const Shape *> &shapes = m_shapeGroup->getShapes();
+	std::vector<bool> used(m_materials.size(), false);
+	m_shapes = shapes;
+	m_overrides.clear();
+
+	for (size_t i=0; i<shapes.size(); ++i) {
+		const Shape *shape = shapes[i];
+		const BSDF *bsdf = shape->getBSDF();
+
+		/* Named overrides take precedence over an unnamed one */
+		int match = -1;
+		for (size_t j=0; j<m_materials.size(); ++j) {
+			const std::string &name = m_materials[j].first;
+			if (name.empty()) {
+				if (match < 0)
+					match = (int) j;
+			} else if (name == shape->getName() || (bsdf && name == bsdf->getID())) {
+				match = (int) j;
+				break;
+			}
+		}
+		if (match < 0)
+			continue;
+		used[match] = true;
+
+		if (!shape->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
+			Log(EError, "Unable to override the material of the shape \"%s\" "
+				"(only supported for triangle meshes)", shape->getName().c_str());
+
+		/* Create a mesh that references the geometry of the original one.
+		   It is not configured, since the shared geometry is complete and
+		   must not be modified (e.g. by flipping normals a second time) */
+		const TriMesh *source = static_cast<const TriMesh *>(shape);
+		ref<TriMesh> mesh = new TriMesh(source->getName(), 0, 0);
+		mesh->shareGeometry(source);
+		mesh->setObjectID(source->getObjectID());
+		mesh->setPartID(source->getPartID());
+		if (source->getInteriorMedium())
+			mesh->addChild("interior", const_cast<Medium *>(source->getInteriorMedium()));
+		if (source->getExteriorMedium())
+			mesh->addChild("exterior", const_cast<Medium *>(source->getExteriorMedium()));
+		mesh->addChild(m_materials[match].second);
+
+		m_overrides.push_back(mesh.get());
+		m_shapes[i] = mesh;
+	}
+
+	for (size_t i=0; i<m_materials.size(); ++i) {
+		if (!used[i])
+			Log(EWarn, "The material override \"%s\" of instance \"%s\" does not "
+				"match any shape of the shape group!", m_materials[i].first.c_str(),
+				getName().c_str());
+	}
 }
 
 AABB Instance::getAABB() const {
@@ -99,6 +187,8 @@ void Instance::addChild(const std::string &name, ConfigurableObject *child) {
 	const Class *cClass = child->getClass();
 	if (cClass->getName() == "ShapeGroup") {
 		m_shapeGroup = static_cast<ShapeGroup *>(child);
+	} else if (cClass->derivesFrom(MTS_CLASS(BSDF))) {
+		m_materials.push_back(std::make_pair(name, static_cast<BSDF *>(child)));
 	} else {
 		Shape::addChild(name, child);
 	}
@@ -151,6 +241,10 @@ void Instance::fillIntersectionRecord(const Ray &_ray,
 	trafo.inverse()(_ray, ray);
 	kdtree->fillIntersectionRecord<false>(ray, temp, its);
 
+	/* The kd-tree may be shared with other shape groups and does
+	   not know about material overrides -- look up the actual shape */
+	its.shape = m_shapes[static_cast<const ShapeKDTree::IntersectionCache *>(temp)->shapeIndex];
+
 	its.shFrame.n = normalize(trafo(its.shFrame.n));
 	its.geoFrame = Frame(normalize(trafo(its.geoFrame.n)));
 	its.dpdu = trafo(its.dpdu);
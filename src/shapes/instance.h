@@ -51,6 +51,14 @@ public:
 	/// Return a pointer to the associated \ref ShapeGroup (const version)
 	inline const ShapeGroup* getShapeGroup() const { return m_shapeGroup.get(); }
 
+	/**
+	 * \brief Return the instantiated shapes
+	 *
+	 * These are the shapes of the associated \ref ShapeGroup, except for
+	 * meshes whose material is overridden by this instance.
+	 */
+	inline const std::vector<const Shape *> &getShapes() const { return m_shapes; }
+
 	/// Return the underlying animated transformation
 	inline const AnimatedTransform *getAnimatedTransform() const { return m_transform.get(); }
 
@@ -81,9 +89,15 @@ public:
 	// =============================================================
 
 	MTS_DECLARE_CLASS()
+protected:
+	/// Apply the material overrides to the shapes of the shape group
+	void resolveShapes();
 private:
 	ref<ShapeGroup> m_shapeGroup;
 	ref<const AnimatedTransform> m_transform;
+	std::vector<std::pair<std::string, ref<BSDF> > > m_materials;
+	ref_vector<Shape> m_overrides;
+	std::vector<const Shape *> m_shapes;
 };
 
 MTS_NAMESPACE_END
@@ -17,15 +17,19 @@
 */
 
 #include <mitsuba/render/trimesh.h>
+#include <mitsuba/render/objparser.h>
+#include <mitsuba/render/vertexwelder.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/resregistry.h>
 #include <mitsuba/render/emitter.h>
 #include <mitsuba/render/bsdf.h>
 #include <mitsuba/render/subsurface.h>
 #include <mitsuba/render/medium.h>
 #include <mitsuba/render/sensor.h>
 #include <mitsuba/hw/basicshader.h>
+#include <boost/bind.hpp>
 #include <set>
 
 MTS_NAMESPACE_BEGIN
@@ -150,41 +154,27 @@ MTS_NAMESPACE_BEGIN
  * utility. Using the resulting output will significantly accelerate the scene loading time.
  * }
  */
-class WavefrontOBJ : public Shape {
+/**
+ * Meshes of an OBJ file, which are shared by all scenes of the process
+ * that load the same file with the same parameters
+ */
+class WavefrontOBJModel : public Object {
 public:
-	struct OBJTriangle {
-		int p[3];
-		int n[3];
-		int uv[3];
+	/// Meshes without materials (must not be modified)
+	std::vector<ref<TriMesh> > meshes;
+	/// Material name of each mesh
+	std::vector<std::string> materialAssignment;
+	/// Material library referenced by the OBJ file (unresolved)
+	std::string materialLibrary;
 
-		inline OBJTriangle() {
-			memset(this, 0, sizeof(OBJTriangle));
-		}
-	};
-
-	bool fetch_line(std::istream &is, std::string &line) {
-		/// Fetch a line from the stream, while handling line breaks with backslashes
-		if (!std::getline(is, line))
-			return false;
-		if (line == "")
-			return true;
-		int lastCharacter = (int) line.size() - 1;
-		while (lastCharacter >= 0 &&
-				(line[lastCharacter] == '\r' ||
-					line[lastCharacter] == '\n' ||
-					line[lastCharacter] == '\t' ||
-					line[lastCharacter] == ' '))
-			lastCharacter--;
-
-		if (lastCharacter >= 0 && line[lastCharacter] == '\\') {
-			std::string nextLine;
-			fetch_line(is, nextLine);
-			line = line.substr(0, lastCharacter) + nextLine;
-		} else {
-			line.resize(lastCharacter+1);
-		}
-		return true;
-	}
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~WavefrontOBJModel() { }
+};
+
+class WavefrontOBJ : public Shape {
+public:
+	typedef OBJParser::Face OBJTriangle;
 
 	WavefrontOBJ(const Properties &props) : Shape(props) {
 		ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver()->clone();
@@ -221,43 +211,88 @@ public:
 
 		/* Load the geometry */
 		Log(EInfo, "Loading geometry from \"%s\" ..", path.filename().string().c_str());
-		fs::ifstream is(path);
-		if (is.bad() || is.fail())
+		if (!fs::exists(path))
 			Log(EError, "Wavefront OBJ file '%s' not found!", path.string().c_str());
 
 		fileResolver->prependPath(fs::absolute(path).parent_path());
 
+		bool smooth = props.hasProperty("maxSmoothAngle");
+		Float maxSmoothAngle = 0;
+		if (smooth) {
+			if (m_faceNormals)
+				Log(EError, "The properties 'maxSmoothAngle' and 'faceNormals' "
+				"can't be specified at the same time!");
+			maxSmoothAngle = props.getFloat("maxSmoothAngle");
+		}
+
+		/* Scenes loaded by the same process share the geometry */
+		std::string key = formatString("obj:%s:%i%i%i%i:%i:%s:%s",
+			ResourceRegistry::getFileKey(path).c_str(), (int) m_faceNormals,
+			(int) m_flipNormals, (int) m_collapse, (int) flipTexCoords, shapeIndex,
+			smooth ? formatString("%a", (double) maxSmoothAngle).c_str() : "none",
+			ResourceRegistry::getTransformKey(objectToWorld).c_str());
+
 		ref<Timer> timer = new Timer();
-		std::string buf;
-		std::vector<Point> vertices;
-		std::vector<Normal> normals;
-		std::vector<Point2> texcoords;
-		std::vector<OBJTriangle> triangles;
-		std::string name = m_name, line;
+		m_model = static_cast<WavefrontOBJModel *>(
+			ResourceRegistry::getInstance()->get(key, boost::bind(
+				&WavefrontOBJ::loadModel, this, boost::cref(path), flipTexCoords,
+				shapeIndex, boost::cref(objectToWorld), smooth, maxSmoothAngle)).get());
+		WavefrontOBJModel *model = m_model.get();
+
+		for (size_t i=0; i<model->meshes.size(); ++i) {
+			const TriMesh *prototype = model->meshes[i];
+			TriMesh *mesh = new TriMesh(prototype->getName(), 0, 0);
+			mesh->shareGeometry(prototype);
+			mesh->incRef();
+			m_meshes.push_back(mesh);
+		}
+		m_materialAssignment = model->materialAssignment;
+
+		/* Materials are created separately for every scene */
+		if (!model->materialLibrary.empty() && loadMaterials) {
+			fs::path materialLibrary = fileResolver->resolve(model->materialLibrary);
+			loadMaterialLibrary(fileResolver, materialLibrary);
+		}
+
+		Log(EInfo, "Done with \"%s\" (took %i ms)", path.filename().string().c_str(), timer->getMilliseconds());
+	}
+
+	/**
+	 * Parse the OBJ file and create the meshes. Normals and tangents are
+	 * computed right away, since the meshes must not be modified once
+	 * they are shared.
+	 */
+	ref<Object> loadModel(const fs::path &path, bool flipTexCoords, int shapeIndex,
+			const Transform &objectToWorld, bool smooth, Float maxSmoothAngle) {
+		ref<WavefrontOBJModel> model = new WavefrontOBJModel();
+		ref<OBJParser> parser = new OBJParser(path);
+		const std::vector<Point> &vertices = parser->getPositions();
+		const std::vector<Normal> &normals = parser->getNormals();
+		std::vector<Point2> &texcoords = parser->getTexcoords();
+		const std::vector<OBJTriangle> &triangles = parser->getFaces();
+		const std::vector<OBJParser::Statement> &statements = parser->getStatements();
+		const OBJTriangle *triangleData = triangles.empty() ? NULL : &triangles[0];
+		std::string name = m_name;
 		std::set<std::string> geomNames;
-		std::vector<Vertex> vertexBuffer;
-		fs::path materialLibrary;
+		VertexWelder welder(vertices.size());
 		int geomIndex = 0;
 		bool nameBeforeGeometry = false;
 		std::string materialName;
+		size_t meshStart = 0;
+
+		if (flipTexCoords) {
+			for (size_t i=0; i<texcoords.size(); ++i)
+				texcoords[i].y = 1-texcoords[i].y;
+		}
 
-		while (is.good() && !is.eof() && fetch_line(is, line)) {
-			std::istringstream iss(line);
-			if (!(iss >> buf))
-				continue;
-
-			if (buf == "v") {
-				/* Parse + transform vertices */
-				Point p;
-				iss >> p.x >> p.y >> p.z;
-				vertices.push_back(p);
-			} else if (buf == "vn") {
-				Normal n;
-				iss >> n.x >> n.y >> n.z;
-				normals.push_back(n);
-			} else if (buf == "g" && !m_collapse) {
+		/* Replay the non-geometric statements against the face list */
+		for (size_t i=0; i<statements.size(); ++i) {
+			const std::string &buf = statements[i].keyword;
+			size_t meshEnd = statements[i].faceIndex;
+
+			if (buf == "g" && !m_collapse) {
 				std::string targetName;
-				std::string newName = trim(line.substr(1, line.length()-1));
+				std::string newName = statements[i].value;
 
 				/* There appear to be two different conventions
 				   for specifying object names in OBJ file -- try
@@ -268,7 +303,7 @@ public:
 				else
 					targetName = newName;
 
-				if (triangles.size() > 0) {
+				if (meshEnd > meshStart) {
 					/// make sure that we have unique names
 					if (geomNames.find(targetName) != geomNames.end())
 						targetName = formatString("%s_%i", targetName.c_str(), geomIndex);
@@ -276,15 +311,16 @@ public:
 					geomNames.insert(targetName);
 					if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
 						createMesh(targetName, vertices, normals, texcoords,
-							triangles, materialName, objectToWorld, vertexBuffer);
-					triangles.clear();
+							triangleData + meshStart, meshEnd - meshStart,
+							materialName, objectToWorld, welder, model);
+					meshStart = meshEnd;
 				} else {
 					nameBeforeGeometry = true;
 				}
 				name = newName;
 			} else if (buf == "usemtl") {
 				/* Flush if necessary */
-				if (triangles.size() > 0 && !m_collapse) {
+				if (meshEnd > meshStart && !m_collapse) {
 					/// make sure that we have unique names
 					if (geomNames.find(name) != geomNames.end())
 						name = formatString("%s_%i", name.c_str(), geomIndex);
@@ -292,35 +328,15 @@ public:
 					geomNames.insert(name);
 					if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
 						createMesh(name, vertices, normals, texcoords,
-							triangles, materialName, objectToWorld, vertexBuffer);
-					triangles.clear();
+							triangleData + meshStart, meshEnd - meshStart,
+							materialName, objectToWorld, welder, model);
+					meshStart = meshEnd;
 					name = m_name;
 				}
 
-				materialName = trim(line.substr(6, line.length()-1));
+				materialName = statements[i].value;
 			} else if (buf == "mtllib") {
-				materialLibrary = fileResolver->resolve(trim(line.substr(6, line.length()-1)));
-			} else if (buf == "vt") {
-				Float u, v;
-				iss >> u >> v;
-				if (flipTexCoords)
-					v = 1-v;
-				texcoords.push_back(Point2(u, v));
-			} else if (buf == "f") {
-				std::string  tmp;
-				OBJTriangle t;
-				iss >> tmp; parse(t, 0, tmp);
-				iss >> tmp; parse(t, 1, tmp);
-				iss >> tmp; parse(t, 2, tmp);
-				triangles.push_back(t);
-				/* Handle n-gons assuming a convex shape */
-				while (iss >> tmp) {
-					t.p[1] = t.p[2];
-					t.uv[1] = t.uv[2];
-					t.n[1] = t.n[2];
-					parse(t, 2, tmp);
-					triangles.push_back(t);
-				}
+				model->materialLibrary = statements[i].value;
 			} else {
 				/* Ignore */
 			}
@@ -331,21 +347,17 @@ public:
 
 		if (shapeIndex < 0 || geomIndex-1 == shapeIndex)
 			createMesh(name, vertices, normals, texcoords,
-				triangles, materialName, objectToWorld, vertexBuffer);
-
-		if (props.hasProperty("maxSmoothAngle")) {
-			if (m_faceNormals)
-				Log(EError, "The properties 'maxSmoothAngle' and 'faceNormals' "
-				"can't be specified at the same time!");
-			Float maxSmoothAngle = props.getFloat("maxSmoothAngle");
-			for (size_t i=0; i<m_meshes.size(); ++i)
-				m_meshes[i]->rebuildTopology(maxSmoothAngle);
+				triangleData + meshStart, triangles.size() - meshStart,
+				materialName, objectToWorld, welder, model);
+
+		for (size_t i=0; i<model->meshes.size(); ++i) {
+			if (smooth)
+				model->meshes[i]->rebuildTopology(maxSmoothAngle);
+			model->meshes[i]->computeNormals();
+			model->meshes[i]->computeUVTangents();
 		}
 
-		if (!materialLibrary.empty() && loadMaterials)
-			loadMaterialLibrary(fileResolver, materialLibrary);
-
-		Log(EInfo, "Done with \"%s\" (took %i ms)", path.filename().string().c_str(), timer->getMilliseconds());
+		return model.get();
 	}
 
 	WavefrontOBJ(Stream *stream, InstanceManager *manager) : Shape(stream, manager) {
@@ -368,27 +380,6 @@ public:
 			manager->serialize(stream, m_meshes[i]);
 	}
 
-	void parse(OBJTriangle &t, int i, const std::string &str) {
-		std::vector<std::string> tokens = tokenize(str, "/");
-		if (tokens.size() == 1) {
-			t.p[i] = atoi(tokens[0].c_str());
-		} else if (tokens.size() == 2) {
-			if (str.find("//") == std::string::npos) {
-				t.p[i]  = atoi(tokens[0].c_str());
-				t.uv[i] = atoi(tokens[1].c_str());
-			} else {
-				t.p[i] = atoi(tokens[0].c_str());
-				t.n[i] = atoi(tokens[1].c_str());
-			}
-		} else if (tokens.size() == 3) {
-			t.p[i] = atoi(tokens[0].c_str());
-			t.uv[i] = atoi(tokens[1].c_str());
-			t.n[i] = atoi(tokens[2].c_str());
-		} else {
-			Log(EError, "Invalid OBJ face format!");
-		}
-	}
-
 	Texture *loadTexture(const FileResolver *fileResolver,
 			std::map<std::string, Texture *> &cache,
 			const fs::path &mtlPath, std::string filename,
@@ -431,11 +422,7 @@ public:
 		}
 
 		Log(EInfo, "Loading OBJ materials from \"%s\" ..", mtlPath.filename().string().c_str());
-		fs::ifstream is(mtlPath);
-		if (is.bad() || is.fail())
-			Log(EError, "Unexpected I/O error while accessing material file '%s'!",
-				mtlPath.string().c_str());
-		std::string buf, line;
+		ref<OBJLexer> lexer = new OBJLexer(mtlPath);
 		std::string mtlName;
 		ref<Texture> specular, diffuse, exponent, bump, mask;
 		int illum = 0;
@@ -444,16 +431,14 @@ public:
 		exponent = new ConstantFloatTexture(0.0f);
 		std::map<std::string, Texture *> cache;
 
-		while (is.good() && !is.eof() && fetch_line(is, line)) {
-			std::istringstream iss(line);
-			if (!(iss >> buf))
-				continue;
+		while (lexer->nextLine()) {
+			OBJLexer::Token buf = lexer->readToken();
 
 			if (buf == "newmtl") {
 				if (mtlName != "")
 					addMaterial(mtlName, diffuse, specular, exponent, bump, mask, illum);
 
-				mtlName = trim(line.substr(6, line.length()-6));
+				mtlName = lexer->readRest();
 
 				specular = new ConstantSpectrumTexture(Spectrum(0.0f));
 				diffuse = new ConstantSpectrumTexture(Spectrum(0.0f));
@@ -463,45 +448,45 @@ public:
 				illum = 0;
 			} else if (buf == "Kd") {
 				Float r, g, b;
-				iss >> r >> g >> b;
+				lexer->readFloat(r);
+				lexer->readFloat(g);
+				lexer->readFloat(b);
 				Spectrum value;
 				value.fromSRGB(r, g, b);
 				diffuse = new ConstantSpectrumTexture(value);
 			} else if (buf == "map_Kd") {
-				std::string filename;
-				iss >> filename;
+				std::string filename = lexer->readToken().str();
 				diffuse = loadTexture(fileResolver, cache, mtlPath, filename);
 			} else if (buf == "Ks") {
 				Float r, g, b;
-				iss >> r >> g >> b;
+				lexer->readFloat(r);
+				lexer->readFloat(g);
+				lexer->readFloat(b);
 				Spectrum value;
 				value.fromSRGB(r, g, b);
 				specular = new ConstantSpectrumTexture(value);
 			} else if (buf == "map_Ks") {
-				std::string filename;
-				iss >> filename;
+				std::string filename = lexer->readToken().str();
 				specular = loadTexture(fileResolver, cache, mtlPath, filename);
 			} else if (buf == "bump") {
-				std::string filename;
-				iss >> filename;
+				std::string filename = lexer->readToken().str();
 				bump = loadTexture(fileResolver, cache, mtlPath, filename, true);
 			} else if (buf == "map_d") {
-				std::string filename;
-				iss >> filename;
+				std::string filename = lexer->readToken().str();
 				mask = loadTexture(fileResolver, cache, mtlPath, filename);
 			} else if (buf == "d" /* || buf == "Tr" */) {
 				Float value;
-				iss >> value;
+				lexer->readFloat(value);
 				if (value == 1)
 					mask = NULL;
 				else
 					mask = new ConstantFloatTexture(value);
 			} else if (buf == "Ns") {
 				Float value;
-				iss >> value;
+				lexer->readFloat(value);
 				exponent = new ConstantFloatTexture(value);
 			} else if (buf == "illum") {
-				iss >> illum;
+				lexer->readInt(illum);
 			} else {
 				/* Ignore */
 			}
@@ -574,144 +559,93 @@ public:
 		addChild(name, bsdf, false);
 	}
 
-	struct Vertex {
-		Point p;
-		Normal n;
-		Point2 uv;
-	};
-
-	/// For using vertices as keys in an associative structure
-	struct vertex_key_order : public
-		std::binary_function<Vertex, Vertex, bool> {
-	public:
-		bool operator()(const Vertex &v1, const Vertex &v2) const {
-			if (v1.p.x < v2.p.x) return true;
-			else if (v1.p.x > v2.p.x) return false;
-			if (v1.p.y < v2.p.y) return true;
-			else if (v1.p.y > v2.p.y) return false;
-			if (v1.p.z < v2.p.z) return true;
-			else if (v1.p.z > v2.p.z) return false;
-			if (v1.n.x < v2.n.x) return true;
-			else if (v1.n.x > v2.n.x) return false;
-			if (v1.n.y < v2.n.y) return true;
-			else if (v1.n.y > v2.n.y) return false;
-			if (v1.n.z < v2.n.z) return true;
-			else if (v1.n.z > v2.n.z) return false;
-			if (v1.uv.x < v2.uv.x) return true;
-			else if (v1.uv.x > v2.uv.x) return false;
-			if (v1.uv.y < v2.uv.y) return true;
-			else if (v1.uv.y > v2.uv.y) return false;
-			return false;
-		}
-	};
-
 	void createMesh(const std::string &name,
 			const std::vector<Point> &vertices,
 			const std::vector<Normal> &normals,
 			const std::vector<Point2> &texcoords,
-			const std::vector<OBJTriangle> &triangles,
+			const OBJTriangle *triangles, size_t triangleCount,
 			const std::string &materialName,
 			const Transform &objectToWorld,
-			std::vector<Vertex> &vertexBuffer) {
-		if (triangles.size() == 0)
+			VertexWelder &welder,
+			WavefrontOBJModel *model) {
+		if (triangleCount == 0)
 			return;
-		typedef std::map<Vertex, uint32_t, vertex_key_order> VertexMapType;
-		VertexMapType vertexMap;
 
-		vertexBuffer.reserve(vertices.size());
-		size_t numMerged = 0;
-		AABB aabb;
 		bool hasTexcoords = false;
 		bool hasNormals = false;
-		ref<Timer> timer = new Timer();
-		vertexBuffer.clear();
+		welder.clear();
 
 		/* Collapse the mesh into a more usable form */
-		Triangle *triangleArray = new Triangle[triangles.size()];
-		for (uint32_t i=0; i<triangles.size(); i++) {
-			Triangle tri;
+		for (size_t i=0; i<triangleCount; i++) {
 			for (uint32_t j=0; j<3; j++) {
 				int vertexId = triangles[i].p[j];
 				int normalId = triangles[i].n[j];
 				int uvId = triangles[i].uv[j];
-				uint32_t key;
-
-				Vertex vertex;
-				if (vertexId < 0)
-					vertexId += (int) vertices.size() + 1;
-				if (normalId < 0)
-					normalId += (int) normals.size() + 1;
-				if (uvId < 0)
-					uvId += (int) texcoords.size() + 1;
 
 				if (vertexId > (int) vertices.size() || vertexId <= 0)
 					Log(EError, "Out of bounds: tried to access vertex %i (max: %i)", vertexId, (int) vertices.size());
 
-				vertex.p = objectToWorld(vertices[vertexId-1]);
-				aabb.expandBy(vertex.p);
-
 				if (normalId != 0) {
 					if (normalId > (int) normals.size() || normalId < 0)
 						Log(EError, "Out of bounds: tried to access normal %i (max: %i)", normalId, (int) normals.size());
-					vertex.n = objectToWorld(normals[normalId-1]);
-					if (!vertex.n.isZero())
-						vertex.n = normalize(vertex.n);
 					hasNormals = true;
-				} else {
-					vertex.n = Normal(0.0f);
 				}
 
 				if (uvId != 0) {
 					if (uvId > (int) texcoords.size() || uvId < 0)
 						Log(EError, "Out of bounds: tried to access uv %i (max: %i)", uvId, (int) texcoords.size());
-					vertex.uv = texcoords[uvId-1];
 					hasTexcoords = true;
-				} else {
-					vertex.uv = Point2(0.0f);
-				}
-
-				VertexMapType::iterator it = vertexMap.find(vertex);
-				if (it != vertexMap.end()) {
-					key = it->second;
-					numMerged++;
-				} else {
-					key = (uint32_t) vertexBuffer.size();
-					vertexMap[vertex] = key;
-					vertexBuffer.push_back(vertex);
 				}
 
-				tri.idx[j] = key;
+				welder.insert(vertexId, uvId, normalId);
 			}
-			triangleArray[i] = tri;
 		}
 
+		size_t vertexCount = welder.getVertexCount();
 		ref<TriMesh> mesh = new TriMesh(name,
-			triangles.size(), vertexBuffer.size(),
+			triangleCount, vertexCount,
 			hasNormals, hasTexcoords, false,
 			m_flipNormals, m_faceNormals);
 
-		std::copy(triangleArray, triangleArray+triangles.size(), mesh->getTriangles());
+		Triangle *target_triangles = mesh->getTriangles();
+		for (size_t i=0; i<triangleCount; i++) {
+			for (uint32_t j=0; j<3; j++)
+				target_triangles[i].idx[j] = welder.find(triangles[i].p[j],
+					triangles[i].uv[j], triangles[i].n[j]);
+		}
 
 		Point    *target_positions = mesh->getVertexPositions();
 		Normal   *target_normals   = mesh->getVertexNormals();
 		Point2   *target_texcoords = mesh->getVertexTexcoords();
+		AABB aabb;
 
-		mesh->getAABB() = aabb;
+		for (size_t i=0; i<vertexCount; i++) {
+			const VertexWelder::Key &key = welder.getKey(i);
+			Point p = objectToWorld(vertices[key.p-1]);
+			aabb.expandBy(p);
+			target_positions[i] = p;
+
+			if (hasNormals) {
+				Normal n(0.0f);
+				if (key.n != 0) {
+					n = objectToWorld(normals[key.n-1]);
+					if (!n.isZero())
+						n = normalize(n);
+				}
+				target_normals[i] = n;
+			}
 
-		for (size_t i=0; i<vertexBuffer.size(); i++) {
-			*target_positions++ = vertexBuffer[i].p;
-			if (hasNormals)
-				*target_normals++ = vertexBuffer[i].n;
 			if (hasTexcoords)
-				*target_texcoords++ = vertexBuffer[i].uv;
+				target_texcoords[i] = key.uv != 0 ? texcoords[key.uv-1] : Point2(0.0f);
 		}
 
-		mesh->incRef();
-		m_materialAssignment.push_back(materialName);
-		m_meshes.push_back(mesh);
+		mesh->getAABB() = aabb;
+
+		model->materialAssignment.push_back(materialName);
+		model->meshes.push_back(mesh);
 		Log(EInfo, "%s: " SIZE_T_FMT " triangles, " SIZE_T_FMT
 			" vertices (merged " SIZE_T_FMT " vertices).", name.c_str(),
-			triangles.size(), vertexBuffer.size(), numMerged);
+			triangleCount, vertexCount, 3*triangleCount - vertexCount);
 	}
 
 	virtual ~WavefrontOBJ() {
@@ -832,12 +766,15 @@ public:
 	MTS_DECLARE_CLASS()
 private:
 	std::vector<TriMesh *> m_meshes;
+	/// Keeps the shared model registered while this shape is alive
+	ref<WavefrontOBJModel> m_model;
 	std::vector<std::string> m_materialAssignment;
 	bool m_flipNormals, m_faceNormals;
 	AABB m_aabb;
 	bool m_collapse;
 };
 
+MTS_IMPLEMENT_CLASS(WavefrontOBJModel, false, Object)
 MTS_IMPLEMENT_CLASS_S(WavefrontOBJ, false, Shape)
 MTS_EXPORT_PLUGIN(WavefrontOBJ, "OBJ triangle mesh loader");
 MTS_NAMESPACE_END
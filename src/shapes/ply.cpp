@@ -21,6 +21,7 @@
 #include <mitsuba/core/properties.h>
 #include <mitsuba/core/fstream.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/resregistry.h>
 #include <ply/ply_parser.hpp>
 
 #if MTS_USE_BOOST_TR1
@@ -94,6 +95,46 @@ public:
 			props.getString("filename"));
 		m_name = filePath.stem().string();
 
+		if (!fs::exists(filePath))
+			Log(EError, "PLY file \"%s\" could not be found!", filePath.string().c_str());
+
+		/* Scenes loaded by the same process share the geometry */
+		std::string key = formatString("ply:%s:%i%i%i:%s:%s",
+			ResourceRegistry::getFileKey(filePath).c_str(),
+			(int) props.getBoolean("srgb", true),
+			(int) props.getBoolean("faceNormals", false),
+			(int) props.getBoolean("flipNormals", false),
+			props.hasProperty("maxSmoothAngle") ? formatString("%a",
+				(double) props.getFloat("maxSmoothAngle")).c_str() : "none",
+			ResourceRegistry::getTransformKey(
+				props.getTransform("toWorld", Transform())).c_str());
+
+		ref<TriMesh> prototype = static_cast<TriMesh *>(
+			ResourceRegistry::getInstance()->get(key, std::tr1::bind(
+				&PLYLoader::loadPrototype, std::tr1::cref(filePath),
+				std::tr1::cref(props))).get());
+
+		shareGeometry(prototype);
+	}
+
+	PLYLoader(Stream *stream, InstanceManager *manager) : TriMesh(stream, manager) { }
+
+	/**
+	 * Load the mesh that is shared by all scenes of the process. Normals
+	 * and tangents are computed right away, since the mesh must not be
+	 * modified once it is shared.
+	 */
+	static ref<Object> loadPrototype(const fs::path &filePath, const Properties &props) {
+		ref<PLYLoader> mesh = new PLYLoader(filePath, props);
+		mesh->computeNormals();
+		mesh->computeUVTangents();
+		return mesh.get();
+	}
+
+	/// Load and transform the geometry
+	PLYLoader(const fs::path &filePath, const Properties &props) : TriMesh(props) {
+		m_name = filePath.stem().string();
+
 		/* Determines whether vertex colors should be
 		   treated as linear RGB or sRGB. */
 		m_sRGB = props.getBoolean("srgb", true);
@@ -137,9 +178,6 @@ public:
 		}
 	}
 
-
-	PLYLoader(Stream *stream, InstanceManager *manager) : TriMesh(stream, manager) { }
-
 	void loadPLY(const fs::path &path);
 
 	void info_callback(const std::string& filename, std::size_t line_number,
@@ -22,8 +22,10 @@
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/lrucache.h>
+#include <mitsuba/core/resregistry.h>
 
 #include <boost/make_shared.hpp>
+#include <boost/bind.hpp>
 
 /// How many files to keep open in the cache, per thread
 #define MTS_SERIALIZED_CACHE_SIZE 4
@@ -149,6 +151,46 @@ public:
 		fs::path filePath = Thread::getThread()->getFileResolver()->resolve(
 			props.getString("filename"));
 
+		/* Scenes loaded by the same process share the geometry */
+		std::string key = formatString("serialized:%s:%i:%i%i:%s:%s",
+			ResourceRegistry::getFileKey(filePath).c_str(),
+			props.getInteger("shapeIndex", 0),
+			(int) props.getBoolean("faceNormals", false),
+			(int) props.getBoolean("flipNormals", false),
+			props.hasProperty("maxSmoothAngle") ? formatString("%a",
+				(double) props.getFloat("maxSmoothAngle")).c_str() : "none",
+			ResourceRegistry::getTransformKey(
+				props.getTransform("toWorld", Transform())).c_str());
+
+		ref<TriMesh> prototype = static_cast<TriMesh *>(
+			ResourceRegistry::getInstance()->get(key, boost::bind(
+				&SerializedMesh::loadPrototype, boost::cref(filePath),
+				boost::cref(props))).get());
+
+		m_name = prototype->getName();
+		shareGeometry(prototype);
+	}
+
+	SerializedMesh(Stream *stream, InstanceManager *manager)
+		: TriMesh(stream, manager) { }
+
+	MTS_DECLARE_CLASS()
+
+private:
+	/**
+	 * Load the mesh that is shared by all scenes of the process. Normals
+	 * and tangents are computed right away, since the mesh must not be
+	 * modified once it is shared.
+	 */
+	static ref<Object> loadPrototype(const fs::path &filePath, const Properties &props) {
+		ref<SerializedMesh> mesh = new SerializedMesh(filePath, props);
+		mesh->computeNormals();
+		mesh->computeUVTangents();
+		return mesh.get();
+	}
+
+	/// Load and transform the geometry
+	SerializedMesh(const fs::path &filePath, const Properties &props) : TriMesh(props) {
 		/* Object-space -> World-space transformation */
 		Transform objectToWorld = props.getTransform("toWorld", Transform());
 
@@ -209,13 +251,6 @@ public:
 		}
 	}
 
-	SerializedMesh(Stream *stream, InstanceManager *manager)
-		: TriMesh(stream, manager) { }
-
-	MTS_DECLARE_CLASS()
-
-private:
-
 	/**
 	 * Helper class for loading serialized meshes from the same file
 	 * repeatedly: it is common for scene to load multiple meshes from the same
@@ -17,6 +17,9 @@
 */
 
 #include "shapegroup.h"
+#include <mitsuba/render/trimesh.h>
+#include <mitsuba/core/resregistry.h>
+#include <boost/bind.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -68,37 +71,99 @@ MTS_NAMESPACE_BEGIN
  *     </transform>
  * </shape>
  * \end{xml}
+ *
+ * The same approach applies to models loaded by the \pluginref{obj} and
+ * \pluginref{shapenet} plugins: placing one in a shape group and
+ * referencing it using many instances (with different transformations
+ * and, optionally, materials) keeps the memory usage independent of
+ * the number of copies. Since the geometry of these plugins is shared
+ * between all scenes loaded by the same process, the kd-tree of a shape
+ * group that only contains such meshes is shared as well and only
+ * built once (e.g. when rendering multiple scenes using
+ * \code{mitsuba -j}).
  */
 
 ShapeGroup::ShapeGroup(const Properties &props) : Shape(props) {
-	m_kdtree = new ShapeKDTree();
 }
 
 ShapeGroup::ShapeGroup(Stream *stream, InstanceManager *manager)
 	: Shape(stream, manager) {
-	m_kdtree = new ShapeKDTree();
 	size_t shapeCount = stream->readSize();
-	for (size_t i=0; i<shapeCount; ++i)
-		m_kdtree->addShape(static_cast<Shape *>(manager->getInstance(stream)));
+	for (size_t i=0; i<shapeCount; ++i) {
+		Shape *shape = static_cast<Shape *>(manager->getInstance(stream));
+		shape->incRef();
+		m_shapes.push_back(shape);
+	}
 	configure();
 }
 
+ShapeGroup::~ShapeGroup() {
+	for (size_t i=0; i<m_shapes.size(); ++i)
+		m_shapes[i]->decRef();
+}
+
 void ShapeGroup::serialize(Stream *stream, InstanceManager *manager) const {
 	Shape::serialize(stream, manager);
-	const std::vector<const Shape *> &shapes = m_kdtree->getShapes();
-	stream->writeSize(shapes.size());
-	for (size_t i=0; i<shapes.size(); ++i)
-		manager->serialize(stream, shapes[i]);
+	stream->writeSize(m_shapes.size());
+	for (size_t i=0; i<m_shapes.size(); ++i)
+		manager->serialize(stream, m_shapes[i]);
 }
 
 void ShapeGroup::configure() {
+	if (m_kdtree)
+		return;
+
+	std::string key = getResourceKey();
+	if (!key.empty())
+		m_kdtree = static_cast<ShapeKDTree *>(ResourceRegistry::getInstance()->get(
+			key, boost::bind(&ShapeGroup::buildKDTree, this, true)).get());
+	else
+		m_kdtree = static_cast<ShapeKDTree *>(buildKDTree(false).get());
+}
+
+std::string ShapeGroup::getResourceKey() const {
+	if (m_shapes.empty())
+		return "";
+
+	/* Meshes that reference registered geometry (e.g. from the 'obj' and
+	   'shapenet' plugins) are identified by the mesh owning their buffers.
+	   A shared kd-tree holds references to these owners, hence their
+	   addresses cannot be reused while the key is registered */
+	std::ostringstream oss;
+	oss << "shapegroup";
+	for (size_t i=0; i<m_shapes.size(); ++i) {
+		const Shape *shape = m_shapes[i];
+		if (!shape->getClass()->derivesFrom(MTS_CLASS(TriMesh)))
+			return "";
+		const TriMesh *mesh = static_cast<const TriMesh *>(shape);
+		if (!mesh->isGeometryShared())
+			return "";
+		oss << ":" << mesh->getGeometrySource();
+	}
+	return oss.str();
+}
+
+ref<Object> ShapeGroup::buildKDTree(bool geometryOnly) const {
+	ref<ShapeKDTree> kdtree = new ShapeKDTree();
+
 	/* Don't bother showing debug messages if the number
 	   of triangles is low. This helps loading scenes exported
 	   from SketchUp which create hundreds of tiny shape groups */
-	if (m_kdtree->getPrimitiveCount() < 100*1024)
-		m_kdtree->setLogLevel(ETrace);
-	if (!m_kdtree->isBuilt())
-		m_kdtree->build();
+	if (getPrimitiveCount() < 100*1024)
+		kdtree->setLogLevel(ETrace);
+
+	for (size_t i=0; i<m_shapes.size(); ++i) {
+		if (geometryOnly) {
+			const TriMesh *source = static_cast<const TriMesh *>(m_shapes[i]);
+			ref<TriMesh> mesh = new TriMesh(source->getName(), 0, 0);
+			mesh->shareGeometry(source);
+			kdtree->addShape(mesh);
+		} else {
+			kdtree->addShape(m_shapes[i]);
+		}
+	}
+	kdtree->build();
+	return kdtree.get();
 }
 
 AABB ShapeGroup::getAABB() const {
@@ -130,7 +195,8 @@ void ShapeGroup::addChild(const std::string &name, ConfigurableObject *child) {
 				addChild(element);
 			} while (true);
 		} else {
-			m_kdtree->addShape(shape);
+			shape->incRef();
+			m_shapes.push_back(shape);
 		}
 	} else {
 		Shape::addChild(name, child);
@@ -143,10 +209,9 @@ bool ShapeGroup::isCompound() const {
 }
 
 size_t ShapeGroup::getPrimitiveCount() const {
-	const std::vector<const Shape *> &shapes = m_kdtree->getShapes();
 	size_t result = 0;
-	for (size_t i=0; i<shapes.size(); ++i)
-		result += shapes[i]->getPrimitiveCount();
+	for (size_t i=0; i<m_shapes.size(); ++i)
+		result += m_shapes[i]->getPrimitiveCount();
 	return result;
 }
 
@@ -158,7 +223,7 @@ std::string ShapeGroup::toString() const {
 	std::ostringstream oss;
 		oss << "ShapeGroup[" << endl
 			<< "  name = \"" << m_name << "\"," << endl
-			<< "  primCount = " << m_kdtree->getPrimitiveCount() << endl
+			<< "  primCount = " << getPrimitiveCount() << endl
 			<< "]";
 	return oss.str();
 }
@@ -59,9 +59,22 @@ public:
 	/// Returns the surface area
 	Float getSurfaceArea() const;
 
-	/// Return a pointer to the internal KD-tree
+	/**
+	 * \brief Return a pointer to the internal KD-tree
+	 *
+	 * The kd-tree may be shared with identical shape groups of other
+	 * scenes (see \ref getShapes()).
+	 */
 	inline const ShapeKDTree *getKDTree() const { return m_kdtree.get(); }
 
+	/**
+	 * \brief Return the shapes contained in this group
+	 *
+	 * The i-th entry corresponds to the i-th shape of the kd-tree, which
+	 * may however be a geometry-only copy when the tree is shared.
+	 */
+	inline const std::vector<const Shape *> &getShapes() const { return m_shapes; }
+
 	/// Return the primitive count of the nested shapes
 	size_t getPrimitiveCount() const;
 
@@ -72,7 +85,26 @@ public:
 	std::string toString() const;
 
 	MTS_DECLARE_CLASS()
+protected:
+	/// Virtual destructor
+	virtual ~ShapeGroup();
+
+	/**
+	 * \brief Return the key, under which the kd-tree is shared with
+	 * other scenes, or an empty string if it cannot be shared
+	 */
+	std::string getResourceKey() const;
+
+	/**
+	 * \brief Build a kd-tree over the contained shapes
+	 *
+	 * When \c geometryOnly is \c true, the tree references copies of the
+	 * meshes without any attached materials, so that it does not keep
+	 * resources of this scene alive once it is shared.
+	 */
+	ref<Object> buildKDTree(bool geometryOnly) const;
 private:
+	std::vector<const Shape *> m_shapes;
 	ref<ShapeKDTree> m_kdtree;
 };
 
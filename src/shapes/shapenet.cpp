@@ -17,19 +17,49 @@ along with this program. If not, see <http://www.gnu.org/licenses/>.
 */
 
 #include <mitsuba/render/trimesh.h>
+#include <mitsuba/render/objparser.h>
+#include <mitsuba/render/vertexwelder.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/timer.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/resregistry.h>
 #include <mitsuba/render/emitter.h>
 #include <mitsuba/render/bsdf.h>
 #include <mitsuba/render/subsurface.h>
 #include <mitsuba/render/medium.h>
 #include <mitsuba/render/sensor.h>
 #include <mitsuba/hw/basicshader.h>
+#include <boost/unordered_map.hpp>
+#include <boost/bind.hpp>
 #include <set>
 
+/// Version of the cache files written by the ShapeNet loader
+#define MTS_SHAPENET_CACHE_VERSION 0x01
+
 MTS_NAMESPACE_BEGIN
 
+/**
+ * Meshes of a ShapeNet model, which are shared by all scenes of the
+ * process that load the same file with the same parameters
+ */
+class ShapeNetModel : public Object {
+public:
+	/// Front and back material name of a mesh
+	typedef std::pair<std::string, std::string> MaterialPair;
+
+	/// Meshes without materials (must not be modified)
+	std::vector<ref<TriMesh> > meshes;
+	/// Material names of each mesh
+	std::vector<MaterialPair> meshMaterials;
+	/// Material libraries referenced by the OBJ file
+	std::vector<std::string> materialLibraries;
+
+	MTS_DECLARE_CLASS()
+protected:
+	virtual ~ShapeNetModel() { }
+};
 
 class ShapeNetOBJ : public Shape {
 public:
@@ -38,18 +68,18 @@ public:
 		int n[3];
 		int uv[3];
 
-		std::string mtl[2];
+		/// Interned material IDs of the front and back side
+		uint32_t mtl[2];
 
 		ShapeNetTriangle() {
 			p[0] = p[1] = p[2] = 0;
 			n[0] = n[1] = n[2] = 0;
 			uv[0] = uv[1] = uv[2] = 0;
-			mtl[0] = "";
-			mtl[1] = "";
+			mtl[0] = mtl[1] = 0;
 		}
 
 		// determine whether the same face
-		bool operator==(const ShapeNetTriangle& tri)
+		bool operator==(const ShapeNetTriangle& tri) const
 		{
 			return (p[0] == tri.p[0] || p[0] == tri.p[1] || p[0] == tri.p[2]) &&
 					(p[1] == tri.p[0] || p[1] == tri.p[1] || p[1] == tri.p[2]) &&
@@ -67,99 +97,190 @@ public:
 
 	std::vector<ShapeNetTriangle> m_triPool;
 
-	bool isGoodUV(int uv[3])
+	bool isGoodUV(const int uv[3])
 	{
 		return uv[0] != uv[1] && uv[1] != uv[2] && uv[0] != uv[2] &&
 			uv[0] && uv[1] && uv[2];
 	}
 
-	bool checkAndAddTriangle(std::vector<ShapeNetTriangle>& triangles, ShapeNetTriangle& t)
-	{
-		bool find = false;
+	/// Key of a face in the double-face index: its sorted vertex-index triple
+	struct FaceKey {
+		int p[3];
+
+		FaceKey(const int idx[3]) {
+			p[0] = idx[0]; p[1] = idx[1]; p[2] = idx[2];
+			if (p[0] > p[1]) std::swap(p[0], p[1]);
+			if (p[1] > p[2]) std::swap(p[1], p[2]);
+			if (p[0] > p[1]) std::swap(p[0], p[1]);
+		}
+
+		inline bool operator==(const FaceKey &key) const {
+			return p[0] == key.p[0] && p[1] == key.p[1] && p[2] == key.p[2];
+		}
+
+		inline bool isDegenerate() const {
+			return p[0] == p[1] || p[1] == p[2];
+		}
+
+		friend std::size_t hash_value(const FaceKey &key) {
+			std::size_t seed = 0;
+			boost::hash_combine(seed, key.p[0]);
+			boost::hash_combine(seed, key.p[1]);
+			boost::hash_combine(seed, key.p[2]);
+			return seed;
+		}
+	};
 
-		for (ShapeNetTriangle& tri : triangles)
+	/// Maps a face to the index of the first triangle sharing its vertices
+	typedef boost::unordered_map<FaceKey, size_t> FaceIndex;
+
+	void resolveDoubleFace(ShapeNetTriangle &tri, const ShapeNetTriangle &t,
+		const std::vector<std::string> &materialNames)
+	{
+		if (isGoodUV(t.uv) && !isGoodUV(tri.uv))
 		{
-			if (tri == t)
-			{
-				// double face exists
-				find = true;
-
-				if (isGoodUV(t.uv) && !isGoodUV(tri.uv))
-				{
-					// sometimes double-sided face contains bad tex coords
-					std::string temp = tri.mtl[0];
-					tri = t;
-					tri.mtl[1] = temp;
-				}
-				else
-				{
-					tri.mtl[1] = t.mtl[0];
-				}
+			// sometimes double-sided face contains bad tex coords
+			uint32_t temp = tri.mtl[0];
+			tri = t;
+			tri.mtl[1] = temp;
+		}
+		else
+		{
+			tri.mtl[1] = t.mtl[0];
+		}
 
-				// well, flip face based on material name sorting
-				if (tri.mtl[1].compare(tri.mtl[0]) < 0)
-					tri.flip();
+		// well, flip face based on material name sorting
+		if (materialNames[tri.mtl[1]].compare(materialNames[tri.mtl[0]]) < 0)
+			tri.flip();
+	}
 
+	bool checkAndAddTriangle(std::vector<ShapeNetTriangle>& triangles,
+		FaceIndex &faceIndex, std::vector<size_t> &degenerate, ShapeNetTriangle& t,
+		const std::vector<std::string> &materialNames)
+	{
+		FaceKey key(t.p);
+		size_t match = (size_t) -1;
+
+		/* A triangle with three distinct vertices never changes its vertex set,
+		   hence the index holds the first one over each set */
+		if (!key.isDegenerate()) {
+			FaceIndex::const_iterator it = faceIndex.find(key);
+			if (it != faceIndex.end())
+				match = it->second;
+		}
+
+		/* Triangles with repeated vertices match any face containing their
+		   vertices. They are rare and are simply scanned in order */
+		std::vector<size_t>::iterator dit = degenerate.begin();
+		for (; dit != degenerate.end() && *dit < match; ++dit) {
+			if (triangles[*dit] == t) {
+				match = *dit;
 				break;
 			}
 		}
 
-		if (!find)
+		if (match == (size_t) -1)
 		{
+			if (key.isDegenerate())
+				degenerate.push_back(triangles.size());
+			else
+				faceIndex[key] = triangles.size();
 			triangles.push_back(t);
+			return true;
 		}
-		return !find;
-	}
 
-	// group triangles by double-sided material
-	typedef std::map<std::string, std::map<std::string, std::vector<ShapeNetTriangle> > > TriGroup;
+		// double face exists
+		ShapeNetTriangle &tri = triangles[match];
+		resolveDoubleFace(tri, t, materialNames);
 
-	TriGroup groupTriByMtl(std::vector<ShapeNetTriangle> triangles)
-	{
-		TriGroup group;
+		if (dit != degenerate.end() && *dit == match && !FaceKey(tri.p).isDegenerate()) {
+			/* The degenerate triangle was replaced by a proper one, which
+			   now precedes any other triangle over the same vertex set */
+			degenerate.erase(dit);
+			faceIndex[FaceKey(tri.p)] = match;
+		}
+		return false;
+	}
 
-		for (ShapeNetTriangle tri : triangles)
-		{
-			if (group.find(tri.mtl[0]) == group.end())
-			{
-				group[tri.mtl[0]] = std::map<std::string, std::vector<ShapeNetTriangle> >();
-			}
+	/// Orders material IDs by the name they were interned from
+	struct MaterialNameOrder {
+		const std::vector<std::string> &names;
 
-			if (group[tri.mtl[0]].find(tri.mtl[1]) == group[tri.mtl[0]].end())
-			{
-				group[tri.mtl[0]][tri.mtl[1]] = std::vector<ShapeNetTriangle>();
-			}
-			group[tri.mtl[0]][tri.mtl[1]].push_back(tri);
+		MaterialNameOrder(const std::vector<std::string> &names) : names(names) { }
+
+		bool operator()(uint32_t a, uint32_t b) const {
+			return names[a] < names[b];
 		}
+	};
+
+	/// Range of triangles sharing the same pair of materials
+	struct TriGroup {
+		uint32_t mtl[2];
+		size_t start, end;
+	};
 
-		return group;
+	/**
+	 * Stable counting sort of the triangle indices in \c input by the
+	 * rank of the material on the given side
+	 */
+	static void sortByMaterial(const std::vector<ShapeNetTriangle> &triangles,
+		const std::vector<uint32_t> &rank, int side,
+		const std::vector<uint32_t> &input, std::vector<uint32_t> &output)
+	{
+		std::vector<size_t> offset(rank.size() + 1, 0);
+		for (size_t i = 0; i < input.size(); ++i)
+			offset[rank[triangles[input[i]].mtl[side]] + 1]++;
+		for (size_t i = 1; i < offset.size(); ++i)
+			offset[i] += offset[i - 1];
+
+		output.resize(input.size());
+		for (size_t i = 0; i < input.size(); ++i)
+			output[offset[rank[triangles[input[i]].mtl[side]]]++] = input[i];
 	}
 
-	bool fetch_line(std::istream &is, std::string &line) {
-		/// Fetch a line from the stream, while handling line breaks with backslashes
-		if (!std::getline(is, line))
-			return false;
-		if (line == "")
-			return true;
-		int lastCharacter = (int)line.size() - 1;
-		while (lastCharacter >= 0 &&
-			(line[lastCharacter] == '\r' ||
-			line[lastCharacter] == '\n' ||
-			line[lastCharacter] == '\t' ||
-			line[lastCharacter] == ' '))
-			lastCharacter--;
-
-		if (lastCharacter >= 0 && line[lastCharacter] == '\\') {
-			std::string nextLine;
-			fetch_line(is, nextLine);
-			line = line.substr(0, lastCharacter) + nextLine;
-		}
-		else {
-			line.resize(lastCharacter + 1);
+	/**
+	 * Group triangles by double-sided material. Groups are ordered by the
+	 * names of the front and back material, and triangles keep their file
+	 * order within a group. \c order receives the permuted triangle indices.
+	 */
+	void groupTriByMtl(const std::vector<ShapeNetTriangle> &triangles,
+		const std::vector<std::string> &materialNames,
+		std::vector<uint32_t> &order, std::vector<TriGroup> &groups)
+	{
+		/* Rank the (few) materials by name */
+		std::vector<uint32_t> sorted(materialNames.size()), rank(materialNames.size());
+		for (size_t i = 0; i < sorted.size(); ++i)
+			sorted[i] = (uint32_t) i;
+		std::sort(sorted.begin(), sorted.end(), MaterialNameOrder(materialNames));
+		for (size_t i = 0; i < sorted.size(); ++i)
+			rank[sorted[i]] = (uint32_t) i;
+
+		/* Two-pass LSD radix sort: back side first, then front side */
+		std::vector<uint32_t> identity(triangles.size());
+		for (size_t i = 0; i < identity.size(); ++i)
+			identity[i] = (uint32_t) i;
+		std::vector<uint32_t> temp;
+		sortByMaterial(triangles, rank, 1, identity, temp);
+		std::vector<uint32_t>().swap(identity);
+		sortByMaterial(triangles, rank, 0, temp, order);
+
+		groups.clear();
+		for (size_t i = 0; i < order.size(); ++i) {
+			const ShapeNetTriangle &tri = triangles[order[i]];
+			if (groups.empty() || groups.back().mtl[0] != tri.mtl[0]
+					|| groups.back().mtl[1] != tri.mtl[1]) {
+				TriGroup group;
+				group.mtl[0] = tri.mtl[0];
+				group.mtl[1] = tri.mtl[1];
+				group.start = i;
+				groups.push_back(group);
+			}
+			groups.back().end = i + 1;
 		}
-		return true;
 	}
 
+	typedef ShapeNetModel::MaterialPair MaterialPair;
+
 	ShapeNetOBJ(const Properties &props) : Shape(props) {
 		ref<FileResolver> fileResolver = Thread::getThread()->getFileResolver()->clone();
 		fs::path path = fileResolver->resolve(props.getString("filename"));
@@ -172,109 +293,167 @@ public:
 
 		/* Load the geometry */
 		Log(EInfo, "Loading geometry from \"%s\" ..", path.filename().string().c_str());
-		fs::ifstream is(path);
-		if (is.bad() || is.fail())
+		if (!fs::exists(path))
 			Log(EError, "ShapeNet OBJ file '%s' not found!", path.string().c_str());
 
 		fileResolver->prependPath(fs::absolute(path).parent_path());
 
+		/* Resolved meshes are cached in a file next to the model */
+		bool useCache = props.getBoolean("cache", true);
+		boost::system::error_code ec;
+		uint64_t timestamp = (uint64_t) fs::last_write_time(path, ec);
+		if (ec.value())
+			useCache = false;
+
+		fs::path cacheFile = path;
+		cacheFile.replace_extension(".sncache");
+
+		/* Scenes loaded by the same process share the geometry */
+		std::string key = formatString("shapenet:%s:%a:%s",
+			ResourceRegistry::getFileKey(path).c_str(), (double) maxSmoothAngle,
+			ResourceRegistry::getTransformKey(objectToWorld).c_str());
+
 		ref<Timer> timer = new Timer();
-		std::string buf, line;
-		std::vector<Point> vertices;
-		std::vector<Normal> normals;
-		std::vector<Point2> texcoords;
-		std::vector<ShapeNetTriangle> triangles;
-		std::vector<Vertex> vertexBuffer;
+		m_model = static_cast<ShapeNetModel *>(
+			ResourceRegistry::getInstance()->get(key, boost::bind(
+				&ShapeNetOBJ::loadModel, this, boost::cref(path), boost::cref(cacheFile),
+				useCache, timestamp, maxSmoothAngle, boost::cref(objectToWorld))).get());
+		ShapeNetModel *model = m_model.get();
+
+		/* Materials are created separately for every scene */
+		for (size_t i = 0; i < model->materialLibraries.size(); ++i) {
+			fs::path materialLibrary = fileResolver->resolve(model->materialLibraries[i]);
+			if (!materialLibrary.empty())
+				loadMaterialLibrary(fileResolver, materialLibrary);
+		}
 
-		std::string materialName;
+		for (size_t i = 0; i < model->meshes.size(); ++i) {
+			const TriMesh *prototype = model->meshes[i];
+			ref<TriMesh> mesh = new TriMesh(prototype->getName(), 0, 0);
+			mesh->shareGeometry(prototype);
+
+			std::string name;
+			ref<BSDF> bsdf = getMaterial(model->meshMaterials[i].first,
+				model->meshMaterials[i].second, name);
+			/* Material groups are numbered like the mesh names in createMesh0() */
+			mesh->setPartID((int) i + 1);
+			mesh->incRef();
+			m_meshes.push_back(mesh);
+			mesh->addChild(name, bsdf);
+		}
 
-		while (is.good() && !is.eof() && fetch_line(is, line)) {
-			std::istringstream iss(line);
-			if (!(iss >> buf))
-				continue;
+		Log(EInfo, "Done with \"%s\" (took %i ms)", path.filename().string().c_str(), timer->getMilliseconds());
+	}
 
-			if (buf == "v") {
-				/* Parse + transform vertices */
-				Point p;
-				iss >> p.x >> p.y >> p.z;
-				vertices.push_back(p);
-			}
-			else if (buf == "vn") {
-				Normal n;
-				iss >> n.x >> n.y >> n.z;
-				normals.push_back(n);
-			}
-			else if (buf == "mtllib") {
+	/**
+	 * Load the meshes of the model from the cache file, or by parsing
+	 * the OBJ file. Normals and tangents are computed right away, since
+	 * the meshes must not be modified once they are shared.
+	 */
+	ref<Object> loadModel(const fs::path &path, const fs::path &cacheFile,
+		bool useCache, uint64_t timestamp, Float maxSmoothAngle,
+		const Transform &objectToWorld)
+	{
+		ref<ShapeNetModel> model = new ShapeNetModel();
 
-				fs::path materialLibrary = fileResolver->resolve(trim(line.substr(6, line.length() - 1)));
+		if (!useCache || !loadCache(cacheFile, timestamp, maxSmoothAngle,
+				objectToWorld, model)) {
+			loadOBJ(path, objectToWorld, maxSmoothAngle, model);
 
-				// we load material library from .mtl file first
-				if (!materialLibrary.empty())
-					loadMaterialLibrary(fileResolver, materialLibrary);
-			}
-			else if (buf == "vt") {
-				Float u, v;
-				iss >> u >> v;
-				// fix texture orientation
-				v = -v;
-				texcoords.push_back(Point2(u, v));
-			}
-			else if (buf == "f") {
-				std::string  tmp;
+			if (useCache)
+				writeCache(cacheFile, timestamp, maxSmoothAngle, objectToWorld, model);
+		}
+
+		for (size_t i = 0; i < model->meshes.size(); ++i) {
+			model->meshes[i]->computeNormals();
+			model->meshes[i]->computeUVTangents();
+		}
+
+		return model.get();
+	}
+
+	/// Parse the OBJ file and create the meshes
+	void loadOBJ(const fs::path &path, const Transform &objectToWorld,
+		Float maxSmoothAngle, ShapeNetModel *model)
+	{
+		ref<OBJParser> parser = new OBJParser(path);
+		const std::vector<Point> &vertices = parser->getPositions();
+		const std::vector<Normal> &normals = parser->getNormals();
+		std::vector<Point2> &texcoords = parser->getTexcoords();
+		const std::vector<OBJParser::Face> &faces = parser->getFaces();
+		const std::vector<OBJParser::Statement> &statements = parser->getStatements();
+		std::vector<ShapeNetTriangle> triangles;
+		FaceIndex faceIndex;
+		std::vector<size_t> degenerateFaces;
+
+		/* Material names are interned, triangles only store their IDs */
+		std::vector<std::string> materialNames;
+		boost::unordered_map<std::string, uint32_t> materialIDs;
+		materialNames.push_back("");
+		materialIDs[""] = 0;
+		uint32_t materialID = 0;
+		size_t face = 0;
+
+		// fix texture orientation
+		for (size_t i = 0; i < texcoords.size(); ++i)
+			texcoords[i].y = -texcoords[i].y;
+
+		/* Replay the non-geometric statements against the face list */
+		for (size_t i = 0; i <= statements.size(); ++i) {
+			size_t faceEnd = i < statements.size() ? statements[i].faceIndex : faces.size();
+
+			for (; face < faceEnd; ++face) {
 				ShapeNetTriangle t;
 
-				t.mtl[0] = materialName;
-				t.mtl[1] = materialName;
+				for (int j = 0; j < 3; ++j) {
+					t.p[j] = faces[face].p[j];
+					t.uv[j] = faces[face].uv[j];
+					t.n[j] = faces[face].n[j];
+				}
 
-				iss >> tmp; parse(t, 0, tmp);
-				iss >> tmp; parse(t, 1, tmp);
-				iss >> tmp; parse(t, 2, tmp);
+				t.mtl[0] = materialID;
+				t.mtl[1] = materialID;
 
 				// check double face here
 				//triangles.push_back(t);
-				checkAndAddTriangle(triangles, t);
-				/* Handle n-gons assuming a convex shape */
-				while (iss >> tmp) {
-					t.p[1] = t.p[2];
-					t.uv[1] = t.uv[2];
-					t.n[1] = t.n[2];
-					parse(t, 2, tmp);
-
-					// check double face here
-					//triangles.push_back(t);
-					checkAndAddTriangle(triangles, t);
-				}
+				checkAndAddTriangle(triangles, faceIndex, degenerateFaces, t, materialNames);
 			}
-			if (buf == "usemtl")
-			{
-				materialName = trim(line.substr(6, line.length() - 1));
-			}
-			else if (buf == "o") {
-				std::string objName = trim(line.substr(1, line.length() - 1));
-			}
-			else if (buf == "g") {
-				std::string groupName = trim(line.substr(1, line.length() - 1));
+
+			if (i == statements.size())
+				break;
+
+			const std::string &buf = statements[i].keyword;
+
+			if (buf == "mtllib") {
+				/* Material libraries are loaded by every scene */
+				model->materialLibraries.push_back(statements[i].value);
 			}
-			else if (buf == "s") {
-				std::string smooth = trim(line.substr(1, line.length() - 1));
-				if (smooth == "1")
-				{
-				}
-				else if (smooth == "off")
-				{
+			else if (buf == "usemtl")
+			{
+				const std::string &materialName = statements[i].value;
+				boost::unordered_map<std::string, uint32_t>::iterator it =
+					materialIDs.find(materialName);
+				if (it == materialIDs.end()) {
+					materialID = (uint32_t) materialNames.size();
+					materialIDs[materialName] = materialID;
+					materialNames.push_back(materialName);
+				} else {
+					materialID = it->second;
 				}
 			}
-
 			else {
 				/* Ignore */
 			}
 		}
 
+		/* The face index is no longer needed */
+		FaceIndex().swap(faceIndex);
+
 		if (!triangles.empty())
 		{
 			createMesh0("model",
 				vertices, normals, texcoords,
-				triangles, objectToWorld, vertexBuffer, maxSmoothAngle < 0);
+				triangles, materialNames, objectToWorld, model, maxSmoothAngle < 0);
 
 			triangles.clear();
 		}
@@ -282,12 +461,139 @@ public:
 		// well, we use some smooth here
 		if (maxSmoothAngle > 0)
 		{
-			for (size_t i = 0; i<m_meshes.size(); ++i)
-				m_meshes[i]->rebuildTopology(maxSmoothAngle);
+			for (size_t i = 0; i<model->meshes.size(); ++i)
+				model->meshes[i]->rebuildTopology(maxSmoothAngle);
 		}
+	}
 
+	/**
+	 * Load the meshes from a cache file. Returns \c false if the file
+	 * does not exist, or if it was created for a different version of
+	 * the model or with different parameters.
+	 */
+	bool loadCache(const fs::path &cacheFile, uint64_t timestamp,
+		Float maxSmoothAngle, const Transform &objectToWorld, ShapeNetModel *model)
+	{
+		if (!fs::exists(cacheFile))
+			return false;
 
-		Log(EInfo, "Done with \"%s\" (took %i ms)", path.filename().string().c_str(), timer->getMilliseconds());
+		std::vector<std::string> materialLibraries;
+		std::vector<MaterialPair> meshMaterials;
+		std::vector<ref<TriMesh> > meshes;
+
+		try {
+			ref<MemoryMappedFile> mmap = new MemoryMappedFile(cacheFile);
+			uint8_t *data = static_cast<uint8_t *>(mmap->getData());
+			size_t size = mmap->getSize();
+			ref<MemoryStream> stream = new MemoryStream(data, size);
+			stream->setByteOrder(Stream::ELittleEndian);
+
+			char identifier[3];
+			stream->read(identifier, 3);
+			if (identifier[0] != 'S' || identifier[1] != 'N' || identifier[2] != 'C'
+				|| stream->readUInt() != MTS_SHAPENET_CACHE_VERSION
+				|| stream->readUChar() != (uint8_t) sizeof(Float)
+				|| stream->readULong() != timestamp
+				|| stream->readFloat() != maxSmoothAngle
+				|| Matrix4x4(stream) != objectToWorld.getMatrix()) {
+				Log(EInfo, "Cache file \"%s\" is out of date, reloading the model",
+					cacheFile.filename().string().c_str());
+				return false;
+			}
+
+			uint32_t libraryCount = stream->readUInt();
+			for (uint32_t i = 0; i < libraryCount; ++i)
+				materialLibraries.push_back(stream->readString());
+
+			uint32_t meshCount = stream->readUInt();
+			for (uint32_t i = 0; i < meshCount; ++i) {
+				std::string front = stream->readString();
+				std::string back = stream->readString();
+				meshMaterials.push_back(MaterialPair(front, back));
+			}
+
+			/* The meshes use the compressed serialized format, whose
+			   offsets are stored in a dictionary at the end of the file */
+			stream->seek(size - sizeof(uint32_t) - sizeof(uint64_t) * meshCount);
+			for (uint32_t i = 0; i < meshCount; ++i) {
+				size_t offset = stream->readSize();
+				if (offset >= size)
+					Log(EError, "Invalid mesh offset");
+				ref<MemoryStream> meshStream = new MemoryStream(data + offset, size - offset);
+				meshStream->setByteOrder(Stream::ELittleEndian);
+				meshes.push_back(new TriMesh(meshStream, 0));
+			}
+			if (stream->readUInt() != meshCount)
+				Log(EError, "Invalid mesh dictionary");
+		} catch (const std::exception &e) {
+			Log(EWarn, "Unable to read the cache file \"%s\", reloading the model: %s",
+				cacheFile.string().c_str(), e.what());
+			return false;
+		}
+
+		model->materialLibraries.swap(materialLibraries);
+		model->meshMaterials.swap(meshMaterials);
+		model->meshes.swap(meshes);
+
+		Log(EInfo, "Loaded " SIZE_T_FMT " meshes from the cache file \"%s\"",
+			model->meshes.size(), cacheFile.filename().string().c_str());
+		return true;
+	}
+
+	/**
+	 * Write the meshes to a cache file. The file is written under a
+	 * temporary name and renamed afterwards, so that concurrent
+	 * processes never observe a partially written cache.
+	 */
+	void writeCache(const fs::path &cacheFile, uint64_t timestamp,
+		Float maxSmoothAngle, const Transform &objectToWorld,
+		const ShapeNetModel *model) const
+	{
+		const std::vector<std::string> &materialLibraries = model->materialLibraries;
+		const std::vector<MaterialPair> &meshMaterials = model->meshMaterials;
+		const std::vector<ref<TriMesh> > &meshes = model->meshes;
+
+		fs::path tempFile = fs::unique_path(cacheFile.string() + ".%%%%-%%%%");
+
+		try {
+			ref<FileStream> stream = new FileStream(tempFile, FileStream::ETruncReadWrite);
+			stream->setByteOrder(Stream::ELittleEndian);
+
+			stream->write("SNC", 3);
+			stream->writeUInt(MTS_SHAPENET_CACHE_VERSION);
+			stream->writeUChar((uint8_t) sizeof(Float));
+			stream->writeULong(timestamp);
+			stream->writeFloat(maxSmoothAngle);
+			objectToWorld.getMatrix().serialize(stream);
+
+			stream->writeUInt((uint32_t) materialLibraries.size());
+			for (size_t i = 0; i < materialLibraries.size(); ++i)
+				stream->writeString(materialLibraries[i]);
+
+			stream->writeUInt((uint32_t) meshMaterials.size());
+			for (size_t i = 0; i < meshMaterials.size(); ++i) {
+				stream->writeString(meshMaterials[i].first);
+				stream->writeString(meshMaterials[i].second);
+			}
+
+			std::vector<size_t> offsets(meshes.size());
+			for (size_t i = 0; i < meshes.size(); ++i) {
+				offsets[i] = stream->getPos();
+				meshes[i]->serialize(stream);
+			}
+
+			for (size_t i = 0; i < offsets.size(); ++i)
+				stream->writeSize(offsets[i]);
+			stream->writeUInt((uint32_t) offsets.size());
+			stream->close();
+
+			fs::rename(tempFile, cacheFile);
+		} catch (const std::exception &e) {
+			Log(EWarn, "Unable to write the cache file \"%s\": %s",
+				cacheFile.string().c_str(), e.what());
+			boost::system::error_code ec;
+			fs::remove(tempFile, ec);
+		}
 	}
 
 
@@ -311,31 +617,6 @@ public:
 			manager->serialize(stream, m_meshes[i]);
 	}
 
-	void parse(ShapeNetTriangle &t, int i, const std::string &str) {
-		std::vector<std::string> tokens = tokenize(str, "/");
-		if (tokens.size() == 1) {
-			t.p[i] = atoi(tokens[0].c_str());
-		}
-		else if (tokens.size() == 2) {
-			if (str.find("//") == std::string::npos) {
-				t.p[i] = atoi(tokens[0].c_str());
-				t.uv[i] = atoi(tokens[1].c_str());
-			}
-			else {
-				t.p[i] = atoi(tokens[0].c_str());
-				t.n[i] = atoi(tokens[1].c_str());
-			}
-		}
-		else if (tokens.size() == 3) {
-			t.p[i] = atoi(tokens[0].c_str());
-			t.uv[i] = atoi(tokens[1].c_str());
-			t.n[i] = atoi(tokens[2].c_str());
-		}
-		else {
-			Log(EError, "Invalid OBJ face format!");
-		}
-	}
-
 	Texture *loadTexture(const FileResolver *fileResolver,
 		std::map<std::string, Texture *> &cache,
 		const fs::path &mtlPath, std::string filename,
@@ -378,11 +659,7 @@ public:
 		}
 
 		Log(EInfo, "Loading OBJ materials from \"%s\" ..", mtlPath.filename().string().c_str());
-		fs::ifstream is(mtlPath);
-		if (is.bad() || is.fail())
-			Log(EError, "Unexpected I/O error while accessing material file '%s'!",
-			mtlPath.string().c_str());
-		std::string buf, line;
+		ref<OBJLexer> lexer = new OBJLexer(mtlPath);
 		std::string mtlName;
 		ref<Texture> specular, diffuse, exponent, bump, mask;
 		int illum = 0;
@@ -391,16 +668,14 @@ public:
 		exponent = new ConstantFloatTexture(0.0f);
 		std::map<std::string, Texture *> cache;
 
-		while (is.good() && !is.eof() && fetch_line(is, line)) {
-			std::istringstream iss(line);
-			if (!(iss >> buf))
-				continue;
+		while (lexer->nextLine()) {
+			OBJLexer::Token buf = lexer->readToken();
 
 			if (buf == "newmtl") {
 				if (mtlName != "")
 					addMaterial(mtlName, diffuse, specular, exponent, bump, mask, illum);
 
-				mtlName = trim(line.substr(6, line.length() - 6));
+				mtlName = lexer->readRest();
 
 				specular = new ConstantSpectrumTexture(Spectrum(0.0f));
 				diffuse = new ConstantSpectrumTexture(Spectrum(0.0f));
@@ -411,41 +686,41 @@ public:
 			}
 			else if (buf == "Kd") {
 				Float r, g, b;
-				iss >> r >> g >> b;
+				lexer->readFloat(r);
+				lexer->readFloat(g);
+				lexer->readFloat(b);
 				Spectrum value;
 				value.fromSRGB(r, g, b);
 				diffuse = new ConstantSpectrumTexture(value);
 			}
 			else if (buf == "map_Kd") {
-				std::string filename;
-				iss >> filename;
+				std::string filename = lexer->readToken().str();
 				diffuse = loadTexture(fileResolver, cache, mtlPath, filename);
 			}
 			else if (buf == "Ks") {
 				Float r, g, b;
-				iss >> r >> g >> b;
+				lexer->readFloat(r);
+				lexer->readFloat(g);
+				lexer->readFloat(b);
 				Spectrum value;
 				value.fromSRGB(r, g, b);
 				specular = new ConstantSpectrumTexture(value);
 			}
 			else if (buf == "map_Ks") {
-				std::string filename;
-				iss >> filename;
+				std::string filename = lexer->readToken().str();
 				specular = loadTexture(fileResolver, cache, mtlPath, filename);
 			}
 			else if (buf == "bump") {
-				std::string filename;
-				iss >> filename;
+				std::string filename = lexer->readToken().str();
 				bump = loadTexture(fileResolver, cache, mtlPath, filename, true);
 			}
 			else if (buf == "map_d") {
-				std::string filename;
-				iss >> filename;
+				std::string filename = lexer->readToken().str();
 				mask = loadTexture(fileResolver, cache, mtlPath, filename);
 			}
 			else if (buf == "d" /* || buf == "Tr" */) {
 				Float value;
-				iss >> value;
+				lexer->readFloat(value);
 				if (value == 1)
 					mask = NULL;
 				else
@@ -453,11 +728,11 @@ public:
 			}
 			else if (buf == "Ns") {
 				Float value;
-				iss >> value;
+				lexer->readFloat(value);
 				exponent = new ConstantFloatTexture(value);
 			}
 			else if (buf == "illum") {
-				iss >> illum;
+				lexer->readInt(illum);
 			}
 			else {
 				/* Ignore */
@@ -536,153 +811,141 @@ public:
 		m_mtl[name] = bsdf;
 	}
 
-	struct Vertex {
-		Point p;
-		Normal n;
-		Point2 uv;
-	};
-
-	/// For using vertices as keys in an associative structure
-	struct vertex_key_order : public
-		std::binary_function<Vertex, Vertex, bool> {
-	public:
-		bool operator()(const Vertex &v1, const Vertex &v2) const {
-			if (v1.p.x < v2.p.x) return true;
-			else if (v1.p.x > v2.p.x) return false;
-			if (v1.p.y < v2.p.y) return true;
-			else if (v1.p.y > v2.p.y) return false;
-			if (v1.p.z < v2.p.z) return true;
-			else if (v1.p.z > v2.p.z) return false;
-			if (v1.n.x < v2.n.x) return true;
-			else if (v1.n.x > v2.n.x) return false;
-			if (v1.n.y < v2.n.y) return true;
-			else if (v1.n.y > v2.n.y) return false;
-			if (v1.n.z < v2.n.z) return true;
-			else if (v1.n.z > v2.n.z) return false;
-			if (v1.uv.x < v2.uv.x) return true;
-			else if (v1.uv.x > v2.uv.x) return false;
-			if (v1.uv.y < v2.uv.y) return true;
-			else if (v1.uv.y > v2.uv.y) return false;
-			return false;
-		}
-	};
-
 	void createMesh(const std::string &name,
 		const std::vector<Point> &vertices,
 		const std::vector<Normal> &normals,
 		const std::vector<Point2> &texcoords,
 		const std::vector<ShapeNetTriangle> &triangles,
+		const uint32_t *order, size_t triangleCount,
 		const Transform &objectToWorld,
-		std::vector<Vertex> &vertexBuffer,
-		const std::string &mtlName,
-		ref<BSDF>	bsdf,
+		VertexWelder &welder,
+		ShapeNetModel *model,
 		bool faceNormal)
 	{
-		if (triangles.size() == 0)
+		if (triangleCount == 0)
 			return;
-		typedef std::map<Vertex, uint32_t, vertex_key_order> VertexMapType;
-		VertexMapType vertexMap;
 
-		vertexBuffer.reserve(vertices.size());
-		size_t numMerged = 0;
-		AABB aabb;
 		bool hasTexcoords = false;
 		bool hasNormals = false;
-		ref<Timer> timer = new Timer();
-		vertexBuffer.clear();
+		welder.clear();
 
 		/* Collapse the mesh into a more usable form */
-		Triangle *triangleArray = new Triangle[triangles.size()];
-		for (uint32_t i = 0; i<triangles.size(); i++) {
-			Triangle tri;
+		for (size_t i = 0; i<triangleCount; i++) {
+			const ShapeNetTriangle &source = triangles[order[i]];
 			for (uint32_t j = 0; j<3; j++) {
-				int vertexId = triangles[i].p[j];
-				int normalId = triangles[i].n[j];
-				int uvId = triangles[i].uv[j];
-				uint32_t key;
-
-				Vertex vertex;
-				if (vertexId < 0)
-					vertexId += (int)vertices.size() + 1;
-				if (normalId < 0)
-					normalId += (int)normals.size() + 1;
-				if (uvId < 0)
-					uvId += (int)texcoords.size() + 1;
+				int vertexId = source.p[j];
+				int normalId = source.n[j];
+				int uvId = source.uv[j];
 
 				if (vertexId >(int) vertices.size() || vertexId <= 0)
 					Log(EError, "Out of bounds: tried to access vertex %i (max: %i)", vertexId, (int)vertices.size());
 
-				vertex.p = objectToWorld(vertices[vertexId - 1]);
-				aabb.expandBy(vertex.p);
-
 				if (normalId != 0) {
 					if (normalId > (int)normals.size() || normalId < 0)
 						Log(EError, "Out of bounds: tried to access normal %i (max: %i)", normalId, (int)normals.size());
-					vertex.n = objectToWorld(normals[normalId - 1]);
-					if (!vertex.n.isZero())
-						vertex.n = normalize(vertex.n);
 					hasNormals = true;
 				}
-				else {
-					vertex.n = Normal(0.0f);
-				}
 
 				if (uvId != 0) {
 					if (uvId > (int)texcoords.size() || uvId < 0)
 						Log(EError, "Out of bounds: tried to access uv %i (max: %i)", uvId, (int)texcoords.size());
-					vertex.uv = texcoords[uvId - 1];
 					hasTexcoords = true;
 				}
-				else {
-					vertex.uv = Point2(0.0f);
-				}
-
-				VertexMapType::iterator it = vertexMap.find(vertex);
-				if (it != vertexMap.end()) {
-					key = it->second;
-					numMerged++;
-				}
-				else {
-					key = (uint32_t)vertexBuffer.size();
-					vertexMap[vertex] = key;
-					vertexBuffer.push_back(vertex);
-				}
 
-				tri.idx[j] = key;
+				welder.insert(vertexId, uvId, normalId);
 			}
-			triangleArray[i] = tri;
 		}
 
+		size_t vertexCount = welder.getVertexCount();
 		ref<TriMesh> mesh = new TriMesh(name,
-			triangles.size(), vertexBuffer.size(),
+			triangleCount, vertexCount,
 			hasNormals, hasTexcoords, false, false, faceNormal);
 			//m_flipNormals, m_faceNormals);
 
-		std::copy(triangleArray, triangleArray + triangles.size(), mesh->getTriangles());
+		Triangle *target_triangles = mesh->getTriangles();
+		for (size_t i = 0; i<triangleCount; i++) {
+			const ShapeNetTriangle &source = triangles[order[i]];
+			for (uint32_t j = 0; j<3; j++)
+				target_triangles[i].idx[j] = welder.find(source.p[j], source.uv[j], source.n[j]);
+		}
 
 		Point    *target_positions = mesh->getVertexPositions();
 		Normal   *target_normals = mesh->getVertexNormals();
 		Point2   *target_texcoords = mesh->getVertexTexcoords();
+		AABB aabb;
 
-		mesh->getAABB() = aabb;
+		for (size_t i = 0; i<vertexCount; i++) {
+			const VertexWelder::Key &key = welder.getKey(i);
+			Point p = objectToWorld(vertices[key.p - 1]);
+			aabb.expandBy(p);
+			target_positions[i] = p;
+
+			if (hasNormals) {
+				Normal n(0.0f);
+				if (key.n != 0) {
+					n = objectToWorld(normals[key.n - 1]);
+					if (!n.isZero())
+						n = normalize(n);
+				}
+				target_normals[i] = n;
+			}
 
-		for (size_t i = 0; i<vertexBuffer.size(); i++) {
-			*target_positions++ = vertexBuffer[i].p;
-			if (hasNormals)
-				*target_normals++ = vertexBuffer[i].n;
 			if (hasTexcoords)
-				*target_texcoords++ = vertexBuffer[i].uv;
+				target_texcoords[i] = key.uv != 0 ? texcoords[key.uv - 1] : Point2(0.0f);
 		}
 
-		mesh->incRef();
-		m_meshes.push_back(mesh);
+		mesh->getAABB() = aabb;
+
+		model->meshes.push_back(mesh);
 		Log(EInfo, "%s: " SIZE_T_FMT " triangles, " SIZE_T_FMT
 			" vertices (merged " SIZE_T_FMT " vertices).", name.c_str(),
-			triangles.size(), vertexBuffer.size(), numMerged);
+			triangleCount, vertexCount, 3*triangleCount - vertexCount);
+	}
 
-		// apply the bsdf to mesh
-		mesh->addChild(mtlName, bsdf);
+	/**
+	 * Return the BSDF of a mesh with the given front and back material,
+	 * creating a two-sided BSDF if necessary. \c name receives the name
+	 * under which it is registered.
+	 */
+	ref<BSDF> getMaterial(const std::string &name1, const std::string &name2,
+		std::string &name)
+	{
+		ref<BSDF> bsdf1 = m_mtl[name1];
+		ref<BSDF> bsdf2 = m_mtl[name2];
+
+		name = formatString("%s-%s", name1.c_str(), name2.c_str());
 
+		ref<BSDF> bsdf;
+
+		if (bsdf1->hasComponent(BSDF::ETransmission))
+		{
+			bsdf = bsdf1;
+		}
+		else if (bsdf2->hasComponent(BSDF::ETransmission))
+		{
+			bsdf = bsdf2;
+		}
+		else if (m_mtl.find(name) != m_mtl.end())
+		{
+			bsdf = m_mtl[name];
+		}
+		else
+		{
+			// create two-sided bsdf
+			Properties props;
+			props.setPluginName("twosided");
+
+			bsdf = static_cast<BSDF *> (PluginManager::getInstance()->
+				createObject(MTS_CLASS(BSDF), props));
+			bsdf->addChild("side-1", bsdf1);
+			bsdf->addChild("side-2", bsdf2);
+			bsdf->configure();
+			bsdf->setID(name);
+
+			m_mtl[name] = bsdf;
+		}
+
+		return bsdf;
 	}
 
 	void createMesh0(const std::string& targetName,
@@ -690,60 +953,30 @@ public:
 		const std::vector<Normal> &normals,
 		const std::vector<Point2> &texcoords,
 		const std::vector<ShapeNetTriangle> &triangles,
+		const std::vector<std::string> &materialNames,
 		const Transform &objectToWorld,
-		std::vector<Vertex> &vertexBuffer,
+		ShapeNetModel *model,
 		bool faceNormal)
 	{
-		TriGroup group = groupTriByMtl(triangles);
+		std::vector<uint32_t> order;
+		std::vector<TriGroup> groups;
+		groupTriByMtl(triangles, materialNames, order, groups);
 
+		VertexWelder welder(vertices.size());
 		int counter = 1;
 
-		for (auto it1 = group.begin(); it1 != group.end(); ++it1)
+		for (size_t i = 0; i < groups.size(); ++i)
 		{
-			ref<BSDF> bsdf1 = m_mtl[it1->first];
-
-			for (auto it2 = it1->second.begin(); it2 != it1->second.end(); ++it2)
-			{
-				ref<BSDF> bsdf2 = m_mtl[it2->first];
+			const std::string &name1 = materialNames[groups[i].mtl[0]];
+			const std::string &name2 = materialNames[groups[i].mtl[1]];
 
-				std::string name = formatString("%s-%s", it1->first.c_str(), it2->first.c_str());
-
-				ref<BSDF> bsdf;
-
-				if (bsdf1->hasComponent(BSDF::ETransmission))
-				{
-					bsdf = bsdf1;
-				}
-				else if (bsdf2->hasComponent(BSDF::ETransmission))
-				{
-					bsdf = bsdf2;
-				}
-				else if (m_mtl.find(name) != m_mtl.end())
-				{
-					bsdf = m_mtl[name];
-				}
-				else
-				{
-					// create two-sided bsdf
-					Properties props;
-					props.setPluginName("twosided");
-
-					bsdf = static_cast<BSDF *> (PluginManager::getInstance()->
-						createObject(MTS_CLASS(BSDF), props));
-					bsdf->addChild("side-1", bsdf1);
-					bsdf->addChild("side-2", bsdf2);
-					bsdf->configure();
-
-					m_mtl[name] = bsdf;
-				}
-
-				createMesh(formatString("%s-%i", targetName.c_str(), counter),
-					vertices, normals, texcoords,
-					it2->second, objectToWorld, vertexBuffer,
-					name, bsdf, faceNormal);
+			createMesh(formatString("%s-%i", targetName.c_str(), counter),
+				vertices, normals, texcoords,
+				triangles, &order[groups[i].start], groups[i].end - groups[i].start,
+				objectToWorld, welder, model, faceNormal);
 
-				counter++;
-			}
+			model->meshMaterials.push_back(MaterialPair(name1, name2));
+			counter++;
 		}
 	}
 
@@ -877,12 +1110,15 @@ public:
 	MTS_DECLARE_CLASS()
 private:
 	std::vector<TriMesh *> m_meshes;
+	/// Keeps the shared model registered while this shape is alive
+	ref<ShapeNetModel> m_model;
 	AABB m_aabb;
 
 	// store material from .mtl file
 	std::map<std::string, ref<BSDF> > m_mtl;
 };
 
+MTS_IMPLEMENT_CLASS(ShapeNetModel, false, Object)
 MTS_IMPLEMENT_CLASS_S(ShapeNetOBJ, false, Shape)
 MTS_EXPORT_PLUGIN(ShapeNetOBJ, "ShapeNet mesh loader");
 MTS_NAMESPACE_END
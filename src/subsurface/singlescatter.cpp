@@ -1667,6 +1667,9 @@ public:
 				MTS_CLASS(SamplingIntegrator)))
 			Log(EError, "The single scattering pluging requires "
 						"a sampling-based surface integrator!");
+		if (!scene->getKDTree())
+			Log(EError, "The single scattering plugin requires the scene "
+						"to use a kd-tree accelerator (accel=\"kdtree\")!");
 		return true;
 	}
 
@@ -0,0 +1,305 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/timer.h>
+#include <mitsuba/render/testcase.h>
+#include <mitsuba/render/trimesh.h>
+#include <map>
+
+MTS_NAMESPACE_BEGIN
+
+class TestTopology : public TestCase {
+public:
+	MTS_BEGIN_TESTCASE()
+	MTS_DECLARE_TEST(test01_identicalOutput)
+	MTS_DECLARE_TEST(test02_benchmark)
+	MTS_END_TESTCASE()
+
+	/* Reference implementation: the original multimap-based version
+	   of TriMesh::rebuildTopology() */
+	struct Vertex {
+		Point p;
+		Point2 uv;
+		Color3 col;
+		inline Vertex() : p(0.0f), uv(0.0f), col(0.0f) { }
+	};
+
+	struct vertex_key_order : public
+		std::binary_function<Vertex, Vertex, bool> {
+		static int compare(const Vertex &v1, const Vertex &v2) {
+			if (v1.p.x < v2.p.x) return -1;
+			else if (v1.p.x > v2.p.x) return 1;
+			if (v1.p.y < v2.p.y) return -1;
+			else if (v1.p.y > v2.p.y) return 1;
+			if (v1.p.z < v2.p.z) return -1;
+			else if (v1.p.z > v2.p.z) return 1;
+			if (v1.uv.x < v2.uv.x) return -1;
+			else if (v1.uv.x > v2.uv.x) return 1;
+			if (v1.uv.y < v2.uv.y) return -1;
+			else if (v1.uv.y > v2.uv.y) return 1;
+			for (int i=0; i<Color3::dim; ++i) {
+				if (v1.col[i] < v2.col[i]) return -1;
+				else if (v1.col[i] > v2.col[i]) return 1;
+			}
+			return 0;
+		}
+
+		bool operator()(const Vertex &v1, const Vertex &v2) const {
+			return compare(v1, v2) < 0;
+		}
+	};
+
+	struct TopoData {
+		size_t idx;
+		bool clustered;
+		inline TopoData() { }
+		inline TopoData(size_t idx, bool clustered)
+			: idx(idx), clustered(clustered) { }
+	};
+
+	struct Result {
+		std::vector<Point> positions;
+		std::vector<Point2> texcoords;
+		std::vector<Color3> colors;
+		std::vector<Triangle> triangles;
+	};
+
+	void rebuildTopologyReference(const TriMesh *mesh, Float maxAngle, Result &result) {
+		typedef std::multimap<Vertex, TopoData, vertex_key_order> MMap;
+		typedef std::pair<Vertex, TopoData> MPair;
+		const Float dpThresh = std::cos(degToRad(maxAngle));
+		const Triangle *triangles = mesh->getTriangles();
+		const Point *positions = mesh->getVertexPositions();
+		const Point2 *texcoords = mesh->getVertexTexcoords();
+		const Color3 *colors = mesh->getVertexColors();
+		size_t triangleCount = mesh->getTriangleCount();
+
+		MMap vertexToFace;
+		std::vector<Normal> faceNormals(triangleCount);
+		result.triangles.resize(triangleCount);
+
+		for (size_t i=0; i<triangleCount; ++i) {
+			const Triangle &tri = triangles[i];
+			Vertex v;
+			for (int j=0; j<3; ++j) {
+				v.p = positions[tri.idx[j]];
+				if (texcoords)
+					v.uv = texcoords[tri.idx[j]];
+				if (colors)
+					v.col = colors[tri.idx[j]];
+				vertexToFace.insert(MPair(v, TopoData(i, false)));
+			}
+			Point v0 = positions[tri.idx[0]];
+			Point v1 = positions[tri.idx[1]];
+			Point v2 = positions[tri.idx[2]];
+
+			Normal n = cross(v1 - v0, v2 - v0);
+			Float l = n.length();
+			if (l > RCPOVERFLOW_FLT)
+				n /= l;
+			else
+				n = Normal(0.0f);
+
+			faceNormals[i] = Normal(n);
+			for (int j=0; j<3; ++j)
+				result.triangles[i].idx[j] = 0xFFFFFFFFU;
+		}
+
+		for (MMap::iterator it = vertexToFace.begin(); it != vertexToFace.end();) {
+			MMap::iterator start = vertexToFace.lower_bound(it->first);
+			MMap::iterator end = vertexToFace.upper_bound(it->first);
+
+			for (MMap::iterator it2 = start; it2 != end; it2++) {
+				const Vertex &v = it2->first;
+				const TopoData &t1 = it2->second;
+				Normal n1(faceNormals[t1.idx]);
+				if (t1.clustered)
+					continue;
+
+				uint32_t vertexIdx = (uint32_t) result.positions.size();
+				result.positions.push_back(v.p);
+				if (texcoords)
+					result.texcoords.push_back(v.uv);
+				if (colors)
+					result.colors.push_back(v.col);
+
+				for (MMap::iterator it3 = it2; it3 != end; ++it3) {
+					TopoData &t2 = it3->second;
+					if (t2.clustered)
+						continue;
+					Normal n2(faceNormals[t2.idx]);
+
+					if (n1 == n2 || dot(n1, n2) > dpThresh) {
+						const Triangle &tri = triangles[t2.idx];
+						Triangle &newTri = result.triangles[t2.idx];
+						for (int i=0; i<3; ++i) {
+							if (positions[tri.idx[i]] == v.p)
+								newTri.idx[i] = vertexIdx;
+						}
+						t2.clustered = true;
+					}
+				}
+			}
+
+			it = end;
+		}
+	}
+
+	/// Create a copy of a mesh
+	ref<TriMesh> copyMesh(const TriMesh *mesh) {
+		ref<TriMesh> copy = new TriMesh(mesh->getName(), mesh->getTriangleCount(),
+			mesh->getVertexCount(), false, mesh->hasVertexTexcoords(), mesh->hasVertexColors());
+		memcpy(copy->getTriangles(), mesh->getTriangles(), sizeof(Triangle) * mesh->getTriangleCount());
+		memcpy(copy->getVertexPositions(), mesh->getVertexPositions(), sizeof(Point) * mesh->getVertexCount());
+		if (mesh->hasVertexTexcoords())
+			memcpy(copy->getVertexTexcoords(), mesh->getVertexTexcoords(), sizeof(Point2) * mesh->getVertexCount());
+		if (mesh->hasVertexColors())
+			memcpy(copy->getVertexColors(), mesh->getVertexColors(), sizeof(Color3) * mesh->getVertexCount());
+		return copy;
+	}
+
+	/**
+	 * Create a mesh with random connectivity. Positions and attributes
+	 * are quantized so that many of them coincide, and some triangles
+	 * are degenerate.
+	 */
+	ref<TriMesh> createRandomMesh(Random *random, size_t vertexCount,
+			bool texcoords, bool colors) {
+		size_t triangleCount = 3 * vertexCount;
+		ref<TriMesh> mesh = new TriMesh("random", triangleCount, vertexCount,
+			false, texcoords, colors);
+		Point *p = mesh->getVertexPositions();
+		Point2 *uv = mesh->getVertexTexcoords();
+		Color3 *col = mesh->getVertexColors();
+		Triangle *tri = mesh->getTriangles();
+
+		for (size_t i=0; i<vertexCount; ++i) {
+			p[i] = Point(
+				std::floor(random->nextFloat() * 4) / 4,
+				std::floor(random->nextFloat() * 4) / 4,
+				std::floor(random->nextFloat() * 2) / 2);
+			if (random->nextFloat() < 0.1f)
+				p[i].x = -0.0f;
+			if (uv)
+				uv[i] = Point2(std::floor(random->nextFloat() * 2), 0.0f);
+			if (col)
+				col[i] = Color3(std::floor(random->nextFloat() * 2));
+		}
+
+		for (size_t i=0; i<triangleCount; ++i) {
+			for (int j=0; j<3; ++j)
+				tri[i].idx[j] = random->nextUInt((uint32_t) vertexCount);
+			if (random->nextFloat() < 0.05f)
+				tri[i].idx[1] = tri[i].idx[0];
+		}
+		return mesh;
+	}
+
+	/// Create a UV sphere with the given resolution
+	ref<TriMesh> createSphere(int res) {
+		ref<TriMesh> mesh = new TriMesh("sphere", 2*res*res, (res+1)*(res+1), false, true);
+		Point *p = mesh->getVertexPositions();
+		Point2 *uv = mesh->getVertexTexcoords();
+		Triangle *tri = mesh->getTriangles();
+
+		for (int i=0; i<=res; ++i) {
+			for (int j=0; j<=res; ++j) {
+				Float theta = M_PI * i / res, phi = 2 * M_PI * j / res;
+				*p++ = Point(std::sin(theta) * std::cos(phi),
+					std::sin(theta) * std::sin(phi), std::cos(theta));
+				*uv++ = Point2(j / (Float) res, i / (Float) res);
+			}
+		}
+
+		for (int i=0; i<res; ++i) {
+			for (int j=0; j<res; ++j) {
+				uint32_t v00 = i*(res+1) + j, v01 = v00 + 1,
+				         v10 = v00 + res + 1, v11 = v10 + 1;
+				tri->idx[0] = v00; tri->idx[1] = v10; tri->idx[2] = v01; ++tri;
+				tri->idx[0] = v01; tri->idx[1] = v10; tri->idx[2] = v11; ++tri;
+			}
+		}
+		return mesh;
+	}
+
+	bool compare(const TriMesh *mesh, const Result &result) {
+		size_t vertexCount = mesh->getVertexCount();
+		if (vertexCount != result.positions.size())
+			return false;
+		if (memcmp(mesh->getTriangles(), &result.triangles[0],
+				sizeof(Triangle) * result.triangles.size()) != 0)
+			return false;
+		if (memcmp(mesh->getVertexPositions(), &result.positions[0],
+				sizeof(Point) * vertexCount) != 0)
+			return false;
+		if (mesh->hasVertexTexcoords() && memcmp(mesh->getVertexTexcoords(),
+				&result.texcoords[0], sizeof(Point2) * vertexCount) != 0)
+			return false;
+		if (mesh->hasVertexColors() && memcmp(mesh->getVertexColors(),
+				&result.colors[0], sizeof(Color3) * vertexCount) != 0)
+			return false;
+		return true;
+	}
+
+	void test01_identicalOutput() {
+		ref<Random> random = new Random();
+		Float angles[] = { 1, 30, 60, 90 };
+
+		for (int i=0; i<200; ++i) {
+			ref<TriMesh> mesh = createRandomMesh(random, 50 + 3*i, i % 2 == 0, i % 3 == 0);
+			Float angle = angles[i % 4];
+			Result result;
+			rebuildTopologyReference(mesh, angle, result);
+			mesh->rebuildTopology(angle);
+			assertTrue(compare(mesh, result));
+		}
+
+		ref<TriMesh> sphere = createSphere(40);
+		Result result;
+		rebuildTopologyReference(sphere, 30, result);
+		sphere->rebuildTopology(30);
+		assertTrue(compare(sphere, result));
+	}
+
+	void test02_benchmark() {
+		ref<TriMesh> sphere = createSphere(1000);
+		ref<TriMesh> copy = copyMesh(sphere);
+		ref<Timer> timer = new Timer();
+
+		Log(EInfo, "Rebuilding the topology of a mesh with " SIZE_T_FMT " triangles ..",
+			sphere->getTriangleCount());
+
+		Result result;
+		timer->reset();
+		rebuildTopologyReference(sphere, 30, result);
+		unsigned int referenceTime = timer->getMilliseconds();
+		Log(EInfo, "  Multimap-based implementation: %i ms", referenceTime);
+
+		timer->reset();
+		copy->rebuildTopology(30);
+		unsigned int time = timer->getMilliseconds();
+		Log(EInfo, "  TriMesh::rebuildTopology(): %i ms (%.1fx)", time,
+			referenceTime / (Float) std::max(time, 1u));
+
+		assertTrue(compare(copy, result));
+	}
+};
+
+MTS_EXPORT_TESTCASE(TestTopology, "Testcase for TriMesh::rebuildTopology()")
+MTS_NAMESPACE_END
@@ -22,12 +22,14 @@
 #include <mitsuba/core/mstream.h>
 #include <mitsuba/core/plugin.h>
 #include <mitsuba/core/sched.h>
+#include <mitsuba/core/resregistry.h>
 #include <mitsuba/render/texture.h>
 #include <mitsuba/render/mipmap.h>
 #include <mitsuba/hw/renderer.h>
 #include <mitsuba/hw/gputexture.h>
 #include <mitsuba/hw/gpuprogram.h>
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 
 MTS_NAMESPACE_BEGIN
 
@@ -234,14 +236,39 @@ public:
 		if (m_filterType != EEWA)
 			m_maxAnisotropy = 1.0f;
 
+		ref<Object> mipmap;
+		if (bitmap == NULL) {
+			/* Scenes loaded by the same process share the MIP map */
+			std::string key = formatString("bitmap:%s:%s:%i:%i:%i:%a:%a",
+				ResourceRegistry::getFileKey(m_filename).c_str(), m_channel.c_str(),
+				(int) m_filterType, (int) m_wrapModeU, (int) m_wrapModeV,
+				(double) m_gamma, (double) m_maxAnisotropy);
+
+			mipmap = ResourceRegistry::getInstance()->get(key, boost::bind(
+				&BitmapTexture::loadMIPMap, this, (Bitmap *) NULL, boost::cref(cacheFile),
+				tryReuseCache, timestamp, boost::cref(props)));
+		} else {
+			mipmap = loadMIPMap(bitmap, cacheFile, tryReuseCache, timestamp, props);
+		}
+
+		m_mipmap1 = dynamic_cast<MIPMap1 *>(mipmap.get());
+		m_mipmap3 = dynamic_cast<MIPMap3 *>(mipmap.get());
+	}
+
+	/**
+	 * Create the MIP map of a bitmap, or of the file \c m_filename when
+	 * \c bitmap is \c NULL. An existing cache file is reused if possible.
+	 */
+	ref<Object> loadMIPMap(ref<Bitmap> bitmap, const fs::path &cacheFile,
+			bool tryReuseCache, uint64_t timestamp, const Properties &props) const {
 		if (tryReuseCache && MIPMap3::validateCacheFile(cacheFile, timestamp,
 				Bitmap::ERGB, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma)) {
 			/* Reuse an existing MIP map cache file */
-			m_mipmap3 = new MIPMap3(cacheFile, m_maxAnisotropy);
+			return new MIPMap3(cacheFile, m_maxAnisotropy);
 		} else if (tryReuseCache && MIPMap1::validateCacheFile(cacheFile, timestamp,
 				Bitmap::ELuminance, m_wrapModeU, m_wrapModeV, m_filterType, m_gamma)) {
 			/* Reuse an existing MIP map cache file */
-			m_mipmap1 = new MIPMap1(cacheFile, m_maxAnisotropy);
+			return new MIPMap1(cacheFile, m_maxAnisotropy);
 		} else {
 			if (bitmap == NULL) {
 				/* Load the input image if necessary */
@@ -273,7 +300,7 @@ public:
 						break;
 					default:
 						Log(EError, "The input image has an unsupported pixel format!");
-						return;
+						return NULL;
 				}
 			}
 
@@ -291,11 +318,11 @@ public:
 				bitmap->getSize().x * bitmap->getSize().y > 1024*1024);
 
 			if (pixelFormat == Bitmap::ELuminance)
-				m_mipmap1 = new MIPMap1(bitmap, pixelFormat, Bitmap::EFloat,
+				return new MIPMap1(bitmap, pixelFormat, Bitmap::EFloat,
 					rfilter, m_wrapModeU, m_wrapModeV, m_filterType, m_maxAnisotropy,
 					createCache ? cacheFile : fs::path(), timestamp);
 			else
-				m_mipmap3 = new MIPMap3(bitmap, pixelFormat, Bitmap::EFloat,
+				return new MIPMap3(bitmap, pixelFormat, Bitmap::EFloat,
 					rfilter, m_wrapModeU, m_wrapModeV, m_filterType, m_maxAnisotropy,
 					createCache ? cacheFile : fs::path(), timestamp);
 		}
@@ -17,10 +17,14 @@
 */
 
 #include <mitsuba/render/util.h>
+#include <mitsuba/render/bvh.h>
 #include <mitsuba/core/timer.h>
 #include <mitsuba/core/fresolver.h>
 #include <mitsuba/core/plugin.h>
 #include <boost/algorithm/string.hpp>
+#if defined(MTS_HAS_COHERENT_RT)
+#include <mitsuba/core/ray_sse.h>
+#endif
 #if defined(WIN32)
 #include <mitsuba/core/getopt.h>
 #endif
@@ -53,8 +57,17 @@ public:
 		cout << "                  builder will switch from (approximate) Min-Max " << endl;
 		cout << "                  binning to the more accurate O(n log n) SAH-based " << endl;
 		cout << "                  optimization method." << endl << endl;
+		cout << "   -k directory   Cache the built kd-tree in the given directory, and" << endl;
+		cout << "                  map it from there on later runs" << endl << endl;
 		cout << "   -f             Try to empirically find the best SAH cost values by" << endl;
 		cout << "                  fitting the cost model to collected performance data" << endl << endl;
+		cout << "   -a name        Acceleration data structure to benchmark: \"kdtree\"" << endl;
+		cout << "                  (the default), \"bvh\", or \"both\" to compare their" << endl;
+		cout << "                  construction and tracing performance" << endl << endl;
+		cout << "   -n width       Specify the number of children per BVH node (4 or 8)" << endl << endl;
+		cout << "   -w width       Trace coherent ray packets of the given width (1, 4, 8" << endl;
+		cout << "                  or 16) instead of incoherent rays. Specify 0 to compare" << endl;
+		cout << "                  all packet widths that are supported by this machine" << endl << endl;
 		cout << "Examples:" << endl;
 		cout << "  E.g. to build a tree for the Stanford bunny having a low SAH cost, type " << endl << endl;
 		cout << "  $ mtsutil kdbench -e .9 -l1 -d48 -x100000 data/tests/bunny.ply" << endl << endl;
@@ -62,6 +75,152 @@ public:
 		cout << "  The high -x paramer effectively disables Min-Max binning, which " << endl;
 		cout << "  leads to a slower and more memory-intensive build, so don't try" << endl;
 		cout << "  this on a huge model." << endl << endl;
+		cout << "  To compare the kd-tree against an 8-wide BVH, type" << endl << endl;
+		cout << "  $ mtsutil kdbench -a both -n 8 data/tests/bunny.ply" << endl << endl;
+	}
+
+	/**
+	 * Generate a 4x4 tile of neighboring rays that originate from a point
+	 * on the bounding sphere. The rays are ordered so that the first 4 and
+	 * 8 entries form 2x2 and 4x2 sub-tiles, respectively.
+	 */
+	void generateTile(const BSphere &bsphere, Random *random, Ray *rays) {
+		Point2 sample1(random->nextFloat(), random->nextFloat()),
+			sample2(random->nextFloat(), random->nextFloat());
+		Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+		Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * (bsphere.radius * 0.5f);
+		Frame frame(normalize(p2-p1));
+		Float spacing = bsphere.radius * 1e-3f;
+
+		for (int i=0; i<16; ++i) {
+			int x = (i & 1) | ((i >> 1) & 2),
+			    y = ((i >> 1) & 1) | ((i >> 2) & 2);
+			Point target = p2 + frame.s * ((x - 1.5f) * spacing)
+				+ frame.t * ((y - 1.5f) * spacing);
+			rays[i] = Ray(p1, normalize(target-p1), 0.0f);
+		}
+	}
+
+#if defined(MTS_HAS_COHERENT_RT)
+	/**
+	 * Trace \c N rays as a packet and create detailed intersection records.
+	 * Falls back to tracing the rays one by one when their direction
+	 * signs disagree.
+	 */
+	template <int N, typename PacketType, typename IntervalType, typename IntersectionType>
+		size_t tracePacket(const ShapeKDTree *kdtree, const Ray *rays, void *temp) {
+		PacketType packet;
+		size_t nIntersections = 0;
+		Intersection its;
+
+		if (packet.load(rays)) {
+			IntervalType interval(rays);
+			IntersectionType packetIts;
+			kdtree->rayIntersectPacket(packet, interval, packetIts, temp);
+			for (int i=0; i<N; ++i) {
+				if (kdtree->fillPacketIntersectionRecord(rays[i], packetIts, i, temp, its))
+					nIntersections++;
+			}
+		} else {
+			for (int i=0; i<N; ++i) {
+				if (kdtree->rayIntersect(rays[i], its))
+					nIntersections++;
+			}
+		}
+		return nIntersections;
+	}
+#endif
+
+	/// Benchmark coherent ray tracing using packets of the given width
+	Float benchmarkPackets(const ShapeKDTree *kdtree, int width,
+			size_t nRays, size_t &nIntersections) {
+		const BSphere bsphere(kdtree->getAABB().getBSphere());
+		ref<Random> random = new Random((uint64_t) 1234);
+		ref<Timer> timer = new Timer();
+		uint8_t temp[16 * MTS_KD_INTERSECTION_TEMP];
+		Ray rays[16];
+		nIntersections = 0;
+
+		Log(EInfo, "Shooting " SIZE_T_FMT " rays (1 thread, coherent, packet width %i) ..",
+			nRays, width);
+
+		for (size_t i=0; i<nRays; i += 16) {
+			generateTile(bsphere, random, rays);
+
+			for (int j=0; j<16; j += width) {
+				switch (width) {
+#if defined(MTS_HAS_COHERENT_RT)
+					case 4:
+						nIntersections += tracePacket<4, RayPacket4, RayInterval4,
+							Intersection4>(kdtree, rays + j, temp);
+						break;
+					case 8:
+						nIntersections += tracePacket<8, RayPacket8, RayInterval8,
+							Intersection8>(kdtree, rays + j, temp);
+						break;
+					case 16:
+						nIntersections += tracePacket<16, RayPacket16, RayInterval16,
+							Intersection16>(kdtree, rays + j, temp);
+						break;
+#endif
+					default: {
+							Intersection its;
+							if (kdtree->rayIntersect(rays[j], its))
+								nIntersections++;
+						}
+						break;
+				}
+			}
+		}
+
+		Log(EInfo, "Found " SIZE_T_FMT " intersections in %i ms",
+			nIntersections, timer->getMilliseconds());
+		Float mrays = nRays / (timer->getMilliseconds() * (Float) 1000);
+		Log(EInfo, "-> %.3f MRays/s", mrays);
+		Log(EInfo, "");
+		return mrays;
+	}
+
+	/**
+	 * Benchmark incoherent ray tracing using uniformly distributed rays
+	 * through the bounding sphere. The random number generator is seeded
+	 * so that different acceleration data structures see the same rays.
+	 */
+	template <typename AccelType> Float benchmarkIncoherent(const AccelType *accel,
+			const char *name, size_t nRays) {
+		const BSphere bsphere(accel->getAABB().getBSphere());
+		Float best = 0;
+
+		for (int j=0; j<3; ++j) {
+			ref<Random> random = new Random((uint64_t) 1234 + j);
+			ref<Timer> timer = new Timer();
+			size_t nIntersections = 0;
+
+			Log(EInfo, "Shooting " SIZE_T_FMT " rays (1 thread, incoherent, %s) ..",
+				nRays, name);
+
+			for (size_t i=0; i<nRays; ++i) {
+				Point2 sample1(random->nextFloat(), random->nextFloat()),
+					sample2(random->nextFloat(), random->nextFloat());
+				Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
+				Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
+				Ray r(p1, normalize(p2-p1), 0.0f);
+
+				Intersection its;
+				if (accel->rayIntersect(r, its))
+					nIntersections++;
+			}
+
+			Log(EInfo, "Found " SIZE_T_FMT " intersections in %i ms",
+				nIntersections, timer->getMilliseconds());
+			Float mrays = nRays / (timer->getMilliseconds() * (Float) 1000);
+			Log(EInfo, "-> %.3f MRays/s", mrays);
+			Log(EInfo, "");
+			best = std::max(best, mrays);
+		}
+		Log(EInfo, "Best of three (%s): %.3f MRays/s", name, best);
+		Log(EInfo, "");
+		return best;
 	}
 
 	int run(int argc, char **argv) {
@@ -70,11 +229,13 @@ public:
 		char *end_ptr = NULL;
 		Float intersectionCost = -1, traversalCost = -1, emptySpaceBonus = -1;
 		int stopPrims = -1, maxDepth = -1, exactPrims = -1, minMaxBins = -1;
+		int packetWidth = -1, bvhWidth = 4;
+		std::string accelType = "kdtree", cacheDirectory;
 		bool clip = true, parallel = true, retract = true, fitParameters = false;
 		optind = 1;
 
 		/* Parse command-line arguments */
-		while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:l:x:b:d:hf")) != -1) {
+		while ((optchar = getopt(argc, argv, "i:t:e:c:p:r:l:x:b:d:w:a:n:k:hf")) != -1) {
 			switch (optchar) {
 				case 'h': {
 						help();
@@ -114,6 +275,25 @@ public:
 					if (*end_ptr != '\0')
 						SLog(EError, "Could not parse the -e parameter!");
 					break;
+				case 'w':
+					packetWidth = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || (packetWidth != 0 && packetWidth != 1
+							&& packetWidth != 4 && packetWidth != 8 && packetWidth != 16))
+						SLog(EError, "Could not parse the packet width!");
+					break;
+				case 'k':
+					cacheDirectory = optarg;
+					break;
+				case 'a':
+					accelType = boost::to_lower_copy(std::string(optarg));
+					if (accelType != "kdtree" && accelType != "bvh" && accelType != "both")
+						SLog(EError, "Could not parse the acceleration data structure name!");
+					break;
+				case 'n':
+					bvhWidth = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || (bvhWidth != 4 && bvhWidth != 8))
+						SLog(EError, "Could not parse the BVH width!");
+					break;
 				case 'b':
 					minMaxBins = strtol(optarg, &end_ptr, 10);
 					if (*end_ptr != '\0')
@@ -153,6 +333,15 @@ public:
 
 		ref<Scene> scene;
 		ref<ShapeKDTree> kdtree;
+		ref<ShapeBVH> bvh;
+		ref<TriMesh> mesh;
+		bool useKDTree = accelType != "bvh", useBVH = accelType != "kdtree";
+
+		if (useBVH) {
+			bvh = new ShapeBVH();
+			bvh->setWidth(bvhWidth);
+			bvh->setParallelBuild(parallel);
+		}
 
 		std::string lowercase = boost::to_lower_copy(std::string(argv[optind]));
 		if (boost::ends_with(lowercase, ".xml")) {
@@ -164,37 +353,49 @@ public:
 			frClone->prependPath(filePath);
 			Thread::getThread()->setFileResolver(frClone);
 			scene = loadScene(argv[optind]);
-			kdtree = scene->getKDTree();
+			if (useKDTree) {
+				if (!scene->getKDTree())
+					scene->setAccelerator(new KDTreeAccelerator());
+				kdtree = scene->getKDTree();
+			} else {
+				scene->setAccelerator(bvh);
+			}
 		} else if (boost::ends_with(lowercase, ".ply")) {
 			Properties props("ply");
 			props.setString("filename", argv[optind]);
-			ref<TriMesh> mesh;
 			mesh = static_cast<TriMesh *> (PluginManager::getInstance()->
 					createObject(MTS_CLASS(TriMesh), props));
 			mesh->configure();
-			kdtree = new ShapeKDTree();
-			kdtree->addShape(mesh);
+			if (useKDTree) {
+				kdtree = new ShapeKDTree();
+				kdtree->addShape(mesh);
+			}
 		} else {
 			Log(EError, "The supplied scene filename must end in either PLY or XML!");
 		}
 
-		if (intersectionCost != -1)
-			kdtree->setQueryCost(intersectionCost);
-		if (traversalCost != -1)
-			kdtree->setTraversalCost(traversalCost);
-		if (emptySpaceBonus != -1)
-			kdtree->setEmptySpaceBonus(emptySpaceBonus);
-		if (stopPrims != -1)
-			kdtree->setStopPrims(stopPrims);
-		if (maxDepth != -1)
-			kdtree->setMaxDepth(maxDepth);
-		if (exactPrims != -1)
-			kdtree->setExactPrimitiveThreshold(exactPrims);
-		if (minMaxBins != -1)
-			kdtree->setMinMaxBins(minMaxBins);
-		kdtree->setClip(clip);
-		kdtree->setRetract(retract);
-		kdtree->setParallelBuild(parallel);
+		if (kdtree) {
+			if (intersectionCost != -1)
+				kdtree->setQueryCost(intersectionCost);
+			if (traversalCost != -1)
+				kdtree->setTraversalCost(traversalCost);
+			if (emptySpaceBonus != -1)
+				kdtree->setEmptySpaceBonus(emptySpaceBonus);
+			if (stopPrims != -1)
+				kdtree->setStopPrims(stopPrims);
+			if (maxDepth != -1)
+				kdtree->setMaxDepth(maxDepth);
+			if (exactPrims != -1)
+				kdtree->setExactPrimitiveThreshold(exactPrims);
+			if (minMaxBins != -1)
+				kdtree->setMinMaxBins(minMaxBins);
+			kdtree->setClip(clip);
+			kdtree->setRetract(retract);
+			kdtree->setParallelBuild(parallel);
+			kdtree->setCacheDirectory(cacheDirectory);
+		} else if (fitParameters || packetWidth != -1) {
+			Log(EError, "The -f and -w options require the kd-tree!");
+		}
 
 		/* Show some statistics, and make sure it roughly fits in 80cols */
 		Logger *logger = Thread::getThread()->getLogger();
@@ -202,47 +403,85 @@ public:
 		logger->setLogLevel(EDebug);
 		formatter->setHaveDate(false);
 
+		/* Build the acceleration data structures and time their construction */
+		ref<Timer> timer = new Timer();
 		if (scene)
 			scene->initialize();
-		else
+		else if (kdtree)
 			kdtree->build();
+		int kdtreeBuildTime = kdtree ? timer->getMilliseconds() : 0;
 
-		BSphere bsphere(kdtree->getAABB().getBSphere());
-		const size_t nRays = 5000000;
+		int bvhBuildTime = 0;
+		if (bvh) {
+			if (!bvh->isBuilt()) {
+				if (scene) {
+					ref_vector<Shape> &shapes = scene->getShapes();
+					for (size_t i=0; i<shapes.size(); ++i)
+						bvh->addShape(shapes[i]);
+				} else {
+					bvh->addShape(mesh);
+				}
+				timer->reset();
+				bvh->build();
+			}
+			bvhBuildTime = timer->getMilliseconds();
+		}
 
-		if (!fitParameters) {
-			Log(EInfo, "Bounding sphere: %s", bsphere.toString().c_str());
-			Float best = 0;
-			for (int j=0; j<3; ++j) {
-				ref<Random> random = new Random();
-				ref<Timer> timer = new Timer();
-				size_t nIntersections = 0;
+		if (!kdtree) {
+			Log(EInfo, "BVH construction took %i ms", bvhBuildTime);
+			benchmarkIncoherent(bvh.get(), "BVH", 5000000);
+			Thread::getThread()->getLogger()->setLogLevel(EInfo);
+			return 0;
+		}
 
-				Log(EInfo, "Shooting " SIZE_T_FMT " rays (1 thread, incoherent) ..", nRays);
+		BSphere bsphere(kdtree->getAABB().getBSphere());
+		const size_t nRays = 5000000;
 
-				for (size_t i=0; i<nRays; ++i) {
-					Point2 sample1(random->nextFloat(), random->nextFloat()),
-						sample2(random->nextFloat(), random->nextFloat());
-					Point p1 = bsphere.center + warp::squareToUniformSphere(sample1) * bsphere.radius;
-					Point p2 = bsphere.center + warp::squareToUniformSphere(sample2) * bsphere.radius;
-					Ray r(p1, normalize(p2-p1), 0.0f);
+#if defined(MTS_HAS_COHERENT_RT)
+		const int maxPacketWidth = ShapeKDTree::getMaxPacketSize();
+#else
+		const int maxPacketWidth = 1;
+#endif
 
-					Intersection its;
-					if (kdtree->rayIntersect(r, its))
-						nIntersections++;
-				}
+		if (packetWidth > maxPacketWidth)
+			Log(EError, "Packets of width %i are not supported by this machine "
+				"(the maximum is %i)!", packetWidth, maxPacketWidth);
 
-				Log(EInfo, "Found " SIZE_T_FMT " intersections in %i ms",
-					nIntersections, timer->getMilliseconds());
-				Float mrays = nRays / (timer->getMilliseconds() * (Float) 1000);
-				Log(EInfo, "-> %.3f MRays/s", mrays);
+		if (fitParameters) {
+			Float intersectionCost, traversalCost;
+			kdtree->findCosts(intersectionCost, traversalCost);
+		} else if (packetWidth != -1) {
+			Log(EInfo, "Bounding sphere: %s", bsphere.toString().c_str());
+			size_t referenceIntersections = 0;
+			for (int width = 1; width <= maxPacketWidth; width *= (width == 1 ? 4 : 2)) {
+				if (packetWidth != 0 && width != packetWidth)
+					continue;
+				Float best = 0;
+				size_t nIntersections = 0;
+				for (int j=0; j<3; ++j)
+					best = std::max(best, benchmarkPackets(kdtree, width, nRays, nIntersections));
+				Log(EInfo, "Packet width %i, best of three: %.3f MRays/s", width, best);
 				Log(EInfo, "");
-				best = std::max(best, mrays);
+
+				if (referenceIntersections == 0)
+					referenceIntersections = nIntersections;
+				else if (referenceIntersections != nIntersections)
+					Log(EWarn, "Packet width %i found " SIZE_T_FMT " intersections, but "
+						"a smaller width found " SIZE_T_FMT "!", width, nIntersections,
+						referenceIntersections);
 			}
-			Log(EInfo, "Best of three: %.3f MRays/s", best);
 		} else {
-			Float intersectionCost, traversalCost;
-			kdtree->findCosts(intersectionCost, traversalCost);
+			Log(EInfo, "Bounding sphere: %s", bsphere.toString().c_str());
+			Float kdtreeBest = benchmarkIncoherent(kdtree.get(), "kd-tree", nRays);
+
+			if (bvh) {
+				Float bvhBest = benchmarkIncoherent(bvh.get(), "BVH", nRays);
+				Log(EInfo, "Summary:");
+				Log(EInfo, "  kd-tree: built in %6i ms, %.3f MRays/s",
+					kdtreeBuildTime, kdtreeBest);
+				Log(EInfo, "  BVH%i   : built in %6i ms, %.3f MRays/s",
+					bvh->getWidth(), bvhBuildTime, bvhBest);
+			}
 		}
 
 		Thread::getThread()->getLogger()->setLogLevel(EInfo);
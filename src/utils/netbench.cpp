@@ -0,0 +1,264 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/imageblock.h>
+#include <mitsuba/core/sched_remote.h>
+#include <mitsuba/core/sstream.h>
+#include <mitsuba/core/mstream.h>
+#include <mitsuba/core/fstream.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+
+#if defined(__WINDOWS__)
+#include <mitsuba/core/getopt.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#define INVALID_SOCKET -1
+#define SOCKET int
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+/// Sends a sequence of image blocks, just like a \ref StreamBackend
+class BlockSender : public Thread {
+public:
+	BlockSender(Stream *stream, const ref_vector<ImageBlock> &blocks,
+		int count, int transportFlags) : Thread("send"), m_stream(stream),
+		m_blocks(blocks), m_count(count), m_transportFlags(transportFlags) { }
+
+	void run() {
+		ref<MemoryStream> mstream = new MemoryStream();
+		mstream->setByteOrder(Stream::ENetworkByteOrder);
+		for (int i=0; i<m_count; ++i) {
+			mstream->reset();
+			RemoteWorker::saveWorkResult(mstream,
+				m_blocks[i % m_blocks.size()], m_transportFlags);
+			mstream->seek(0);
+			mstream->copyTo(m_stream);
+			m_stream->flush();
+		}
+	}
+private:
+	ref<Stream> m_stream;
+	ref_vector<ImageBlock> m_blocks;
+	int m_count, m_transportFlags;
+};
+
+class NetBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Network transport benchmark. Sends rendered image blocks over a" << endl;
+		cout << "loopback connection and reports the transmitted amount of data and the" << endl;
+		cout << "achieved throughput for the different work result transport options." << endl;
+		cout << "Note that a loopback connection is much faster than a real network, hence" << endl;
+		cout << "the reduction of the data size is usually the more relevant number." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil netbench [options] [Image used as block content]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -b size        Block size (default: 32)" << endl << endl;
+		cout << "   -n count       Number of transmitted blocks (default: 2000)" << endl << endl;
+		cout << "   -s spp         Simulated number of samples per pixel. When no image" << endl;
+		cout << "                  is specified, this also controls the amount of noise" << endl;
+		cout << "                  in the synthetic block content (default: 16)" << endl << endl;
+	}
+
+	/// Create blocks, which look like the output of a rendering process
+	void createBlocks(const std::string &filename, int blockSize, int spp,
+			ref_vector<ImageBlock> &blocks) {
+		ref<Bitmap> image;
+		if (!filename.empty()) {
+			ref<FileStream> fs = new FileStream(filename, FileStream::EReadOnly);
+			image = new Bitmap(Bitmap::EAuto, fs);
+			image = image->convert(Bitmap::ERGB, Bitmap::EFloat32);
+		}
+
+		ref<Random> random = new Random();
+		int blockCount = image ? std::max(1, (image->getWidth() / blockSize)
+			* (image->getHeight() / blockSize)) : 64;
+		int blocksPerRow = image ? std::max(1, image->getWidth() / blockSize) : 8;
+
+		for (int b=0; b<blockCount; ++b) {
+			ref<ImageBlock> block = new ImageBlock(Bitmap::ESpectrumAlphaWeight,
+				Vector2i(blockSize), NULL);
+			Point2i offset((b % blocksPerRow) * blockSize, (b / blocksPerRow) * blockSize);
+			block->setOffset(offset);
+			block->setSize(Vector2i(blockSize));
+
+			Float *data = block->getBitmap()->getFloatData();
+			int channels = block->getBitmap()->getChannelCount();
+			for (int y=0; y<blockSize; ++y) {
+				for (int x=0; x<blockSize; ++x) {
+					Float *pixel = data + (y * blockSize + x) * channels;
+					Float rgb[3];
+					if (image) {
+						const float *value = image->getFloat32Data() + 3 *
+							((offset.y + y) % image->getHeight() * image->getWidth()
+							+ (offset.x + x) % image->getWidth());
+						for (int i=0; i<3; ++i)
+							rgb[i] = (Float) value[i] * spp;
+					} else {
+						/* Smooth shading plus Monte Carlo noise */
+						Float u = (Float) (offset.x + x) / 256, v = (Float) (offset.y + y) / 256;
+						for (int i=0; i<3; ++i) {
+							Float sum = 0;
+							for (int s=0; s<spp; ++s)
+								sum += (Float) 0.5f * (1 + std::sin(u * (i+1) + v * 3))
+									* -math::fastlog(1 - random->nextFloat());
+							rgb[i] = sum;
+						}
+					}
+					for (int i=0; i<SPECTRUM_SAMPLES; ++i)
+						pixel[i] = rgb[i % 3];
+					pixel[SPECTRUM_SAMPLES] = (Float) spp;
+					pixel[SPECTRUM_SAMPLES + 1] = (Float) spp;
+				}
+			}
+			blocks.push_back(block);
+		}
+	}
+
+	/// Establish a connection over the loopback interface
+	void connect(ref<SocketStream> &client, ref<SocketStream> &server) {
+		SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+		if (sock == INVALID_SOCKET)
+			SocketStream::handleError("none", "socket");
+
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		addr.sin_port = 0;
+		socklen_t addrlen = sizeof(addr);
+
+		if (bind(sock, (struct sockaddr *) &addr, addrlen) == -1)
+			SocketStream::handleError("none", "bind");
+		if (getsockname(sock, (struct sockaddr *) &addr, &addrlen) == -1)
+			SocketStream::handleError("none", "getsockname");
+		if (listen(sock, 1) == -1)
+			SocketStream::handleError("none", "listen");
+
+		client = new SocketStream("127.0.0.1", ntohs(addr.sin_port));
+		SOCKET newSocket = accept(sock, NULL, NULL);
+		if (newSocket == INVALID_SOCKET)
+			SocketStream::handleError("none", "accept");
+		server = new SocketStream(newSocket);
+		client->setByteOrder(Stream::ENetworkByteOrder);
+		server->setByteOrder(Stream::ENetworkByteOrder);
+
+#if defined(__WINDOWS__)
+		closesocket(sock);
+#else
+		close(sock);
+#endif
+	}
+
+	int run(int argc, char **argv) {
+		int optchar, blockSize = 32, count = 2000, spp = 16;
+		char *end_ptr = NULL;
+		optind = 1;
+
+		while ((optchar = getopt(argc, argv, "b:n:s:h")) != -1) {
+			switch (optchar) {
+				case 'b':
+					blockSize = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || blockSize < 1)
+						SLog(EError, "Could not parse the block size!");
+					break;
+				case 'n':
+					count = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || count < 1)
+						SLog(EError, "Could not parse the block count!");
+					break;
+				case 's':
+					spp = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || spp < 1)
+						SLog(EError, "Could not parse the sample count!");
+					break;
+				case 'h':
+				default:
+					help();
+					return 0;
+			}
+		}
+
+		ref_vector<ImageBlock> blocks;
+		createBlocks(optind < argc ? argv[optind] : "", blockSize, spp, blocks);
+		ref<ImageBlock> received = new ImageBlock(Bitmap::ESpectrumAlphaWeight,
+			Vector2i(blockSize), NULL);
+		size_t values = (size_t) blockSize * blockSize
+			* received->getBitmap()->getChannelCount();
+
+		const int modes[] = { 0, RemoteWorker::ECompressResults,
+			RemoteWorker::ECompactResults,
+			RemoteWorker::ECompressResults | RemoteWorker::ECompactResults };
+		const char *names[] = { "raw", "zlib", "half", "half+zlib" };
+
+		cout << formatString("Sending %i blocks of %ix%i pixels (%i KB each)",
+			count, blockSize, blockSize, (int) (values * sizeof(Float) / 1024)) << endl;
+		cout << formatString("%-10s %12s %8s %12s %12s %12s", "Transport", "KB/block",
+			"Ratio", "Blocks/s", "MB/s (raw)", "Max. error") << endl;
+
+		size_t rawBytes = 0;
+		for (int m=0; m<4; ++m) {
+			ref<SocketStream> client, server;
+			connect(client, server);
+
+			ref<BlockSender> sender = new BlockSender(server, blocks, count, modes[m]);
+			ref<Timer> timer = new Timer();
+			sender->start();
+
+			Float maxError = 0;
+			for (int i=0; i<count; ++i) {
+				RemoteWorker::loadWorkResult(client, received, modes[m]);
+
+				/* Relative error with respect to the accumulated weight */
+				const ImageBlock *block = blocks[i % blocks.size()];
+				const Float *expected = block->getBitmap()->getFloatData(),
+				            *data = received->getBitmap()->getFloatData();
+				for (size_t j=0; j<values; ++j)
+					maxError = std::max(maxError, std::abs(expected[j] - data[j])
+						/ std::max(std::abs(expected[j]), (Float) 1));
+			}
+			sender->join();
+			Float seconds = timer->getMilliseconds() / (Float) 1000;
+
+			size_t bytes = client->getReceivedBytes();
+			if (m == 0)
+				rawBytes = bytes;
+			cout << formatString("%-10s %12.2f %8.2f %12.0f %12.1f %12.2e", names[m],
+				bytes / (Float) (1024 * count), rawBytes / (Float) bytes, count / seconds,
+				count * values * sizeof(Float) / (seconds * 1024 * 1024), maxError) << endl;
+		}
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(NetBench, "Network transport benchmark")
+MTS_NAMESPACE_END
@@ -0,0 +1,180 @@
+/*
+    This file is part of Mitsuba, a physically based rendering system.
+
+    Copyright (c) 2007-2014 by Wenzel Jakob and others.
+
+    Mitsuba is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License Version 3
+    as published by the Free Software Foundation.
+
+    Mitsuba is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <mitsuba/render/util.h>
+#include <mitsuba/render/imageblock.h>
+#include <mitsuba/core/plugin.h>
+#include <mitsuba/core/random.h>
+#include <mitsuba/core/timer.h>
+#if defined(__WINDOWS__)
+#include <mitsuba/core/getopt.h>
+#endif
+
+MTS_NAMESPACE_BEGIN
+
+class SplatBench : public Utility {
+public:
+	void help() {
+		cout << endl;
+		cout << "Synopsis: Image block splatting benchmark. Measures how many samples per" << endl;
+		cout << "second ImageBlock::put() can accumulate using each reconstruction filter," << endl;
+		cout << "and compares against a plain scalar implementation." << endl;
+		cout << endl;
+		cout << "Usage: mtsutil splatbench [options] [filter names]" << endl;
+		cout << "Options/Arguments:" << endl;
+		cout << "   -h             Display this help text" << endl << endl;
+		cout << "   -b size        Block size (default: 32)" << endl << endl;
+		cout << "   -n count       Number of samples per filter (default: 4000000)" << endl << endl;
+		cout << "Without filter names, all filters that ship with Mitsuba are tested." << endl << endl;
+	}
+
+	/// Scalar reference version of \ref ImageBlock::put()
+	static void putReference(ImageBlock *block, const ReconstructionFilter *filter,
+			const Point2 &_pos, const Float *value, Float *weightsX, Float *weightsY) {
+		Bitmap *bitmap = block->getBitmap();
+		const int channels = bitmap->getChannelCount();
+		const Float filterRadius = filter->getRadius();
+		const Vector2i &size = bitmap->getSize();
+		const Point2i &offset = block->getOffset();
+		const int borderSize = block->getBorderSize();
+
+		const Point2 pos(
+			_pos.x - 0.5f - (offset.x - borderSize),
+			_pos.y - 0.5f - (offset.y - borderSize));
+
+		const Point2i min(std::max((int) std::ceil (pos.x - filterRadius), 0),
+		                  std::max((int) std::ceil (pos.y - filterRadius), 0)),
+		              max(std::min((int) std::floor(pos.x + filterRadius), size.x - 1),
+		                  std::min((int) std::floor(pos.y + filterRadius), size.y - 1));
+
+		for (int x=min.x, idx = 0; x<=max.x; ++x)
+			weightsX[idx++] = filter->evalDiscretized(x-pos.x);
+		for (int y=min.y, idx = 0; y<=max.y; ++y)
+			weightsY[idx++] = filter->evalDiscretized(y-pos.y);
+
+		for (int y=min.y, yr=0; y<=max.y; ++y, ++yr) {
+			const Float weightY = weightsY[yr];
+			Float *dest = bitmap->getFloatData()
+				+ (y * (size_t) size.x + min.x) * channels;
+
+			for (int x=min.x, xr=0; x<=max.x; ++x, ++xr) {
+				const Float weight = weightsX[xr] * weightY;
+
+				for (int k=0; k<channels; ++k)
+					*dest++ += weight * value[k];
+			}
+		}
+	}
+
+	int run(int argc, char **argv) {
+		int optchar, blockSize = 32, count = 4000000;
+		char *end_ptr = NULL;
+		optind = 1;
+
+		while ((optchar = getopt(argc, argv, "b:n:h")) != -1) {
+			switch (optchar) {
+				case 'b':
+					blockSize = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || blockSize < 1)
+						SLog(EError, "Could not parse the block size!");
+					break;
+				case 'n':
+					count = strtol(optarg, &end_ptr, 10);
+					if (*end_ptr != '\0' || count < 1)
+						SLog(EError, "Could not parse the sample count!");
+					break;
+				case 'h':
+				default:
+					help();
+					return 0;
+			}
+		}
+
+		std::vector<std::string> filters;
+		for (int i=optind; i<argc; ++i)
+			filters.push_back(argv[i]);
+		if (filters.empty()) {
+			const char *names[] = { "box", "tent", "gaussian", "mitchell",
+				"catmullrom", "lanczos" };
+			filters.assign(names, names + sizeof(names) / sizeof(names[0]));
+		}
+
+		/* Precompute the sample positions and values */
+		const int channels = SPECTRUM_SAMPLES + 2, sampleCount = 1 << 16;
+		ref<Random> random = new Random();
+		std::vector<Point2> positions(sampleCount);
+		std::vector<Float> values(sampleCount * channels);
+		for (int i=0; i<sampleCount; ++i) {
+			positions[i] = Point2(random->nextFloat(), random->nextFloat()) * (Float) blockSize;
+			for (int k=0; k<channels; ++k)
+				values[i*channels + k] = random->nextFloat();
+		}
+
+		cout << formatString("%-12s %14s %14s %10s %12s", "Filter", "Msamples/s",
+			"Scalar Ms/s", "Speedup", "Max. diff.") << endl;
+
+		for (size_t f=0; f<filters.size(); ++f) {
+			ref<ReconstructionFilter> filter = static_cast<ReconstructionFilter *> (
+				PluginManager::getInstance()->createObject(
+				MTS_CLASS(ReconstructionFilter), Properties(filters[f])));
+			filter->configure();
+
+			ref<ImageBlock> block = new ImageBlock(Bitmap::ESpectrumAlphaWeight,
+				Vector2i(blockSize), filter);
+			ref<ImageBlock> reference = new ImageBlock(Bitmap::ESpectrumAlphaWeight,
+				Vector2i(blockSize), filter);
+			block->clear();
+			reference->clear();
+
+			int tempSize = (int) std::ceil(2*filter->getRadius()) + 1;
+			std::vector<Float> weightsX(tempSize), weightsY(tempSize);
+
+			ref<Timer> timer = new Timer();
+			for (int i=0; i<count; ++i) {
+				int j = i & (sampleCount - 1);
+				block->put(positions[j], &values[j * channels]);
+			}
+			Float time = timer->getMilliseconds() / (Float) 1000;
+
+			timer->reset();
+			for (int i=0; i<count; ++i) {
+				int j = i & (sampleCount - 1);
+				putReference(reference, filter, positions[j], &values[j * channels],
+					&weightsX[0], &weightsY[0]);
+			}
+			Float timeReference = timer->getMilliseconds() / (Float) 1000;
+
+			const Bitmap *b1 = block->getBitmap(), *b2 = reference->getBitmap();
+			size_t valueCount = b1->getPixelCount() * channels;
+			Float maxDiff = 0;
+			for (size_t i=0; i<valueCount; ++i)
+				maxDiff = std::max(maxDiff, std::abs(b1->getFloatData()[i] - b2->getFloatData()[i]));
+
+			cout << formatString("%-12s %14.2f %14.2f %10.2f %12.2e", filters[f].c_str(),
+				count / (time * 1e6f), count / (timeReference * 1e6f),
+				timeReference / time, maxDiff) << endl;
+		}
+
+		return 0;
+	}
+
+	MTS_DECLARE_UTILITY()
+};
+
+MTS_EXPORT_UTILITY(SplatBench, "Image block splatting benchmark")
+MTS_NAMESPACE_END